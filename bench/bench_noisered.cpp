@@ -0,0 +1,301 @@
+/**********************************************************************
+
+  Benchmarks of the stages of noise reduction, and of the whole run on the
+  test files, written as JSON:
+
+  {"benchmarks": [{"name": ..., "rate": ..., "iterations": ...,
+                   "seconds": ..., "samples_per_second": ...,
+                   "realtime_factor": ...}, ...]}
+
+  Stages done once a window count the hop of NEW samples that each window
+  accounts for, so that all real-time factors compare with the whole run's.
+
+  With --trace, the spans of the stages on each thread of all the runs are
+  written to a file as Chrome trace event JSON, for Perfetto.
+
+  bench [--filter substring] [--min-time seconds] [--data directory]
+        [--trace file]
+
+**********************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "DirManager.h"
+#include "ExportPCM.h"
+#include "ImportPCM.h"
+#include "Instrumentation.h"
+#include "NoiseReduction.h"
+#include "NoiseReductionKernels.h"
+#include "RealFFTf.h"
+#include "WaveTrack.h"
+
+#ifndef NOISERED_BENCH_DATA
+#define NOISERED_BENCH_DATA "test"
+#endif
+
+namespace {
+
+// The defaults of the effect
+const size_t windowSize = 2048;
+const size_t stepSize = windowSize / 4;
+const size_t spectrumSize = windowSize / 2 + 1;
+const double noiseGain = 12.0, sensitivity = 6.0, freqSmoothingBands = 3.0;
+
+struct Benchmark {
+    std::string name;
+    // Of the samples, for the real-time factor
+    double rate;
+    // Processed by each run
+    size_t samples;
+    std::function<void()> run;
+};
+
+struct Result {
+    unsigned long iterations;
+    double seconds;
+};
+
+Result Measure(const Benchmark &benchmark, double minTime) {
+    using clock = std::chrono::steady_clock;
+    // Once untimed, for the caches and any lazy setup
+    benchmark.run();
+
+    Result result{0, 0.0};
+    const auto start = clock::now();
+    unsigned long batch = 1;
+    do {
+        for (unsigned long ii = 0; ii < batch; ++ii)
+            benchmark.run();
+        result.iterations += batch;
+        result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        batch *= 2;
+    } while (result.seconds < minTime);
+    return result;
+}
+
+std::vector<float> Noise(size_t len, unsigned seed) {
+    std::mt19937 engine{seed};
+    std::normal_distribution<float> distribution{0.0f, 0.05f};
+    std::vector<float> samples(len);
+    for (auto &sample : samples)
+        sample = distribution(engine);
+    return samples;
+}
+
+TrackHolders Import(const std::string &path, TrackFactory &factory) {
+    TrackHolders holders;
+    auto handle = PCMImportFileHandle::Open(path);
+    if (!handle || handle->Import(&factory, holders) != ProgressResult::Success || holders.empty()) {
+        std::cerr << "Cannot import " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return holders;
+}
+
+size_t Length(const WaveTrack &track) {
+    return track.TimeToLongSamples(track.GetEndTime()).as_size_t();
+}
+
+// State shared by the benchmarks, made before any is run
+struct Fixture {
+    explicit Fixture(const std::string &data)
+            : input{data + "/input.wav"}, background{data + "/bg_input.wav"},
+              dirManager{std::make_shared<DirManager>(true)}, factory{dirManager} {
+        auto holders = Import(input, factory);
+        track = std::move(holders[0]);
+        rate = track->GetRate();
+        samples.resize(Length(*track));
+        track->Get((samplePtr) samples.data(), floatSample, 0, samples.size());
+        exportTracks.emplace_back(std::move(Import(input, factory)[0]));
+    }
+
+    const std::string input, background;
+    std::shared_ptr<DirManager> dirManager;
+    TrackFactory factory;
+    std::unique_ptr<WaveTrack> track;
+    double rate;
+    std::vector<float> samples;
+    WaveTrackConstArray exportTracks;
+};
+
+std::vector<Benchmark> MakeBenchmarks(Fixture &fixture) {
+    std::vector<Benchmark> benchmarks;
+    const double rate = fixture.rate;
+
+    // Transforms
+    {
+        auto hFFT = GetFFT(windowSize);
+        auto buffer = std::make_shared<std::vector<float>>(Noise(windowSize, 1));
+        benchmarks.push_back({"RealFFTf", rate, stepSize, [hFFT, buffer] {
+            RealFFTf(buffer->data(), hFFT.get());
+        }});
+        benchmarks.push_back({"InverseRealFFTf", rate, stepSize, [hFFT, buffer] {
+            InverseRealFFTf(buffer->data(), hFFT.get());
+        }});
+    }
+
+    // Inner loops of the reduction of one window
+    {
+        auto gains = std::make_shared<std::vector<float>>(spectrumSize);
+        auto scratch = std::make_shared<std::vector<double>>(spectrumSize + 1);
+        const auto bins = (size_t) freqSmoothingBands;
+        benchmarks.push_back({"ApplyFreqSmoothing", rate, stepSize, [gains, scratch, bins] {
+            // Gains between the floor and 1, as the effect makes them
+            std::fill(gains->begin(), gains->end(), 0.25f);
+            SmoothGainsGeometrically(gains->data(), scratch->data(), gains->size(), bins);
+        }});
+    }
+    {
+        const unsigned nWindows = 5, rank = 2;
+        auto spectrums = std::make_shared<std::vector<std::vector<float>>>();
+        for (unsigned ii = 0; ii < nWindows; ++ii) {
+            auto noise = Noise(spectrumSize, 2 + ii);
+            for (auto &power : noise)
+                power *= power;
+            spectrums->push_back(std::move(noise));
+        }
+        auto rows = std::make_shared<std::vector<const float *>>();
+        for (const auto &spectrum : *spectrums)
+            rows->push_back(spectrum.data());
+        auto thresholds = std::make_shared<std::vector<float>>(spectrumSize, 0.0025f);
+        auto mask = std::make_shared<std::vector<float>>(spectrumSize);
+        benchmarks.push_back({"Classify", rate, stepSize, [spectrums, rows, thresholds, mask] {
+            ClassifyBands(mask->data(), rows->data(), nWindows, rank, thresholds->data(), 0, spectrumSize);
+        }});
+        auto pairs = std::make_shared<std::vector<float>>(Noise(windowSize, 7));
+        benchmarks.push_back({"ApplySpectralGain", rate, stepSize, [pairs, mask] {
+            ApplySpectralGain(pairs->data() + 2, mask->data() + 1, spectrumSize - 2, 0.0f);
+        }});
+    }
+
+    // The whole of ReduceNoise for samples in memory, without tracks
+    {
+        auto effect = std::make_shared<EffectNoiseReduction>();
+        const auto noise = Noise(fixture.samples.size(), 11);
+        if (!effect->GetProfile(noise.data(), noise.size(), rate)) {
+            std::cerr << "Cannot profile" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::shared_ptr<EffectNoiseReduction::Stream> stream{
+                effect->CreateStream(noiseGain, sensitivity, freqSmoothingBands)};
+        auto output = std::make_shared<std::vector<float>>(fixture.samples.size());
+        const auto &samples = fixture.samples;
+        benchmarks.push_back({"ReduceNoise", rate, samples.size(), [effect, stream, output, &samples] {
+            stream->Push(samples.data(), samples.size());
+            stream->Flush();
+            stream->Pull(output->data(), output->size());
+        }});
+    }
+
+    // Tracks
+    benchmarks.push_back({"PCMImportFileHandle::Import", rate, fixture.samples.size(), [&fixture] {
+        Import(fixture.input, fixture.factory);
+    }});
+    {
+        auto buffer = std::make_shared<std::vector<float>>(fixture.samples.size());
+        benchmarks.push_back({"Sequence::Append", rate, fixture.samples.size(), [&fixture] {
+            auto track = fixture.factory.NewWaveTrack(floatSample, fixture.rate);
+            track->Append((samplePtr) fixture.samples.data(), floatSample, fixture.samples.size());
+            track->Flush();
+        }});
+        benchmarks.push_back({"Sequence::Get", rate, fixture.samples.size(), [&fixture, buffer] {
+            fixture.track->Get((samplePtr) buffer->data(), floatSample, 0, buffer->size());
+        }});
+    }
+    benchmarks.push_back({"ExportPCM::Export", rate, fixture.samples.size(), [&fixture] {
+        std::vector<char> data;
+        if (ExportPCM().ExportToMemory(fixture.exportTracks, data) != ProgressResult::Success) {
+            std::cerr << "Cannot export" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }});
+
+    // Import of both files, profile, reduction and export
+    benchmarks.push_back({"end-to-end", rate, fixture.samples.size(), [&fixture] {
+        EffectNoiseReduction effect;
+        auto background = Import(fixture.background, fixture.factory);
+        auto holders = Import(fixture.input, fixture.factory);
+        if (!effect.GetProfile(background[0].get(), 0.0, 0.5, noiseGain, sensitivity, freqSmoothingBands,
+                               &fixture.factory) ||
+            !effect.ReduceNoise(holders[0].get(), noiseGain, sensitivity, freqSmoothingBands, &fixture.factory)) {
+            std::cerr << "Cannot reduce noise" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        WaveTrackConstArray tracks;
+        tracks.emplace_back(std::move(holders[0]));
+        std::vector<char> data;
+        ExportPCM().ExportToMemory(tracks, data);
+    }});
+
+    return benchmarks;
+}
+
+std::string Quoted(const std::string &text) {
+    std::string result = "\"";
+    for (const char c : text) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::string filter, data = NOISERED_BENCH_DATA, trace;
+    double minTime = 0.5;
+    for (int ii = 1; ii < argc; ++ii) {
+        const std::string arg = argv[ii];
+        if (arg == "--filter" && ii + 1 < argc)
+            filter = argv[++ii];
+        else if (arg == "--min-time" && ii + 1 < argc)
+            minTime = atof(argv[++ii]);
+        else if (arg == "--data" && ii + 1 < argc)
+            data = argv[++ii];
+        else if (arg == "--trace" && ii + 1 < argc)
+            trace = argv[++ii];
+        else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--filter substring] [--min-time seconds] [--data directory] [--trace file]"
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    Fixture fixture{data};
+    const auto benchmarks = MakeBenchmarks(fixture);
+    if (!trace.empty())
+        Instrumentation::StartTrace();
+
+    std::cout << "{\"benchmarks\": [";
+    const char *separator = "";
+    for (const auto &benchmark : benchmarks) {
+        if (benchmark.name.find(filter) == std::string::npos)
+            continue;
+        const auto result = Measure(benchmark, minTime);
+        const double samplesPerSecond = benchmark.samples * result.iterations / result.seconds;
+        std::cout << separator << "\n  {\"name\": " << Quoted(benchmark.name)
+                  << ", \"rate\": " << benchmark.rate
+                  << ", \"iterations\": " << result.iterations
+                  << ", \"seconds\": " << result.seconds
+                  << ", \"samples_per_second\": " << samplesPerSecond
+                  << ", \"realtime_factor\": " << samplesPerSecond / benchmark.rate << "}";
+        std::cout.flush();
+        separator = ",";
+    }
+    std::cout << "\n]}" << std::endl;
+    if (!trace.empty() && !Instrumentation::StopTrace(trace)) {
+        std::cerr << "Cannot write " << trace << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
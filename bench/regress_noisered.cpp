@@ -0,0 +1,297 @@
+/**********************************************************************
+
+  Regression gates of noise reduction, run on test/test.wav with its own
+  first 0.3 seconds as the profile, which is how test/test_answer.wav was
+  made by Audacity.
+
+  For each configuration, the spectrum of the reduced track must be within
+  a tolerance of the spectrum of test_answer.wav, and, given a baseline of
+  an earlier run, its throughput must not fall by more than a fraction of
+  the baseline's.  Throughput is that of the fastest of the runs of a
+  configuration.  Results are written as JSON:
+
+  {"configurations": [{"name": ..., "window_size": ..., "steps_per_window": ...,
+                       "method": ..., "threads": ..., "simd": ...,
+                       "spectrum_error_db": ..., "samples_per_second": ...,
+                       "realtime_factor": ..., "passed": ...}, ...],
+   "passed": ...}
+
+  which is also the format of the baseline; configurations are matched by
+  name.  Exits with failure if any gate fails.
+
+  regress [--baseline file] [--max-slowdown fraction] [--tolerance dB]
+          [--min-time seconds] [--data directory]
+
+**********************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "CpuFeatures.h"
+#include "DirManager.h"
+#include "ImportPCM.h"
+#include "NoiseReduction.h"
+#include "NoiseReductionKernels.h"
+#include "RealFFTf.h"
+#include "SampleKernels.h"
+#include "WaveTrack.h"
+
+#ifndef NOISERED_BENCH_DATA
+#define NOISERED_BENCH_DATA "test"
+#endif
+
+namespace {
+
+// As test_answer.wav was made
+const double profileStart = 0.0, profileEnd = 0.3;
+const double noiseGain = 12.0, sensitivity = 6.0, freqSmoothingBands = 3.0;
+
+// Of the spectra compared:  bins of 31.25 Hz at 16 kHz, averaged over all
+// the frames of the track
+const size_t spectrumWindowSize = 512;
+const size_t spectrumStepSize = spectrumWindowSize / 2;
+// Bins this far below the loudest of the golden spectrum are not compared:
+// in the highest bins, the noise shaped dither of its 16 bit samples is as
+// loud as what is left of the signal
+const double spectrumRangeDb = 30.0;
+
+struct Configuration {
+    // The settings of the effect, which are its defaults until they may be
+    // changed at run time
+    size_t windowSize;
+    unsigned stepsPerWindow;
+    std::string method;
+
+    unsigned threads;
+    SimdLevel simd;
+
+    std::string Name() const {
+        std::ostringstream name;
+        name << "window=" << windowSize << " steps=" << stepsPerWindow << " method=" << method
+             << " threads=" << threads << " simd=" << SimdLevelName(simd);
+        return name.str();
+    }
+};
+
+std::vector<Configuration> MakeConfigurations() {
+    std::vector<Configuration> configurations;
+    const SimdLevel levels[] = {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512,
+                                SimdLevel::NEON};
+    for (const auto level : levels) {
+        if (!SimdLevelSupported(level))
+            continue;
+        for (const unsigned threads : {1u, 2u, 4u})
+            configurations.push_back({2048, 4, "second-greatest", threads, level});
+    }
+    return configurations;
+}
+
+// Dispatch all the kernels to one level; false if it is unsupported
+bool SetSimdLevel(SimdLevel level) {
+    return SetFFTSimdLevel(level) && SetKernelSimdLevel(level) && SetSampleKernelSimdLevel(level);
+}
+
+std::unique_ptr<WaveTrack> Import(const std::string &path, TrackFactory &factory) {
+    TrackHolders holders;
+    auto handle = PCMImportFileHandle::Open(path);
+    if (!handle || handle->Import(&factory, holders) != ProgressResult::Success || holders.empty()) {
+        std::cerr << "Cannot import " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return std::move(holders[0]);
+}
+
+std::unique_ptr<WaveTrack> NewTrack(const std::vector<float> &samples, double rate, TrackFactory &factory) {
+    auto track = factory.NewWaveTrack(floatSample, rate);
+    track->Append((samplePtr) samples.data(), floatSample, samples.size());
+    track->Flush();
+    return track;
+}
+
+std::vector<float> Samples(const WaveTrack &track) {
+    std::vector<float> samples(track.TimeToLongSamples(track.GetEndTime()).as_size_t());
+    track.Get((samplePtr) samples.data(), floatSample, 0, samples.size());
+    return samples;
+}
+
+// Mean power of each bin over Hann windowed frames, in dB
+std::vector<double> Spectrum(const std::vector<float> &samples) {
+    const auto hFFT = GetFFT(spectrumWindowSize);
+    const size_t nBins = spectrumWindowSize / 2 + 1;
+    std::vector<float> window(spectrumWindowSize), buffer(spectrumWindowSize), packed(spectrumWindowSize),
+            power(nBins);
+    for (size_t ii = 0; ii < spectrumWindowSize; ++ii)
+        window[ii] = 0.5 - 0.5 * cos(2.0 * M_PI * ii / spectrumWindowSize);
+
+    std::vector<double> sums(nBins, 0.0);
+    size_t nFrames = 0;
+    for (size_t start = 0; start + spectrumWindowSize <= samples.size(); start += spectrumStepSize) {
+        RealFFTfSpectrum(samples.data() + start, window.data(), buffer.data(), packed.data(), power.data(),
+                         hFFT.get());
+        for (size_t ii = 0; ii < nBins; ++ii)
+            sums[ii] += power[ii];
+        ++nFrames;
+    }
+
+    std::vector<double> spectrum(nBins);
+    for (size_t ii = 0; ii < nBins; ++ii)
+        spectrum[ii] = 10.0 * log10(sums[ii] / std::max<size_t>(nFrames, 1) + 1e-30);
+    return spectrum;
+}
+
+// Largest difference over the bins loud enough in the golden spectrum
+double SpectrumError(const std::vector<double> &golden, const std::vector<double> &spectrum) {
+    const double floor = *std::max_element(golden.begin(), golden.end()) - spectrumRangeDb;
+    double error = 0.0;
+    for (size_t ii = 0; ii < golden.size(); ++ii) {
+        if (golden[ii] >= floor)
+            error = std::max(error, std::abs(golden[ii] - spectrum[ii]));
+    }
+    return error;
+}
+
+struct Run {
+    double spectrumError;
+    double samplesPerSecond;
+};
+
+// Reduce noise in tracks of the source samples until minTime has been spent
+// reducing, after one untimed run whose result is compared
+Run Measure(const Configuration &configuration, const std::vector<float> &source, double rate, TrackFactory &factory,
+            const std::vector<double> &golden, double minTime) {
+    using clock = std::chrono::steady_clock;
+    EffectNoiseReduction effect;
+    effect.SetThreadCount(configuration.threads);
+
+    auto profileTrack = NewTrack(source, rate, factory);
+    if (!effect.GetProfile(profileTrack.get(), profileStart, profileEnd, noiseGain, sensitivity,
+                           freqSmoothingBands, &factory)) {
+        std::cerr << "Cannot profile" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto reduce = [&] {
+        auto track = NewTrack(source, rate, factory);
+        const auto start = clock::now();
+        if (!effect.ReduceNoise(track.get(), noiseGain, sensitivity, freqSmoothingBands, &factory)) {
+            std::cerr << "Cannot reduce noise" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return std::make_pair(std::move(track), std::chrono::duration<double>(clock::now() - start).count());
+    };
+
+    Run run;
+    run.spectrumError = SpectrumError(golden, Spectrum(Samples(*reduce().first)));
+
+    // The fastest run, which varies least with the load of the machine
+    double seconds = 0.0, fastest = HUGE_VAL;
+    do {
+        const double time = reduce().second;
+        seconds += time;
+        fastest = std::min(fastest, time);
+    } while (seconds < minTime);
+    run.samplesPerSecond = source.size() / fastest;
+    return run;
+}
+
+// Samples per second of each configuration of a baseline, by name
+std::map<std::string, double> ReadBaseline(const std::string &path) {
+    std::ifstream file{path};
+    if (!file) {
+        std::cerr << "Cannot read " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    const std::string text = contents.str();
+
+    std::map<std::string, double> baseline;
+    const std::string nameKey = "\"name\": \"", speedKey = "\"samples_per_second\": ";
+    for (auto pos = text.find(nameKey); pos != std::string::npos; pos = text.find(nameKey, pos)) {
+        pos += nameKey.size();
+        const auto end = text.find('"', pos);
+        const auto speed = text.find(speedKey, end);
+        if (end == std::string::npos || speed == std::string::npos)
+            break;
+        baseline[text.substr(pos, end - pos)] = atof(text.c_str() + speed + speedKey.size());
+    }
+    return baseline;
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::string data = NOISERED_BENCH_DATA, baselinePath;
+    double maxSlowdown = 0.2, tolerance = 0.5, minTime = 0.5;
+    for (int ii = 1; ii < argc; ++ii) {
+        const std::string arg = argv[ii];
+        if (arg == "--baseline" && ii + 1 < argc)
+            baselinePath = argv[++ii];
+        else if (arg == "--max-slowdown" && ii + 1 < argc)
+            maxSlowdown = atof(argv[++ii]);
+        else if (arg == "--tolerance" && ii + 1 < argc)
+            tolerance = atof(argv[++ii]);
+        else if (arg == "--min-time" && ii + 1 < argc)
+            minTime = atof(argv[++ii]);
+        else if (arg == "--data" && ii + 1 < argc)
+            data = argv[++ii];
+        else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--baseline file] [--max-slowdown fraction] [--tolerance dB]"
+                         " [--min-time seconds] [--data directory]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const auto baseline = baselinePath.empty() ? std::map<std::string, double>{} : ReadBaseline(baselinePath);
+
+    const auto dirManager = std::make_shared<DirManager>(true);
+    TrackFactory factory{dirManager};
+    const auto track = Import(data + "/test.wav", factory);
+    const auto source = Samples(*track);
+    const double rate = track->GetRate();
+    const auto golden = Spectrum(Samples(*Import(data + "/test_answer.wav", factory)));
+
+    const auto initialLevel = GetKernelSimdLevel();
+    bool passed = true;
+    std::cout << "{\"configurations\": [";
+    const char *separator = "";
+    for (const auto &configuration : MakeConfigurations()) {
+        if (!SetSimdLevel(configuration.simd))
+            continue;
+        const auto run = Measure(configuration, source, rate, factory, golden, minTime);
+        SetSimdLevel(initialLevel);
+
+        const auto name = configuration.Name();
+        bool ok = run.spectrumError <= tolerance;
+        const auto found = baseline.find(name);
+        if (found != baseline.end())
+            ok = ok && run.samplesPerSecond >= found->second * (1.0 - maxSlowdown);
+        passed = passed && ok;
+
+        std::cout << separator << "\n  {\"name\": \"" << name << "\""
+                  << ", \"window_size\": " << configuration.windowSize
+                  << ", \"steps_per_window\": " << configuration.stepsPerWindow
+                  << ", \"method\": \"" << configuration.method << "\""
+                  << ", \"threads\": " << configuration.threads
+                  << ", \"simd\": \"" << SimdLevelName(configuration.simd) << "\""
+                  << ", \"spectrum_error_db\": " << run.spectrumError
+                  << ", \"samples_per_second\": " << run.samplesPerSecond
+                  << ", \"realtime_factor\": " << run.samplesPerSecond / rate;
+        if (found != baseline.end())
+            std::cout << ", \"baseline_samples_per_second\": " << found->second;
+        std::cout << ", \"passed\": " << (ok ? "true" : "false") << "}";
+        std::cout.flush();
+        separator = ",";
+    }
+    std::cout << "\n], \"passed\": " << (passed ? "true" : "false") << "}" << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
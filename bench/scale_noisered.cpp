@@ -0,0 +1,250 @@
+/**********************************************************************
+
+  How noise reduction scales with the length of the input, its channels
+  and the threads:  for each combination, tracks of a synthetic signal
+  (tones in white and pink noise, after a second of the noise alone) are
+  generated a chunk at a time, profiled over their first half second and
+  reduced, with
+  GetProfile() and ReduceNoise() as for a file.  Results are written as
+  JSON:
+
+  {"runs": [{"duration": ..., "channels": ..., "threads": ..., "storage": ...,
+             "append_seconds": ..., "profile_seconds": ..., "reduce_seconds": ...,
+             "realtime_factor": ..., "replace_seconds": ..., "blocks": ...,
+             "peak_rss_bytes": ..., "block_file_peak_bytes": ...,
+             "arena_peak_bytes": ...}, ...]}
+
+  The real-time factor is of the profile and reduction, over all channels.
+  Peak RSS is that of the run alone where the kernel can reset it;
+  block file bytes are those of the temp directory with --storage disk.
+
+  The defaults run 1 second to 10 hours, at 1 to 8 channels and 1 to 64
+  threads, which takes hours and, for the longest, tens of GB; pass
+  shorter lists to try less.
+
+  scale [--durations seconds,...] [--channels n,...] [--threads n,...]
+        [--rate hz] [--storage memory|disk] [--temp directory]
+
+**********************************************************************/
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "DirManager.h"
+#include "Instrumentation.h"
+#include "NoiseReduction.h"
+#include "Sequence.h"
+#include "WaveClip.h"
+#include "WaveTrack.h"
+
+namespace {
+
+const double noiseGain = 12.0, sensitivity = 6.0, freqSmoothingBands = 3.0;
+const double profileEnd = 0.5;
+// Noise alone, before the tones start
+const double noiseOnly = 1.0;
+// Samples made and appended at a time
+const size_t chunkSize = 65536;
+
+// Tones in white and pink noise, different for each channel
+class Signal {
+public:
+    Signal(double rate, unsigned channel)
+            : mRate{rate}, mEngine{channel + 1}, mFrequencies{440.0 * (channel + 1), 1000.0, 3150.0} {}
+
+    void Fill(float *samples, size_t len) {
+        std::normal_distribution<float> white{0.0f, 1.0f};
+        for (size_t ii = 0; ii < len; ++ii, ++mPosition) {
+            const float w = white(mEngine);
+            // Paul Kellet's economy filter of white noise into pink
+            mPink[0] = 0.99765f * mPink[0] + w * 0.0990460f;
+            mPink[1] = 0.96300f * mPink[1] + w * 0.2965164f;
+            mPink[2] = 0.57000f * mPink[2] + w * 1.0526913f;
+            const float pink = mPink[0] + mPink[1] + mPink[2] + w * 0.1848f;
+
+            float sample = 0.01f * w + 0.005f * pink;
+            const double time = mPosition / mRate;
+            if (time >= noiseOnly) {
+                for (const auto frequency : mFrequencies)
+                    sample += 0.1f * (float) sin(2.0 * M_PI * frequency * time);
+            }
+            samples[ii] = sample;
+        }
+    }
+
+private:
+    const double mRate;
+    std::mt19937 mEngine;
+    const double mFrequencies[3];
+    float mPink[3]{};
+    unsigned long long mPosition{0};
+};
+
+std::vector<double> ParseList(const std::string &text) {
+    std::vector<double> values;
+    std::istringstream stream{text};
+    std::string item;
+    while (std::getline(stream, item, ','))
+        values.push_back(atof(item.c_str()));
+    return values;
+}
+
+// Lets the peak RSS of /proc/self/status start again from the current RSS;
+// false where the kernel does not support it
+bool ResetPeakRss() {
+    std::ofstream clearRefs{"/proc/self/clear_refs"};
+    return static_cast<bool>(clearRefs << "5" << std::flush);
+}
+
+// VmHWM, or 0 where there is none
+unsigned long long PeakRss() {
+    std::ifstream status{"/proc/self/status"};
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+    }
+    return 0;
+}
+
+size_t CountBlocks(WaveTrack &track) {
+    size_t blocks = 0;
+    for (const auto &clip : track.GetClips())
+        blocks += clip->GetSequence()->GetBlockArray().size();
+    return blocks;
+}
+
+struct Run {
+    double duration;
+    unsigned channels;
+    unsigned threads;
+};
+
+void Measure(const Run &run, double rate, bool inMemory, std::ostream &out) {
+    using clock = std::chrono::steady_clock;
+    const auto seconds = [](clock::time_point start) {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    ResetPeakRss();
+    Instrumentation::ResetPeaks();
+    const auto before = Instrumentation::GetReport();
+
+    const auto dirManager = std::make_shared<DirManager>(inMemory);
+    TrackFactory factory{dirManager};
+
+    // Make the tracks, a chunk of each channel at a time
+    auto start = clock::now();
+    const auto len = (unsigned long long) llround(run.duration * rate);
+    std::vector<std::unique_ptr<WaveTrack>> holders;
+    std::vector<Signal> signals;
+    for (unsigned channel = 0; channel < run.channels; ++channel) {
+        holders.push_back(factory.NewWaveTrack(floatSample, rate));
+        signals.emplace_back(rate, channel);
+    }
+    std::vector<float> chunk(chunkSize);
+    for (unsigned long long done = 0; done < len;) {
+        const auto count = (size_t) std::min<unsigned long long>(chunkSize, len - done);
+        for (unsigned channel = 0; channel < run.channels; ++channel) {
+            signals[channel].Fill(chunk.data(), count);
+            holders[channel]->Append((samplePtr) chunk.data(), floatSample, count);
+        }
+        done += count;
+    }
+    for (auto &holder : holders)
+        holder->Flush();
+    const double appendSeconds = seconds(start);
+
+    EffectNoiseReduction effect;
+    effect.SetThreadCount(run.threads);
+    start = clock::now();
+    if (!effect.GetProfile(holders[0].get(), 0.0, std::min(profileEnd, run.duration), noiseGain, sensitivity,
+                           freqSmoothingBands, &factory)) {
+        std::cerr << "Cannot profile" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const double profileSeconds = seconds(start);
+
+    std::vector<WaveTrack *> tracks;
+    for (const auto &holder : holders)
+        tracks.push_back(holder.get());
+    start = clock::now();
+    if (!effect.ReduceNoise(tracks, noiseGain, sensitivity, freqSmoothingBands, &factory)) {
+        std::cerr << "Cannot reduce noise" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const double reduceSeconds = seconds(start);
+
+    size_t blocks = 0;
+    for (const auto &holder : holders)
+        blocks += CountBlocks(*holder);
+    const auto report = Instrumentation::GetReport() - before;
+
+    out << "\n  {\"duration\": " << run.duration
+        << ", \"channels\": " << run.channels
+        << ", \"threads\": " << run.threads
+        << ", \"storage\": \"" << (inMemory ? "memory" : "disk") << "\""
+        << ", \"append_seconds\": " << appendSeconds
+        << ", \"profile_seconds\": " << profileSeconds
+        << ", \"reduce_seconds\": " << reduceSeconds
+        << ", \"realtime_factor\": " << run.duration * run.channels / (profileSeconds + reduceSeconds)
+        << ", \"replace_seconds\": " << report.stages[Instrumentation::Replace].nanoseconds * 1e-9
+        << ", \"blocks\": " << blocks
+        << ", \"peak_rss_bytes\": " << PeakRss()
+        << ", \"block_file_peak_bytes\": " << dirManager->GetBlockSpace().GetPeak()
+        << ", \"arena_peak_bytes\": " << report.gauges[Instrumentation::Arenas].peak << "}";
+    out.flush();
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::vector<double> durations{1, 10, 60, 600, 3600, 36000}, channels{1, 2, 4, 8},
+            threads{1, 2, 4, 8, 16, 32, 64};
+    double rate = 16000;
+    bool inMemory = true;
+    for (int ii = 1; ii < argc; ++ii) {
+        const std::string arg = argv[ii];
+        if (arg == "--durations" && ii + 1 < argc)
+            durations = ParseList(argv[++ii]);
+        else if (arg == "--channels" && ii + 1 < argc)
+            channels = ParseList(argv[++ii]);
+        else if (arg == "--threads" && ii + 1 < argc)
+            threads = ParseList(argv[++ii]);
+        else if (arg == "--rate" && ii + 1 < argc)
+            rate = atof(argv[++ii]);
+        else if (arg == "--storage" && ii + 1 < argc && (argv[ii + 1] == std::string("memory") ||
+                                                         argv[ii + 1] == std::string("disk")))
+            inMemory = argv[++ii] == std::string("memory");
+        else if (arg == "--temp" && ii + 1 < argc)
+            DirManager::SetTempDir(argv[++ii]);
+        else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--durations seconds,...] [--channels n,...] [--threads n,...]"
+                         " [--rate hz] [--storage memory|disk] [--temp directory]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The timers of the stages, for the time of replacing
+    Instrumentation::Enable();
+    std::cout << "{\"runs\": [";
+    const char *separator = "";
+    for (const auto duration : durations)
+        for (const auto nChannels : channels)
+            for (const auto nThreads : threads) {
+                std::cout << separator;
+                Measure({duration, (unsigned) nChannels, (unsigned) nThreads}, rate, inMemory, std::cout);
+                separator = ",";
+            }
+    std::cout << "\n]}" << std::endl;
+    Instrumentation::Disable();
+    return EXIT_SUCCESS;
+}
@@ -29,15 +29,42 @@ sources += ['src/pyaudacity/noiseredmodule.cpp']
 # additional CFLAGS
 extra_compile_args = ['-std=c++14', '-Wextra', '-pedantic',
                       '-Wno-unused-parameter', '-Wno-unused-variable',
-                      '-Wno-implicit-fallthrough']
+                      '-Wno-implicit-fallthrough', '-pthread',
+                      # no fused multiply-add, as in CMakeLists.txt
+                      '-ffp-contract=off']
+
+# worker threads
+extra_link_args = ['-pthread']
+
+# FFT backend, as NOISERED_FFT_BACKEND in CMake: builtin, fftw3, pocketfft or mkl
+fft_backend = os.environ.get('NOISERED_FFT_BACKEND', 'builtin')
+fft_macros = {'fftw3': 'NOISERED_FFT_FFTW3',
+              'pocketfft': 'NOISERED_FFT_POCKETFFT',
+              'mkl': 'NOISERED_FFT_MKL'}
+fft_libraries = {'fftw3': ['fftw3f'], 'mkl': ['mkl_rt']}
+if fft_backend != 'builtin' and fft_backend not in fft_macros:
+    raise SystemExit('unknown NOISERED_FFT_BACKEND: ' + fft_backend)
+define_macros = [(fft_macros[fft_backend], None)] if fft_backend in fft_macros else []
+# As NOISERED_BLOCK_SUMMARIES in CMake
+if os.environ.get('NOISERED_BLOCK_SUMMARIES', 'ON').upper() in ('OFF', '0', 'NO', 'FALSE'):
+    define_macros.append(('NOISERED_NO_BLOCK_SUMMARIES', None))
+# As NOISERED_INSTRUMENTATION in CMake
+if os.environ.get('NOISERED_INSTRUMENTATION', 'ON').upper() in ('OFF', '0', 'NO', 'FALSE'):
+    define_macros.append(('NOISERED_NO_INSTRUMENTATION', None))
+libraries = ['stdc++', 'sndfile', 'soxr'] + fft_libraries.get(fft_backend, [])
+include_dirs = ['src/audacity']
+if 'POCKETFFT_INCLUDE_DIR' in os.environ:
+    include_dirs.append(os.environ['POCKETFFT_INCLUDE_DIR'])
 
 # create build module
 module = Extension(name='cmodule',
                    # define_macros=[('MAJOR_VERSION', '2'), ('MINOR_VERSION', '1')],
-                   libraries=['stdc++', 'sndfile', 'soxr'],
+                   define_macros=define_macros,
+                   libraries=libraries,
                    language='c++14',
                    extra_compile_args=extra_compile_args,
-                   include_dirs=['src/audacity'],
+                   extra_link_args=extra_link_args,
+                   include_dirs=include_dirs,
                    sources=sources,
                    )
 
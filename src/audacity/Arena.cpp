@@ -0,0 +1,120 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Arena.cpp
+
+*******************************************************************//**
+
+\class Arena
+\brief A bump allocator over aligned chunks.
+
+Allocation only advances the position in the current chunk, going on to
+the next (reused, or added) chunk when it is full.  Nothing is freed on
+its own:  Rewind() moves the position back for reuse, as ArenaFrame does
+for the temporaries of a function, and Release() frees every chunk.
+
+An arena is not thread safe; each thread of a run has its own.
+
+*//*******************************************************************/
+
+#include "Arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "Instrumentation.h"
+
+namespace {
+thread_local Arena *sCurrentArena = nullptr;
+
+inline size_t RoundUp(size_t bytes) {
+    return (bytes + Arena::Alignment - 1) & ~(Arena::Alignment - 1);
+}
+}
+
+Arena::Arena(size_t chunkSize)
+        : mChunkSize{RoundUp(chunkSize)} {
+}
+
+Arena::~Arena() {
+    Release();
+}
+
+void *Arena::Allocate(size_t bytes) {
+    bytes = RoundUp(std::max<size_t>(bytes, 1));
+
+    if (mChunk < mChunks.size() && mChunks[mChunk].size - mUsed >= bytes) {
+        void *result = mChunks[mChunk].base + mUsed;
+        mUsed += bytes;
+        return result;
+    }
+
+    // The first later chunk, kept from before a Rewind(), that is large
+    // enough; positions only increase, so smaller ones are passed over
+    size_t next = mChunks.empty() ? 0 : mChunk + 1;
+    while (next < mChunks.size() && mChunks[next].size < bytes)
+        ++next;
+
+    if (next == mChunks.size()) {
+        const size_t size = std::max(mChunkSize, bytes);
+        void *memory = malloc(size + Alignment - 1);
+        if (!memory)
+            throw std::bad_alloc{};
+        const auto address = reinterpret_cast<uintptr_t>(memory);
+        char *base = static_cast<char *>(memory) + (Alignment - address % Alignment) % Alignment;
+        mChunks.push_back({memory, base, size});
+        NOISERED_GAUGE_ADD(Arenas, size);
+    }
+
+    mChunk = next;
+    mUsed = bytes;
+    return mChunks[mChunk].base;
+}
+
+void Arena::Rewind(Mark mark) {
+    mChunk = mark.chunk;
+    mUsed = mark.used;
+}
+
+void Arena::Release() {
+    for (const auto &chunk : mChunks) {
+        free(chunk.memory);
+        NOISERED_GAUGE_SUBTRACT(Arenas, chunk.size);
+    }
+    mChunks.clear();
+    mChunk = 0;
+    mUsed = 0;
+}
+
+size_t Arena::GetCapacity() const {
+    size_t capacity = 0;
+    for (const auto &chunk : mChunks)
+        capacity += chunk.size;
+    return capacity;
+}
+
+Arena *Arena::Current() {
+    return sCurrentArena;
+}
+
+ArenaScope::ArenaScope(Arena &arena)
+        : mPrevious{sCurrentArena} {
+    sCurrentArena = &arena;
+}
+
+ArenaScope::~ArenaScope() {
+    sCurrentArena = mPrevious;
+}
+
+ArenaFrame::ArenaFrame()
+        : mArena{Arena::Current()},
+          mMark{mArena ? mArena->GetMark() : Arena::Mark{}} {
+}
+
+ArenaFrame::~ArenaFrame() {
+    if (mArena)
+        mArena->Rewind(mMark);
+}
@@ -0,0 +1,131 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Arena.h
+
+  Memory for one run of an effect:  buffers are carved, aligned for the
+  widest SIMD loads, out of a few large chunks, and all freed at once.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_ARENA__
+#define __AUDACITY_ARENA__
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+class Arena {
+public:
+    /// Of every allocation:  a cache line, and an AVX-512 register
+    static const size_t Alignment = 64;
+
+    static const size_t DefaultChunkSize = 256 * 1024;
+
+    /// Allocations larger than chunkSize get chunks of their own
+    explicit Arena(size_t chunkSize = DefaultChunkSize);
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    /// Release()s
+    ~Arena();
+
+    /// Uninitialized memory, valid until a Rewind() to before it, or
+    /// Release().  Throws std::bad_alloc.
+    void *Allocate(size_t bytes);
+
+    /// Uninitialized, for trivial types
+    template<typename T>
+    T *Allocate(size_t count) {
+        return static_cast<T *>(Allocate(count * sizeof(T)));
+    }
+
+    /// Zeroed, for trivial types
+    template<typename T>
+    T *AllocateZeroed(size_t count);
+
+    /// Where the next allocation goes
+    struct Mark {
+        size_t chunk;
+        size_t used;
+    };
+
+    Mark GetMark() const { return {mChunk, mUsed}; }
+
+    /// Makes everything allocated since mark free for reuse, keeping the
+    /// chunks
+    void Rewind(Mark mark);
+
+    /// Frees all the chunks, in one operation
+    void Release();
+
+    /// Bytes of chunks held
+    size_t GetCapacity() const;
+
+    /// The arena that the current thread's run draws temporaries from, or
+    /// null
+    static Arena *Current();
+
+private:
+    friend class ArenaScope;
+
+    struct Chunk {
+        void *memory;
+        char *base; // aligned
+        size_t size;
+    };
+
+    const size_t mChunkSize;
+    std::vector<Chunk> mChunks;
+    // The chunk being allocated from, and the bytes of it used
+    size_t mChunk{0};
+    size_t mUsed{0};
+};
+
+/// Makes an arena Arena::Current() for this thread, until destroyed
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena &arena);
+
+    ArenaScope(const ArenaScope &) = delete;
+
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+    ~ArenaScope();
+
+private:
+    Arena *const mPrevious;
+};
+
+/// Temporaries of a function, drawn from the current arena (if there is
+/// one) and given back when the frame is destroyed.  Nothing allocated from
+/// GetArena() may outlive the frame.
+class ArenaFrame {
+public:
+    ArenaFrame();
+
+    ArenaFrame(const ArenaFrame &) = delete;
+
+    ArenaFrame &operator=(const ArenaFrame &) = delete;
+
+    ~ArenaFrame();
+
+    /// Null when there is no current arena
+    Arena *GetArena() const { return mArena; }
+
+private:
+    Arena *const mArena;
+    const Arena::Mark mMark;
+};
+
+template<typename T>
+T *Arena::AllocateZeroed(size_t count) {
+    T *result = Allocate<T>(count);
+    memset(result, 0, count * sizeof(T));
+    return result;
+}
+
+#endif
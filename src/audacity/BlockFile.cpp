@@ -65,7 +65,7 @@ out.
 #endif
 
 static const int headerTagLen = 20;
-static char headerTag[headerTagLen + 1] = "AudacityBlockFile112";
+static const char headerTag[headerTagLen + 1] = "AudacityBlockFile112";
 
 SummaryInfo::SummaryInfo(size_t samples) {
     format = floatSample;
@@ -82,7 +82,7 @@ SummaryInfo::SummaryInfo(size_t samples) {
     totalSummaryBytes = offset256 + (frames256 * bytesPerFrame);
 }
 
-ArrayOf<char> BlockFile::fullSummary;
+thread_local ArrayOf<char> BlockFile::fullSummary;
 
 /// Initializes the base BlockFile data.  The block is initially
 /// unlocked and its reference count is 1.
@@ -108,11 +108,23 @@ BlockFile::~BlockFile()
       // PRL: what should be done if this fails?
       unlink(mFileName.GetFullPath().c_str());
 
+   if (mSpaceGauge) {
+      mSpaceGauge->Subtract(mGaugedBytes);
+      NOISERED_GAUGE_SUBTRACT(BlockFiles, mGaugedBytes);
+   }
+
    ++gBlockFileDestructionCount;
 }
 
 // static
-unsigned long BlockFile::gBlockFileDestructionCount{0};
+std::atomic<unsigned long> BlockFile::gBlockFileDestructionCount{0};
+
+void BlockFile::SetSpaceGauge(std::shared_ptr<SpaceGauge> gauge, DiskByteCount bytes) {
+    mSpaceGauge = std::move(gauge);
+    mGaugedBytes = bytes;
+    mSpaceGauge->Add(bytes);
+    NOISERED_GAUGE_ADD(BlockFiles, bytes);
+}
 
 /// Returns true if the block is locked.
 bool BlockFile::IsLocked() {
@@ -145,12 +157,11 @@ void *BlockFile::CalcSummary(samplePtr buffer, size_t len,
     float *summary64K = (float *) (fullSummary.get() + mSummaryInfo.offset64K);
     float *summary256 = (float *) (fullSummary.get() + mSummaryInfo.offset256);
 
-    float *fbuffer = new float[len];
-    memset(fbuffer, 0, len);
+    ArrayOf<float> fbuffer{len};
     CopySamples(buffer, format,
-                (samplePtr) &fbuffer[0], floatSample, len);
+                (samplePtr) fbuffer.get(), floatSample, len);
 
-    CalcSummaryFromBuffer(&fbuffer[0], len, summary256, summary64K);
+    CalcSummaryFromBuffer(fbuffer.get(), len, summary256, summary64K);
 
     return fullSummary.get();
 }
@@ -279,7 +290,7 @@ inline bool exists_test(const std::string &name) {
 
 size_t BlockFile::CommonReadData(
         bool mayThrow,
-        const wxFileName &fileName, bool &mSilentLog,
+        const wxFileName &fileName, std::atomic<bool> &mSilentLog,
         const AliasBlockFile *pAliasFile, sampleCount origin, unsigned channel,
         samplePtr data, sampleFormat format, size_t start, size_t len,
         const sampleFormat *pLegacyFormat, size_t legacyLen) {
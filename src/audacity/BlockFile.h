@@ -12,8 +12,10 @@
 #ifndef __AUDACITY_BLOCKFILE__
 #define __AUDACITY_BLOCKFILE__
 
+#include <atomic>
 #include <string>
 
+#include "Instrumentation.h"
 #include "MemoryX.h"
 #include "Types.h"
 #include "wxFileNameWrapper.h"
@@ -57,7 +59,8 @@ public:
 
     virtual ~BlockFile();
 
-    static unsigned long gBlockFileDestructionCount;
+    // Atomic, since tracks may be processed on several threads
+    static std::atomic<unsigned long> gBlockFileDestructionCount;
 
     // Reading
 
@@ -118,7 +121,7 @@ public:
 
     static size_t CommonReadData(
             bool mayThrow,
-            const wxFileName &fileName, bool &mSilentLog,
+            const wxFileName &fileName, std::atomic<bool> &mSilentLog,
             const AliasBlockFile *pAliasFile, sampleCount origin, unsigned channel,
             samplePtr data, sampleFormat format, size_t start, size_t len,
             const sampleFormat *pLegacyFormat = nullptr, size_t legacyLen = 0);
@@ -128,6 +131,11 @@ public:
 
     virtual DiskByteCount GetSpaceUsage() const = 0;
 
+    /// Count bytes, what this block takes in memory or on disk, in gauge
+    /// and the Instrumentation::BlockFiles gauge until it is destroyed.
+    /// Done once, by the DirManager making the block.
+    void SetSpaceGauge(std::shared_ptr<SpaceGauge> gauge, DiskByteCount bytes);
+
     /// if the on-disk state disappeared, either recover it (if it was
     //summary only), write out a placeholder of silence data (missing
     //.au) or mark the blockfile to deal some other way without spewing
@@ -138,17 +146,29 @@ public:
    /// Returns TRUE if this block's complete summary has been computed and is ready (for OD)
    virtual bool IsSummaryAvailable() const {return true;}
 
+   /// Returns TRUE if this block's complete data is ready to access without a delay (for OD)
+   virtual bool IsDataAvailable() const {return true;}
+
+   /// Write any samples held in memory whose file is not yet written;
+   /// false if writing failed
+   virtual bool WriteCacheToDisk() {return true;}
+
 private:
     int mLockCount;
 
-    static ArrayOf<char> fullSummary;
+    // Per thread, since CalcSummary hands out a pointer into it
+    static thread_local ArrayOf<char> fullSummary;
+
+    std::shared_ptr<SpaceGauge> mSpaceGauge;
+    DiskByteCount mGaugedBytes{0};
 
 protected:
     wxFileNameWrapper mFileName;
     size_t mLen;
     SummaryInfo mSummaryInfo;
     float mMin, mMax, mRMS;
-    mutable bool mSilentLog;
+    // Set by reads, which may be on several threads at once
+    mutable std::atomic<bool> mSilentLog;
 };
 
 /// A BlockFile that refers to data in an existing file
@@ -0,0 +1,50 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  CpuFeatures.cpp
+
+**********************************************************************/
+
+#include "CpuFeatures.h"
+
+SimdLevel CpuSimdLevel() {
+    // Probed once; initialization of the static is thread safe
+    static const SimdLevel level = [] {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2"))
+            return SimdLevel::AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return SimdLevel::SSE2;
+#elif defined(__aarch64__)
+        return SimdLevel::NEON;
+#endif
+        return SimdLevel::Scalar;
+    }();
+    return level;
+}
+
+bool SimdLevelSupported(SimdLevel level) {
+    const auto best = CpuSimdLevel();
+    return level == SimdLevel::Scalar ||
+           ((level == SimdLevel::NEON) == (best == SimdLevel::NEON) && level <= best);
+}
+
+const char *SimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::NEON:
+            return "neon";
+        case SimdLevel::AVX512:
+            return "avx512";
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::SSE2:
+            return "sse2";
+        case SimdLevel::Scalar:
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,34 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  CpuFeatures.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_CPU_FEATURES__
+#define __AUDACITY_CPU_FEATURES__
+
+// Instruction sets that hand-vectorized kernels may be dispatched to at
+// run time.  Kernels are compiled with per-function target attributes, so
+// the library as a whole still runs on the baseline architecture.  The x86
+// levels are ordered, each including those before; NEON, which every
+// AArch64 CPU has, stands apart from them.
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512,
+    NEON,
+};
+
+/// The best level supported by this CPU
+SimdLevel CpuSimdLevel();
+
+/// Whether kernels may be dispatched to the level on this CPU:  Scalar,
+/// and those of its architecture up to CpuSimdLevel()
+bool SimdLevelSupported(SimdLevel level);
+
+const char *SimdLevelName(SimdLevel level);
+
+#endif
@@ -43,19 +43,28 @@
   when reading a project from disk, multiple copies of the
   same block still get mapped to the same BlockFile object.
 
-  The blockfile/directory scheme is rather complicated with two different schemes.
-  The current scheme uses two levels of subdirectories - up to 256 'eXX' and up to
+  The blockfile/directory scheme uses two levels of subdirectories - up to 256 'eXX' and up to
   256 'dYY' directories within each of the 'eXX' dirs, where XX and YY are hex chars.
   In each of the dXX directories there are up to 256 audio files (e.g. .au or .auf).
-  They have a filename scheme of 'eXXYYZZZZ', where XX and YY refers to the
-  subdirectories as above.  The 'ZZZZ' component is generated randomly for some reason.
-  The XX and YY components are sequential.
-  DirManager fills up the current dYY subdir until 256 are created, and moves on to the next one.
-
-  So for example, the first blockfile created may be 'e00/d00/e0000a23b.au' and the next
-  'e00/d00/e000015e8.au', and the 257th may be 'e00/d01/e0001f02a.au'.
-  On close the blockfiles that are no longer referenced by the project (edited or deleted) are removed,
-  along with the consequent empty directories.
+  They have a filename scheme of 'eXXYYGZZ', where XX and YY refers to the
+  subdirectories as above.  Block files are numbered in order of creation, so
+  that XXYYZZ counts up, and a subdirectory is made only when its first block
+  file is.  G counts the uses of the project temp dir, in this process.
+
+  So for example, the first blockfile created is 'e00/d00/e0000000.au' and the next
+  'e00/d00/e0000001.au', and the 257th is 'e00/d01/e0001000.au'.
+  Block files no longer referenced by the project (edited or deleted) are removed,
+  but not their directories; on close, a temp dir emptied of block files is kept
+  for the next DirManager of the process, with its subdirectories, and removed
+  only at exit.
+
+  The project temp dir is made with the first block file on disk, so that a
+  DirManager in memory, or one that makes no blocks, touches no file system.
+  It is named 'project<pid>-<n>', n counting the temp dirs of the process, and
+  made with one mkdir, which fails rather than share a dir left by another
+  process; then the next n is tried.  Each DirManager, and the pool at exit,
+  removes only the temp dirs of this process, never sweeping the others of
+  the temp directory.
 
 
 *//*******************************************************************/
@@ -67,13 +76,15 @@
 #include <sys/stat.h> // stat
 #include <errno.h>    // errno, ENOENT, EEXIST
 #include <fstream>
-#include <zconf.h>
+#include <unistd.h>   // getpid, rmdir, unlink
 #include <cstring>
+#include <cstdlib>
 
 #include "Audacity.h"
 #include "DirManager.h"
 #include "MemoryX.h"
 #include "SimpleBlockFile.h"
+#include "MemoryBlockFile.h"
 #include "Utils.h"
 #include "InconsistencyException.h"
 #include "FileException.h"
@@ -107,7 +118,13 @@ int remove_directory(const char *path) {
 
                 snprintf(buf, len, "%s/%s", path, p->d_name);
 
-                if (!stat(buf, &statbuf)) {
+                // The type of the entry itself, without a stat where the
+                // file system tells it; a link is removed, not followed
+                if (p->d_type == DT_DIR) {
+                    r2 = remove_directory(buf);
+                } else if (p->d_type != DT_UNKNOWN) {
+                    r2 = unlink(buf);
+                } else if (!lstat(buf, &statbuf)) {
                     if (S_ISDIR(statbuf.st_mode)) {
                         r2 = remove_directory(buf);
                     } else {
@@ -131,6 +148,8 @@ int remove_directory(const char *path) {
     return r;
 }
 
+static bool makePath(const std::string &path);
+
 static bool isDirExist(const std::string &path) {
 
     struct stat info;
@@ -140,29 +159,51 @@ static bool isDirExist(const std::string &path) {
     return (info.st_mode & S_IFDIR) != 0;
 }
 
+std::mutex DirManager::globalLock;
 std::string DirManager::globaltemp("/dev/shm/audacity-noisered");
 int DirManager::numDirManagers = 0;
+unsigned DirManager::numTempDirs = 0;
 
-DirManager::DirManager() {
-    mLastBlockFileDestructionCount = BlockFile::gBlockFileDestructionCount;
+namespace {
+
+// Temp dirs kept, at most, for reuse
+const size_t maxPooledDirs = 16;
+
+// Block files a temp dir may have numbered, in 256 x 256 subdirectories
+const unsigned maxBlockNumber = 1u << 24;
+
+}
+
+// static
+auto DirManager::GetPooledDirs() -> std::vector<PooledDir> & {
+    // Removes the temp dirs still pooled at exit
+    struct Pool {
+        std::vector<PooledDir> dirs;
+        ~Pool() {
+            for (const auto &dir : dirs)
+                remove_directory(dir.path.c_str());
+            // Only if nothing else is left in it
+            if (!dirs.empty())
+                rmdir(globaltemp.c_str());
+        }
+    };
+    static Pool pool;
+    return pool.dirs;
+}
 
-    // Seed the random number generator.
-    // this need not be strictly uniform or random, but it should give
-    // unclustered numbers
-    srand(time(nullptr));
+// static
+void DirManager::SetTempDir(const std::string &_temp) {
+    std::lock_guard<std::mutex> lock(globalLock);
+    globaltemp = _temp;
+}
 
-    // Set up local temp subdir
-    // Previously, Audacity just named project temp directories "project0",
-    // "project1" and so on. But with the advent of recovery code, we need a
-    // unique name even after a crash. So we create a random project index
-    // and make sure it is not used already. This will not pose any performance
-    // penalties as long as the number of open Audacity projects is much
-    // lower than RAND_MAX.
-    do {
-        mytemp = globaltemp + "/" + string_format("project%d", (int) rand());
-    } while (isDirExist(mytemp));
+DirManager::DirManager(bool inMemory) : mInMemory(inMemory) {
+    mLastBlockFileDestructionCount = BlockFile::gBlockFileDestructionCount;
 
-    numDirManagers++;
+    {
+        std::lock_guard<std::mutex> lock(globalLock);
+        numDirManagers++;
+    }
 
     projPath = "";
     projName = "";
@@ -170,35 +211,69 @@ DirManager::DirManager() {
     mLoadingTarget = nullptr;
     mLoadingTargetIdx = 0;
     mMaxSamples = ~size_t(0);
-
-    // toplevel pool hash is fully populated to begin
-    {
-        // We can bypass the accessor function while initializing
-        auto &balanceInfo = mBalanceInfo;
-        auto &dirTopPool = balanceInfo.dirTopPool;
-        for (int i = 0; i < 256; ++i)
-            dirTopPool[i] = 0;
-    }
 }
 
 DirManager::~DirManager() {
+    // Any block file left keeps its file
+    bool empty = true;
+    for (const auto &pair : mBlockFileHash)
+        if (!pair.second.expired()) {
+            empty = false;
+            break;
+        }
+
+    std::lock_guard<std::mutex> lock(globalLock);
     numDirManagers--;
-    if (numDirManagers == 0) {
-        CleanTempDir();
-        //::wxRmdir(temp);
-    } else if (projFull.empty() && !mytemp.empty()) {
-        CleanDir(mytemp);
+    if (projFull.empty() && !mytemp.empty()) {
+        auto &pooledDirs = GetPooledDirs();
+        // Not the whole temp dir, which other processes may be using too
+        if (empty && pooledDirs.size() < maxPooledDirs)
+            pooledDirs.push_back({mytemp, mMadeDirs, mGeneration});
+        else
+            CleanDir(mytemp);
     }
 }
 
 // static
-// This is quite a dangerous function.  In the temp dir it will DELETE every directory
-// recursively, that has 'project*' as the name - EVEN if it happens not to be an Audacity
-// project but just something else called project.
 void DirManager::CleanTempDir() {
-    // with default flags (none) this does not clean the top directory, and may remove non-empty
-    // directories.
-    CleanDir(globaltemp);
+    std::lock_guard<std::mutex> lock(globalLock);
+    auto &pooledDirs = GetPooledDirs();
+    for (const auto &dir : pooledDirs)
+        CleanDir(dir.path);
+    pooledDirs.clear();
+    // Only if nothing else is left in it
+    rmdir(globaltemp.c_str());
+}
+
+void DirManager::MakeTempDir() {
+    std::lock_guard<std::mutex> lock(globalLock);
+
+    auto &pooledDirs = GetPooledDirs();
+    if (!pooledDirs.empty() &&
+        pooledDirs.back().path.compare(0, globaltemp.size() + 1, globaltemp + "/") == 0) {
+        // Reuse the temp dir of a DirManager that is gone, and its subdirectories
+        const auto &pooled = pooledDirs.back();
+        mytemp = pooled.path;
+        mMadeDirs = pooled.madeDirs;
+        mGeneration = pooled.generation + 1;
+        pooledDirs.pop_back();
+        return;
+    }
+
+    if (!isDirExist(globaltemp) && !makePath(globaltemp))
+        throw FileException{FileException::Cause::Write, wxFileName{}};
+    // mkdir fails on a dir of the same name, left by an earlier process of
+    // the same pid, say, so that no two share one
+    const auto pid = (long) getpid();
+    while (true) {
+        const auto path = globaltemp + "/" + string_format("project%ld-%u", pid, numTempDirs++);
+        if (mkdir(path.c_str(), 0755) == 0) {
+            mytemp = path;
+            return;
+        }
+        if (errno != EEXIST)
+            throw FileException{FileException::Cause::Write, wxFileName{}};
+    }
 }
 
 // static
@@ -211,176 +286,84 @@ BlockFilePtr DirManager::NewSimpleBlockFile(
         samplePtr sampleData, size_t sampleLen,
         sampleFormat format,
         bool allowDeferredWrite) {
+    if (mInMemory) {
+        // Not entered in mBlockFileHash: the block has no name to collide with
+        auto newBlockFile = make_blockfile<MemoryBlockFile>(sampleData, sampleLen, format);
+        GaugeBlockFile(*newBlockFile, sampleLen, format);
+        return newBlockFile;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
     wxFileNameWrapper filePath{MakeBlockFileName()};
     const std::string fileName{filePath.GetName()};
 
     auto newBlockFile = std::make_shared<SimpleBlockFile>
-            (std::move(filePath), sampleData, sampleLen, format, allowDeferredWrite, false);
+            (std::move(filePath), sampleData, sampleLen, format, allowDeferredWrite, false,
+             mBlockSummaries);
+    GaugeBlockFile(*newBlockFile, sampleLen, format);
 
     mBlockFileHash[fileName] = newBlockFile;
 
     return newBlockFile;
 }
 
-// only determines appropriate filename and subdir balance; does not
-// perform maintainence
-wxFileNameWrapper DirManager::MakeBlockFileName() {
-    auto &balanceInfo = GetBalanceInfo();
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirTopPool = balanceInfo.dirTopPool;
-    auto &dirTopFull = balanceInfo.dirTopFull;
-
-    wxFileNameWrapper ret;
-    std::string baseFileName;
-
-    unsigned int filenum, midnum, topnum, midkey;
-
-    while (1) {
-
-        /* blockfiles are divided up into heirarchical directories.
-           Each toplevel directory is represented by "e" + two unique
-           hexadecimal digits, for a total possible number of 256
-           toplevels.  Each toplevel contains up to 256 subdirs named
-           "d" + two hex digits.  Each subdir contains 'a number' of
-           files.  */
-
-        filenum = 0;
-        midnum = 0;
-        topnum = 0;
-
-        // first action: if there is no available two-level directory in
-        // the available pool, try to make one
-
-        if (dirMidPool.empty()) {
-
-            // is there a toplevel directory with space for a NEW subdir?
-
-            if (!dirTopPool.empty()) {
-
-                // there's still a toplevel with room for a subdir
-
-                DirHash::iterator iter = dirTopPool.begin();
-                int newcount = 0;
-                topnum = iter->first;
-
-
-                // search for unused midlevels; linear search adequate
-                // add 32 NEW topnum/midnum dirs full of  prospective filenames to midpool
-                for (midnum = 0; midnum < 256; midnum++) {
-                    midkey = (topnum << 8) + midnum;
-                    if (BalanceMidAdd(topnum, midkey)) {
-                        newcount++;
-                        if (newcount >= 32)break;
-                    }
-                }
-
-                if (dirMidPool.empty()) {
-                    // all the midlevels in this toplevel are in use yet the
-                    // toplevel claims some are free; this implies multiple
-                    // internal logic faults, but simply giving up and going
-                    // into an infinite loop isn't acceptible.  Just in case,
-                    // for some reason, we get here, dynamite this toplevel so
-                    // we don't just fail.
-
-                    // this is 'wrong', but the best we can do given that
-                    // something else is also wrong.  It will contain the
-                    // problem so we can keep going without worry.
-                    dirTopPool.erase(topnum);
-                    dirTopFull[topnum] = 256;
-                }
-                continue;
-            }
-        }
-
-        if (dirMidPool.empty()) {
-            // still empty, thus an absurdly large project; all dirs are
-            // full to 256/256/256; keep working, but fall back to 'big
-            // filenames' and randomized placement
-
-            filenum = rand();
-            midnum = (int) (256. * rand() / (RAND_MAX + 1.));
-            topnum = (int) (256. * rand() / (RAND_MAX + 1.));
-            midkey = (topnum << 8) + midnum;
-
+void DirManager::GaugeBlockFile(BlockFile &blockFile, size_t sampleLen, sampleFormat format) {
+    // Memory blocks take no disk space, but their samples are what count
+    const auto bytes = mInMemory ? sampleLen * SAMPLE_SIZE(format) : blockFile.GetSpaceUsage();
+    if (!HasSpaceFor(bytes))
+        // The block is dropped, unwritten if deferred; as if the disk had
+        // filled
+        throw FileException{FileException::Cause::Write, blockFile.GetFileName().name};
+    blockFile.SetSpaceGauge(mBlockSpace, bytes);
+}
 
-        } else {
+wxFileNameWrapper DirManager::MakeBlockFileName() {
+    PruneBlockFileHash();
 
-            DirHash::iterator iter = dirMidPool.begin();
-            midkey = iter->first;
+    if (mNextBlockNumber >= maxBlockNumber)
+        // 16M block files of up to 1MB, all named
+        throw FileException{FileException::Cause::Write, wxFileName{}};
 
-            // split the retrieved 16 bit directory key into two 8 bit numbers
-            topnum = midkey >> 8;
-            midnum = midkey & 0xff;
-            filenum = (int) (4096. * rand() / (RAND_MAX + 1.));
+    if (mytemp.empty() && projFull.empty())
+        MakeTempDir();
 
-        }
+    const unsigned number = mNextBlockNumber++;
+    const unsigned midkey = number >> 8;
+    const unsigned topnum = midkey >> 8;
+    const unsigned midnum = midkey & 0xff;
+    const unsigned filenum = (mGeneration & 0xf) << 8 | (number & 0xff);
+    const std::string baseFileName = string_format("e%02x%02x%03x", topnum, midnum, filenum);
 
-        baseFileName = string_format("e%02x%02x%03x", topnum, midnum, filenum);
-
-        if (!ContainsBlockFile(baseFileName)) {
-            // not in the hash, good.
-            if (!this->AssignFile(ret, baseFileName, true)) {
-                // this indicates an on-disk collision, likely due to an
-                // orphan blockfile.  We should try again, but first
-                // alert the balancing info there's a phantom file here;
-                // if the directory is nearly full of orphans we neither
-                // want performance to suffer nor potentially get into an
-                // infinite loop if all possible filenames are taken by
-                // orphans (unlikely but possible)
-                BalanceFileAdd(midkey);
-
-            } else break;
-        }
+    wxFileNameWrapper dir;
+    dir.AssignDir(GetDataFilesDir());
+    dir.AppendDir(baseFileName.substr(0, 3));
+    dir.AppendDir("d" + baseFileName.substr(3, 2));
+    if (midkey >= mMadeDirs) {
+        // The first block file of this subdirectory, as numbers count up
+        if (!isDirExist(dir.GetFullPath()) && !makePath(dir.GetFullPath()))
+            std::cerr << "mkdir in DirManager::MakeBlockFileName failed." << std::endl;
+        mMadeDirs = midkey + 1;
     }
-    // FIXME: Might we get here without midkey having been set?
-    //    Seemed like a possible problem in these changes in .aup directory hierarchy.
-    BalanceFileAdd(midkey);
-    return ret;
-}
 
-int DirManager::BalanceMidAdd(int topnum, int midkey) {
-    // enter the midlevel directory if it doesn't exist
-
-    auto &balanceInfo = GetBalanceInfo();
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirMidFull = balanceInfo.dirMidFull;
-    auto &dirTopPool = balanceInfo.dirTopPool;
-    auto &dirTopFull = balanceInfo.dirTopFull;
-
-    if (dirMidPool.find(midkey) == dirMidPool.end() &&
-        dirMidFull.find(midkey) == dirMidFull.end()) {
-        dirMidPool[midkey] = 0;
-
-        // increment toplevel directory fill
-        dirTopPool[topnum]++;
-        if (dirTopPool[topnum] >= 256) {
-            // this toplevel is now full; move it to the full hash
-            dirTopPool.erase(topnum);
-            dirTopFull[topnum] = 256;
-        }
-        return 1;
-    }
-    return 0;
+    wxFileNameWrapper ret;
+    ret.Assign(dir.GetFullPath(), baseFileName);
+    return ret;
 }
 
-void DirManager::BalanceFileAdd(int midkey) {
-    auto &balanceInfo = GetBalanceInfo();
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirMidFull = balanceInfo.dirMidFull;
-
-    // increment the midlevel directory usage information
-    if (dirMidPool.find(midkey) != dirMidPool.end()) {
-        dirMidPool[midkey]++;
-        if (dirMidPool[midkey] >= 256) {
-            // this middir is now full; move it to the full hash
-            dirMidPool.erase(midkey);
-            dirMidFull[midkey] = 256;
-        }
-    } else {
-        // this case only triggers in absurdly large projects; we still
-        // need to track directory fill even if we're over 256/256/256
-        dirMidPool[midkey]++;
+void DirManager::PruneBlockFileHash() {
+    // Counts destructions in all DirManagers, so may prune more often than
+    // needed, but never more than once for each block file destroyed
+    const unsigned long count = BlockFile::gBlockFileDestructionCount;
+    if (count - mLastBlockFileDestructionCount < std::max<size_t>(mBlockFileHash.size(), 1))
+        return;
+
+    for (auto it = mBlockFileHash.begin(); it != mBlockFileHash.end();) {
+        if (it->second.expired())
+            it = mBlockFileHash.erase(it);
+        else
+            ++it;
     }
+    mLastBlockFileDestructionCount = count;
 }
 
 bool DirManager::ContainsBlockFile(const std::string &filepath) const {
@@ -511,6 +494,7 @@ BlockFilePtr DirManager::CopyBlockFile(const BlockFilePtr &b) {
     if (!b)
         THROW_INCONSISTENCY_EXCEPTION;
 
+    std::lock_guard<std::mutex> lock(mLock);
     auto result = b->GetFileName();
     const auto &fn = result.name;
 
@@ -540,6 +524,11 @@ BlockFilePtr DirManager::CopyBlockFile(const BlockFilePtr &b) {
         // as the existing file
         newFile.SetExt(fn.GetExt());
 
+        // A deferred block is written first, so that there is a file to copy
+        if (!b->WriteCacheToDisk())
+            throw FileException{
+                    FileException::Cause::Write, fn};
+
         //some block files such as ODPCMAliasBlockFIle don't always have
         //a summary file, so we should check before we copy.
         if (b->IsSummaryAvailable()) {
@@ -566,105 +555,3 @@ std::string DirManager::GetDataFilesDir() const {
     return projFull != "" ? projFull : mytemp;
 }
 
-auto DirManager::GetBalanceInfo() -> BalanceInfo & {
-    // Before returning the map,
-    // see whether any block files have disappeared,
-    // and if so update
-
-    auto count = BlockFile::gBlockFileDestructionCount;
-    if (mLastBlockFileDestructionCount != count) {
-        auto it = mBlockFileHash.begin(), end = mBlockFileHash.end();
-        while (it != end) {
-            BlockFilePtr ptr{it->second.lock()};
-            if (!ptr) {
-                auto name = it->first;
-                mBlockFileHash.erase(it++);
-                BalanceInfoDel(name);
-            } else
-                ++it;
-        }
-    }
-
-    mLastBlockFileDestructionCount = count;
-
-    return mBalanceInfo;
-}
-
-static inline unsigned int hexchar_to_int(unsigned int x) {
-    if (x < 48U)return 0;
-    if (x < 58U)return x - 48U;
-    if (x < 65U)return 10U;
-    if (x < 71U)return x - 55U;
-    if (x < 97U)return 10U;
-    if (x < 103U)return x - 87U;
-    return 15U;
-}
-
-// Note that this will try to clean up directories out from under even
-// locked blockfiles; this is actually harmless as the rmdir will fail
-// on non-empty directories.
-void DirManager::BalanceInfoDel(const std::string &file) {
-    // do not use GetBalanceInfo(),
-    // rather this function will be called from there.
-    auto &balanceInfo = mBalanceInfo;
-    auto &dirMidPool = balanceInfo.dirMidPool;
-    auto &dirMidFull = balanceInfo.dirMidFull;
-    auto &dirTopPool = balanceInfo.dirTopPool;
-    auto &dirTopFull = balanceInfo.dirTopFull;
-
-    const char *s = file.c_str();
-    if (s[0] == 'e') {
-        // this is one of the modern two-deep managed files
-
-        unsigned int topnum = (hexchar_to_int(s[1]) << 4) |
-                              hexchar_to_int(s[2]);
-        unsigned int midnum = (hexchar_to_int(s[3]) << 4) |
-                              hexchar_to_int(s[4]);
-        unsigned int midkey = topnum << 8 | midnum;
-
-        // look for midkey in the mid pool
-        if (dirMidFull.find(midkey) != dirMidFull.end()) {
-            // in the full pool
-
-            if (--dirMidFull[midkey] < 256) {
-                // move out of full into available
-                dirMidPool[midkey] = dirMidFull[midkey];
-                dirMidFull.erase(midkey);
-            }
-        } else {
-            if (--dirMidPool[midkey] < 1) {
-                // erasing the key here is OK; we have provision to add it
-                // back if its needed (unlike the dirTopPool hash)
-                dirMidPool.erase(midkey);
-
-                // DELETE the actual directory
-                std::string dir = (projFull != "" ? projFull : mytemp);
-                dir += "/";
-                dir += file.substr(0, 3);
-                dir += "/";
-                dir += "d";
-                dir += file.substr(3, 2);
-                remove_directory(dir.c_str());
-
-                // also need to remove from toplevel
-                if (dirTopFull.find(topnum) != dirTopFull.end()) {
-                    // in the full pool
-                    if (--dirTopFull[topnum] < 256) {
-                        // move out of full into available
-                        dirTopPool[topnum] = dirTopFull[topnum];
-                        dirTopFull.erase(topnum);
-                    }
-                } else {
-                    if (--dirTopPool[topnum] < 1) {
-                        // do *not* erase the hash entry from dirTopPool
-                        // *do* DELETE the actual directory
-                        std::string dir = (projFull != "" ? projFull : mytemp);
-                        dir += "/";
-                        dir += file.substr(0, 3);
-                        remove_directory(dir.c_str());
-                    }
-                }
-            }
-        }
-    }
-}
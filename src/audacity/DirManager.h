@@ -11,7 +11,10 @@
 #ifndef _DIRMANAGER_
 #define _DIRMANAGER_
 
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 #include "MemoryX.h"
 #include "wxFileNameWrapper.h"
@@ -22,41 +25,56 @@
 
 using BlockHash = std::unordered_map<std::string, std::weak_ptr<BlockFile>>;
 
-using DirHash = std::unordered_map<int, int>;
 class BlockArray;
 
 class DirManager {
 public:
 
-    static void SetTempDir(const std::string &_temp) { globaltemp = _temp; }
+    static void SetTempDir(const std::string &_temp);
 
     // MM: Construct DirManager
-    DirManager();
+    // When inMemory is true, NEW block files keep their samples in RAM
+    // and nothing is ever written under the temp directory.
+    explicit DirManager(bool inMemory = false);
 
     virtual ~DirManager();
 
+    bool IsInMemory() const { return mInMemory; }
 
-    BlockFilePtr
-    NewSimpleBlockFile(samplePtr sampleData,
-                       size_t sampleLen,
-                       sampleFormat format,
-                       bool allowDeferredWrite = false);
+    // Whether NEW simple block files compute the min/max/RMS summaries for
+    // display and write them before their samples.  Nothing in this library
+    // reads them back, so headless use can skip both.  On by default, unless
+    // built with NOISERED_NO_BLOCK_SUMMARIES.  Memory blocks never have them.
+    void SetBlockSummaries(bool summaries) { mBlockSummaries = summaries; }
+
+    bool GetBlockSummaries() const { return mBlockSummaries; }
 
-    // Hashes for management of the sub-directory tree of _data
-    struct BalanceInfo {
-        DirHash dirTopPool;    // available toplevel dirs
-        DirHash dirTopFull;    // full toplevel dirs
-        DirHash dirMidPool;    // available two-level dirs
-        DirHash dirMidFull;    // full two-level dirs
-    } mBalanceInfo;
+    // Bytes of the block files made by this DirManager and not yet
+    // destroyed, in memory or on disk, and the most there were at once
+    const SpaceGauge &GetBlockSpace() const { return *mBlockSpace; }
 
-    // Accessor for the balance info, may need to do a delayed update for
-    // deletion in case other threads DELETE block files
-    BalanceInfo &GetBalanceInfo();
+    // A hard limit on GetBlockSpace().GetLive(), so that a run fails before
+    // it fills memory or the temp directory (a tmpfs, say):  NEW block files
+    // beyond it throw FileException.  0, the default, is no limit.
+    void SetSpaceBudget(BlockFile::DiskByteCount bytes) { mSpaceBudget = bytes; }
 
-    int BalanceMidAdd(int, int);
+    BlockFile::DiskByteCount GetSpaceBudget() const { return mSpaceBudget; }
 
-    void BalanceFileAdd(int);
+    // Whether bytes more of block files fit in the budget, so that callers
+    // may estimate what a run needs and fail, or take another path, before
+    // starting
+    bool HasSpaceFor(BlockFile::DiskByteCount bytes) const {
+        return !mSpaceBudget || mBlockSpace->GetLive() + bytes <= mSpaceBudget;
+    }
+
+
+    // With the SimpleBlockFile cache on, a NEW block allowing deferred write
+    // stays in memory until evicted, and one deleted first is never written
+    BlockFilePtr
+    NewSimpleBlockFile(samplePtr sampleData,
+                       size_t sampleLen,
+                       sampleFormat format,
+                       bool allowDeferredWrite = true);
 
     /// Check for existing using filename using complete filename
     bool ContainsBlockFile(const std::string &filepath) const;
@@ -74,23 +92,54 @@ public:
 
     // Get directory where data files are in. Note that projects are normally
     // not interested in this information, but it is important for the
-    // auto-save functionality
+    // auto-save functionality.  Empty until the first block file on disk.
     std::string GetDataFilesDir() const;
 
     bool CopyFile(const std::string &file1, const std::string &file2);
 
-    void BalanceInfoDel(const std::string &);
-
+    // Removes the temp dirs that this process keeps for reuse, and the temp
+    // directory if nothing else is left in it; never the dirs of other
+    // processes, nor those of DirManagers still alive
     static void CleanTempDir();
 
     static void CleanDir(const std::string &path);
 
 private:
+    // Guards globaltemp, numDirManagers, numTempDirs and the pooled temp
+    // dirs, so that DirManagers can come and go on different threads
+    static std::mutex globalLock;
     static std::string globaltemp;
     static int numDirManagers;
-
+    // Project temp dirs made by this process, numbering their names
+    static unsigned numTempDirs;
+
+    // A project temp dir, made by a DirManager of this process that is gone,
+    // with no block files left, for reuse by NEW ones
+    struct PooledDir {
+        std::string path;
+        unsigned madeDirs;
+        unsigned generation;
+    };
+
+    // Used with globalLock held
+    static std::vector<PooledDir> &GetPooledDirs();
+
+    // Sets mytemp to a pooled temp dir, or to one NEW and made; with mLock
+    // held.  Throws FileException if none can be made.
+    void MakeTempDir();
+
+    // O(1):  block files are numbered in order of creation, 256 to a
+    // subdirectory, each made when its first block is
     wxFileNameWrapper MakeBlockFileName();
 
+    // Forget blocks that are gone, once enough have gone for the scan to
+    // cost O(1) for each
+    void PruneBlockFileHash();
+
+    // Counts a NEW block file in mBlockSpace, or throws if it exceeds the
+    // budget
+    void GaugeBlockFile(BlockFile &blockFile, size_t sampleLen, sampleFormat format);
+
     std::vector<std::string> aliasList;
 
     BlockHash mBlockFileHash; // repository for blockfiles
@@ -104,6 +153,29 @@ private:
 
     size_t mMaxSamples; // max samples per block
 
+    const bool mInMemory;
+#ifdef NOISERED_NO_BLOCK_SUMMARIES
+    bool mBlockSummaries{false};
+#else
+    bool mBlockSummaries{true};
+#endif
+
+    // Shared with the block files, which may outlive this
+    const std::shared_ptr<SpaceGauge> mBlockSpace{std::make_shared<SpaceGauge>()};
+    std::atomic<BlockFile::DiskByteCount> mSpaceBudget{0};
+
+    // Guards the hash and block file naming, so that tracks sharing this
+    // DirManager can be processed on different threads
+    std::mutex mLock;
+
+    // Block file naming; used with mLock held
+    unsigned mNextBlockNumber{0};
+    // "eXX/dYY" subdirectories made so far, in order
+    unsigned mMadeDirs{0};
+    // Of the project temp dir, counting its reuses, so that a block file of
+    // an earlier DirManager still being deleted meets no NEW one of its name
+    unsigned mGeneration{0};
+
     unsigned long mLastBlockFileDestructionCount{0};
 
 };
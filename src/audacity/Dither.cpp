@@ -29,8 +29,15 @@
 
 Dither class. You must construct an instance because it keeps
 state. Call Dither::Apply() to apply the dither. You can call
-Reset() between subsequent dithers to reset the dither state
-and get deterministic behaviour.
+Reset() between subsequent dithers to reset the dither state,
+and SetSeed() to restart the noise and get deterministic behaviour.
+
+  The noise comes from interleaved xorshift generators, a block at a
+  time (see FillDitherNoise()).  Contiguous samples are dithered a block
+  at a time too:  rectangle and triangle dither in loops that vectorize,
+  and noise shaping, which feeds each error back into the next sample,
+  with its filter state in registers.  Either way a sample takes the
+  same noise, and gets the same result, as in the strided loops.
 
 *//*******************************************************************/
 
@@ -42,12 +49,14 @@ and get deterministic behaviour.
 
 #include <stdlib.h>
 #include <math.h>
+#include <algorithm>
 #include <string.h>
 //#include <sys/types.h>
 //#include <memory.h>
 //#include <assert.h>
 
 #include "Dither.h"
+#include "SampleKernels.h"
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -58,8 +67,15 @@ const int Dither::BUF_SIZE = 8;
 // Lipshitz's minimally audible FIR
 const float Dither::SHAPED_BS[] = { 2.033f, -2.165f, 1.959f, -1.590f, 0.6149f };
 
+// Samples dithered at a time, and noise generated at a time (enough for
+// a block of shaped dither)
+const unsigned int Dither::DITHER_BLOCK = 512;
+const size_t Dither::NOISE_BLOCK = 1024;
+
+static_assert(nDitherNoiseLanes == 8, "mNoiseState has a state per lane");
+
 // This is supposed to produce white noise and no dc
-#define DITHER_NOISE (rand() / (float)RAND_MAX - 0.5f)
+#define DITHER_NOISE NextNoise()
 
 // The following is a rather ugly, but fast implementation
 // of a dither loop. The macro "DITHER" is expanded to an implementation
@@ -206,6 +222,7 @@ Dither::Dither()
 {
     // On startup, initialize dither by resetting values
     Reset();
+    SetSeed(0);
 }
 
 void Dither::Reset()
@@ -215,6 +232,40 @@ void Dither::Reset()
     memset(mBuffer, 0, sizeof(float) * BUF_SIZE);
 }
 
+void Dither::SetSeed(uint32_t seed)
+{
+    // Distinct, well mixed (and nonzero) states for the lanes
+    for (unsigned ll = 0; ll < nDitherNoiseLanes; ++ll) {
+        uint32_t z = seed + (ll + 1) * 0x9E3779B9u;
+        z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+        z ^= z >> 16;
+        mNoiseState[ll] = z ? z : 1;
+    }
+    mNoiseBegin = mNoiseEnd = 0;
+}
+
+const float *Dither::TakeNoise(size_t len)
+{
+    assert(len <= NOISE_BLOCK);
+    if (mNoiseEnd - mNoiseBegin < len) {
+        // Keep what is left, and generate a block more after it
+        memmove(mNoise, mNoise + mNoiseBegin, (mNoiseEnd - mNoiseBegin) * sizeof(float));
+        mNoiseEnd -= mNoiseBegin;
+        mNoiseBegin = 0;
+        FillDitherNoise(mNoiseState, mNoise + mNoiseEnd, NOISE_BLOCK);
+        mNoiseEnd += NOISE_BLOCK;
+    }
+    const float *noise = mNoise + mNoiseBegin;
+    mNoiseBegin += len;
+    return noise;
+}
+
+inline float Dither::NextNoise()
+{
+    return *TakeNoise(1);
+}
+
 // This only decides if we must dither at all, the dithers
 // are all implemented using macros.
 //
@@ -295,6 +346,16 @@ void Dither::Apply(enum DitherType ditherType,
         // No clipping should be necessary.
         float* d = (float*)dest;
 
+        if (destStride == 1 && sourceStride == 1)
+        {
+            // Vectorized, with the same results
+            if (sourceFormat == int16Sample)
+                ConvertSamples((const short*)source, d, len);
+            else if (sourceFormat == int24Sample)
+                ConvertSamples((const int*)source, d, len);
+            else
+                assert(false); // source format unknown
+        } else
         if (sourceFormat == int16Sample)
         {
             short* s = (short*)source;
@@ -315,8 +376,28 @@ void Dither::Apply(enum DitherType ditherType,
         // Special case when promoting 16 bit to 24 bit
         int* d = (int*)dest;
         short* s = (short*)source;
-        for (i = 0; i < len; i++, d += destStride, s += sourceStride)
-            *d = ((int)*s) << 8;
+        if (destStride == 1 && sourceStride == 1)
+            ConvertSamples(s, d, len);
+        else
+            for (i = 0; i < len; i++, d += destStride, s += sourceStride)
+                *d = ((int)*s) << 8;
+    } else
+    if (ditherType == DitherType::none && destStride == 1 && sourceStride == 1)
+    {
+        // Clipping and rounding only, vectorized, with the results of
+        // DITHER(NoDither, ...)
+        if (sourceFormat == int24Sample && destFormat == int16Sample)
+            ConvertSamples((const int*)source, (short*)dest, len);
+        else if (sourceFormat == floatSample && destFormat == int16Sample)
+            ConvertSamples((const float*)source, (short*)dest, len);
+        else if (sourceFormat == floatSample && destFormat == int24Sample)
+            ConvertSamples((const float*)source, (int*)dest, len);
+        else
+            assert(false);
+    } else
+    if (destStride == 1 && sourceStride == 1)
+    {
+        ApplyBlocks(ditherType, source, sourceFormat, dest, destFormat, len);
     } else
     {
         // We must do dithering
@@ -342,6 +423,105 @@ void Dither::Apply(enum DitherType ditherType,
     }
 }
 
+// The dither of the DITHER loops, on a block of promoted samples, which
+// are then rounded and clipped by ConvertSamples()
+void Dither::ApplyBlocks(enum DitherType ditherType,
+                         const samplePtr source, sampleFormat sourceFormat,
+                         samplePtr dest, sampleFormat destFormat,
+                         unsigned int len)
+{
+    if (ditherType == DitherType::triangle || ditherType == DitherType::shaped)
+        Reset(); // reset dither filter for this NEW conversion
+
+    const bool toInt16 = destFormat == int16Sample;
+    // Scaling back to [-1, 1] is exact, and ConvertSamples() scales up again
+    const float unscale = toInt16 ? 1.0f / CONVERT_DIV16 : 1.0f / CONVERT_DIV24;
+    float block[512 /* = DITHER_BLOCK */];
+
+    for (unsigned int done = 0; done < len;) {
+        const unsigned int n = std::min(len - done, DITHER_BLOCK);
+
+        if (sourceFormat == int24Sample) {
+            assert(toInt16);
+            const int *s = (const int*)source + done;
+            for (unsigned int i = 0; i < n; i++)
+                block[i] = PROMOTE_TO_INT16(FROM_INT24(s + i));
+        } else {
+            assert(sourceFormat == floatSample);
+            const float *s = (const float*)source + done;
+            if (toInt16)
+                for (unsigned int i = 0; i < n; i++)
+                    block[i] = PROMOTE_TO_INT16(FROM_FLOAT(s + i));
+            else
+                for (unsigned int i = 0; i < n; i++)
+                    block[i] = PROMOTE_TO_INT24(FROM_FLOAT(s + i));
+        }
+
+        switch (ditherType)
+        {
+        case DitherType::rectangle:
+        {
+            const float *noise = TakeNoise(n);
+            for (unsigned int i = 0; i < n; i++)
+                block[i] -= noise[i];
+            break;
+        }
+        case DitherType::triangle:
+        {
+            const float *noise = TakeNoise(n);
+            block[0] = block[0] + noise[0] - mTriangleState;
+            for (unsigned int i = 1; i < n; i++)
+                block[i] = block[i] + noise[i] - noise[i - 1];
+            mTriangleState = noise[n - 1];
+            break;
+        }
+        case DitherType::shaped:
+        {
+            const float *noise = TakeNoise(2 * n);
+            // The last errors, newest first
+            float e0 = mBuffer[mPhase],
+                  e1 = mBuffer[(mPhase - 1) & BUF_MASK],
+                  e2 = mBuffer[(mPhase - 2) & BUF_MASK],
+                  e3 = mBuffer[(mPhase - 3) & BUF_MASK],
+                  e4 = mBuffer[(mPhase - 4) & BUF_MASK];
+            for (unsigned int i = 0; i < n; i++) {
+                float sample = block[i];
+                if (sample != sample)  // test for NaN
+                    sample = 0;
+                const float r = noise[2 * i] + noise[2 * i + 1];
+                const float xe = sample + e0 * SHAPED_BS[0]
+                    + e1 * SHAPED_BS[1]
+                    + e2 * SHAPED_BS[2]
+                    + e3 * SHAPED_BS[3]
+                    + e4 * SHAPED_BS[4];
+                const float result = xe + r;
+                e4 = e3; e3 = e2; e2 = e1; e1 = e0;
+                e0 = xe - lrintf(result);
+                block[i] = result;
+            }
+            mPhase = (mPhase + n) & BUF_MASK;
+            mBuffer[mPhase] = e0;
+            mBuffer[(mPhase - 1) & BUF_MASK] = e1;
+            mBuffer[(mPhase - 2) & BUF_MASK] = e2;
+            mBuffer[(mPhase - 3) & BUF_MASK] = e3;
+            mBuffer[(mPhase - 4) & BUF_MASK] = e4;
+            break;
+        }
+        default:
+            break;
+        }
+
+        for (unsigned int i = 0; i < n; i++)
+            block[i] *= unscale;
+        if (toInt16)
+            ConvertSamples(block, (short*)dest + done, n);
+        else
+            ConvertSamples(block, (int*)dest + done, n);
+
+        done += n;
+    }
+}
+
 // Dither implementations
 
 // No dither, just return sample
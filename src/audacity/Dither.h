@@ -10,6 +10,7 @@
 #ifndef __AUDACITY_DITHER_H__
 #define __AUDACITY_DITHER_H__
 
+#include <cstdint>
 #include "SampleFormat.h"
 
 
@@ -26,6 +27,10 @@ public:
     /// Reset state of the dither.
     void Reset();
 
+    /// Restart the noise, which Reset() leaves running, from seed.  A new
+    /// Dither starts from seed 0, so that its output is deterministic.
+    void SetSeed(uint32_t seed);
+
     /// Apply the actual dithering. Expects the source sample in the
     /// 'source' variable, the destination sample in the 'dest' variable,
     /// and hints to the formats of the samples. Even if the sample formats
@@ -38,6 +43,16 @@ public:
                unsigned int destStride = 1);
 
 private:
+    // Contiguous samples, a block at a time
+    void ApplyBlocks(DitherType ditherType,
+                     const samplePtr source, sampleFormat sourceFormat,
+                     samplePtr dest, sampleFormat destFormat,
+                     unsigned int len);
+
+    // The next len <= NOISE_BLOCK values of the noise
+    const float *TakeNoise(size_t len);
+    float NextNoise();
+
     // Dither methods
     float NoDither(float sample);
     float RectangleDither(float sample);
@@ -48,11 +63,19 @@ private:
     static const int BUF_SIZE; /* = 8 */
     static const int BUF_MASK; /* = 7 */
     static const float SHAPED_BS[];
+    static const unsigned int DITHER_BLOCK; /* = 512 */
+    static const size_t NOISE_BLOCK; /* = 1024 */
 
     // Dither state
     int mPhase;
     float mTriangleState;
     float mBuffer[8 /* = BUF_SIZE */];
+
+    // Noise state, and generated noise [mNoiseBegin, mNoiseEnd) not yet used
+    uint32_t mNoiseState[8 /* = nDitherNoiseLanes */];
+    float mNoise[2048 /* = 2 * NOISE_BLOCK */];
+    size_t mNoiseBegin;
+    size_t mNoiseEnd;
 };
 
 #endif /* __AUDACITY_DITHER_H__ */
@@ -56,6 +56,9 @@ public:
     /** \brief Return number of points */
     size_t GetNumberOfPoints() const;
 
+    /** \brief Value everywhere when there are no points */
+    double GetDefaultValue() const { return mDefaultValue; }
+
     virtual ~Envelope();
 
     // Accessors
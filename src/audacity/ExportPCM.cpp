@@ -8,13 +8,20 @@
 
 **********************************************************************/
 
+#include <algorithm>
+#include <cstdio>
+#include <functional>
 #include <iostream>
+#include <vector>
 #include "ExportPCM.h"
 
 #include "sndfile.h"
 #include "Utils.h"
 #include "FileFormats.h"
 #include "Mix.h"
+#include "Envelope.h"
+#include "WaveClip.h"
+#include "Instrumentation.h"
 
 struct {
     int format;
@@ -32,6 +39,112 @@ static const kFormats[] =
 // { SF_FORMAT_WAV | SF_FORMAT_GSM610,    wxT("GSM610"), XO("GSM 6.10 WAV (mobile)")             },
         };
 
+namespace {
+
+// Whether the Mixer would only copy each track into its own channel:  one
+// output channel per track, at the same rate, with no gain and no
+// envelope, so that mixing and resampling leave the samples as they are.
+bool IsDirectCopy(const WaveTrackConstArray &tracks, unsigned numChannels,
+                  double rate, MixerSpec *mixerSpec) {
+    if (tracks.size() != numChannels)
+        return false;
+    // The Mixer ignores a spec that does not fit
+    if (mixerSpec && mixerSpec->GetNumChannels() == numChannels &&
+        mixerSpec->GetNumTracks() == tracks.size()) {
+        for (unsigned i = 0; i < numChannels; ++i)
+            for (unsigned j = 0; j < numChannels; ++j)
+                if (mixerSpec->mMap[i][j] != (i == j))
+                    return false;
+    } else if (numChannels != 1 || tracks[0]->GetChannel() != WaveTrack::MonoChannel)
+        return false;
+
+    for (unsigned i = 0; i < numChannels; ++i) {
+        const auto &track = tracks[i];
+        if (track->GetRate() != rate || track->GetChannelGain(i) != 1.0f)
+            return false;
+        for (const auto &clip : track->GetClips()) {
+            const Envelope *envelope = clip->GetEnvelope();
+            if (envelope->GetNumberOfPoints() != 0 || envelope->GetDefaultValue() != 1.0)
+                return false;
+        }
+    }
+    return true;
+}
+
+/// Reads the tracks straight into interleaved blocks, for what
+/// IsDirectCopy() accepts, giving what Mixer::Process() and GetBuffer()
+/// would:  the same block lengths, zeros after the end of a shorter track,
+/// and the same conversion to format.
+class DirectCopy {
+public:
+    DirectCopy(const WaveTrackConstArray &tracks, double startTime, double stopTime,
+               size_t bufferSize, sampleFormat format)
+            : mTracks{tracks}, mT1{stopTime}, mFormat{format},
+              mNumChannels{static_cast<unsigned>(tracks.size())},
+              mInterleaved{bufferSize * mNumChannels},
+              mChannel{mNumChannels > 1 ? bufferSize : 0} {
+        for (const auto &track : mTracks)
+            mSamplePos.push_back(track->TimeToLongSamples(startTime));
+        if (mFormat != floatSample)
+            mBuffer.Allocate(bufferSize * mNumChannels, mFormat);
+    }
+
+    size_t Process(size_t maxToProcess) {
+        std::vector<size_t> lengths(mNumChannels);
+        size_t maxOut = 0;
+        for (unsigned c = 0; c < mNumChannels; ++c) {
+            // The length Mixer::MixSameRate() takes
+            const WaveTrack *const track = mTracks[c].get();
+            const double t = mSamplePos[c].as_double() / track->GetRate();
+            const double tEnd = std::min(track->GetEndTime(), mT1);
+            if (t >= tEnd)
+                continue;
+            lengths[c] = limitSampleBufferSize(
+                    maxToProcess, sampleCount{(tEnd - t) * track->GetRate() + 0.5});
+            maxOut = std::max(maxOut, lengths[c]);
+        }
+
+        for (unsigned c = 0; c < mNumChannels; ++c) {
+            const auto len = lengths[c];
+            float *const samples = mNumChannels > 1 ? mChannel.get() : mInterleaved.get();
+            if (len > 0)
+                mTracks[c]->Get((samplePtr) samples, floatSample, mSamplePos[c], len);
+            std::fill(samples + len, samples + maxOut, 0.0f);
+            mSamplePos[c] += len;
+            // Adding to zero, as the Mixer's sum does, makes -0 into +0
+            if (mNumChannels > 1)
+                for (size_t ii = 0; ii < maxOut; ++ii)
+                    mInterleaved[ii * mNumChannels + c] = samples[ii] + 0.0f;
+            else
+                for (size_t ii = 0; ii < maxOut; ++ii)
+                    samples[ii] += 0.0f;
+        }
+
+        if (mFormat != floatSample)
+            for (unsigned c = 0; c < mNumChannels; ++c)
+                CopySamples((samplePtr) (mInterleaved.get() + c), floatSample,
+                            mBuffer.ptr() + c * SAMPLE_SIZE(mFormat), mFormat,
+                            maxOut, true, mNumChannels, mNumChannels);
+        return maxOut;
+    }
+
+    samplePtr GetBuffer() {
+        return mFormat == floatSample ? (samplePtr) mInterleaved.get() : mBuffer.ptr();
+    }
+
+private:
+    const WaveTrackConstArray &mTracks;
+    const double mT1;
+    const sampleFormat mFormat;
+    const unsigned mNumChannels;
+    std::vector<sampleCount> mSamplePos;
+    Floats mInterleaved;
+    Floats mChannel;
+    SampleBuffer mBuffer;
+};
+
+}
+
 ExportPCM::ExportPCM() {
 
     SF_INFO si;
@@ -71,6 +184,12 @@ ExportPCM::ExportPCM() {
     SetMaxChannels(255, format);
 }
 
+int ExportPCM::GetSFFormat(int subformat) {
+    if (subformat < 0 || static_cast<unsigned int>(subformat) >= (sizeof(kFormats) / sizeof(kFormats[0])))
+        return SF_FORMAT_WAV;
+    return kFormats[subformat].format;
+}
+
 /**
  *
  * @param subformat Control whether we are doing a "preset" export to a popular
@@ -81,30 +200,71 @@ ProgressResult ExportPCM::Export(
         const std::string &fName,
         MixerSpec *mixerSpec,
         int subformat) {
-    assert(waveTracks.size() == 1);
+    std::unique_ptr<FILE, int (*)(FILE *)> f{nullptr, fclose};
+    auto open = [&](SF_INFO *info) -> SNDFILE * {
+        f.reset(fopen(fName.c_str(), "wb"));
+        if (!f)
+            return nullptr;
+        int fd = fileno(f.get());
+        // Even though there is an sf_open() that takes a filename, use the one that
+        // takes a file descriptor since wxWidgets can open a file with a Unicode name and
+        // libsndfile can't (under Windows).
+        return SFCall<SNDFILE *>(sf_open_fd, fd, SFM_WRITE, info, false);
+    };
+    return DoExport(waveTracks, open, fName, mixerSpec, subformat);
+}
+
+ProgressResult ExportPCM::ExportToMemory(
+        WaveTrackConstArray &waveTracks,
+        std::vector<char> &data,
+        MixerSpec *mixerSpec,
+        int subformat) {
+    SFMemoryIO memory;
+    auto open = [&](SF_INFO *info) { return memory.Open(SFM_WRITE, info); };
+    const auto result = DoExport(waveTracks, open, "memory", mixerSpec, subformat);
+    if (result == ProgressResult::Success)
+        data = std::move(memory.Data());
+    return result;
+}
+
+ProgressResult ExportPCM::DoExport(
+        WaveTrackConstArray &waveTracks,
+        const std::function<SNDFILE *(SF_INFO *)> &open,
+        const std::string &fName,
+        MixerSpec *mixerSpec,
+        int subformat) {
+    NOISERED_TIMED(Export);
+    assert(!waveTracks.empty());
     double rate = waveTracks.at(0)->GetRate();
     double t0 = waveTracks.at(0)->GetStartTime();
     double t1 = waveTracks.at(0)->GetEndTime();
     unsigned numChannels = waveTracks.at(0)->GetChannel() == WaveTrack::MonoChannel ? 1 : 2;
 
-    int sf_format;
-    if (subformat < 0 || static_cast<unsigned int>(subformat) >= (sizeof(kFormats) / sizeof(kFormats[0]))) {
-        sf_format = SF_FORMAT_WAV;
-    } else {
-        sf_format = kFormats[subformat].format;
+    // Several tracks, as imported from one multi-channel file, are written
+    // as one interleaved channel each, in order.
+    std::unique_ptr<MixerSpec> channelSpec;
+    if (waveTracks.size() > 1) {
+        for (const auto &track : waveTracks) {
+            t0 = std::min(t0, track->GetStartTime());
+            t1 = std::max(t1, track->GetEndTime());
+        }
+        numChannels = waveTracks.size();
+        if (!mixerSpec) {
+            channelSpec = std::make_unique<MixerSpec>(numChannels, numChannels);
+            mixerSpec = channelSpec.get();
+        }
     }
 
+    int sf_format = GetSFFormat(subformat);
+
     auto updateResult = ProgressResult::Success;
     {
-        SFFile sf; // wraps f
+        SFFile sf;
 
         std::string formatStr;
         SF_INFO info;
         //int          err;
 
-        //This whole operation should not occur while a file is being loaded on OD,
-        //(we are worried about reading from a file being written to,) so we block.
-        //Furthermore, we need to do this because libsndfile is not threadsafe.
         formatStr = SFCall<std::string>(sf_header_name, sf_format & SF_FORMAT_TYPEMASK);
 
         // Use libsndfile to export file
@@ -125,20 +285,13 @@ ProgressResult ExportPCM::Export(
             return ProgressResult::Cancelled;
         }
 
-        if (FILE* f = fopen(fName.c_str(), "wb")) {
-            int fd = fileno(f);
-            // Even though there is an sf_open() that takes a filename, use the one that
-            // takes a file descriptor since wxWidgets can open a file with a Unicode name and
-            // libsndfile can't (under Windows).
-            sf.reset(SFCall<SNDFILE *>(sf_open_fd, fd, SFM_WRITE, &info, false));
-            //add clipping for integer formats.  We allow floats to clip.
-            sf_command(sf.get(), SFC_SET_CLIPPING, nullptr, sf_subtype_is_integer(sf_format) ? SF_TRUE : SF_FALSE);
-        }
-
+        sf.reset(open(&info));
         if (!sf) {
-            std::cerr << string_format("Cannot export audio to %s", fName) << std::endl;
+            std::cerr << string_format("Cannot export audio to %s", fName.c_str()) << std::endl;
             return ProgressResult::Cancelled;
         }
+        //add clipping for integer formats.  We allow floats to clip.
+        sf_command(sf.get(), SFC_SET_CLIPPING, nullptr, sf_subtype_is_integer(sf_format) ? SF_TRUE : SF_FALSE);
 
         sampleFormat format;
         if (sf_subtype_more_than_16_bits(info.format))
@@ -150,41 +303,48 @@ ProgressResult ExportPCM::Export(
 
         {
             assert(info.channels >= 0);
-            auto mixer = CreateMixer(waveTracks,
-                                     t0, t1,
-                                     info.channels, maxBlockLen, true,
-                                     rate, format, true, mixerSpec);
-
+            // Tracks that need no mixing are read straight into the output
+            std::unique_ptr<Mixer> mixer;
+            std::unique_ptr<DirectCopy> direct;
+            if (IsDirectCopy(waveTracks, info.channels, rate, mixerSpec))
+                direct = std::make_unique<DirectCopy>(waveTracks, t0, t1, maxBlockLen, format);
+            else
+                mixer = CreateMixer(waveTracks,
+                                    t0, t1,
+                                    info.channels, maxBlockLen, true,
+                                    rate, format, true, mixerSpec);
+
+
+            // Finished at the end of this block, before sf is closed
+            SoundFileWriter writer(sf.get(), format, info.channels, mWriteQueueDepth);
+            auto reportError = [&] {
+                std::cerr << string_format(
+                        /* i18n-hint: %s will be the error message from libsndfile, which
+                         * is usually something unhelpful (and untranslated) like "system
+                         * error" */
+                        "Error while writing %s file (disk full?).\nLibsndfile says \"%s\"",
+                        formatStr.c_str(),
+                        writer.GetError().c_str());
+                updateResult = ProgressResult::Cancelled;
+            };
 
             while (updateResult == ProgressResult::Success) {
-                sf_count_t samplesWritten;
-                size_t numSamples = mixer->Process(maxBlockLen);
+                size_t numSamples = direct ? direct->Process(maxBlockLen) : mixer->Process(maxBlockLen);
 
                 if (numSamples == 0)
                     break;
+                NOISERED_COUNT(SamplesExported, numSamples * info.channels);
+
+                samplePtr mixed = direct ? direct->GetBuffer() : mixer->GetBuffer();
 
-                samplePtr mixed = mixer->GetBuffer();
-
-                if (format == int16Sample)
-                    samplesWritten = SFCall<sf_count_t>(sf_writef_short, sf.get(), (short *) mixed, numSamples);
-                else
-                    samplesWritten = SFCall<sf_count_t>(sf_writef_float, sf.get(), (float *) mixed, numSamples);
-
-                if (static_cast<size_t>(samplesWritten) != numSamples) {
-                    char buffer2[1000];
-                    sf_error_str(sf.get(), buffer2, 1000);
-                    std::cerr << string_format(
-                            /* i18n-hint: %s will be the error message from libsndfile, which
-                             * is usually something unhelpful (and untranslated) like "system
-                             * error" */
-                            "Error while writing %s file (disk full?).\nLibsndfile says \"%s\"",
-                            formatStr,
-                            buffer2);
-                    updateResult = ProgressResult::Cancelled;
+                if (!writer.Write(mixed, numSamples)) {
+                    reportError();
                     break;
                 }
 
             }
+            if (updateResult == ProgressResult::Success && !writer.Finish())
+                reportError();
         }
 
         // Install the WAV metata in a "LIST" chunk at the end of the file
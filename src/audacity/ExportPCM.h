@@ -11,9 +11,13 @@
 #ifndef __AUDACITY_EXPORTPCM__
 #define __AUDACITY_EXPORTPCM__
 
+#include <functional>
+#include <vector>
+
 #include "ImportPlugin.h"
 #include "Export.h"
 #include "Mix.h"
+#include "SoundFileWriter.h"
 
 class ExportPCM final : ExportPlugin {
 public:
@@ -28,6 +32,31 @@ public:
             MixerSpec *mixerSpec = nullptr,
             int subformat = 0) override;
 
+    /// As Export(), into data rather than a file, on success
+    ProgressResult ExportToMemory(
+            WaveTrackConstArray &tracks,
+            std::vector<char> &data,
+            MixerSpec *mixerSpec = nullptr,
+            int subformat = 0);
+
+    /// The libsndfile format that Export writes for subformat
+    static int GetSFFormat(int subformat);
+
+    /// Blocks that may wait for the writer thread while the next ones are
+    /// mixed; 0 writes each block before mixing the next
+    void SetWriteQueueDepth(size_t depth) { mWriteQueueDepth = depth; }
+
+private:
+    // Export to what open makes of the SF_INFO, named fName in messages
+    ProgressResult DoExport(
+            WaveTrackConstArray &tracks,
+            const std::function<SNDFILE *(SF_INFO *)> &open,
+            const std::string &fName,
+            MixerSpec *mixerSpec,
+            int subformat);
+
+    size_t mWriteQueueDepth{SoundFileWriter::DefaultQueueDepth};
+
 };
 
 
@@ -0,0 +1,354 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  FFTBackend.cpp
+
+*******************************************************************//**
+
+\class FFTBackend
+\brief A real FFT of one size, with implementations chosen at build time.
+
+The built-in RealFFTf leaves its output bit-reversed, and callers such
+as the noise reduction Worker gather through the order tables instead of
+reordering.  Vendor libraries give natural order, and their order tables
+are the identity, so the same caller code serves all.
+
+*//*******************************************************************/
+
+
+#include "FFTBackend.h"
+
+#include <cstring>
+#include <iostream>
+#include "RealFFTf.h"
+
+#if defined(NOISERED_FFT_FFTW3)
+#include <cstdlib>
+#include <mutex>
+#include <fftw3.h>
+#elif defined(NOISERED_FFT_POCKETFFT)
+#define POCKETFFT_NO_MULTITHREADING
+#include <pocketfft_hdronly.hpp>
+#elif defined(NOISERED_FFT_MKL)
+#include <mkl_dfti.h>
+#endif
+
+FFTBackend::FFTBackend(size_t size)
+        : mSize(size) {
+}
+
+FFTBackend::~FFTBackend() {
+}
+
+void FFTBackend::UseNaturalOrder() {
+    mNaturalOrder.reinit(mSize / 2);
+    for (size_t kk = 0; kk < mSize / 2; ++kk)
+        mNaturalOrder[kk] = 2 * kk;
+    mSpectrumOrder = mTimeOrder = mNaturalOrder.get();
+}
+
+void FFTBackend::ForwardSpectrum(const float *input, const float *window,
+                                 float *buffer, float *packed, float *power) {
+    const size_t half = mSize / 2;
+    if (window)
+        for (size_t ii = 0; ii < mSize; ++ii)
+            buffer[ii] = input[ii] * window[ii];
+    else
+        memmove(buffer, input, mSize * sizeof(float));
+    Forward(buffer);
+
+    for (size_t kk = 1; kk < half; ++kk) {
+        const int pos = mSpectrumOrder[kk];
+        const float realPart = packed[2 * kk] = buffer[pos];
+        const float imagPart = packed[2 * kk + 1] = buffer[pos + 1];
+        power[kk] = realPart * realPart + imagPart * imagPart;
+    }
+    const float dc = packed[0] = buffer[0];
+    power[0] = dc * dc;
+    const float nyquist = packed[1] = buffer[1];
+    power[half] = nyquist * nyquist;
+}
+
+void FFTBackend::ForwardFrames(float *buffer, size_t nFrames) {
+    if (!mFrameScratch)
+        mFrameScratch.reinit(mSize);
+    float *const frame = mFrameScratch.get();
+    for (size_t ff = 0; ff < nFrames; ++ff) {
+        for (size_t ii = 0; ii < mSize; ++ii)
+            frame[ii] = buffer[ii * nFrames + ff];
+        Forward(frame);
+        for (size_t ii = 0; ii < mSize; ++ii)
+            buffer[ii * nFrames + ff] = frame[ii];
+    }
+}
+
+namespace {
+
+class BuiltinFFT final : public FFTBackend {
+public:
+    explicit BuiltinFFT(size_t size)
+            : FFTBackend(size), mFFT(GetFFT(size)) {
+        mSpectrumOrder = mTimeOrder = mFFT->BitReversed.get();
+    }
+
+    const char *Name() const override { return "builtin"; }
+
+    void Forward(float *buffer) override {
+        RealFFTf(buffer, mFFT.get());
+    }
+
+    void ForwardSpectrum(const float *input, const float *window,
+                         float *buffer, float *packed, float *power) override {
+        RealFFTfSpectrum(input, window, buffer, packed, power, mFFT.get());
+    }
+
+    void ForwardFrames(float *buffer, size_t nFrames) override {
+        RealFFTfFrames(buffer, nFrames, mFFT.get());
+    }
+
+    void Inverse(float *buffer) override {
+        InverseRealFFTf(buffer, mFFT.get());
+    }
+
+private:
+    const HFFT mFFT;
+};
+
+#if defined(NOISERED_FFT_FFTW3)
+
+// The FFTW planner is not thread safe
+std::mutex &PlannerMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Wisdom, if any, is read from and saved to this file
+const char *WisdomPath() {
+    return getenv("NOISERED_FFTW_WISDOM");
+}
+
+class FFTW3FFT final : public FFTBackend {
+public:
+    static std::unique_ptr<FFTBackend> Create(size_t size) {
+        std::unique_ptr<FFTW3FFT> fft{new FFTW3FFT(size)};
+        if (!fft->mForward || !fft->mInverse)
+            return {};
+        return fft;
+    }
+
+    ~FFTW3FFT() override {
+        std::lock_guard<std::mutex> lock{PlannerMutex()};
+        if (mForward)
+            fftwf_destroy_plan(mForward);
+        if (mInverse)
+            fftwf_destroy_plan(mInverse);
+        fftwf_free(mWave);
+        fftwf_free(mSpectrum);
+    }
+
+    const char *Name() const override { return "fftw3"; }
+
+    void Forward(float *buffer) override {
+        const size_t half = Size() / 2;
+        memcpy(mWave, buffer, Size() * sizeof(float));
+        fftwf_execute(mForward);
+        buffer[0] = mSpectrum[0][0];
+        buffer[1] = mSpectrum[half][0];
+        for (size_t kk = 1; kk < half; ++kk) {
+            buffer[2 * kk] = mSpectrum[kk][0];
+            buffer[2 * kk + 1] = mSpectrum[kk][1];
+        }
+    }
+
+    void Inverse(float *buffer) override {
+        const size_t half = Size() / 2;
+        mSpectrum[0][0] = buffer[0];
+        mSpectrum[0][1] = 0;
+        mSpectrum[half][0] = buffer[1];
+        mSpectrum[half][1] = 0;
+        for (size_t kk = 1; kk < half; ++kk) {
+            mSpectrum[kk][0] = buffer[2 * kk];
+            mSpectrum[kk][1] = buffer[2 * kk + 1];
+        }
+        fftwf_execute(mInverse);
+        const float scale = 1.0f / Size();
+        for (size_t ii = 0; ii < Size(); ++ii)
+            buffer[ii] = mWave[ii] * scale;
+    }
+
+private:
+    explicit FFTW3FFT(size_t size)
+            : FFTBackend(size) {
+        UseNaturalOrder();
+        std::lock_guard<std::mutex> lock{PlannerMutex()};
+        static bool imported = false;
+        const char *const wisdom = WisdomPath();
+        if (!imported && wisdom)
+            fftwf_import_wisdom_from_filename(wisdom);
+        imported = true;
+
+        mWave = fftwf_alloc_real(size);
+        mSpectrum = fftwf_alloc_complex(size / 2 + 1);
+        if (!mWave || !mSpectrum)
+            return;
+        // Measuring overwrites the arrays, which hold nothing yet
+        mForward = fftwf_plan_dft_r2c_1d(size, mWave, mSpectrum, FFTW_MEASURE);
+        mInverse = fftwf_plan_dft_c2r_1d(size, mSpectrum, mWave, FFTW_MEASURE);
+        if (wisdom)
+            fftwf_export_wisdom_to_filename(wisdom);
+    }
+
+    float *mWave{};
+    fftwf_complex *mSpectrum{};
+    fftwf_plan mForward{};
+    fftwf_plan mInverse{};
+};
+
+#elif defined(NOISERED_FFT_POCKETFFT)
+
+class PocketFFT final : public FFTBackend {
+public:
+    static std::unique_ptr<FFTBackend> Create(size_t size) {
+        return std::unique_ptr<FFTBackend>{new PocketFFT(size)};
+    }
+
+    const char *Name() const override { return "pocketfft"; }
+
+    // pocketfft packs as FFTPACK does, the Fs/2 value last:
+    // r0, r1, i1, ..., r(n/2)
+
+    void Forward(float *buffer) override {
+        const size_t size = Size();
+        mPlan.exec(buffer, 1.0f, true);
+        const float nyquist = buffer[size - 1];
+        memmove(buffer + 2, buffer + 1, (size - 2) * sizeof(float));
+        buffer[1] = nyquist;
+    }
+
+    void Inverse(float *buffer) override {
+        const size_t size = Size();
+        const float nyquist = buffer[1];
+        memmove(buffer + 1, buffer + 2, (size - 2) * sizeof(float));
+        buffer[size - 1] = nyquist;
+        mPlan.exec(buffer, 1.0f / size, false);
+    }
+
+private:
+    explicit PocketFFT(size_t size)
+            : FFTBackend(size), mPlan(size) {
+        UseNaturalOrder();
+    }
+
+    pocketfft::detail::pocketfft_r<float> mPlan;
+};
+
+#elif defined(NOISERED_FFT_MKL)
+
+class MKLFFT final : public FFTBackend {
+public:
+    static std::unique_ptr<FFTBackend> Create(size_t size) {
+        std::unique_ptr<MKLFFT> fft{new MKLFFT(size)};
+        if (!fft->mHandle)
+            return {};
+        return fft;
+    }
+
+    ~MKLFFT() override {
+        if (mHandle)
+            DftiFreeDescriptor(&mHandle);
+    }
+
+    const char *Name() const override { return "mkl"; }
+
+    void Forward(float *buffer) override {
+        const size_t half = Size() / 2;
+        DftiComputeForward(mHandle, buffer, mSpectrum.get());
+        const float *const spectrum = mSpectrum.get();
+        buffer[0] = spectrum[0];
+        buffer[1] = spectrum[2 * half];
+        memcpy(buffer + 2, spectrum + 2, (Size() - 2) * sizeof(float));
+    }
+
+    void Inverse(float *buffer) override {
+        const size_t half = Size() / 2;
+        float *const spectrum = mSpectrum.get();
+        spectrum[0] = buffer[0];
+        spectrum[1] = 0;
+        spectrum[2 * half] = buffer[1];
+        spectrum[2 * half + 1] = 0;
+        memcpy(spectrum + 2, buffer + 2, (Size() - 2) * sizeof(float));
+        DftiComputeBackward(mHandle, spectrum, buffer);
+        const float scale = 1.0f / Size();
+        for (size_t ii = 0; ii < Size(); ++ii)
+            buffer[ii] *= scale;
+    }
+
+private:
+    explicit MKLFFT(size_t size)
+            : FFTBackend(size) {
+        UseNaturalOrder();
+        mSpectrum.reinit(2 * (size / 2 + 1));
+
+        DFTI_DESCRIPTOR_HANDLE handle{};
+        MKL_LONG status = DftiCreateDescriptor(&handle, DFTI_SINGLE, DFTI_REAL, 1, (MKL_LONG) size);
+        if (status == DFTI_NO_ERROR)
+            status = DftiSetValue(handle, DFTI_PLACEMENT, DFTI_NOT_INPLACE);
+        if (status == DFTI_NO_ERROR)
+            status = DftiSetValue(handle, DFTI_CONJUGATE_EVEN_STORAGE, DFTI_COMPLEX_COMPLEX);
+        if (status == DFTI_NO_ERROR)
+            status = DftiCommitDescriptor(handle);
+        if (status == DFTI_NO_ERROR)
+            mHandle = handle;
+        else {
+            std::cerr << DftiErrorMessage(status) << std::endl;
+            if (handle)
+                DftiFreeDescriptor(&handle);
+        }
+    }
+
+    DFTI_DESCRIPTOR_HANDLE mHandle{};
+    ArrayOf<float> mSpectrum;
+};
+
+#endif
+
+// Null when the build chose the built-in FFT, or the other failed
+std::unique_ptr<FFTBackend> CreateConfiguredFFTBackend(size_t size) {
+#if defined(NOISERED_FFT_FFTW3)
+    return FFTW3FFT::Create(size);
+#elif defined(NOISERED_FFT_POCKETFFT)
+    return PocketFFT::Create(size);
+#elif defined(NOISERED_FFT_MKL)
+    return MKLFFT::Create(size);
+#else
+    return {};
+#endif
+}
+
+}
+
+std::unique_ptr<FFTBackend> CreateFFTBackend(size_t size) {
+    if (auto fft = CreateConfiguredFFTBackend(size))
+        return fft;
+    if (strcmp(FFTBackendName(), "builtin") != 0)
+        std::cerr << "The " << FFTBackendName() << " FFT of " << size
+                  << " points is unavailable, using the built-in FFT." << std::endl;
+    return CreateBuiltinFFTBackend(size);
+}
+
+std::unique_ptr<FFTBackend> CreateBuiltinFFTBackend(size_t size) {
+    return std::make_unique<BuiltinFFT>(size);
+}
+
+const char *FFTBackendName() {
+#if defined(NOISERED_FFT_FFTW3)
+    return "fftw3";
+#elif defined(NOISERED_FFT_POCKETFFT)
+    return "pocketfft";
+#elif defined(NOISERED_FFT_MKL)
+    return "mkl";
+#else
+    return "builtin";
+#endif
+}
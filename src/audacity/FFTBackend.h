@@ -0,0 +1,87 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  FFTBackend.h
+
+  The real FFT used by noise reduction, behind one interface.  The
+  implementation is chosen at build time (NOISERED_FFT_BACKEND in CMake):
+  the built-in RealFFTf, FFTW3, pocketfft or Intel MKL.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_FFT_BACKEND__
+#define __AUDACITY_FFT_BACKEND__
+
+#include <cstddef>
+#include <memory>
+#include "MemoryX.h"
+
+/// A real FFT of one size.  Spectra are packed as by RealFFTf: the real
+/// DC value at [0], the real Fs/2 value at [1], and (real, imaginary) of
+/// each other bin kk at [SpectrumOrder()[kk]] and the place after.  The
+/// forward transform is unnormalized, the inverse scaled by 1/Size(), so
+/// that one undoes the other.
+///
+/// Transforms may keep scratch space in the object; use one per thread.
+class FFTBackend {
+public:
+    virtual ~FFTBackend();
+
+    virtual const char *Name() const = 0;
+
+    size_t Size() const { return mSize; }
+
+    /// Where the pairs of the forward output are, 2 kk for a backend
+    /// that leaves them in natural order
+    const int *SpectrumOrder() const { return mSpectrumOrder; }
+
+    /// Where the inverse output has samples 2 kk and 2 kk + 1
+    const int *TimeOrder() const { return mTimeOrder; }
+
+    /// In place, from samples in time order
+    virtual void Forward(float *buffer) = 0;
+
+    /// Forward transform of input, multiplied by window if that is not
+    /// null, into packed in natural order, as Inverse() takes it, and the
+    /// squared magnitude of each bin kk <= Size() / 2 into power[kk].
+    /// buffer is scratch of Size().  By default windows, transforms, then
+    /// reorders.
+    virtual void ForwardSpectrum(const float *input, const float *window,
+                                 float *buffer, float *packed, float *power);
+
+    /// nFrames frames interleaved as for RealFFTfFrames, sample ii of frame
+    /// ff at buffer[ii * nFrames + ff], before and after.  By default one
+    /// frame at a time.
+    virtual void ForwardFrames(float *buffer, size_t nFrames);
+
+    /// In place, from a spectrum packed in natural order: pair kk at 2 kk,
+    /// whatever SpectrumOrder() is
+    virtual void Inverse(float *buffer) = 0;
+
+protected:
+    explicit FFTBackend(size_t size);
+
+    // Subclasses leaving natural order keep these tables
+    void UseNaturalOrder();
+
+    const int *mSpectrumOrder{};
+    const int *mTimeOrder{};
+
+private:
+    const size_t mSize;
+    ArrayOf<int> mNaturalOrder;
+    ArrayOf<float> mFrameScratch;
+};
+
+/// The backend chosen at build time, falling back to the built-in one
+/// (with a message) if it cannot make a plan of this size
+std::unique_ptr<FFTBackend> CreateFFTBackend(size_t size);
+
+/// Always RealFFTf, whatever the build chose
+std::unique_ptr<FFTBackend> CreateBuiltinFFTBackend(size_t size);
+
+/// Name of the backend chosen at build time
+const char *FFTBackendName();
+
+#endif
@@ -14,6 +14,8 @@ information.
 
 *//*******************************************************************/
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <cstring>
 #include <string>
@@ -86,8 +88,6 @@ std::vector<std::string> sf_get_all_extensions() {
     return exts;
 }
 
-ODLock libSndFileMutex;
-
 int SFFileCloser::operator()(SNDFILE *sf) const {
     auto err = SFCall<int>(sf_close, sf);
     if (err) {
@@ -98,3 +98,79 @@ int SFFileCloser::operator()(SNDFILE *sf) const {
     }
     return err;
 }
+
+SFMemoryIO::SFMemoryIO(const void *data, size_t size)
+        : mReadData{static_cast<const char *>(data)}, mSize{size} {
+}
+
+SFMemoryIO::SFMemoryIO()
+        : mReadData{nullptr}, mSize{0} {
+}
+
+SNDFILE *SFMemoryIO::Open(int mode, SF_INFO *info) {
+    // Writing needs somewhere to write
+    if (mode != SFM_READ && mReadData)
+        return nullptr;
+    SF_VIRTUAL_IO io{GetFileLen, Seek, Read, Write, Tell};
+    return SFCall<SNDFILE *>(sf_open_virtual, &io, mode, info, this);
+}
+
+sf_count_t SFMemoryIO::GetFileLen(void *user) {
+    return static_cast<SFMemoryIO *>(user)->mSize;
+}
+
+sf_count_t SFMemoryIO::Seek(sf_count_t offset, int whence, void *user) {
+    auto &self = *static_cast<SFMemoryIO *>(user);
+    sf_count_t position;
+    switch (whence) {
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = self.mPosition + offset;
+            break;
+        case SEEK_END:
+            position = self.mSize + offset;
+            break;
+        default:
+            return -1;
+    }
+    if (position < 0)
+        return -1;
+    // Past the end only when writing, as a file could
+    if (self.mReadData && position > static_cast<sf_count_t>(self.mSize))
+        position = self.mSize;
+    self.mPosition = position;
+    return position;
+}
+
+sf_count_t SFMemoryIO::Read(void *ptr, sf_count_t count, void *user) {
+    auto &self = *static_cast<SFMemoryIO *>(user);
+    if (count <= 0 || self.mPosition >= static_cast<sf_count_t>(self.mSize))
+        return 0;
+    count = std::min<sf_count_t>(count, self.mSize - self.mPosition);
+    memcpy(ptr, self.Bytes() + self.mPosition, count);
+    self.mPosition += count;
+    return count;
+}
+
+sf_count_t SFMemoryIO::Write(const void *ptr, sf_count_t count, void *user) {
+    auto &self = *static_cast<SFMemoryIO *>(user);
+    if (self.mReadData || count <= 0)
+        return 0;
+    const size_t end = self.mPosition + count;
+    if (end > self.mWritten.size()) {
+        // Grow geometrically, as libsndfile writes many small pieces
+        if (end > self.mWritten.capacity())
+            self.mWritten.reserve(std::max(end, 2 * self.mWritten.capacity()));
+        self.mWritten.resize(end);
+    }
+    memcpy(&self.mWritten[self.mPosition], ptr, count);
+    self.mPosition = end;
+    self.mSize = self.mWritten.size();
+    return count;
+}
+
+sf_count_t SFMemoryIO::Tell(void *user) {
+    return static_cast<SFMemoryIO *>(user)->mPosition;
+}
@@ -13,9 +13,9 @@
 
 #include <vector>
 #include <memory>
+#include <utility>
 #include "sndfile.h"
 #include "MemoryX.h"
-#include "ODTaskThread.h"
 
 //
 // other utility functions
@@ -43,14 +43,13 @@ std::string sf_header_extension(int format);
  * part is used) */
 std::string sf_header_name(int format);
 
-// This function wrapper uses a mutex to serialize calls to the SndFile library.
-
-extern ODLock libSndFileMutex;
-
+// A call into the SndFile library.  Calls are not serialized:  libsndfile
+// keeps no state between them but that of each SNDFILE, and every file here
+// is opened, read or written and closed by one import or export, on one
+// thread at a time.  Only the error of a failed open (sf_error(nullptr)) is
+// shared, so it is never asked for.
 template<typename R, typename F, typename... Args>
 inline R SFCall(F fun, Args &&... args) {
-    // ODLocker locker{&libSndFileMutex};
-    ODLocker locker;
     return fun(std::forward<Args>(args)...);
 }
 
@@ -74,4 +73,40 @@ struct SFFile : public std::unique_ptr<SNDFILE, ::SFFileCloser> {
     }
 };
 
+/// A sound file held in memory, opened through libsndfile's SF_VIRTUAL_IO,
+/// so that encoding and decoding need no file system.  Must outlive the
+/// SNDFILE opened on it.
+class SFMemoryIO {
+public:
+    /// For reading size bytes at data, which must outlive this
+    SFMemoryIO(const void *data, size_t size);
+
+    /// For writing into Data(), which grows as libsndfile writes
+    SFMemoryIO();
+
+    SFMemoryIO(const SFMemoryIO &) = delete;
+
+    SFMemoryIO &operator=(const SFMemoryIO &) = delete;
+
+    /// As sf_open() does, with SFM_READ or, for writing, SFM_WRITE
+    SNDFILE *Open(int mode, SF_INFO *info);
+
+    /// What was written
+    std::vector<char> &Data() { return mWritten; }
+
+private:
+    static sf_count_t GetFileLen(void *user);
+    static sf_count_t Seek(sf_count_t offset, int whence, void *user);
+    static sf_count_t Read(void *ptr, sf_count_t count, void *user);
+    static sf_count_t Write(const void *ptr, sf_count_t count, void *user);
+    static sf_count_t Tell(void *user);
+
+    const char *Bytes() const { return mReadData ? mReadData : mWritten.data(); }
+
+    const char *const mReadData;
+    size_t mSize;
+    std::vector<char> mWritten;
+    sf_count_t mPosition{0};
+};
+
 #endif
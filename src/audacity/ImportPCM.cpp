@@ -19,13 +19,171 @@
 
 *//*******************************************************************/
 
+#include <cstdint>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 #include "ImportPCM.h"
 
 #include "sndfile.h"
 #include "FileFormats.h"
 #include "ImportPlugin.h"
+#include "SampleKernels.h"
+#include "Instrumentation.h"
+
+/// The data chunk of a little endian PCM or float WAV file, mapped into
+/// memory.  Samples are converted straight from the mapping to the values
+/// sf_readf_float gives, so that a cold import of a long file is bound by
+/// the disk alone, without copies through libsndfile's buffers.
+class PCMImportFileHandle::MappedData {
+public:
+    // Null if the file is not such a WAV file, or cannot be mapped
+    static std::unique_ptr<MappedData> Map(const std::string &filename, const SF_INFO &info);
+
+    ~MappedData() {
+        munmap(mAddress, mLength);
+    }
+
+    // Frames [start, start + len) of every channel c into dst[c]
+    void Get(float *const *dst, sampleCount start, size_t len) const;
+
+private:
+    MappedData(void *address, size_t length, int subtype)
+            : mAddress(address), mLength(length), mSubtype(subtype) {}
 
+    static uint32_t Get16(const unsigned char *p) { return p[0] | p[1] << 8; }
+
+    static uint32_t Get32(const unsigned char *p) {
+        return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+    }
+
+    void *const mAddress;
+    const size_t mLength;
+    const int mSubtype;
+    const unsigned char *mData{};
+    size_t mSampleBytes{};
+    size_t mFrameBytes{};
+    size_t mChannels{};
+    // Whether the samples are aligned for reading as short or float
+    bool mAligned{};
+};
+
+auto PCMImportFileHandle::MappedData::Map(const std::string &filename, const SF_INFO &info)
+-> std::unique_ptr<MappedData> {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const int type = info.format & SF_FORMAT_TYPEMASK;
+    const int subtype = info.format & SF_FORMAT_SUBMASK;
+    if ((type != SF_FORMAT_WAV && type != SF_FORMAT_WAVEX) ||
+        (info.format & SF_FORMAT_ENDMASK) != SF_ENDIAN_FILE || info.channels < 1)
+        return {};
+    size_t sampleBytes;
+    switch (subtype) {
+        case SF_FORMAT_PCM_16:
+            sampleBytes = 2;
+            break;
+        case SF_FORMAT_PCM_24:
+            sampleBytes = 3;
+            break;
+        case SF_FORMAT_PCM_32:
+        case SF_FORMAT_FLOAT:
+            sampleBytes = 4;
+            break;
+        default:
+            // Compressed, or 8 bit, or double: libsndfile reads these
+            return {};
+    }
+    const size_t frameBytes = sampleBytes * info.channels;
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return {};
+    struct stat st;
+    void *address = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= 12)
+        address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping outlives the descriptor
+    close(fd);
+    if (address == MAP_FAILED)
+        return {};
+    std::unique_ptr<MappedData> mapped{new MappedData(address, st.st_size, subtype)};
+    const auto file = static_cast<const unsigned char *>(address);
+    const size_t size = st.st_size;
+
+    // Find the data chunk, checking that the format chunk agrees with what
+    // libsndfile made of the header
+    if (memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0)
+        return {};
+    bool formatMatches = false;
+    for (size_t pos = 12; pos + 8 <= size;) {
+        const auto chunk = file + pos;
+        const size_t len = Get32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (len < 16 || pos + 8 + len > size)
+                return {};
+            const auto tag = Get16(chunk + 8);
+            formatMatches = (tag == 1 || tag == 3 || tag == 0xFFFE) &&
+                            Get16(chunk + 10) == (uint32_t) info.channels &&
+                            Get16(chunk + 20) == frameBytes &&
+                            Get16(chunk + 22) == 8 * sampleBytes;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            // The length may be unset in a file that was never finished
+            const size_t available = std::min(len, size - (pos + 8));
+            if (!formatMatches || available / frameBytes < (size_t) info.frames)
+                return {};
+            mapped->mData = chunk + 8;
+            mapped->mSampleBytes = sampleBytes;
+            mapped->mFrameBytes = frameBytes;
+            mapped->mChannels = info.channels;
+            mapped->mAligned = reinterpret_cast<uintptr_t>(mapped->mData) % sampleBytes == 0;
+            madvise(address, size, MADV_SEQUENTIAL);
+            return mapped;
+        }
+        pos += 8 + len + (len & 1);
+    }
+#endif
+    return {};
+}
+
+void PCMImportFileHandle::MappedData::Get(float *const *dst, sampleCount start, size_t len) const {
+    const unsigned char *const frames = mData + start.as_size_t() * mFrameBytes;
+    if (mAligned && mSubtype == SF_FORMAT_PCM_16) {
+        Deinterleave(reinterpret_cast<const short *>(frames), mChannels, dst, len);
+        return;
+    }
+    if (mAligned && mSubtype == SF_FORMAT_FLOAT) {
+        Deinterleave(reinterpret_cast<const float *>(frames), mChannels, dst, len);
+        return;
+    }
+
+    // Scaled as libsndfile normalizes, by a power of 2 after conversion to
+    // float, so that the values are the same
+    for (size_t c = 0; c < mChannels; ++c) {
+        const unsigned char *p = frames + c * mSampleBytes;
+        float *const buffer = dst[c];
+        switch (mSubtype) {
+            case SF_FORMAT_PCM_16:
+                for (size_t ii = 0; ii < len; ++ii, p += mFrameBytes)
+                    buffer[ii] = (float) (int16_t) Get16(p) * (1.0f / 0x8000);
+                break;
+            case SF_FORMAT_PCM_24:
+                for (size_t ii = 0; ii < len; ++ii, p += mFrameBytes)
+                    buffer[ii] = (float) (int32_t) (p[0] << 8 | p[1] << 16 | (uint32_t) p[2] << 24)
+                                 * (1.0f / 0x80000000);
+                break;
+            case SF_FORMAT_PCM_32:
+                for (size_t ii = 0; ii < len; ++ii, p += mFrameBytes)
+                    buffer[ii] = (float) (int32_t) Get32(p) * (1.0f / 0x80000000);
+                break;
+            case SF_FORMAT_FLOAT:
+                for (size_t ii = 0; ii < len; ++ii, p += mFrameBytes)
+                    memcpy(&buffer[ii], p, sizeof(float));
+                break;
+        }
+    }
+}
 
 // static
 std::unique_ptr<ImportFileHandle> PCMImportFileHandle::Open(const std::string &filename) {
@@ -69,10 +227,27 @@ std::unique_ptr<ImportFileHandle> PCMImportFileHandle::Open(const std::string &f
     return std::make_unique<PCMImportFileHandle>(filename, std::move(file), info);
 }
 
+// static
+std::unique_ptr<ImportFileHandle> PCMImportFileHandle::OpenMemory(const void *data, size_t size) {
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+
+    auto memory = std::make_unique<SFMemoryIO>(data, size);
+    SFFile file;
+    file.reset(memory->Open(SFM_READ, &info));
+    // OGG refused as by Open()
+    if (!file || (info.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_OGG)
+        return nullptr;
+
+    return std::make_unique<PCMImportFileHandle>(std::string{}, std::move(file), info, std::move(memory));
+}
+
 
 PCMImportFileHandle::PCMImportFileHandle(std::string name,
-                                         SFFile &&file, SF_INFO info)
+                                         SFFile &&file, SF_INFO info,
+                                         std::unique_ptr<SFMemoryIO> memory)
         : ImportFileHandle(name),
+          mMemory(std::move(memory)),
           mFile(std::move(file)),
           mInfo(info) {
     assert(info.channels >= 0);
@@ -90,6 +265,21 @@ PCMImportFileHandle::PCMImportFileHandle(std::string name,
     if (mFormat != floatSample &&
         sf_subtype_more_than_16_bits(mInfo.format))
         mFormat = floatSample;
+
+    if (mFormat == floatSample && !mMemory)
+        mMapped = MappedData::Map(mFilename, mInfo);
+}
+
+void PCMImportFileHandle::SetSampleFormat(sampleFormat format) {
+    // As in the constructor, wider samples stay float
+    if (format == mFormat || (format != floatSample && sf_subtype_more_than_16_bits(mInfo.format)))
+        return;
+    mFormat = format;
+    // The mapping reads float
+    if (mFormat == floatSample && !mMemory)
+        mMapped = MappedData::Map(mFilename, mInfo);
+    else
+        mMapped.reset();
 }
 
 std::string PCMImportFileHandle::GetFileDescription() {
@@ -102,6 +292,7 @@ auto PCMImportFileHandle::GetFileUncompressedBytes() -> ByteCount {
 
 ProgressResult PCMImportFileHandle::Import(TrackFactory *trackFactory,
                                            TrackHolders &outTracks) {
+    NOISERED_TIMED(Import);
     outTracks.clear();
 
     assert(mFile.get());
@@ -147,55 +338,84 @@ ProgressResult PCMImportFileHandle::Import(TrackFactory *trackFactory,
     if (maxBlock < 1)
         return ProgressResult::Failed;
 
+    // 16 bit samples for float tracks are read as they are, and converted
+    // as they are deinterleaved, rather than by libsndfile
+    const bool readShorts = mFormat == int16Sample ||
+                            (mInfo.format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_16;
+    const sampleFormat readFormat = readShorts ? int16Sample : floatSample;
+
+    // buffer holds a block of each channel in turn
     SampleBuffer srcbuffer, buffer;
     assert(mInfo.channels >= 0);
-    while (nullptr == srcbuffer.Allocate(maxBlock * mInfo.channels, mFormat).ptr() ||
-           nullptr == buffer.Allocate(maxBlock, mFormat).ptr()) {
+    // Reading in place from the mapping needs no interleaved buffer
+    while ((!mMapped && nullptr == srcbuffer.Allocate(maxBlock * mInfo.channels, readFormat).ptr()) ||
+           nullptr == buffer.Allocate(maxBlock * mInfo.channels, mFormat).ptr()) {
         maxBlock /= 2;
         if (maxBlock < 1)
             return ProgressResult::Failed;
     }
+    std::vector<float *> channelBuffers(mInfo.channels);
+    for (int c = 0; c < mInfo.channels; ++c)
+        channelBuffers[c] = (float *) buffer.ptr() + c * maxBlock;
 
     decltype(fileTotalFrames) framescompleted = 0;
 
-    long block;
-    do {
-        block = maxBlock;
+    if (mMapped) {
+        while (framescompleted < fileTotalFrames) {
+            const auto block = limitSampleBufferSize(maxBlock, fileTotalFrames - framescompleted);
+            mMapped->Get(channelBuffers.data(), framescompleted, block);
+            auto iter = channels.begin();
+            for (int c = 0; c < mInfo.channels; ++iter, ++c)
+                iter->get()->Append((samplePtr) channelBuffers[c], floatSample, block);
+            framescompleted += block;
+        }
+    } else {
+        long block;
+        do {
+            block = maxBlock;
 
-        if (mFormat == int16Sample)
-            block = SFCall<sf_count_t>(sf_readf_short, mFile.get(), (short *) srcbuffer.ptr(), block);
-            //import 24 bit int as float and have the append function convert it.  This is how PCMAliasBlockFile works too.
-        else
-            block = SFCall<sf_count_t>(sf_readf_float, mFile.get(), (float *) srcbuffer.ptr(), block);
+            if (readShorts)
+                block = SFCall<sf_count_t>(sf_readf_short, mFile.get(), (short *) srcbuffer.ptr(), block);
+                //import 24 bit int as float and have the append function convert it.  This is how PCMAliasBlockFile works too.
+            else
+                block = SFCall<sf_count_t>(sf_readf_float, mFile.get(), (float *) srcbuffer.ptr(), block);
 
-        if (block < 0 || block > (long) maxBlock) {
-            assert(false);
-            block = maxBlock;
-        }
+            if (block < 0 || block > (long) maxBlock) {
+                assert(false);
+                block = maxBlock;
+            }
 
-        if (block) {
-            auto iter = channels.begin();
-            for (int c = 0; c < mInfo.channels; ++iter, ++c) {
+            if (block) {
                 if (mFormat == int16Sample) {
-                    for (int j = 0; j < block; j++)
-                        ((short *) buffer.ptr())[j] =
-                                ((short *) srcbuffer.ptr())[mInfo.channels * j + c];
+                    auto iter = channels.begin();
+                    for (int c = 0; c < mInfo.channels; ++iter, ++c) {
+                        for (int j = 0; j < block; j++)
+                            ((short *) buffer.ptr())[j] =
+                                    ((short *) srcbuffer.ptr())[mInfo.channels * j + c];
+                        iter->get()->Append(buffer.ptr(), int16Sample, block);
+                    }
                 } else {
-                    for (int j = 0; j < block; j++)
-                        ((float *) buffer.ptr())[j] =
-                                ((float *) srcbuffer.ptr())[mInfo.channels * j + c];
+                    // All channels in one pass
+                    if (readShorts)
+                        Deinterleave((const short *) srcbuffer.ptr(), mInfo.channels,
+                                     channelBuffers.data(), block);
+                    else
+                        Deinterleave((const float *) srcbuffer.ptr(), mInfo.channels,
+                                     channelBuffers.data(), block);
+                    auto iter = channels.begin();
+                    for (int c = 0; c < mInfo.channels; ++iter, ++c)
+                        iter->get()->Append((samplePtr) channelBuffers[c], floatSample, block);
                 }
-
-                iter->get()->Append(buffer.ptr(), (mFormat == int16Sample) ? int16Sample : floatSample, block);
+                framescompleted += block;
             }
-            framescompleted += block;
-        }
 
-    } while (block > 0);
+        } while (block > 0);
+    }
 
     for (const auto &channel : channels) {
         channel->Flush();
     }
+    NOISERED_COUNT(SamplesImported, framescompleted.as_long_long() * mInfo.channels);
     outTracks.swap(channels);
 
     return ProgressResult::Success;
@@ -20,7 +20,12 @@ class PCMImportFileHandle final : public ImportFileHandle {
 public:
     static std::unique_ptr<ImportFileHandle> Open(const std::string &filename);
 
-    PCMImportFileHandle(std::string name, SFFile &&file, SF_INFO info);
+    /// As Open(), from the size bytes of a sound file at data, which must
+    /// outlive the handle
+    static std::unique_ptr<ImportFileHandle> OpenMemory(const void *data, size_t size);
+
+    PCMImportFileHandle(std::string name, SFFile &&file, SF_INFO info,
+                        std::unique_ptr<SFMemoryIO> memory = nullptr);
 
     ~PCMImportFileHandle();
 
@@ -39,10 +44,19 @@ public:
 
     void SetStreamUsage(int32_t StreamID, bool Use) override {}
 
+    void SetSampleFormat(sampleFormat format) override;
+
 private:
+    class MappedData;
+
+    // What mFile reads, when it is in memory
+    std::unique_ptr<SFMemoryIO> mMemory;
     SFFile mFile;
     const SF_INFO mInfo;
     sampleFormat mFormat;
+    // The samples of an uncompressed WAV file, read in place rather than
+    // through libsndfile; null for other formats
+    std::unique_ptr<MappedData> mMapped;
 };
 
 
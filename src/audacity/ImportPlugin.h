@@ -107,6 +107,12 @@ public:
     // Set stream "import/don't import" flag
     virtual void SetStreamUsage(int32_t StreamID, bool Use) = 0;
 
+    // Store the samples of the tracks in format, when it holds those of the
+    // file without loss; otherwise they are stored as float, the default.
+    // Compact storage suits effects that reduce to the same width again,
+    // as their float results are converted once, as they are appended.
+    virtual void SetSampleFormat(sampleFormat format) = 0;
+
 protected:
     std::string mFilename;
 };
@@ -0,0 +1,296 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Instrumentation.cpp
+
+*******************************************************************//**
+
+\class Instrumentation
+\brief Where the time of a job went, stage by stage.
+
+Disabled, a timer or counter costs one relaxed load.  Enabled, it adds
+to totals that are atomic, so that the threads of a job (or of several)
+all add to one set; a caller wanting the work of one job takes the
+difference of reports from before and after it.
+
+Gauges are levels rather than totals:  one wanting the peak of a job
+resets the peaks before it, or, with other jobs about, watches them for
+the job alone.
+
+A trace keeps the spans of each thread in a buffer of its own, made on the
+thread's first span of the trace, so that threads only contend to register.
+
+*//*******************************************************************/
+
+#include "Instrumentation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace {
+struct Totals {
+    std::atomic<unsigned long long> calls[Instrumentation::nStages];
+    std::atomic<unsigned long long> nanoseconds[Instrumentation::nStages];
+    std::atomic<unsigned long long> counters[Instrumentation::nCounters];
+    SpaceGauge gauges[Instrumentation::nGauges];
+    // Bit ii set while the ii-th watch of every gauge is in use
+    std::atomic<unsigned long long> watches;
+};
+
+Totals &GetTotals() {
+    // Zero initialized, being static
+    static Totals totals;
+    return totals;
+}
+
+struct Span {
+    Instrumentation::Stage stage;
+    unsigned long long start;
+    unsigned long long end;
+};
+
+// The spans of one thread in one trace
+struct ThreadTrace {
+    unsigned trace;
+    unsigned thread;
+    // Guards spans, which StopTrace reads from another thread
+    std::mutex mutex;
+    std::vector<Span> spans;
+};
+
+struct Trace {
+    // Counts the traces started, so that threads know their buffers of
+    // earlier ones; changed with mutex held
+    std::atomic<unsigned> number{0};
+    // Guards all below
+    std::mutex mutex;
+    unsigned long long start{0};
+    std::vector<std::shared_ptr<ThreadTrace>> threads;
+};
+
+Trace &GetTrace() {
+    static Trace trace;
+    return trace;
+}
+
+thread_local std::shared_ptr<ThreadTrace> tThreadTrace;
+
+void AddSpan(Instrumentation::Stage stage, unsigned long long start, unsigned long long end) {
+    auto &trace = GetTrace();
+    if (!tThreadTrace || tThreadTrace->trace != trace.number) {
+        std::lock_guard<std::mutex> lock{trace.mutex};
+        if (!Instrumentation::IsTracing())
+            return;
+        tThreadTrace = std::make_shared<ThreadTrace>();
+        tThreadTrace->trace = trace.number;
+        tThreadTrace->thread = trace.threads.size() + 1;
+        trace.threads.push_back(tThreadTrace);
+    }
+    std::lock_guard<std::mutex> lock{tThreadTrace->mutex};
+    tThreadTrace->spans.push_back({stage, start, end});
+}
+}
+
+std::atomic<int> Instrumentation::sEnabled{0};
+std::atomic<bool> Instrumentation::sTracing{false};
+
+const char *Instrumentation::GetName(Stage stage) {
+    static const char *const names[nStages] = {
+            "import", "profile", "fft", "classify", "gains", "inverse_fft", "overlap_add",
+            "replace", "append", "block_read", "block_write", "export",
+            "steps", "fft_batch", "export_write",
+    };
+    return stage < nStages ? names[stage] : "";
+}
+
+bool Instrumentation::IsTraced(Stage stage) {
+    switch (stage) {
+        case Profile:
+        case FFT:
+        case Classify:
+        case Gains:
+        case InverseFFT:
+        case OverlapAdd:
+        // Once a step, for the output
+        case Append:
+            return false;
+        default:
+            return stage < nStages;
+    }
+}
+
+const char *Instrumentation::GetName(Counter counter) {
+    static const char *const names[nCounters] = {
+            "samples_imported", "windows", "samples_appended", "blocks_read", "bytes_read",
+            "blocks_written", "bytes_written", "samples_exported",
+    };
+    return counter < nCounters ? names[counter] : "";
+}
+
+const char *Instrumentation::GetName(Gauge gauge) {
+    static const char *const names[nGauges] = {
+            "sample_buffer_bytes", "arena_bytes", "block_file_bytes",
+    };
+    return gauge < nGauges ? names[gauge] : "";
+}
+
+auto Instrumentation::Report::operator-(const Report &that) const -> Report {
+    Report result;
+    for (unsigned ii = 0; ii < nStages; ++ii) {
+        result.stages[ii].calls = stages[ii].calls - that.stages[ii].calls;
+        result.stages[ii].nanoseconds = stages[ii].nanoseconds - that.stages[ii].nanoseconds;
+    }
+    for (unsigned ii = 0; ii < nCounters; ++ii)
+        result.counters[ii] = counters[ii] - that.counters[ii];
+    for (unsigned ii = 0; ii < nGauges; ++ii)
+        result.gauges[ii] = gauges[ii];
+    return result;
+}
+
+auto Instrumentation::GetReport() -> Report {
+    auto &totals = GetTotals();
+    Report report;
+    for (unsigned ii = 0; ii < nStages; ++ii) {
+        report.stages[ii].calls = totals.calls[ii].load(std::memory_order_relaxed);
+        report.stages[ii].nanoseconds = totals.nanoseconds[ii].load(std::memory_order_relaxed);
+    }
+    for (unsigned ii = 0; ii < nCounters; ++ii)
+        report.counters[ii] = totals.counters[ii].load(std::memory_order_relaxed);
+    for (unsigned ii = 0; ii < nGauges; ++ii)
+        report.gauges[ii] = {totals.gauges[ii].GetLive(), totals.gauges[ii].GetPeak()};
+    return report;
+}
+
+SpaceGauge &Instrumentation::GetGauge(Gauge gauge) {
+    return GetTotals().gauges[gauge];
+}
+
+void Instrumentation::ResetPeaks() {
+    for (auto &gauge : GetTotals().gauges)
+        gauge.ResetPeak();
+}
+
+int Instrumentation::WatchPeaks() {
+    auto &totals = GetTotals();
+    auto watches = totals.watches.load(std::memory_order_relaxed);
+    for (;;) {
+        unsigned watch = 0;
+        while (watch < SpaceGauge::nWatches && (watches >> watch & 1))
+            ++watch;
+        if (watch == SpaceGauge::nWatches)
+            return -1;
+        if (totals.watches.compare_exchange_weak(watches, watches | 1ull << watch, std::memory_order_relaxed)) {
+            for (auto &gauge : totals.gauges)
+                gauge.Watch(watch);
+            return (int) watch;
+        }
+    }
+}
+
+void Instrumentation::UnwatchPeaks(int watch, unsigned long long (&peaks)[nGauges]) {
+    auto &totals = GetTotals();
+    auto &gauges = totals.gauges;
+    if (watch < 0) {
+        for (unsigned ii = 0; ii < nGauges; ++ii)
+            peaks[ii] = gauges[ii].GetPeak();
+        return;
+    }
+    for (unsigned ii = 0; ii < nGauges; ++ii)
+        peaks[ii] = gauges[ii].Unwatch((unsigned) watch);
+    totals.watches.fetch_and(~(1ull << watch), std::memory_order_relaxed);
+}
+
+void Instrumentation::Enable() {
+    ++sEnabled;
+}
+
+void Instrumentation::Disable() {
+    --sEnabled;
+}
+
+unsigned long long Instrumentation::Now() {
+    // Never 0, which InstrumentationTimer takes to mean disabled
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() | 1;
+}
+
+void Instrumentation::Finish(Stage stage, unsigned long long start) {
+    const auto end = Now();
+    auto &totals = GetTotals();
+    totals.calls[stage].fetch_add(1, std::memory_order_relaxed);
+    totals.nanoseconds[stage].fetch_add(end - start, std::memory_order_relaxed);
+    if (IsTracing() && IsTraced(stage))
+        AddSpan(stage, start, end);
+}
+
+bool Instrumentation::StartTrace() {
+    auto &trace = GetTrace();
+    {
+        std::lock_guard<std::mutex> lock{trace.mutex};
+        if (IsTracing())
+            return false;
+        ++trace.number;
+        trace.start = Now();
+        trace.threads.clear();
+        sTracing = true;
+    }
+    Enable();
+    return true;
+}
+
+bool Instrumentation::StopTrace(std::ostream &out) {
+    auto &trace = GetTrace();
+    std::vector<std::shared_ptr<ThreadTrace>> threads;
+    unsigned long long start;
+    {
+        std::lock_guard<std::mutex> lock{trace.mutex};
+        if (!IsTracing())
+            return false;
+        sTracing = false;
+        threads.swap(trace.threads);
+        start = trace.start;
+    }
+    Disable();
+
+    // Complete ("X") events, and a name for the track of each thread
+    const auto microseconds = [](unsigned long long nanoseconds) { return nanoseconds / 1000.0; };
+    out << "{\"traceEvents\": [";
+    const char *separator = "\n";
+    for (const auto &thread : threads) {
+        out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+            << thread->thread << ", \"args\": {\"name\": \"thread " << thread->thread << "\"}}";
+        separator = ",\n";
+        std::lock_guard<std::mutex> lock{thread->mutex};
+        for (const auto &span : thread->spans) {
+            // Spans begun before the trace are cut at its start
+            const auto spanStart = std::max(span.start, start);
+            out << separator << "{\"name\": \"" << GetName(span.stage)
+                << "\", \"cat\": \"noisered\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->thread
+                << ", \"ts\": " << microseconds(spanStart - start)
+                << ", \"dur\": " << microseconds(span.end - spanStart) << "}";
+        }
+    }
+    out << "\n], \"displayTimeUnit\": \"ns\"}" << std::endl;
+    return out.good();
+}
+
+bool Instrumentation::StopTrace(const std::string &path) {
+    std::ofstream file{path};
+    if (!file) {
+        // Stopped all the same
+        std::ostream discard{nullptr};
+        StopTrace(discard);
+        return false;
+    }
+    return StopTrace(file);
+}
+
+void Instrumentation::AddCount(Counter counter, unsigned long long n) {
+    GetTotals().counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
@@ -0,0 +1,252 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  Instrumentation.h
+
+  Process wide timers and counters of the stages of import, noise
+  reduction and export, off until enabled, and gauges of the memory and
+  storage they take, always kept; all compiled out with
+  NOISERED_NO_INSTRUMENTATION.  Tracing records the spans of the coarser
+  stages on each thread, for a timeline in Perfetto or chrome://tracing.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_INSTRUMENTATION__
+#define __AUDACITY_INSTRUMENTATION__
+
+#include <atomic>
+#include <iosfwd>
+#include <string>
+
+/// Live and peak bytes of some kind of storage, updated from any thread
+class SpaceGauge {
+public:
+    using ByteCount = unsigned long long;
+
+    /// Watches of the peak at once, each by one caller
+    static const unsigned nWatches = 64;
+
+    void Add(ByteCount bytes) {
+        const auto live = mLive.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        Raise(mPeak, live);
+        auto watching = mWatching.load(std::memory_order_relaxed);
+        for (unsigned ii = 0; watching; ++ii, watching >>= 1)
+            if (watching & 1)
+                Raise(mWatchPeaks[ii], live);
+    }
+
+    void Subtract(ByteCount bytes) { mLive.fetch_sub(bytes, std::memory_order_relaxed); }
+
+    ByteCount GetLive() const { return mLive.load(std::memory_order_relaxed); }
+
+    /// The most live at once since made or ResetPeak()
+    ByteCount GetPeak() const { return mPeak.load(std::memory_order_relaxed); }
+
+    void ResetPeak() { mPeak.store(GetLive(), std::memory_order_relaxed); }
+
+    /// Keep a peak from now for watch, one of nWatches not in use, that
+    /// ResetPeak() leaves alone
+    void Watch(unsigned watch) {
+        mWatchPeaks[watch].store(0, std::memory_order_relaxed);
+        mWatching.fetch_or(1ull << watch, std::memory_order_relaxed);
+        Raise(mWatchPeaks[watch], GetLive());
+    }
+
+    /// The most live at once since Watch(watch), which ends
+    ByteCount Unwatch(unsigned watch) {
+        mWatching.fetch_and(~(1ull << watch), std::memory_order_relaxed);
+        return mWatchPeaks[watch].load(std::memory_order_relaxed);
+    }
+
+private:
+    static void Raise(std::atomic<ByteCount> &peak, ByteCount live) {
+        auto old = peak.load(std::memory_order_relaxed);
+        while (live > old && !peak.compare_exchange_weak(old, live, std::memory_order_relaxed)) {
+        }
+    }
+
+    std::atomic<ByteCount> mLive{0};
+    std::atomic<ByteCount> mPeak{0};
+    std::atomic<unsigned long long> mWatching{0};
+    std::atomic<ByteCount> mWatchPeaks[nWatches]{};
+};
+
+class Instrumentation {
+public:
+    /// Stages may nest:  an import includes its appends, which include
+    /// their block writes
+    enum Stage : unsigned {
+        Import,
+        Profile,
+        FFT,
+        Classify,
+        Gains,
+        InverseFFT,
+        OverlapAdd,
+        Replace,
+        Append,
+        BlockRead,
+        BlockWrite,
+        Export,
+        /// The windows of one buffer of samples given a Worker
+        Steps,
+        /// One batched transform of profile windows
+        FFTBatch,
+        /// One write of frames to libsndfile, maybe on a writer thread
+        ExportWrite,
+        nStages
+    };
+
+    enum Counter : unsigned {
+        SamplesImported,
+        Windows,
+        SamplesAppended,
+        BlocksRead,
+        BytesRead,
+        BlocksWritten,
+        BytesWritten,
+        SamplesExported,
+        nCounters
+    };
+
+    enum Gauge : unsigned {
+        /// Sample buffers on the heap, not drawn from an arena
+        SampleBuffers,
+        /// Chunks of arenas, which hold the buffers and spectrum history
+        /// of noise reduction
+        Arenas,
+        /// Samples, headers and summaries of block files, in memory or on
+        /// disk, of all DirManagers
+        BlockFiles,
+        nGauges
+    };
+
+    static const char *GetName(Stage stage);
+
+    static const char *GetName(Counter counter);
+
+    static const char *GetName(Gauge gauge);
+
+    struct Report {
+        struct Timing {
+            unsigned long long calls;
+            unsigned long long nanoseconds;
+        };
+        Timing stages[nStages];
+        unsigned long long counters[nCounters];
+
+        struct Level {
+            unsigned long long live;
+            unsigned long long peak;
+        };
+        Level gauges[nGauges];
+
+        /// What was added between that and this; gauges are this one's
+        Report operator-(const Report &that) const;
+    };
+
+    /// Totals of all threads since the process started, while enabled
+    static Report GetReport();
+
+    /// Enabling nests, so that concurrent users can each enable and
+    /// disable.  The totals include the work of all threads meanwhile.
+    static void Enable();
+
+    static void Disable();
+
+    static bool IsEnabled() { return sEnabled.load(std::memory_order_relaxed) > 0; }
+
+    static void Count(Counter counter, unsigned long long n) {
+        if (IsEnabled())
+            AddCount(counter, n);
+    }
+
+    /// Gauges are kept whether or not enabled, so that what is added and
+    /// subtracted always balances
+    static SpaceGauge &GetGauge(Gauge gauge);
+
+    /// Peaks of all gauges from now on
+    static void ResetPeaks();
+
+    /// Keep peaks of all gauges from now for one caller, whatever others
+    /// watch or reset meanwhile; -1 if SpaceGauge::nWatches callers
+    /// already watch
+    static int WatchPeaks();
+
+    /// The peaks of the gauges since WatchPeaks() returned watch, which
+    /// ends; for -1, those of the process, since made or ResetPeaks()
+    static void UnwatchPeaks(int watch, unsigned long long (&peaks)[nGauges]);
+
+    /// Whether spans of the stage are traced.  Those timed once a window
+    /// are not, being too many and too short; the Steps around them are.
+    static bool IsTraced(Stage stage);
+
+    /// Record a span of each traced stage timed on any thread, enabling
+    /// until StopTrace().  False if a trace is already started.
+    static bool StartTrace();
+
+    /// Stop and write the spans recorded as Chrome trace event JSON,
+    /// microseconds since StartTrace(), one track for each thread.  False
+    /// if no trace was started, or it cannot be written.
+    static bool StopTrace(std::ostream &out);
+
+    static bool StopTrace(const std::string &path);
+
+    static bool IsTracing() { return sTracing.load(std::memory_order_relaxed); }
+
+private:
+    friend class InstrumentationTimer;
+
+    static unsigned long long Now();
+
+    /// Adds the time since start to the stage, and traces it
+    static void Finish(Stage stage, unsigned long long start);
+
+    static void AddCount(Counter counter, unsigned long long n);
+
+    static std::atomic<int> sEnabled;
+    static std::atomic<bool> sTracing;
+};
+
+/// Adds the time until it is destroyed to a stage, if Instrumentation was
+/// enabled when it was made
+class InstrumentationTimer {
+public:
+    explicit InstrumentationTimer(Instrumentation::Stage stage)
+            : mStage{stage}, mStart{Instrumentation::IsEnabled() ? Instrumentation::Now() : 0} {}
+
+    InstrumentationTimer(const InstrumentationTimer &) = delete;
+
+    InstrumentationTimer &operator=(const InstrumentationTimer &) = delete;
+
+    ~InstrumentationTimer() {
+        if (mStart)
+            Instrumentation::Finish(mStage, mStart);
+    }
+
+private:
+    const Instrumentation::Stage mStage;
+    const unsigned long long mStart;
+};
+
+#define NOISERED_CONCAT_(a, b) a##b
+#define NOISERED_CONCAT(a, b) NOISERED_CONCAT_(a, b)
+
+#ifdef NOISERED_NO_INSTRUMENTATION
+#define NOISERED_TIMED(stage) ((void) 0)
+#define NOISERED_COUNT(counter, n) ((void) 0)
+#define NOISERED_GAUGE_ADD(gauge, bytes) ((void) 0)
+#define NOISERED_GAUGE_SUBTRACT(gauge, bytes) ((void) 0)
+#else
+/// Time the rest of the enclosing scope as Instrumentation::stage
+#define NOISERED_TIMED(stage) \
+    const InstrumentationTimer NOISERED_CONCAT(instrumentationTimer, __LINE__){Instrumentation::stage}
+/// Add n to Instrumentation::counter
+#define NOISERED_COUNT(counter, n) Instrumentation::Count(Instrumentation::counter, (n))
+/// Bytes taken and given back of Instrumentation::gauge
+#define NOISERED_GAUGE_ADD(gauge, bytes) Instrumentation::GetGauge(Instrumentation::gauge).Add(bytes)
+#define NOISERED_GAUGE_SUBTRACT(gauge, bytes) Instrumentation::GetGauge(Instrumentation::gauge).Subtract(bytes)
+#endif
+
+#endif
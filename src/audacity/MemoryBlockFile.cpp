@@ -0,0 +1,83 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MemoryBlockFile.cpp
+
+*******************************************************************//**
+
+\class MemoryBlockFile
+\brief A BlockFile whose sample data lives only in RAM.
+
+Unlike SimpleBlockFile, no .au file is written and the summary is not
+computed up front; it is derived from the held samples on request.
+
+*//*******************************************************************/
+
+
+#include <cstring>
+#include "MemoryBlockFile.h"
+#include "FileException.h"
+#include "SampleFormat.h"
+#include "Instrumentation.h"
+
+MemoryBlockFile::MemoryBlockFile(samplePtr sampleData, size_t sampleLen,
+                                 sampleFormat format):
+BlockFile{ wxFileNameWrapper{}, sampleLen },
+mFormat(format)
+{
+   NOISERED_TIMED(BlockWrite);
+   NOISERED_COUNT(BlocksWritten, 1);
+   NOISERED_COUNT(BytesWritten, sampleLen * SAMPLE_SIZE(format));
+   const auto sampleDataSize = sampleLen * SAMPLE_SIZE(format);
+   mSampleData.reinit(sampleDataSize);
+   memcpy(mSampleData.get(), sampleData, sampleDataSize);
+}
+
+MemoryBlockFile::~MemoryBlockFile()
+{
+}
+
+bool MemoryBlockFile::ReadSummary(ArrayOf<char> &data)
+{
+   ArrayOf<char> cleanup;
+   void *summaryData = CalcSummary((samplePtr)mSampleData.get(), mLen,
+                                   mFormat, cleanup);
+   data.reinit( mSummaryInfo.totalSummaryBytes );
+   memcpy(data.get(), summaryData, mSummaryInfo.totalSummaryBytes);
+   return true;
+}
+
+size_t MemoryBlockFile::ReadData(samplePtr data, sampleFormat format,
+                              size_t start, size_t len, bool mayThrow) const
+{
+   NOISERED_TIMED(BlockRead);
+   NOISERED_COUNT(BlocksRead, 1);
+   NOISERED_COUNT(BytesRead, len * SAMPLE_SIZE(mFormat));
+   auto framesRead = std::min(len, std::max(start, mLen) - start);
+   CopySamples(
+      (samplePtr)(mSampleData.get() + start * SAMPLE_SIZE(mFormat)),
+      mFormat, data, format, framesRead);
+
+   if ( framesRead < len ) {
+      if (mayThrow)
+         throw FileException{ FileException::Cause::Read, mFileName };
+      ClearSamples(data, format, framesRead, len - framesRead);
+   }
+
+   return framesRead;
+}
+
+/// Create a copy of this BlockFile
+BlockFilePtr MemoryBlockFile::Copy(wxFileNameWrapper &&)
+{
+   auto newBlockFile = make_blockfile<MemoryBlockFile>(
+      (samplePtr)mSampleData.get(), mLen, mFormat);
+
+   return newBlockFile;
+}
+
+auto MemoryBlockFile::GetSpaceUsage() const -> DiskByteCount
+{
+   return 0;
+}
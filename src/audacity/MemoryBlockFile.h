@@ -0,0 +1,51 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MemoryBlockFile.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_MEMORY_BLOCKFILE__
+#define __AUDACITY_MEMORY_BLOCKFILE__
+
+#include "BlockFile.h"
+#include "DirManager.h"
+
+
+/// A BlockFile that keeps its samples in a heap buffer and never touches
+/// the filesystem.  Used by DirManager in memory storage mode, where the
+/// project is headless and no undo or crash recovery is needed.
+class MemoryBlockFile final : public BlockFile {
+public:
+    // Constructor / Destructor
+
+    /// Copy sampleLen samples of the given format into a NEW buffer
+    MemoryBlockFile(samplePtr sampleData, size_t sampleLen,
+                    sampleFormat format);
+
+    virtual ~MemoryBlockFile();
+
+    // Reading
+
+    /// Compute the summary from the held samples
+    bool ReadSummary(ArrayOf<char> &data) override;
+
+    /// Read the data section from memory
+    size_t ReadData(samplePtr data, sampleFormat format,
+                    size_t start, size_t len, bool mayThrow) const override;
+
+    /// Create a NEW block file identical to this one
+    BlockFilePtr Copy(wxFileNameWrapper &&newFileName) override;
+
+    DiskByteCount GetSpaceUsage() const override;
+
+    void Recover() override {};
+
+private:
+    sampleFormat mFormat;
+    ArrayOf<char> mSampleData;
+};
+
+
+#endif
@@ -22,6 +22,7 @@
 
 #include <cstring>
 #include "Mix.h"
+#include "SampleKernels.h"
 
 MixerSpec::MixerSpec(unsigned numTracks, unsigned maxNumChannels) {
     mNumTracks = mNumChannels = numTracks;
@@ -256,13 +257,8 @@ void MixBuffers(unsigned numChannels, int *channelFlags, float *gains,
          skip = 1;
       }
 
-      float gain = gains[c];
-      float *dest = (float *)destPtr;
-      float *temp = (float *)src;
-      for (int j = 0; j < len; j++) {
-         *dest += temp[j] * gain;   // the actual mixing process
-         dest += skip;
-      }
+      // the actual mixing process
+      MixSamples((const float *)src, gains[c], (float *)destPtr, skip, len);
    }
 }
 
@@ -293,6 +289,8 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
     double endTime = track->GetEndTime();
     double startTime = track->GetStartTime();
     const bool backwards = (mT1 < mT0);
+    // Multiplying by 1.0 changes nothing
+    const bool unitEnvelope = track->HasUnitEnvelope();
     const double tEnd = backwards
                         ? std::max(startTime, mT1)
                         : std::min(endTime, mT1);
@@ -321,9 +319,10 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
                     else
                         memset(&queue[*queueLen], 0, sizeof(float) * getLen);
 
-                    track->GetEnvelopeValues(mEnvValues.get(),
-                                             getLen,
-                                             (*pos - (getLen - 1)).as_double() / trackRate);
+                    if (!unitEnvelope)
+                        track->GetEnvelopeValues(mEnvValues.get(),
+                                                 getLen,
+                                                 (*pos - (getLen - 1)).as_double() / trackRate);
                     *pos -= getLen;
                 } else {
                     auto results = cache.Get(floatSample, *pos, getLen, mMayThrow);
@@ -332,16 +331,16 @@ size_t Mixer::MixVariableRates(int *channelFlags, WaveTrackCache &cache,
                     else
                         memset(&queue[*queueLen], 0, sizeof(float) * getLen);
 
-                    track->GetEnvelopeValues(mEnvValues.get(),
-                                             getLen,
-                                             (*pos).as_double() / trackRate);
+                    if (!unitEnvelope)
+                        track->GetEnvelopeValues(mEnvValues.get(),
+                                                 getLen,
+                                                 (*pos).as_double() / trackRate);
 
                     *pos += getLen;
                 }
 
-                for (decltype(getLen) i = 0; i < getLen; i++) {
-                    queue[(*queueLen) + i] *= mEnvValues[i];
-                }
+                if (!unitEnvelope)
+                    ApplyGains(&queue[*queueLen], mEnvValues.get(), getLen);
 
                 if (backwards)
                     ReverseSamples((samplePtr) &queue[0], floatSample,
@@ -403,6 +402,9 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
     const double trackEndTime = track->GetEndTime();
     const double trackStartTime = track->GetStartTime();
     const bool backwards = (mT1 < mT0);
+    // Multiplying by 1.0 changes nothing; otherwise the envelope resumes
+    // its search for points where the last block's ended
+    const bool unitEnvelope = track->HasUnitEnvelope();
     const double tEnd = backwards
                         ? std::max(trackStartTime, mT1)
                         : std::min(trackEndTime, mT1);
@@ -425,9 +427,10 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
             memcpy(mFloatBuffer.get(), results, sizeof(float) * slen);
         else
             memset(mFloatBuffer.get(), 0, sizeof(float) * slen);
-        track->GetEnvelopeValues(mEnvValues.get(), slen, t - (slen - 1) / mRate);
-        for (decltype(slen) i = 0; i < slen; i++)
-            mFloatBuffer[i] *= mEnvValues[i]; // Track gain control will go here?
+        if (!unitEnvelope) {
+            track->GetEnvelopeValues(mEnvValues.get(), slen, t - (slen - 1) / mRate);
+            ApplyGains(mFloatBuffer.get(), mEnvValues.get(), slen); // Track gain control will go here?
+        }
         ReverseSamples((samplePtr) mFloatBuffer.get(), floatSample, 0, slen);
 
         *pos -= slen;
@@ -437,9 +440,10 @@ size_t Mixer::MixSameRate(int *channelFlags, WaveTrackCache &cache,
             memcpy(mFloatBuffer.get(), results, sizeof(float) * slen);
         else
             memset(mFloatBuffer.get(), 0, sizeof(float) * slen);
-        track->GetEnvelopeValues(mEnvValues.get(), slen, t);
-        for (decltype(slen) i = 0; i < slen; i++)
-            mFloatBuffer[i] *= mEnvValues[i]; // Track gain control will go here?
+        if (!unitEnvelope) {
+            track->GetEnvelopeValues(mEnvValues.get(), slen, t);
+            ApplyGains(mFloatBuffer.get(), mEnvValues.get(), slen); // Track gain control will go here?
+        }
 
         *pos += slen;
     }
@@ -38,6 +38,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <algorithm>
@@ -45,17 +46,28 @@
 #include <iostream>
 #include <cmath>
 #include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <utility>
 
 #include "Audacity.h"
+#include "Arena.h"
 #include "Types.h"
-#include "RealFFTf.h"
+#include "FFTBackend.h"
+#include "Instrumentation.h"
+#include "NoiseReductionKernels.h"
 #include "NoiseReduction.h"
+#include "ODComputedBlockFile.h"
 #include "WaveTrack.h"
 
-// SPECTRAL_SELECTION not to affect this effect for now, as there might be no indication that it does.
-// [Discussed and agreed for v2.1 by Steve, Paul, Bill].
-#undef EXPERIMENTAL_SPECTRAL_EDITING
-
 typedef std::vector<float> FloatVector;
 
 // Define both of these to make the radio button three-way
@@ -86,6 +98,63 @@ enum DiscriminationMethod {
 // and the old discrimination
 const float minSignalTime = 0.05f;
 
+// Windows gathered for one batched transform while profiling
+const size_t profileBatchFrames = 16;
+
+// Most windows of a track kept when profiling the quietest:  4 MB of
+// spectra at the default window size
+const size_t maxQuietWindows = 4096;
+
+// The power spectra of the quietest windows offered, by their total power,
+// in a fixed number of rows
+class QuietWindows {
+public:
+    QuietWindows(size_t capacity, size_t spectrumSize)
+            : mCapacity(capacity), mSpectrumSize(spectrumSize), mRows((capacity + 1) * spectrumSize) {
+        mHeap.reserve(capacity);
+    }
+
+    // The row to fill with the spectrum of a window before Offer()
+    float *Candidate() { return &mRows[mCandidate * mSpectrumSize]; }
+
+    // Keep the candidate if it is among the quietest so far, dropping the
+    // loudest kept when full
+    void Offer() {
+        const float *const row = Candidate();
+        const double power = std::accumulate(row, row + mSpectrumSize, 0.0);
+        if (mHeap.size() < mCapacity) {
+            mHeap.emplace_back(power, mCandidate);
+            std::push_heap(mHeap.begin(), mHeap.end());
+            // The next row never used
+            mCandidate = mHeap.size();
+        } else if (power < mHeap.front().first) {
+            std::pop_heap(mHeap.begin(), mHeap.end());
+            const auto freed = mHeap.back().second;
+            mHeap.back() = {power, mCandidate};
+            std::push_heap(mHeap.begin(), mHeap.end());
+            mCandidate = freed;
+        }
+    }
+
+    // Add the kept spectra to sums; returns how many
+    size_t AddTo(float *sums) const {
+        for (const auto &entry : mHeap) {
+            const float *const row = &mRows[entry.second * mSpectrumSize];
+            for (size_t ii = 0; ii < mSpectrumSize; ++ii)
+                sums[ii] += row[ii];
+        }
+        return mHeap.size();
+    }
+
+private:
+    const size_t mCapacity;
+    const size_t mSpectrumSize;
+    FloatVector mRows;
+    // Total power and row of each kept window, the loudest first
+    std::vector<std::pair<double, size_t>> mHeap;
+    size_t mCandidate{0};
+};
+
 enum WindowTypes {
     WT_RECTANGULAR_HANN = 0, // 2.0.6 behavior, requires 1/2 step
     WT_HANN_RECTANGULAR, // requires 1/2 step
@@ -121,8 +190,12 @@ const struct WindowTypesInfo {
 };
 
 enum {
+    MIN_WINDOW_SIZE_CHOICE = 0, // corresponds to 8
     DEFAULT_WINDOW_SIZE_CHOICE = 8, // corresponds to 2048
-    DEFAULT_STEPS_PER_WINDOW_CHOICE = 1 // corresponds to 4, minimum for WT_HANN_HANN
+    MAX_WINDOW_SIZE_CHOICE = 11, // corresponds to 16384
+    DEFAULT_STEPS_PER_WINDOW_CHOICE = 1, // corresponds to 4, minimum for WT_HANN_HANN
+    MAX_STEPS_PER_WINDOW_CHOICE = 5, // corresponds to 64
+    LOW_LATENCY_WINDOW_SIZE_CHOICE = 6 // corresponds to 512
 };
 
 enum NoiseReductionChoice {
@@ -133,6 +206,109 @@ enum NoiseReductionChoice {
 
 } // namespace
 
+namespace {
+// Take the (flushed) output track and insert it in place of the original
+// sample data (as operated on -- this may not match mT0/mT1)
+void ReplaceWithOutput(WaveTrack *track, WaveTrack *outputTrack, sampleCount start, sampleCount len) {
+    NOISERED_TIMED(Replace);
+    // Usually all the output replaces one clip, or part of it, so the
+    // output blocks can go straight in
+    if (track->ReplaceSamples(start, len, *outputTrack))
+        return;
+
+    double t0 = outputTrack->LongSamplesToTime(start);
+    double tLen = outputTrack->LongSamplesToTime(len);
+    // Filtering effects always end up with more data than they started with.  Delete this 'tail'.
+    outputTrack->HandleClear(tLen, outputTrack->GetEndTime(), false, false);
+    track->ClearAndPaste(t0, t0 + tLen, outputTrack, true, false);
+}
+}
+
+namespace {
+// Analysis and synthesis windows, each empty if rectangular
+struct WindowTables {
+    FloatVector mIn;
+    FloatVector mOut;
+};
+
+std::shared_ptr<const WindowTables> MakeWindows(int windowTypes, size_t windowSize, unsigned stepsPerWindow) {
+    auto windows = std::make_shared<WindowTables>();
+    auto &inWindow = windows->mIn;
+    auto &outWindow = windows->mOut;
+
+    const double constantTerm =
+            windowTypesInfo[windowTypes].productConstantTerm;
+
+    // One or the other window must by multiplied by this to correct for
+    // overlap.  Must scale down as steps get smaller, and overlaps larger.
+    const double multiplier = 1.0 / (constantTerm * stepsPerWindow);
+
+    // Create the analysis window
+    switch (windowTypes) {
+        case WT_RECTANGULAR_HANN:
+            break;
+        default: {
+            const bool rectangularOut =
+                    windowTypes == WT_HAMMING_RECTANGULAR ||
+                    windowTypes == WT_HANN_RECTANGULAR;
+            const double m =
+                    rectangularOut ? multiplier : 1;
+            const double *const coefficients =
+                    windowTypesInfo[windowTypes].inCoefficients;
+            const double c0 = coefficients[0];
+            const double c1 = coefficients[1];
+            const double c2 = coefficients[2];
+            inWindow.resize(windowSize);
+            for (size_t ii = 0; ii < windowSize; ++ii)
+                inWindow[ii] = m *
+                               (c0 + c1 * cos((2.0 * M_PI * ii) / windowSize)
+                                + c2 * cos((4.0 * M_PI * ii) / windowSize));
+        }
+            break;
+    }
+
+    // Create the synthesis window
+    switch (windowTypes) {
+        case WT_HANN_RECTANGULAR:
+        case WT_HAMMING_RECTANGULAR:
+            break;
+        case WT_HAMMING_INV_HAMMING: {
+            outWindow.resize(windowSize);
+            for (size_t ii = 0; ii < windowSize; ++ii)
+                outWindow[ii] = multiplier / inWindow[ii];
+        }
+            break;
+        default: {
+            const double *const coefficients =
+                    windowTypesInfo[windowTypes].outCoefficients;
+            const double c0 = coefficients[0];
+            const double c1 = coefficients[1];
+            const double c2 = coefficients[2];
+            outWindow.resize(windowSize);
+            for (size_t ii = 0; ii < windowSize; ++ii)
+                outWindow[ii] = multiplier *
+                                (c0 + c1 * cos((2.0 * M_PI * ii) / windowSize)
+                                 + c2 * cos((4.0 * M_PI * ii) / windowSize));
+        }
+            break;
+    }
+
+    return windows;
+}
+
+// Like GetFFT, shares the immutable tables among all Workers on all threads
+std::shared_ptr<const WindowTables> GetWindows(int windowTypes, size_t windowSize, unsigned stepsPerWindow) {
+    static std::mutex mutex;
+    static std::map<std::tuple<int, size_t, unsigned>, std::shared_ptr<const WindowTables>> cache;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    auto &windows = cache[std::make_tuple(windowTypes, windowSize, stepsPerWindow)];
+    if (!windows)
+        windows = MakeWindows(windowTypes, windowSize, stepsPerWindow);
+    return windows;
+}
+}
+
 //----------------------------------------------------------------------------
 // EffectNoiseReduction::Statistics
 //----------------------------------------------------------------------------
@@ -147,6 +323,14 @@ public:
 #endif
     {}
 
+    // The profile as if taken at rate:  for each bin, the mean power
+    // interpolated at its frequency, and scaled with the width of the bins
+    std::unique_ptr<Statistics> Resampled(double rate) const;
+
+    // Combine with the statistics of other windows, as
+    // FinishTrackStatistics combines those of several tracks
+    void Merge(const Statistics &other);
+
     // Noise profile statistics follow
 
     double mRate; // Rate of profile track(s) -- processed tracks must match
@@ -164,6 +348,52 @@ public:
 #endif
 };
 
+auto EffectNoiseReduction::Statistics::Resampled(double rate) const
+-> std::unique_ptr<Statistics> {
+    auto result = std::make_unique<Statistics>(*this);
+    result->mRate = rate;
+
+    // The profile's bin at the frequency of bin ii is ii * ratio
+    const double ratio = rate / mRate;
+    const size_t last = mMeans.size() - 1;
+    const auto resample = [&](const FloatVector &from, FloatVector &to) {
+        for (size_t ii = 0; ii <= last; ++ii) {
+            const double position = ii * ratio;
+            double value;
+            if (position >= last)
+                value = from[last];
+            else {
+                const auto below = (size_t) position;
+                const double fraction = position - below;
+                value = from[below] + fraction * (from[below + 1] - from[below]);
+            }
+            to[ii] = (float) (value * ratio);
+        }
+    };
+    resample(mSums, result->mSums);
+    resample(mMeans, result->mMeans);
+#ifdef OLD_METHOD_AVAILABLE
+    resample(mNoiseThreshold, result->mNoiseThreshold);
+#endif
+    return result;
+}
+
+void EffectNoiseReduction::Statistics::Merge(const Statistics &other) {
+    const int windows = other.mTotalWindows;
+    const int multiplier = mTotalWindows;
+    const int denom = windows + multiplier;
+    if (windows)
+        for (size_t ii = 0, nn = mMeans.size(); ii < nn; ++ii) {
+            float &mean = mMeans[ii];
+            mean = (mean * multiplier + other.mMeans[ii] * windows) / denom;
+        }
+#ifdef OLD_METHOD_AVAILABLE
+    for (size_t ii = 0, nn = mNoiseThreshold.size(); ii < nn; ++ii)
+        mNoiseThreshold[ii] = std::max(mNoiseThreshold[ii], other.mNoiseThreshold[ii]);
+#endif
+    mTotalWindows = denom;
+}
+
 //----------------------------------------------------------------------------
 // EffectNoiseReduction::Settings
 //----------------------------------------------------------------------------
@@ -180,11 +410,26 @@ public:
 
     bool Validate(EffectNoiseReduction *effect) const;
 
-    size_t WindowSize() const { return 1u << (3 + mWindowSizeChoice); }
+    size_t WindowSize() const {
+        return 1u << (3 + (mMaxLatency > 0 ? LOW_LATENCY_WINDOW_SIZE_CHOICE : mWindowSizeChoice));
+    }
 
     unsigned StepsPerWindow() const { return 1u << (1 + mStepsPerWindowChoice); }
 
     bool mDoProfile;
+    // in secs, 0 for a fixed profile; not stored in preferences
+    double mAdaptiveTime;
+    // of the windows of each track, the quietest to profile; 0 for all
+    double mQuietFraction;
+    // in Hz, the bands affected; negative for no bound
+    double mF0;
+    double mF1;
+    // in ms, the most output may lag input, with a short window; 0 for the
+    // window of the preferences and the full attack
+    double mMaxLatency;
+    // becomes true to stop between blocks of input; null for never; not
+    // stored in preferences
+    const std::atomic<bool> *mCancel;
 
     // Stored in preferences:
 
@@ -209,7 +454,8 @@ public:
 };
 
 EffectNoiseReduction::Settings::Settings()
-        : mDoProfile(true) {
+        : mDoProfile(true), mAdaptiveTime(0.0), mQuietFraction(0.0), mF0(-1.0), mF1(-1.0), mMaxLatency(0.0),
+          mCancel(nullptr) {
     PrefsIO(true);
 }
 
@@ -224,9 +470,6 @@ public:
     typedef EffectNoiseReduction::Statistics Statistics;
 
     Worker(const Settings &settings, double sampleRate
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
-            , double f0, double f1
-#endif
     );
 
     ~Worker();
@@ -234,51 +477,136 @@ public:
     bool Process(EffectNoiseReduction &effect, WaveTrack *track,
                  Statistics &statistics, TrackFactory &factory, double mT0, double mT1);
 
+    // For parallel noise reduction of one track: reduce samples
+    // [segStart, segStart + segLen) of [start, start + len) into outputTrack.
+    // Enough extra input around the segment is read that the output is
+    // identical to that of a serial pass over the whole range.
+    bool ProcessSegment(const Statistics &statistics, WaveTrack *track, WaveTrack *outputTrack,
+                        sampleCount start, sampleCount len,
+                        sampleCount segStart, sampleCount segLen);
+
+    // Samples of input on each side of a segment needed by ProcessSegment;
+    // a multiple of the step size
+    size_t SegmentOverlap() const { return mSegmentOverlap; }
+
+    size_t StepSize() const { return mStepSize; }
+
+    // Blocks of the track for ProcessRange to read ahead; 0 for none
+    void SetReadAhead(unsigned blocks) { mReadAheadBlocks = blocks; }
+
+    // Profiling without a track
+    void ProfileSamples(Statistics &statistics, const float *buffer, size_t len);
+
+    // Streaming, without tracks:  finished samples are appended to output
+    void StartStream(const Statistics &statistics);
+    void PushSamples(const Statistics &statistics, const float *buffer, size_t len,
+                     FloatVector &output);
+    // At most one step of extra samples follow the last pushed
+    void FinishStream(const Statistics &statistics, FloatVector &output);
+
+    // Input samples needed, beyond those output, before a step is done
+    size_t Latency() const;
+
 private:
     bool ProcessOne(EffectNoiseReduction &effect,
                     Statistics &statistics, TrackFactory &factory,
                     int count, WaveTrack *track,
                     sampleCount start, sampleCount len);
 
+    // False if cancelled part way.  profile is the statistics to gather
+    // when profiling, and null otherwise, when noise reduction only reads
+    // statistics.
+    bool ProcessRange(const Statistics &statistics, Statistics *profile,
+                      WaveTrack *track, WaveTrack *outputTrack,
+                      sampleCount start, sampleCount len,
+                      sampleCount keepStart, sampleCount keepEnd);
+
     void StartNewTrack();
 
-    void ProcessSamples(Statistics &statistics,
-                        WaveTrack *outputTrack, size_t len, float *buffer);
+    void ProcessSamples(const Statistics &statistics, Statistics *profile,
+                        WaveTrack *outputTrack, size_t len, const float *buffer);
 
     void FillFirstHistoryWindow();
 
-    void ApplyFreqSmoothing(FloatVector &gains);
+    void ApplyFreqSmoothing(float *gains);
 
     void GatherStatistics(Statistics &statistics);
 
+    // Queue the current window for a batched transform when profiling
+    void AddProfileWindow(Statistics &statistics);
+
+    // Transform the queued windows and add their power spectra
+    void GatherBatchStatistics(Statistics &statistics);
+
     inline bool Classify(const Statistics &statistics, int band);
 
+    // Classify all bands of the center window at once, into mNoiseMask
+    void ClassifyAllBands(const Statistics &statistics);
+
+    void PrepareThresholds(const Statistics &statistics);
+
+    // Whether the center window lies wholly within the input, rather than
+    // in the zero padding before or after it
+    bool CenterWindowIsInput() const;
+
+    // Move the adapted means toward the power of the center window, in the
+    // band range, and their thresholds with them
+    void AdaptProfile();
+
     void ReduceNoise(const Statistics &statistics, WaveTrack *outputTrack);
 
     void RotateHistoryWindows();
 
     void FinishTrackStatistics(Statistics &statistics);
 
-    void FinishTrack(Statistics &statistics, WaveTrack *outputTrack);
+    void FinishTrack(const Statistics &statistics, WaveTrack *outputTrack);
 
 private:
 
+    // All the buffers of the run, 64 byte aligned, freed with the Worker;
+    // current while it processes a track, for Sequence scratch
+    Arena mArena;
+
     const bool mDoProfile;
 
     const double mSampleRate;
 
     const size_t mWindowSize;
     // These have that size:
-    HFFT hFFT;
-    FloatVector mFFTBuffer;
-    FloatVector mInWaveBuffer;
-    FloatVector mOutOverlapBuffer;
-    // These have that size, or 0:
-    FloatVector mInWindow;
-    FloatVector mOutWindow;
+    std::unique_ptr<FFTBackend> mFFT;
+    float *mFFTBuffer;
+    float *mInWaveBuffer;
+    float *mOutOverlapBuffer;
+    // These have that size, or are null for rectangular windows:
+    std::shared_ptr<const WindowTables> mWindows;
+    const float *mInWindow;
+    const float *mOutWindow;
 
     const size_t mSpectrumSize;
-    FloatVector mFreqSmoothingScratch;
+    // (mSpectrumSize + 1)
+    double *mFreqSmoothingScratch;
+    // Per bin, whether the attack is still raising gains; 1 or 0
+    float *mAttackActive;
+    // Per bin, the greatest float not exceeding mNewSensitivity * mean
+    float *mThresholds;
+    // Per bin, when adapting, the profile's mean moved toward the noise
+    // since; else null
+    float *mAdaptedMeans;
+    // Per bin, whether the center window is noise; 1 or 0
+    float *mNoiseMask;
+    // (mNWindowsToExamine)
+    const float **mClassifyRows;
+    // Per bin, when the median is of more windows than ClassifyBands ranks
+    // quickly, a column of (mNWindowsToExamine) holding the powers of the
+    // windows examined ascending, all but the newest between steps; else
+    // null
+    float *mSortedPowers;
+    // When profiling, windows interleaved for ForwardFrames, and how many
+    float *mProfileFrames;
+    size_t mProfileFrameCount;
+    // When profiling the quietest windows of each track, those so far
+    const double mQuietFraction;
+    std::unique_ptr<QuietWindows> mQuietWindows;
     const size_t mFreqSmoothingBins;
     // When spectral selection limits the affected band:
     int mBinLow;  // inclusive lower bound
@@ -290,6 +618,8 @@ private:
     const int mMethod;
     const double mNewSensitivity;
 
+    // (mStepSize) zeros, to flush the history
+    float *mEmpty;
 
     sampleCount mInSampleCount;
     sampleCount mOutStepCount;
@@ -299,26 +629,129 @@ private:
     float mOneBlockRelease;
     float mNoiseAttenFactor;
     float mOldSensitivityFactor;
+    // Weight of each noise window in the adapted means; 0 if not adapting
+    float mAdaptRate;
 
     unsigned mNWindowsToExamine;
     unsigned mCenter;
     unsigned mHistoryLen;
 
-    struct Record {
-        Record(size_t spectrumSize)
-                : mSpectrums(spectrumSize), mGains(spectrumSize), mRealFFTs(spectrumSize - 1),
-                  mImagFFTs(spectrumSize - 1) {
+    size_t mSegmentOverlap;
+    // Output positions, relative to the start of the range, to append
+    sampleCount mOutKeepStart;
+    sampleCount mOutKeepEnd;
+    // Receives output instead of a track, when streaming
+    FloatVector *mStreamOutput{};
+    unsigned mReadAheadBlocks{0};
+    const std::atomic<bool> *const mCancel;
+
+    // The sliding history of windows, index 0 the newest.  Each quantity is
+    // one contiguous matrix with a row per window, rows padded to a cache
+    // line; rotation only moves the head.
+    class History {
+    public:
+        History() {}
+        History(const History &) = delete;
+        History &operator=(const History &) = delete;
+
+        void Reset(unsigned historyLen, size_t spectrumSize, Arena &arena) {
+            mLen = historyLen;
+            mHead = 0;
+            // round up to 16 floats = 64 bytes
+            mStride = (spectrumSize + 15) & ~size_t(15);
+            mFFTStride = (2 * (spectrumSize - 1) + 15) & ~size_t(15);
+            mBase = arena.AllocateZeroed<float>(mLen * (2 * mStride + mFFTStride));
+        }
+
+        float *Spectrums(unsigned ii) { return mBase + Row(ii) * mStride; }
+        float *Gains(unsigned ii) { return mBase + (mLen + Row(ii)) * mStride; }
+        // The spectrum packed in natural order as the inverse FFT takes
+        // it, (windowSize) floats, which that transforms in place
+        float *FFTs(unsigned ii) {
+            return mBase + 2 * mLen * mStride + Row(ii) * mFFTStride;
+        }
+
+        // Make room for a newest window, dropping the oldest
+        void Rotate() { mHead = (mHead + mLen - 1) % mLen; }
+
+    private:
+        unsigned Row(unsigned ii) const {
+            auto row = mHead + ii;
+            if (row >= mLen)
+                row -= mLen;
+            return row;
         }
 
-        FloatVector mSpectrums;
-        FloatVector mGains;
-        FloatVector mRealFFTs;
-        FloatVector mImagFFTs;
+        float *mBase{};
+        size_t mStride{};
+        size_t mFFTStride{};
+        unsigned mLen{};
+        unsigned mHead{};
     };
 
-    std::vector<std::unique_ptr<Record>> mQueue;
+    History mHistory;
+};
+
+//----------------------------------------------------------------------------
+// EffectNoiseReduction::LazyTask
+//----------------------------------------------------------------------------
+
+// Reduces the blocks of one track's range as readers demand them, each a
+// segment like those of ReduceNoiseInSegments, from a copy of the track
+// sharing its block files; the copy goes once all are reduced
+class EffectNoiseReduction::LazyTask final : public ODTask {
+public:
+    LazyTask(const Settings &settings, const Statistics &statistics, WaveTrack::Holder source,
+             sampleCount start, sampleCount len, size_t blockLen, size_t nBlocks,
+             const std::shared_ptr<DirManager> &dirManager)
+            : ODTask{nBlocks}, mSettings(settings), mStatistics(statistics), mSource{std::move(source)},
+              mFormat{mSource->GetSampleFormat()}, mRate{mSource->GetRate()}, mStart{start}, mLen{len},
+              mBlockLen{blockLen}, mDirManager{dirManager}, mScratch{std::make_shared<DirManager>(true)} {
+        // Stopped only when the blocks go, with no one left to read them
+        mSettings.mCancel = &GetStopping();
+    }
+
+    ~LazyTask() override {
+        Stop();
+    }
+
+protected:
+    BlockFilePtr ComputeBlock(size_t ii) override;
+
+    void OnComputed() override {
+        mSource.reset();
+        mScratch.reset();
+    }
+
+private:
+    Settings mSettings;
+    const Statistics mStatistics;
+    WaveTrack::Holder mSource;
+    const sampleFormat mFormat;
+    const double mRate;
+    const sampleCount mStart, mLen;
+    const size_t mBlockLen;
+    const std::shared_ptr<DirManager> mDirManager;
+    // Of the block reduced, before it is written to mDirManager
+    std::shared_ptr<DirManager> mScratch;
 };
 
+BlockFilePtr EffectNoiseReduction::LazyTask::ComputeBlock(size_t ii) {
+    const sampleCount segStart = mBlockLen * ii;
+    const auto segLen = limitSampleBufferSize(mBlockLen, mLen - segStart);
+
+    Worker worker(mSettings, mRate);
+    TrackFactory factory{mScratch};
+    const auto outputTrack = factory.NewWaveTrack(mFormat, mRate);
+    if (!worker.ProcessSegment(mStatistics, mSource.get(), outputTrack.get(),
+                               mStart, mLen, segStart, segLen))
+        return nullptr;
+
+    SampleBuffer samples(segLen, mFormat);
+    outputTrack->Get(samples.ptr(), mFormat, 0, segLen);
+    return mDirManager->NewSimpleBlockFile(samples.ptr(), segLen, mFormat);
+}
+
 EffectNoiseReduction::EffectNoiseReduction()
         : mSettings(std::make_unique<EffectNoiseReduction::Settings>()) {
     Init();
@@ -331,6 +764,78 @@ bool EffectNoiseReduction::Init() {
 EffectNoiseReduction::~EffectNoiseReduction() {
 }
 
+bool EffectNoiseReduction::SetFrequencyRange(double f0, double f1) {
+    if (f0 >= 0.0 && f1 >= 0.0 && !(f1 > f0))
+        return false;
+    mSettings->mF0 = f0;
+    mSettings->mF1 = f1;
+    return true;
+}
+
+void EffectNoiseReduction::SetAdaptiveProfile(double timeConstant) {
+    mSettings->mAdaptiveTime = std::max(0.0, timeConstant);
+}
+
+void EffectNoiseReduction::SetLowLatency(double milliseconds) {
+    mSettings->mMaxLatency = std::max(0.0, milliseconds);
+}
+
+bool EffectNoiseReduction::SetAdvancedSettings(const AdvancedSettings &settings) {
+    Settings candidate = *mSettings;
+    candidate.mWindowTypes = settings.windowTypes;
+    candidate.mWindowSizeChoice = settings.windowSizeChoice;
+    candidate.mStepsPerWindowChoice = settings.stepsPerWindowChoice;
+    candidate.mMethod = settings.method;
+    candidate.mAttackTime = settings.attackTime;
+    candidate.mReleaseTime = settings.releaseTime;
+    if (!candidate.Validate(this))
+        return false;
+    *mSettings = candidate;
+    return true;
+}
+
+auto EffectNoiseReduction::GetAdvancedSettings() const -> AdvancedSettings {
+    AdvancedSettings settings;
+    settings.windowTypes = mSettings->mWindowTypes;
+    settings.windowSizeChoice = mSettings->mWindowSizeChoice;
+    settings.stepsPerWindowChoice = mSettings->mStepsPerWindowChoice;
+    settings.method = mSettings->mMethod;
+    settings.attackTime = mSettings->mAttackTime;
+    settings.releaseTime = mSettings->mReleaseTime;
+    return settings;
+}
+
+size_t EffectNoiseReduction::GetWindowSize() const {
+    return mSettings->WindowSize();
+}
+
+bool EffectNoiseReduction::GetPreset(const std::string &name, AdvancedSettings &settings) {
+    AdvancedSettings preset;
+    if (name == "fast") {
+        preset.windowTypes = WT_HANN_RECTANGULAR;
+        preset.stepsPerWindowChoice = 0;
+    } else if (name == "quality") {
+        preset.windowSizeChoice = DEFAULT_WINDOW_SIZE_CHOICE + 1;
+        preset.stepsPerWindowChoice = DEFAULT_STEPS_PER_WINDOW_CHOICE + 1;
+    } else if (name != "default")
+        return false;
+    settings = preset;
+    return true;
+}
+
+bool EffectNoiseReduction::SetPreset(const std::string &name) {
+    AdvancedSettings settings;
+    return GetPreset(name, settings) && SetAdvancedSettings(settings);
+}
+
+void EffectNoiseReduction::SetCancel(const std::atomic<bool> *cancel) {
+    mSettings->mCancel = cancel;
+}
+
+bool EffectNoiseReduction::IsCancelled() const {
+    return mSettings->mCancel && mSettings->mCancel->load(std::memory_order_relaxed);
+}
+
 namespace {
 template<typename StructureType, typename FieldType>
 struct PrefsTableEntry {
@@ -355,7 +860,7 @@ bool EffectNoiseReduction::Settings::PrefsIO(bool read) {
             // Advanced settings
             {&Settings::mOldSensitivity,     "OldSensitivity", DEFAULT_OLD_SENSITIVITY},
     };
-    static int doubleTableSize = sizeof(doubleTable) / sizeof(doubleTable[0]);
+    static const int doubleTableSize = sizeof(doubleTable) / sizeof(doubleTable[0]);
 
     static const PrefsTableEntry<Settings, int> intTable[] = {
             {&Settings::mNoiseReductionChoice, "ReductionChoice", NRC_REDUCE_NOISE},
@@ -366,7 +871,7 @@ bool EffectNoiseReduction::Settings::PrefsIO(bool read) {
             {&Settings::mStepsPerWindowChoice, "StepsPerWindow",  DEFAULT_STEPS_PER_WINDOW_CHOICE},
             {&Settings::mMethod,               "Method",          DM_DEFAULT_METHOD},
     };
-    static int intTableSize = sizeof(intTable) / sizeof(intTable[0]);
+    static const int intTableSize = sizeof(intTable) / sizeof(intTable[0]);
 
     static const std::string prefix("/Effects/NoiseReduction/");
 
@@ -377,6 +882,7 @@ bool EffectNoiseReduction::Settings::PrefsIO(bool read) {
         mReleaseTime = doubleTable[3].defaultValue;
         mFreqSmoothingBands = doubleTable[4].defaultValue;
         mOldSensitivity = doubleTable[5].defaultValue;
+        mNoiseReductionChoice = intTable[0].defaultValue;
 
         // Ignore preferences for unavailable options.
 #ifndef RESIDUE_CHOICE
@@ -405,6 +911,26 @@ bool EffectNoiseReduction::Settings::PrefsIO(bool read) {
 }
 
 bool EffectNoiseReduction::Settings::Validate(EffectNoiseReduction *effect) const {
+    if (mWindowTypes < 0 || mWindowTypes >= WT_N_WINDOW_TYPES ||
+        mWindowSizeChoice < MIN_WINDOW_SIZE_CHOICE || mWindowSizeChoice > MAX_WINDOW_SIZE_CHOICE ||
+        mStepsPerWindowChoice < 0 || mStepsPerWindowChoice > MAX_STEPS_PER_WINDOW_CHOICE ||
+        mMethod < 0 || mMethod >= DM_N_METHODS) {
+        std::cerr << "An advanced setting is out of range." << std::endl;
+        return false;
+    }
+
+#ifndef OLD_METHOD_AVAILABLE
+    if (mMethod == DM_OLD_METHOD) {
+        std::cerr << "The old discrimination method is not available." << std::endl;
+        return false;
+    }
+#endif
+
+    if (!(mAttackTime >= 0.0 && mAttackTime <= 1.0 && mReleaseTime >= 0.0 && mReleaseTime <= 1.0)) {
+        std::cerr << "Attack and release times must be from 0 to 1 second." << std::endl;
+        return false;
+    }
+
     if (StepsPerWindow() < windowTypesInfo[mWindowTypes].minSteps) {
         std::cerr << "Steps per block are too few for the window types." << std::endl;
         return false;
@@ -415,11 +941,6 @@ bool EffectNoiseReduction::Settings::Validate(EffectNoiseReduction *effect) cons
         return false;
     }
 
-    if (mMethod == DM_MEDIAN && StepsPerWindow() > 4) {
-        std::cerr << "Median method is not implemented for more than four steps per window." << std::endl;
-        return false;
-    }
-
     return true;
 }
 
@@ -453,38 +974,382 @@ bool EffectNoiseReduction::GetProfile(WaveTrack *track, double t0, double t1,
     return Process(track);
 }
 
+bool EffectNoiseReduction::GetProfile(const std::vector<ProfileRegion> &regions,
+                                      double noiseGain, double sensitivity, double freqSmoothingBands,
+                                      TrackFactory *factory) {
+    if (regions.empty())
+        return false;
+
+    mFactory = factory;
+    mSettings->mDoProfile = true;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+    if (!Init())
+        return false;
+
+    const double rate = regions[0].track->GetRate();
+    for (const auto &region : regions)
+        if (region.track->GetRate() != rate) {
+            std::cerr << "All noise profile data must have the same sample rate." << std::endl;
+            mStatistics.reset();
+            return false;
+        }
+
+    // Each region gathers into statistics of its own
+    const size_t spectrumSize = 1 + mSettings->WindowSize() / 2;
+    std::vector<std::unique_ptr<Statistics>> partials;
+    for (size_t ii = 0; ii < regions.size(); ++ii)
+        partials.push_back(std::make_unique<Statistics>(spectrumSize, rate, mSettings->mWindowTypes));
+
+    // A worker per thread, constructed up front, as ReduceNoiseInSegments
+    // does; each takes the next region until none are left or one fails
+    const unsigned maxThreads = (mThreadCount > 0)
+                                ? mThreadCount
+                                : std::max(1u, std::thread::hardware_concurrency());
+    const auto nThreads = (unsigned) std::min<size_t>(regions.size(), maxThreads);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (unsigned ii = 0; ii < nThreads; ++ii) {
+        workers.push_back(std::make_unique<Worker>(*mSettings, rate));
+        workers.back()->SetReadAhead(mReadAheadBlocks);
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    const auto gather = [&](Worker &worker) {
+        while (!failed) {
+            const size_t ii = next++;
+            if (ii >= regions.size())
+                break;
+            const auto &region = regions[ii];
+            double t0 = region.t0, t1 = region.t1;
+            if (t1 > t0) {
+                // as for one track
+                const double duration = QUANTIZED_TIME(t1, rate) - QUANTIZED_TIME(t0, rate);
+                t1 = t0 + duration;
+            }
+            bool result = false;
+            try {
+                result = worker.Process(*this, region.track, *partials[ii], *mFactory, t0, t1);
+            } catch (...) {
+                std::cerr << "Noise profiling failed." << std::endl;
+            }
+            if (!result)
+                failed = true;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned ii = 1; ii < nThreads; ++ii)
+        threads.emplace_back(gather, std::ref(*workers[ii]));
+    gather(*workers[0]);
+    for (auto &thread : threads)
+        thread.join();
+
+    if (failed) {
+        // So that profiling must be done again before noise reduction
+        mStatistics.reset();
+        return false;
+    }
+
+    // In the order of the regions, so that the profile does not depend on
+    // which thread finished first
+    mStatistics = std::move(partials[0]);
+    for (size_t ii = 1; ii < partials.size(); ++ii)
+        mStatistics->Merge(*partials[ii]);
+    mSettings->mDoProfile = false;
+    return true;
+}
+
+bool EffectNoiseReduction::GetAutoProfile(const std::vector<WaveTrack *> &tracks, double fraction,
+                                          double noiseGain, double sensitivity, double freqSmoothingBands,
+                                          TrackFactory *factory) {
+    if (tracks.empty() || !(fraction > 0 && fraction <= 1))
+        return false;
+
+    mFactory = factory;
+    mSettings->mDoProfile = true;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+    mSettings->mQuietFraction = fraction;
+    auto restore = finally([this] { mSettings->mQuietFraction = 0.0; });
+
+    // All of every track, as ReduceNoise takes
+    mT0 = tracks[0]->GetStartTime();
+    mT1 = tracks[0]->GetEndTime();
+    for (const auto track : tracks) {
+        mT0 = std::min(mT0, track->GetStartTime());
+        mT1 = std::max(mT1, track->GetEndTime());
+    }
+
+    if (!Init())
+        return false;
+
+    return Process(tracks);
+}
+
+bool EffectNoiseReduction::GetProfile(const float *samples, size_t len, double rate) {
+    mSettings->mDoProfile = true;
+    if (!Init())
+        return false;
+
+    size_t spectrumSize = 1 + mSettings->WindowSize() / 2;
+    mStatistics = std::make_unique<Statistics>(spectrumSize, rate, mSettings->mWindowTypes);
+    Worker worker(*mSettings, rate
+    );
+    worker.ProfileSamples(*mStatistics, samples, len);
+
+    if (mStatistics->mTotalWindows == 0) {
+        std::cerr << "Selected noise profile is too short." << std::endl;
+        mStatistics.reset();
+        return false;
+    }
+    mSettings->mDoProfile = false;
+    return true;
+}
+
 bool
 EffectNoiseReduction::ReduceNoise(WaveTrack *track, double noiseGain, double sensitivity, double freqSmoothingBands,
                                   TrackFactory *factory) {
+    return ReduceNoise(std::vector<WaveTrack *>{track}, noiseGain, sensitivity, freqSmoothingBands, factory);
+}
+
+bool
+EffectNoiseReduction::ReduceNoise(const std::vector<WaveTrack *> &tracks, double noiseGain, double sensitivity,
+                                  double freqSmoothingBands, TrackFactory *factory) {
+    if (tracks.empty())
+        return false;
+
     mFactory = factory;
     mSettings->mDoProfile = false;
     mSettings->mFreqSmoothingBands = freqSmoothingBands;
     mSettings->mNoiseGain = noiseGain;
     mSettings->mNewSensitivity = sensitivity;
 
-    mT0 = track->GetStartTime();
-    mT1 = track->GetEndTime();
+    // Cover all of every track
+    mT0 = tracks[0]->GetStartTime();
+    mT1 = tracks[0]->GetEndTime();
+    for (const auto track : tracks) {
+        mT0 = std::min(mT0, track->GetStartTime());
+        mT1 = std::max(mT1, track->GetEndTime());
+    }
     double duration = 0.0;
     if (mT1 > mT0) {
         // there is a selection: let's fit in there...
         // MJS: note that this is just for the TTC and is independent of the track rate
         // but we do need to make sure we have the right number of samples at the project rate
-        double quantMT0 = QUANTIZED_TIME(mT0, track->GetRate());
-        double quantMT1 = QUANTIZED_TIME(mT1, track->GetRate());
+        double quantMT0 = QUANTIZED_TIME(mT0, tracks[0]->GetRate());
+        double quantMT1 = QUANTIZED_TIME(mT1, tracks[0]->GetRate());
         duration = quantMT1 - quantMT0;
         mT1 = mT0 + duration;
     }
 
-    return Process(track);
+    return Process(tracks);
+}
+
+auto EffectNoiseReduction::CreateStream(double noiseGain, double sensitivity, double freqSmoothingBands)
+-> std::unique_ptr<Stream> {
+    if (!mStatistics) {
+        std::cerr << "Noise profile must be taken or loaded before reducing noise." << std::endl;
+        return {};
+    }
+    mSettings->mDoProfile = false;
+    mSettings->mFreqSmoothingBands = freqSmoothingBands;
+    mSettings->mNoiseGain = noiseGain;
+    mSettings->mNewSensitivity = sensitivity;
+    if (mStatistics->mWindowSize != mSettings->WindowSize()) {
+        // possible only with advanced settings
+        std::cerr << "You must specify the same window size for steps 1 and 2." << std::endl;
+        return {};
+    }
+
+    auto worker = std::make_unique<Worker>(*mSettings, mStatistics->mRate
+    );
+    return std::unique_ptr<Stream>{new Stream{
+            std::move(worker), std::make_unique<Statistics>(*mStatistics)}};
+}
+
+EffectNoiseReduction::Stream::Stream(std::unique_ptr<Worker> worker, std::unique_ptr<Statistics> statistics)
+        : mStatistics(std::move(statistics)), mWorker(std::move(worker)) {
+    mWorker->StartStream(*mStatistics);
+}
+
+EffectNoiseReduction::Stream::~Stream() {
+}
+
+double EffectNoiseReduction::Stream::GetRate() const {
+    return mStatistics->mRate;
+}
+
+size_t EffectNoiseReduction::Stream::GetLatency() const {
+    return mWorker->Latency();
+}
+
+void EffectNoiseReduction::Stream::Push(const float *samples, size_t len) {
+    const auto before = mOutput.size();
+    mWorker->PushSamples(*mStatistics, samples, len, mOutput);
+    mPushed += len;
+    mProduced += mOutput.size() - before;
+}
+
+size_t EffectNoiseReduction::Stream::Available() const {
+    return mOutput.size() - mOutputStart;
+}
+
+size_t EffectNoiseReduction::Stream::Pull(float *samples, size_t len) {
+    len = std::min(len, Available());
+    std::copy(mOutput.begin() + mOutputStart, mOutput.begin() + mOutputStart + len, samples);
+    mOutputStart += len;
+    // Discard the pulled samples once they are the greater part of the buffer
+    if (mOutputStart > mOutput.size() / 2) {
+        mOutput.erase(mOutput.begin(), mOutput.begin() + mOutputStart);
+        mOutputStart = 0;
+    }
+    return len;
+}
+
+void EffectNoiseReduction::Stream::Flush() {
+    const auto before = mOutput.size();
+    mWorker->FinishStream(*mStatistics, mOutput);
+    mProduced += mOutput.size() - before;
+
+    // Drop the extra samples after the last pushed, as ProcessOne does
+    const auto extra = (mProduced - mPushed).as_size_t();
+    mOutput.resize(mOutput.size() - std::min(extra, Available()));
+
+    mPushed = mProduced = 0;
+    mWorker->StartStream(*mStatistics);
+}
+
+void EffectNoiseReduction::Stream::Reset() {
+    mOutput.clear();
+    mOutputStart = 0;
+    mPushed = mProduced = 0;
+    mWorker->StartStream(*mStatistics);
+}
+
+size_t EffectNoiseReduction::Stream::GetSegmentOverlap() const {
+    return mWorker->SegmentOverlap();
+}
+
+namespace {
+// Serialized noise profile: tag, then the fields below in native byte order
+// (like the .au block files), then mSums and mMeans.
+const char profileTag[] = "NRPROF01";
+const size_t profileTagLen = sizeof(profileTag) - 1;
+
+struct ProfileHeader {
+    double rate;
+    uint32_t windowSize;
+    int32_t windowTypes;
+    int32_t totalWindows;
+    uint32_t spectrumSize;
+};
+}
+
+bool EffectNoiseReduction::SaveProfile(std::vector<char> &blob) const {
+    if (!mStatistics) {
+        std::cerr << "There is no noise profile to save." << std::endl;
+        return false;
+    }
+
+    const Statistics &statistics = *mStatistics;
+    ProfileHeader header;
+    header.rate = statistics.mRate;
+    header.windowSize = statistics.mWindowSize;
+    header.windowTypes = statistics.mWindowTypes;
+    header.totalWindows = statistics.mTotalWindows;
+    header.spectrumSize = statistics.mMeans.size();
+
+    const size_t arrayBytes = header.spectrumSize * sizeof(float);
+    blob.resize(profileTagLen + sizeof(header) + 2 * arrayBytes);
+    char *p = &blob[0];
+    memcpy(p, profileTag, profileTagLen);
+    p += profileTagLen;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, &statistics.mSums[0], arrayBytes);
+    p += arrayBytes;
+    memcpy(p, &statistics.mMeans[0], arrayBytes);
+
+    return true;
+}
+
+bool EffectNoiseReduction::SaveProfile(const std::string &path) const {
+    std::vector<char> blob;
+    if (!SaveProfile(blob))
+        return false;
+
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Could not open noise profile for writing: " << path << std::endl;
+        return false;
+    }
+    file.write(&blob[0], blob.size());
+    return file.good();
+}
+
+bool EffectNoiseReduction::LoadProfile(const char *data, size_t size) {
+    ProfileHeader header;
+    if (size < profileTagLen + sizeof(header) ||
+        memcmp(data, profileTag, profileTagLen) != 0) {
+        std::cerr << "Not a noise profile." << std::endl;
+        return false;
+    }
+    memcpy(&header, data + profileTagLen, sizeof(header));
+
+    const size_t arrayBytes = size_t{header.spectrumSize} * sizeof(float);
+    if (header.windowSize < 2 ||
+        (header.windowSize & (header.windowSize - 1)) != 0 ||
+        header.spectrumSize != 1 + header.windowSize / 2 ||
+        header.windowTypes < 0 || header.windowTypes >= WT_N_WINDOW_TYPES ||
+        header.totalWindows <= 0 || !(header.rate > 0) ||
+        size != profileTagLen + sizeof(header) + 2 * arrayBytes) {
+        std::cerr << "Noise profile is corrupt." << std::endl;
+        return false;
+    }
+
+    auto statistics = std::make_unique<Statistics>
+            (header.spectrumSize, header.rate, header.windowTypes);
+    statistics->mTotalWindows = header.totalWindows;
+    const char *p = data + profileTagLen + sizeof(header);
+    memcpy(&statistics->mSums[0], p, arrayBytes);
+    p += arrayBytes;
+    memcpy(&statistics->mMeans[0], p, arrayBytes);
+
+    mStatistics = std::move(statistics);
+    mSettings->mDoProfile = false;
+    return true;
+}
+
+bool EffectNoiseReduction::LoadProfile(const std::string &path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Could not open noise profile: " << path << std::endl;
+        return false;
+    }
+    std::vector<char> blob{std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>()};
+    return LoadProfile(blob.data(), blob.size());
 }
 
 bool EffectNoiseReduction::Process(WaveTrack *track) {
+    return Process(std::vector<WaveTrack *>{track});
+}
+
+bool EffectNoiseReduction::Process(const std::vector<WaveTrack *> &tracks) {
+    if (tracks.empty())
+        return false;
+
     // Initialize statistics if gathering them, or check for mismatched (advanced)
     // settings if reducing noise.
     if (mSettings->mDoProfile) {
         size_t spectrumSize = 1 + mSettings->WindowSize() / 2;
         mStatistics = std::make_unique<Statistics>
-                (spectrumSize, track->GetRate(), mSettings->mWindowTypes);
+                (spectrumSize, tracks[0]->GetRate(), mSettings->mWindowTypes);
+    } else if (!mStatistics) {
+        std::cerr << "Noise profile must be taken or loaded before reducing noise." << std::endl;
+        return false;
     } else if (mStatistics->mWindowSize != mSettings->WindowSize()) {
         // possible only with advanced settings
         std::cerr << "You must specify the same window size for steps 1 and 2." << std::endl;
@@ -494,12 +1359,50 @@ bool EffectNoiseReduction::Process(WaveTrack *track) {
         std::cerr << "Warning: window types are not the same as for profiling." << std::endl;
     }
 
-    Worker worker(*mSettings, mStatistics->mRate
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
-            , mF0, mF1
-#endif
-    );
-    bool bGoodResult = worker.Process(*this, track, *mStatistics, *mFactory, mT0, mT1);
+    if (!mSettings->mDoProfile && mResampleProfile &&
+        std::any_of(tracks.begin(), tracks.end(), [this](const WaveTrack *track) {
+            return track->GetRate() != mStatistics->mRate;
+        })) {
+        // Reduce the tracks of each rate with the profile mapped to that rate
+        auto profile = std::move(mStatistics);
+        auto restore = finally([&] { mStatistics = std::move(profile); });
+        std::vector<WaveTrack *> remaining = tracks;
+        while (!remaining.empty()) {
+            const double rate = remaining[0]->GetRate();
+            const auto split = std::stable_partition(remaining.begin(), remaining.end(),
+                                                     [rate](const WaveTrack *track) {
+                                                         return track->GetRate() == rate;
+                                                     });
+            mStatistics = rate == profile->mRate ? std::make_unique<Statistics>(*profile)
+                                                 : profile->Resampled(rate);
+            if (!Process(std::vector<WaveTrack *>(remaining.begin(), split)))
+                return false;
+            remaining.erase(remaining.begin(), split);
+        }
+        return true;
+    }
+
+    const unsigned nThreads = (mThreadCount > 0)
+                              ? mThreadCount
+                              : std::max(1u, std::thread::hardware_concurrency());
+
+    bool bGoodResult = true;
+    if (!mSettings->mDoProfile && mLazy && mSettings->mAdaptiveTime <= 0)
+        bGoodResult = ReduceNoiseLazily(tracks);
+    else if (mSettings->mDoProfile || (tracks.size() == 1 && nThreads == 1)) {
+        // Profile statistics accumulate over all the tracks
+        Worker worker(*mSettings, mStatistics->mRate
+        );
+        worker.SetReadAhead(mReadAheadBlocks);
+        for (const auto track : tracks)
+            if (!(bGoodResult = worker.Process(*this, track, *mStatistics, *mFactory, mT0, mT1)))
+                break;
+    } else
+        // At least one thread per track; just one when adapting, as segments
+        // would each start again from the profile
+        bGoodResult = ReduceNoiseInSegments(tracks, mSettings->mAdaptiveTime > 0
+                                                    ? 1 : std::max<unsigned>(1, nThreads / tracks.size()));
+
     if (mSettings->mDoProfile) {
         if (bGoodResult)
             mSettings->mDoProfile = false; // So that "repeat last effect" will reduce noise
@@ -510,6 +1413,140 @@ bool EffectNoiseReduction::Process(WaveTrack *track) {
     return bGoodResult;
 }
 
+bool EffectNoiseReduction::ReduceNoiseInSegments(const std::vector<WaveTrack *> &tracks, unsigned nSegments) {
+    struct Segment {
+        WaveTrack *track;
+        // The range of the track being processed, and the part of it
+        // this segment outputs, relative to start
+        sampleCount start, len, segStart, segLen;
+        std::unique_ptr<Worker> worker;
+        WaveTrack::Holder outputTrack;
+        char result;
+    };
+
+    // Construct all workers up front, so that a failure leaves the tracks unchanged.
+    std::vector<Segment> segments;
+    for (const auto track : tracks) {
+        if (track->GetRate() != mStatistics->mRate) {
+            std::cerr << "The sample rate of the noise profile must match that of the sound to be processed."
+                      << std::endl;
+            return false;
+        }
+
+        const double t0 = std::max(track->GetStartTime(), mT0);
+        const double t1 = std::min(track->GetEndTime(), mT1);
+        if (!(t1 > t0))
+            continue;
+        const auto start = track->TimeToLongSamples(t0);
+        const auto len = track->TimeToLongSamples(t1) - start;
+
+        auto worker = std::make_unique<Worker>(*mSettings, mStatistics->mRate
+        );
+        // Segments shorter than the overlap would mostly repeat work,
+        // and their boundaries must fall on the step grid.
+        const sampleCount step = worker->StepSize();
+        const auto maxSegments = std::max(1LL, (len / worker->SegmentOverlap()).as_long_long());
+        const auto nn = std::min<long long>(nSegments, maxSegments);
+        const auto segLen = ((len + nn - 1) / nn + step - 1) / step * step;
+
+        for (sampleCount segStart = 0; segStart < len; segStart += segLen) {
+            Segment segment;
+            segment.track = track;
+            segment.start = start;
+            segment.len = len;
+            segment.segStart = segStart;
+            segment.segLen = std::min(segLen, len - segStart);
+            segment.worker = worker
+                             ? std::move(worker)
+                             : std::make_unique<Worker>(*mSettings, mStatistics->mRate
+                             );
+            segment.worker->SetReadAhead(mReadAheadBlocks);
+            segment.outputTrack = mFactory->NewWaveTrack(track->GetSampleFormat(), track->GetRate());
+            segment.result = 0;
+            segments.push_back(std::move(segment));
+        }
+    }
+
+    // Noise reduction only reads the statistics.
+    std::vector<std::thread> threads;
+    for (auto &segment : segments)
+        threads.emplace_back([this, &segment] {
+            try {
+                segment.result = segment.worker->ProcessSegment(
+                        *mStatistics, segment.track, segment.outputTrack.get(),
+                        segment.start, segment.len, segment.segStart, segment.segLen);
+            } catch (...) {
+                std::cerr << "Noise reduction failed." << std::endl;
+            }
+        });
+    for (auto &thread : threads)
+        thread.join();
+
+    if (!std::all_of(segments.begin(), segments.end(),
+                     [](const Segment &segment) { return segment.result != 0; }))
+        return false;
+
+    // Stitch the segments of each track in order, then replace the track's samples
+    for (auto it = segments.begin(), end = segments.end(); it != end;) {
+        WaveTrack *outputTrack = it->outputTrack.get();
+        WaveClip *clip = outputTrack->GetClipByIndex(0);
+        const auto first = it;
+        for (++it; it != end && it->track == first->track; ++it)
+            if (clip && it->outputTrack->GetNumClips() > 0)
+                clip->Paste(clip->GetEndTime(), it->outputTrack->GetClipByIndex(0));
+
+        ReplaceWithOutput(first->track, outputTrack, first->start, first->len);
+    }
+
+    return true;
+}
+
+bool EffectNoiseReduction::ReduceNoiseLazily(const std::vector<WaveTrack *> &tracks) {
+    struct Lazy {
+        WaveTrack *track;
+        sampleCount start, len;
+        std::shared_ptr<LazyTask> task;
+        WaveTrack::Holder outputTrack;
+    };
+
+    // Blocks on the step grid, as segments are, for windows to line up
+    const size_t step = mSettings->WindowSize() / mSettings->StepsPerWindow();
+    std::vector<Lazy> lazies;
+    for (const auto track : tracks) {
+        if (track->GetRate() != mStatistics->mRate) {
+            std::cerr << "The sample rate of the noise profile must match that of the sound to be processed."
+                      << std::endl;
+            return false;
+        }
+
+        const double t0 = std::max(track->GetStartTime(), mT0);
+        const double t1 = std::min(track->GetEndTime(), mT1);
+        if (!(t1 > t0))
+            continue;
+        Lazy lazy;
+        lazy.track = track;
+        lazy.start = track->TimeToLongSamples(t0);
+        lazy.len = track->TimeToLongSamples(t1) - lazy.start;
+        lazy.outputTrack = mFactory->NewWaveTrack(track->GetSampleFormat(), track->GetRate());
+
+        const size_t blockLen = lazy.outputTrack->GetMaxBlockSize() / step * step;
+        const auto nBlocks = ((lazy.len + blockLen - 1) / blockLen).as_size_t();
+        lazy.task = std::make_shared<LazyTask>(*mSettings, *mStatistics, mFactory->DuplicateWaveTrack(*track),
+                                               lazy.start, lazy.len, blockLen, nBlocks, mFactory->mDirManager);
+        for (size_t ii = 0; ii < nBlocks; ++ii)
+            lazy.outputTrack->AppendBlockFile(make_blockfile<ODComputedBlockFile>(
+                    lazy.task, ii, limitSampleBufferSize(blockLen, lazy.len - blockLen * ii)));
+        lazies.push_back(std::move(lazy));
+    }
+
+    for (auto &lazy : lazies) {
+        ReplaceWithOutput(lazy.track, lazy.outputTrack.get(), lazy.start, lazy.len);
+        if (mLazyBackground)
+            lazy.task->Start();
+    }
+    return true;
+}
+
 EffectNoiseReduction::Worker::~Worker() {
 }
 
@@ -552,61 +1589,48 @@ bool EffectNoiseReduction::Worker::Process
     return true;
 }
 
-void EffectNoiseReduction::Worker::ApplyFreqSmoothing(FloatVector &gains) {
+void EffectNoiseReduction::Worker::ApplyFreqSmoothing(float *gains) {
     // Given an array of gain mutipliers, average them
-    // GEOMETRICALLY.  Don't multiply and take nth root --
-    // that may quickly cause underflows.  Instead, average the logs.
-
-    if (mFreqSmoothingBins == 0)
+    // GEOMETRICALLY.
+    if (mFreqSmoothingBins == 0 || mBinHigh == mBinLow)
         return;
 
-    {
-        float *pScratch = &mFreqSmoothingScratch[0];
-        std::fill(pScratch, pScratch + mSpectrumSize, 0.0f);
-    }
-
-    for (size_t ii = 0; ii < mSpectrumSize; ++ii)
-        gains[ii] = log(gains[ii]);
-
-    // ii must be signed
-    for (int ii = 0; ii < (int) mSpectrumSize; ++ii) {
-        const int j0 = std::max(0, ii - (int) mFreqSmoothingBins);
-        const int j1 = std::min(mSpectrumSize - 1, ii + mFreqSmoothingBins);
-        for (int jj = j0; jj <= j1; ++jj) {
-            mFreqSmoothingScratch[ii] += gains[jj];
-        }
-        mFreqSmoothingScratch[ii] /= (j1 - j0 + 1);
-    }
-
-    for (size_t ii = 0; ii < mSpectrumSize; ++ii)
-        gains[ii] = exp(mFreqSmoothingScratch[ii]);
+    // Of the bands affected only, as if they were all
+    SmoothGainsGeometrically(gains + mBinLow, mFreqSmoothingScratch, mBinHigh - mBinLow, mFreqSmoothingBins);
 }
 
 EffectNoiseReduction::Worker::Worker
         (const Settings &settings, double sampleRate
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
-        , double f0, double f1
-#endif
 )
         : mDoProfile(settings.mDoProfile), mSampleRate(sampleRate), mWindowSize(settings.WindowSize()),
-          hFFT(GetFFT(mWindowSize)), mFFTBuffer(mWindowSize), mInWaveBuffer(mWindowSize),
-          mOutOverlapBuffer(mWindowSize), mInWindow(), mOutWindow(), mSpectrumSize(1 + mWindowSize / 2),
-          mFreqSmoothingScratch(mSpectrumSize), mFreqSmoothingBins((int) (settings.mFreqSmoothingBands)), mBinLow(0),
+          mFFT(CreateFFTBackend(mWindowSize)), mFFTBuffer(mArena.AllocateZeroed<float>(mWindowSize)),
+          mInWaveBuffer(mArena.AllocateZeroed<float>(mWindowSize)),
+          mOutOverlapBuffer(mArena.AllocateZeroed<float>(mWindowSize)), mInWindow(), mOutWindow(),
+          mSpectrumSize(1 + mWindowSize / 2),
+          mFreqSmoothingScratch(mArena.AllocateZeroed<double>(mSpectrumSize + 1)),
+          mAttackActive(mArena.AllocateZeroed<float>(mSpectrumSize)),
+          mThresholds(mArena.AllocateZeroed<float>(mSpectrumSize)),
+          mAdaptedMeans(!mDoProfile && settings.mAdaptiveTime > 0 ? mArena.AllocateZeroed<float>(mSpectrumSize)
+                                                                  : nullptr),
+          mNoiseMask(mArena.AllocateZeroed<float>(mSpectrumSize)), mClassifyRows(), mSortedPowers(),
+          mProfileFrames(mDoProfile ? mArena.AllocateZeroed<float>(mWindowSize * profileBatchFrames) : nullptr),
+          mProfileFrameCount(0), mQuietFraction(mDoProfile ? settings.mQuietFraction : 0.0),
+          mFreqSmoothingBins((int) (settings.mFreqSmoothingBands)), mBinLow(0),
           mBinHigh(mSpectrumSize), mNoiseReductionChoice(settings.mNoiseReductionChoice),
           mStepsPerWindow(settings.StepsPerWindow()), mStepSize(mWindowSize / mStepsPerWindow),
           mMethod(settings.mMethod)
 
 // Sensitivity setting is a base 10 log, turn it into a natural log
-        , mNewSensitivity(settings.mNewSensitivity * log(10.0)), mInSampleCount(0), mOutStepCount(0), mInWavePos(0) {
-#ifdef EXPERIMENTAL_SPECTRAL_EDITING
+        , mNewSensitivity(settings.mNewSensitivity * log(10.0)), mInSampleCount(0), mOutStepCount(0), mInWavePos(0),
+          mCancel(settings.mCancel) {
     {
-       const double bin = mSampleRate / mWindowSize;
-       if (f0 >= 0.0 )
-          mBinLow = floor(f0 / bin);
-       if (f1 >= 0.0)
-          mBinHigh = ceil(f1 / bin);
+        const double bin = mSampleRate / mWindowSize;
+        // Bins from the one at or below f0 to the one at or below f1
+        if (settings.mF0 >= 0.0)
+            mBinLow = std::min<int>(mSpectrumSize, floor(settings.mF0 / bin));
+        if (settings.mF1 >= 0.0)
+            mBinHigh = std::max(mBinLow, std::min<int>(mSpectrumSize, floor(settings.mF1 / bin) + 1));
     }
-#endif
 
     const double noiseGain = -settings.mNoiseGain;
     const unsigned nAttackBlocks = 1 + (int) (settings.mAttackTime * sampleRate / mStepSize);
@@ -618,6 +1642,8 @@ EffectNoiseReduction::Worker::Worker
     mOneBlockRelease = DB_TO_LINEAR(noiseGain / nReleaseBlocks);
     // Applies to power, divide by 10:
     mOldSensitivityFactor = pow(10.0, settings.mOldSensitivity / 10.0);
+    // Each step, what is left of the past decays by exp(-step time / time constant)
+    mAdaptRate = mAdaptedMeans ? -expm1(-(mStepSize / sampleRate) / settings.mAdaptiveTime) : 0.0f;
 
     mNWindowsToExamine = (mMethod == DM_OLD_METHOD)
                          ? std::max(2, (int) (minSignalTime * sampleRate / mStepSize))
@@ -625,6 +1651,10 @@ EffectNoiseReduction::Worker::Worker
 
     mCenter = mNWindowsToExamine / 2;
     assert(mCenter >= 1); // release depends on this assumption
+    mClassifyRows = mArena.Allocate<const float *>(mNWindowsToExamine);
+    if (!mDoProfile && mMethod == DM_MEDIAN && mNWindowsToExamine > 5)
+        mSortedPowers = mArena.Allocate<float>(mSpectrumSize * mNWindowsToExamine);
+    mEmpty = mArena.AllocateZeroed<float>(mStepSize);
 
     if (mDoProfile)
 #ifdef OLD_METHOD_AVAILABLE
@@ -637,92 +1667,52 @@ EffectNoiseReduction::Worker::Worker
         // and for attack processing
         // See ReduceNoise()
         mHistoryLen = std::max(mNWindowsToExamine, mCenter + nAttackBlocks);
+        if (settings.mMaxLatency > 0) {
+            // Hold only the windows that Latency() allows, however long the
+            // attack:  it raises the gains of those older than the center
+            // that are not yet output, and not those already gone
+            const auto maxSteps = (size_t) (settings.mMaxLatency / 1000.0 * sampleRate / mStepSize);
+            const auto maxHistoryLen = maxSteps + 2 > mStepsPerWindow ? maxSteps + 2 - mStepsPerWindow : 1;
+            mHistoryLen = std::max<size_t>(mNWindowsToExamine, std::min<size_t>(mHistoryLen, maxHistoryLen));
+        }
     }
 
-    mQueue.resize(mHistoryLen);
-    for (unsigned ii = 0; ii < mHistoryLen; ++ii)
-        mQueue[ii] = std::make_unique<Record>(mSpectrumSize);
+    // A window influences the gains of others at most nAttackBlocks earlier
+    // and nReleaseBlocks later, after which they are clamped to
+    // mNoiseAttenFactor again; add the history, the overlapping windows and
+    // some margin for rounding in the decay.
+    mSegmentOverlap = mWindowSize +
+                      (mHistoryLen + mStepsPerWindow + nAttackBlocks + nReleaseBlocks + 4) * mStepSize;
 
-    // Create windows
-
-    const double constantTerm =
-            windowTypesInfo[settings.mWindowTypes].productConstantTerm;
+    mHistory.Reset(mHistoryLen, mSpectrumSize, mArena);
 
-    // One or the other window must by multiplied by this to correct for
-    // overlap.  Must scale down as steps get smaller, and overlaps larger.
-    const double multiplier = 1.0 / (constantTerm * mStepsPerWindow);
-
-    // Create the analysis window
-    switch (settings.mWindowTypes) {
-        case WT_RECTANGULAR_HANN:
-            break;
-        default: {
-            const bool rectangularOut =
-                    settings.mWindowTypes == WT_HAMMING_RECTANGULAR ||
-                    settings.mWindowTypes == WT_HANN_RECTANGULAR;
-            const double m =
-                    rectangularOut ? multiplier : 1;
-            const double *const coefficients =
-                    windowTypesInfo[settings.mWindowTypes].inCoefficients;
-            const double c0 = coefficients[0];
-            const double c1 = coefficients[1];
-            const double c2 = coefficients[2];
-            mInWindow.resize(mWindowSize);
-            for (size_t ii = 0; ii < mWindowSize; ++ii)
-                mInWindow[ii] = m *
-                                (c0 + c1 * cos((2.0 * M_PI * ii) / mWindowSize)
-                                 + c2 * cos((4.0 * M_PI * ii) / mWindowSize));
-        }
-            break;
-    }
-
-    if (!mDoProfile) {
-        // Create the synthesis window
-        switch (settings.mWindowTypes) {
-            case WT_HANN_RECTANGULAR:
-            case WT_HAMMING_RECTANGULAR:
-                break;
-            case WT_HAMMING_INV_HAMMING: {
-                mOutWindow.resize(mWindowSize);
-                for (size_t ii = 0; ii < mWindowSize; ++ii)
-                    mOutWindow[ii] = multiplier / mInWindow[ii];
-            }
-                break;
-            default: {
-                const double *const coefficients =
-                        windowTypesInfo[settings.mWindowTypes].outCoefficients;
-                const double c0 = coefficients[0];
-                const double c1 = coefficients[1];
-                const double c2 = coefficients[2];
-                mOutWindow.resize(mWindowSize);
-                for (size_t ii = 0; ii < mWindowSize; ++ii)
-                    mOutWindow[ii] = multiplier *
-                                     (c0 + c1 * cos((2.0 * M_PI * ii) / mWindowSize)
-                                      + c2 * cos((4.0 * M_PI * ii) / mWindowSize));
-            }
-                break;
-        }
-    }
+    mWindows = GetWindows(settings.mWindowTypes, mWindowSize, mStepsPerWindow);
+    mInWindow = mWindows->mIn.empty() ? nullptr : &mWindows->mIn[0];
+    // The synthesis window is not needed for profiling
+    mOutWindow = mDoProfile || mWindows->mOut.empty() ? nullptr : &mWindows->mOut[0];
 }
 
 void EffectNoiseReduction::Worker::StartNewTrack() {
     float *pFill;
     for (unsigned ii = 0; ii < mHistoryLen; ++ii) {
-        Record &record = *mQueue[ii];
-
-        pFill = &record.mSpectrums[0];
+        pFill = mHistory.Spectrums(ii);
         std::fill(pFill, pFill + mSpectrumSize, 0.0f);
 
-        pFill = &record.mRealFFTs[0];
-        std::fill(pFill, pFill + mSpectrumSize - 1, 0.0f);
-
-        pFill = &record.mImagFFTs[0];
-        std::fill(pFill, pFill + mSpectrumSize - 1, 0.0f);
+        pFill = mHistory.FFTs(ii);
+        std::fill(pFill, pFill + mWindowSize, 0.0f);
 
-        pFill = &record.mGains[0];
-        std::fill(pFill, pFill + mSpectrumSize, mNoiseAttenFactor);
+        // Gains outside the bands affected are never changed from these
+        pFill = mHistory.Gains(ii);
+        const float outside = mNoiseReductionChoice == NRC_ISOLATE_NOISE ? 0.0f : 1.0f;
+        std::fill(pFill, pFill + mBinLow, outside);
+        std::fill(pFill + mBinLow, pFill + mBinHigh, mNoiseAttenFactor);
+        std::fill(pFill + mBinHigh, pFill + mSpectrumSize, outside);
     }
 
+    // The zeros of the history, but for the newest window
+    if (mSortedPowers)
+        std::fill(mSortedPowers, mSortedPowers + mSpectrumSize * mNWindowsToExamine, 0.0f);
+
     pFill = &mOutOverlapBuffer[0];
     std::fill(pFill, pFill + mWindowSize, 0.0f);
 
@@ -746,11 +1736,13 @@ void EffectNoiseReduction::Worker::StartNewTrack() {
     }
 
     mInSampleCount = 0;
+    mProfileFrameCount = 0;
 }
 
 void EffectNoiseReduction::Worker::ProcessSamples
-        (Statistics &statistics, WaveTrack *outputTrack,
-         size_t len, float *buffer) {
+        (const Statistics &statistics, Statistics *profile, WaveTrack *outputTrack,
+         size_t len, const float *buffer) {
+    NOISERED_TIMED(Steps);
     while (len && mOutStepCount * mStepSize < mInSampleCount) {
         auto avail = std::min(len, mWindowSize - mInWavePos);
         memmove(&mInWaveBuffer[mInWavePos], buffer, avail * sizeof(float));
@@ -759,11 +1751,20 @@ void EffectNoiseReduction::Worker::ProcessSamples
         mInWavePos += avail;
 
         if (mInWavePos == (int) mWindowSize) {
-            FillFirstHistoryWindow();
-            if (mDoProfile)
-                GatherStatistics(statistics);
-            else
+            NOISERED_COUNT(Windows, 1);
+            if (mDoProfile) {
+                NOISERED_TIMED(Profile);
+#ifdef OLD_METHOD_AVAILABLE
+                // The old statistics examine the history of spectra
+                FillFirstHistoryWindow();
+                GatherStatistics(*profile);
+#else
+                AddProfileWindow(*profile);
+#endif
+            } else {
+                FillFirstHistoryWindow();
                 ReduceNoise(statistics, outputTrack);
+            }
             ++mOutStepCount;
             RotateHistoryWindows();
 
@@ -776,53 +1777,37 @@ void EffectNoiseReduction::Worker::ProcessSamples
 }
 
 void EffectNoiseReduction::Worker::FillFirstHistoryWindow() {
-    // Transform samples to frequency domain, windowed as needed
-    if (mInWindow.size() > 0)
-        for (size_t ii = 0; ii < mWindowSize; ++ii)
-            mFFTBuffer[ii] = mInWaveBuffer[ii] * mInWindow[ii];
-    else
-        memmove(&mFFTBuffer[0], &mInWaveBuffer[0], mWindowSize * sizeof(float));
-    RealFFTf(&mFFTBuffer[0], hFFT.get());
-
-    Record &record = *mQueue[0];
-
-    // Store real and imaginary parts for later inverse FFT, and compute
-    // power
-    {
-        float *pReal = &record.mRealFFTs[1];
-        float *pImag = &record.mImagFFTs[1];
-        float *pPower = &record.mSpectrums[1];
-        int *pBitReversed = &hFFT->BitReversed[1];
-        const auto last = mSpectrumSize - 1;
-        for (unsigned int ii = 1; ii < last; ++ii) {
-            const int kk = *pBitReversed++;
-            const float realPart = *pReal++ = mFFTBuffer[kk];
-            const float imagPart = *pImag++ = mFFTBuffer[kk + 1];
-            *pPower++ = realPart * realPart + imagPart * imagPart;
-        }
-        // DC and Fs/2 bins need to be handled specially
-        const float dc = mFFTBuffer[0];
-        record.mRealFFTs[0] = dc;
-        record.mSpectrums[0] = dc * dc;
-
-        const float nyquist = mFFTBuffer[1];
-        record.mImagFFTs[0] = nyquist; // For Fs/2, not really imaginary
-        record.mSpectrums[last] = nyquist * nyquist;
-    }
+    NOISERED_TIMED(FFT);
+    // Transform samples to frequency domain, windowed as needed, storing
+    // the spectrum packed for later inverse FFT, and the power
+    mFFT->ForwardSpectrum(&mInWaveBuffer[0], mInWindow, &mFFTBuffer[0],
+                          mHistory.FFTs(0), mHistory.Spectrums(0));
 
     if (mNoiseReductionChoice != NRC_ISOLATE_NOISE) {
-        // Default all gains to the reduction factor,
+        // Default all gains of the bands affected to the reduction factor,
         // until we decide to raise some of them later
-        float *pGain = &record.mGains[0];
-        std::fill(pGain, pGain + mSpectrumSize, mNoiseAttenFactor);
+        float *pGain = mHistory.Gains(0);
+        std::fill(pGain + mBinLow, pGain + mBinHigh, mNoiseAttenFactor);
     }
 }
 
 void EffectNoiseReduction::Worker::RotateHistoryWindows() {
-    std::rotate(mQueue.begin(), mQueue.end() - 1, mQueue.end());
+    // The oldest window examined will not be next time
+    if (mSortedPowers)
+        RemoveSortedBands(mSortedPowers, mNWindowsToExamine, mNWindowsToExamine,
+                          mHistory.Spectrums(mNWindowsToExamine - 1), mBinLow, mBinHigh);
+    mHistory.Rotate();
 }
 
 void EffectNoiseReduction::Worker::FinishTrackStatistics(Statistics &statistics) {
+    NOISERED_TIMED(Profile);
+    if (mProfileFrameCount > 0)
+        GatherBatchStatistics(statistics);
+    if (mQuietWindows) {
+        statistics.mTrackWindows += mQuietWindows->AddTo(&statistics.mSums[0]);
+        mQuietWindows.reset();
+    }
+
     const int windows = statistics.mTrackWindows;
     const int multiplier = statistics.mTotalWindows;
     const int denom = windows + multiplier;
@@ -843,7 +1828,7 @@ void EffectNoiseReduction::Worker::FinishTrackStatistics(Statistics &statistics)
 }
 
 void EffectNoiseReduction::Worker::FinishTrack
-        (Statistics &statistics, WaveTrack *outputTrack) {
+        (const Statistics &statistics, WaveTrack *outputTrack) {
     // Keep flushing empty input buffers through the history
     // windows until we've output exactly as many samples as
     // were input.
@@ -851,10 +1836,8 @@ void EffectNoiseReduction::Worker::FinishTrack
     // at the end.
     // We'll DELETE them later in ProcessOne.
 
-    FloatVector empty(mStepSize);
-
     while (mOutStepCount * mStepSize < mInSampleCount) {
-        ProcessSamples(statistics, outputTrack, mStepSize, &empty[0]);
+        ProcessSamples(statistics, nullptr, outputTrack, mStepSize, mEmpty);
     }
 }
 
@@ -863,7 +1846,7 @@ void EffectNoiseReduction::Worker::GatherStatistics(Statistics &statistics) {
 
     {
         // NEW statistics
-        const float *pPower = &mQueue[0]->mSpectrums[0];
+        const float *pPower = mHistory.Spectrums(0);
         float *pSum = &statistics.mSums[0];
         for (size_t jj = 0; jj < mSpectrumSize; ++jj) {
             *pSum++ += *pPower++;
@@ -879,12 +1862,12 @@ void EffectNoiseReduction::Worker::GatherStatistics(Statistics &statistics) {
 
     {
        // old statistics
-       const float *pPower = &mQueue[0]->mSpectrums[0];
+       const float *pPower = mHistory.Spectrums(0);
        float *pThreshold = &statistics.mNoiseThreshold[0];
        for (int jj = 0; jj < mSpectrumSize; ++jj) {
           float min = *pPower++;
           for (unsigned ii = 1; ii < finish; ++ii)
-             min = std::min(min, mQueue[ii]->mSpectrums[jj]);
+             min = std::min(min, mHistory.Spectrums(ii)[jj]);
           *pThreshold = std::max(*pThreshold, min);
           ++pThreshold;
        }
@@ -892,6 +1875,75 @@ void EffectNoiseReduction::Worker::GatherStatistics(Statistics &statistics) {
 #endif
 }
 
+void EffectNoiseReduction::Worker::AddProfileWindow(Statistics &statistics) {
+    float *const frame = &mProfileFrames[mProfileFrameCount];
+    if (mInWindow)
+        for (size_t ii = 0; ii < mWindowSize; ++ii)
+            frame[ii * profileBatchFrames] = mInWaveBuffer[ii] * mInWindow[ii];
+    else
+        for (size_t ii = 0; ii < mWindowSize; ++ii)
+            frame[ii * profileBatchFrames] = mInWaveBuffer[ii];
+
+    if (++mProfileFrameCount == profileBatchFrames)
+        GatherBatchStatistics(statistics);
+}
+
+void EffectNoiseReduction::Worker::GatherBatchStatistics(Statistics &statistics) {
+    const size_t count = mProfileFrameCount;
+    float *const frames = &mProfileFrames[0];
+    // Clear what earlier batches left in unused frames, so it stays finite
+    if (count < profileBatchFrames)
+        for (size_t ii = 0; ii < mWindowSize; ++ii)
+            std::fill(frames + ii * profileBatchFrames + count,
+                      frames + (ii + 1) * profileBatchFrames, 0.0f);
+
+    {
+        NOISERED_TIMED(FFTBatch);
+        mFFT->ForwardFrames(frames, profileBatchFrames);
+    }
+
+    const auto last = mSpectrumSize - 1;
+    if (mQuietWindows) {
+        // Offer the power spectrum of each frame in order
+        for (size_t ff = 0; ff < count; ++ff) {
+            float *const power = mQuietWindows->Candidate();
+            for (size_t ii = 1; ii < last; ++ii) {
+                const float *pReal = frames + mFFT->SpectrumOrder()[ii] * profileBatchFrames;
+                const float *pImag = pReal + profileBatchFrames;
+                power[ii] = pReal[ff] * pReal[ff] + pImag[ff] * pImag[ff];
+            }
+            power[0] = frames[ff] * frames[ff];
+            power[last] = frames[profileBatchFrames + ff] * frames[profileBatchFrames + ff];
+            mQuietWindows->Offer();
+        }
+        mProfileFrameCount = 0;
+        return;
+    }
+
+    // Add the power of each frame in order, as GatherStatistics would
+    statistics.mTrackWindows += count;
+    float *const sums = &statistics.mSums[0];
+    for (size_t ii = 1; ii < last; ++ii) {
+        const int kk = mFFT->SpectrumOrder()[ii];
+        const float *pReal = frames + kk * profileBatchFrames;
+        const float *pImag = pReal + profileBatchFrames;
+        float &sum = sums[ii];
+        for (size_t ff = 0; ff < count; ++ff) {
+            const float power = pReal[ff] * pReal[ff] + pImag[ff] * pImag[ff];
+            sum += power;
+        }
+    }
+    // DC and Fs/2 bins need to be handled specially
+    for (size_t ff = 0; ff < count; ++ff) {
+        const float dc = frames[ff];
+        sums[0] += dc * dc;
+        const float nyquist = frames[profileBatchFrames + ff];
+        sums[last] += nyquist * nyquist;
+    }
+
+    mProfileFrameCount = 0;
+}
+
 // Return true iff the given band of the "center" window looks like noise.
 // Examine the band in a few neighboring windows to decide.
 inline
@@ -900,9 +1952,9 @@ bool EffectNoiseReduction::Worker::Classify(const Statistics &statistics, int ba
 #ifdef OLD_METHOD_AVAILABLE
         case DM_OLD_METHOD:
            {
-              float min = mQueue[0]->mSpectrums[band];
+              float min = mHistory.Spectrums(0)[band];
               for (unsigned ii = 1; ii < mNWindowsToExamine; ++ii)
-                 min = std::min(min, mQueue[ii]->mSpectrums[band]);
+                 min = std::min(min, mHistory.Spectrums(ii)[band]);
               return min <= mOldSensitivityFactor * statistics.mNoiseThreshold[band];
            }
 #endif
@@ -925,7 +1977,7 @@ bool EffectNoiseReduction::Worker::Classify(const Statistics &statistics, int ba
             else if (mNWindowsToExamine == 5) {
                 float greatest = 0.0, second = 0.0, third = 0.0;
                 for (unsigned ii = 0; ii < mNWindowsToExamine; ++ii) {
-                    const float power = mQueue[ii]->mSpectrums[band];
+                    const float power = mHistory.Spectrums(ii)[band];
                     if (power >= greatest)
                         third = second, second = greatest, greatest = power;
                     else if (power >= second)
@@ -935,7 +1987,9 @@ bool EffectNoiseReduction::Worker::Classify(const Statistics &statistics, int ba
                 }
                 return third <= mNewSensitivity * statistics.mMeans[band];
             } else {
-                return true;
+                // Of more windows, as ClassifyAllBands() slides it
+                const float median = mSortedPowers[band * mNWindowsToExamine + mNWindowsToExamine / 2];
+                return median <= mNewSensitivity * statistics.mMeans[band];
             }
         secondGreatest:
         case DM_SECOND_GREATEST: {
@@ -944,7 +1998,7 @@ bool EffectNoiseReduction::Worker::Classify(const Statistics &statistics, int ba
             // chimes.
             float greatest = 0.0, second = 0.0;
             for (unsigned ii = 0; ii < mNWindowsToExamine; ++ii) {
-                const float power = mQueue[ii]->mSpectrums[band];
+                const float power = mHistory.Spectrums(ii)[band];
                 if (power >= greatest)
                     second = greatest, greatest = power;
                 else if (power >= second)
@@ -959,53 +2013,120 @@ bool EffectNoiseReduction::Worker::Classify(const Statistics &statistics, int ba
 
 }
 
+namespace {
+// Classify compares a float power with a double threshold; comparing
+// with the greatest float not exceeding it gives the same answer
+inline float RoundThreshold(double threshold) {
+    float rounded = (float) threshold;
+    if (rounded > threshold)
+        rounded = std::nextafter(rounded, -std::numeric_limits<float>::infinity());
+    return rounded;
+}
+}
+
+void EffectNoiseReduction::Worker::PrepareThresholds(const Statistics &statistics) {
+    // Adaptation starts again from the profile
+    if (mAdaptedMeans)
+        std::copy(statistics.mMeans.begin(), statistics.mMeans.end(), mAdaptedMeans);
+    for (size_t jj = 0; jj < mSpectrumSize; ++jj)
+        mThresholds[jj] = RoundThreshold(mNewSensitivity * statistics.mMeans[jj]);
+}
+
+bool EffectNoiseReduction::Worker::CenterWindowIsInput() const {
+    // Windows are counted from the first transformed, which has just one
+    // step of input at its end; see StartNewTrack()
+    const sampleCount center = mOutStepCount + (int) (mHistoryLen - 1 + mStepsPerWindow - 1 - mCenter);
+    return center >= (int) (mStepsPerWindow - 1) && (center + 1) * mStepSize <= mInSampleCount;
+}
+
+void EffectNoiseReduction::Worker::AdaptProfile() {
+    const float *const pPower = mHistory.Spectrums(mCenter);
+    for (int jj = mBinLow; jj < mBinHigh; ++jj) {
+        float &mean = mAdaptedMeans[jj];
+        mean += mAdaptRate * (pPower[jj] - mean);
+        mThresholds[jj] = RoundThreshold(mNewSensitivity * mean);
+    }
+}
+
+void EffectNoiseReduction::Worker::ClassifyAllBands(const Statistics &statistics) {
+    // Same decisions as Classify, but for the whole band range at once
+    unsigned rank = 0;
+    switch (mMethod) {
+        case DM_MEDIAN:
+            if (mNWindowsToExamine == 3)
+                // No different from second greatest.
+                rank = 2;
+            else if (mNWindowsToExamine == 5)
+                rank = 3;
+            else {
+                // Add the newest window to the sorted powers of the others,
+                // from which RotateHistoryWindows() took the one leaving
+                const unsigned nn = mNWindowsToExamine;
+                InsertSortedBands(mSortedPowers, nn, nn - 1, mHistory.Spectrums(0), mBinLow, mBinHigh);
+                // The middle of the odd count, the (nn / 2 + 1)th greatest
+                // as for 3 and 5
+                for (int jj = mBinLow; jj < mBinHigh; ++jj)
+                    mNoiseMask[jj] = mSortedPowers[jj * nn + nn / 2] <= mThresholds[jj] ? 1.0f : 0.0f;
+                return;
+            }
+            break;
+        case DM_SECOND_GREATEST:
+            rank = 2;
+            break;
+        default:
+            for (int jj = mBinLow; jj < mBinHigh; ++jj)
+                mNoiseMask[jj] = Classify(statistics, jj) ? 1.0f : 0.0f;
+            return;
+    }
+
+    for (unsigned ii = 0; ii < mNWindowsToExamine; ++ii)
+        mClassifyRows[ii] = mHistory.Spectrums(ii);
+    ClassifyBands(&mNoiseMask[0], &mClassifyRows[0], mNWindowsToExamine, rank,
+                  &mThresholds[0], mBinLow, mBinHigh);
+}
+
 void EffectNoiseReduction::Worker::ReduceNoise
         (const Statistics &statistics, WaveTrack *outputTrack) {
     // Raise the gain for elements in the center of the sliding history
     // or, if isolating noise, zero out the non-noise
     {
-        float *pGain = &mQueue[mCenter]->mGains[0];
+        NOISERED_TIMED(Classify);
+        ClassifyAllBands(statistics);
+        const float *pNoise = &mNoiseMask[0];
+        if (mAdaptRate > 0 && CenterWindowIsInput() &&
+            std::all_of(pNoise + mBinLow, pNoise + mBinHigh, [](float noise) { return noise != 0.0f; }))
+            AdaptProfile();
+        float *pGain = mHistory.Gains(mCenter);
+        // All above or below the selected frequency range is non-noise,
+        // as StartNewTrack() left it
         if (mNoiseReductionChoice == NRC_ISOLATE_NOISE) {
-            // All above or below the selected frequency range is non-noise
-            std::fill(pGain, pGain + mBinLow, 0.0f);
-            std::fill(pGain + mBinHigh, pGain + mSpectrumSize, 0.0f);
-            pGain += mBinLow;
-            for (int jj = mBinLow; jj < mBinHigh; ++jj) {
-                const bool isNoise = Classify(statistics, jj);
-                *pGain++ = isNoise ? 1.0f : 0.0f;
-            }
+            for (int jj = mBinLow; jj < mBinHigh; ++jj)
+                pGain[jj] = pNoise[jj];
         } else {
-            // All above or below the selected frequency range is non-noise
-            std::fill(pGain, pGain + mBinLow, 1.0f);
-            std::fill(pGain + mBinHigh, pGain + mSpectrumSize, 1.0f);
-            pGain += mBinLow;
-            for (int jj = mBinLow; jj < mBinHigh; ++jj) {
-                const bool isNoise = Classify(statistics, jj);
-                if (!isNoise)
-                    *pGain = 1.0;
-                ++pGain;
-            }
+            for (int jj = mBinLow; jj < mBinHigh; ++jj)
+                pGain[jj] = pNoise[jj] != 0.0f ? pGain[jj] : 1.0f;
         }
     }
 
     if (mNoiseReductionChoice != NRC_ISOLATE_NOISE) {
+        NOISERED_TIMED(Gains);
         // In each direction, define an exponential decay of gain from the
         // center; make actual gains the maximum of mNoiseAttenFactor, and
         // the decay curve, and their prior values.
 
         // First, the attack, which goes backward in time, which is,
-        // toward higher indices in the queue.
-        for (size_t jj = 0; jj < mSpectrumSize; ++jj) {
+        // toward higher indices in the queue.  Sweep one window at a time;
+        // each bin stops rising once the attack curve intersects the decay
+        // curve of some window previously processed.  Only the bands
+        // affected are swept; the gains of the others stay 1.
+        const size_t nBins = mBinHigh - mBinLow;
+        {
+            float *pActive = &mAttackActive[mBinLow];
+            std::fill(pActive, pActive + nBins, 1.0f);
             for (unsigned ii = mCenter + 1; ii < mHistoryLen; ++ii) {
-                const float minimum =
-                        std::max(mNoiseAttenFactor,
-                                 mQueue[ii - 1]->mGains[jj] * mOneBlockAttack);
-                float &gain = mQueue[ii]->mGains[jj];
-                if (gain < minimum)
-                    gain = minimum;
-                else
-                    // We can stop now, our attack curve is intersecting
-                    // the decay curve of some window previously processed.
+                if (!PropagateAttack(mHistory.Gains(ii) + mBinLow, mHistory.Gains(ii - 1) + mBinLow,
+                                     pActive, nBins,
+                                     mOneBlockAttack, mNoiseAttenFactor))
                     break;
             }
         }
@@ -1013,86 +2134,70 @@ void EffectNoiseReduction::Worker::ReduceNoise
         // Now, release.  We need only look one window ahead.  This part will
         // be visited again when we examine the next window, and
         // carry the decay further.
-        {
-            float *pNextGain = &mQueue[mCenter - 1]->mGains[0];
-            const float *pThisGain = &mQueue[mCenter]->mGains[0];
-            for (int nn = mSpectrumSize; nn--;) {
-                *pNextGain =
-                        std::max(*pNextGain,
-                                 std::max(mNoiseAttenFactor,
-                                          *pThisGain++ * mOneBlockRelease));
-                ++pNextGain;
-            }
-        }
+        PropagateRelease(mHistory.Gains(mCenter - 1) + mBinLow, mHistory.Gains(mCenter) + mBinLow,
+                         nBins, mOneBlockRelease, mNoiseAttenFactor);
     }
 
 
     if (mOutStepCount >= -(int) (mStepsPerWindow - 1)) {
-        Record &record = *mQueue[mHistoryLen - 1];  // end of the queue
+        // end of the queue
+        float *const gains = mHistory.Gains(mHistoryLen - 1);
+        // The oldest window is not needed after this, so transform in place
+        float *const fft = mHistory.FFTs(mHistoryLen - 1);
         const auto last = mSpectrumSize - 1;
 
-        if (mNoiseReductionChoice != NRC_ISOLATE_NOISE)
-            // Apply frequency smoothing to output gain
-            // Gains are not less than mNoiseAttenFactor
-            ApplyFreqSmoothing(record.mGains);
-
-        // Apply gain to FFT
         {
-            const float *pGain = &record.mGains[1];
-            const float *pReal = &record.mRealFFTs[1];
-            const float *pImag = &record.mImagFFTs[1];
-            float *pBuffer = &mFFTBuffer[2];
-            auto nn = mSpectrumSize - 2;
-            if (mNoiseReductionChoice == NRC_LEAVE_RESIDUE) {
-                for (; nn--;) {
-                    // Subtract the gain we would otherwise apply from 1, and
-                    // negate that to flip the phase.
-                    const double gain = *pGain++ - 1.0;
-                    *pBuffer++ = *pReal++ * gain;
-                    *pBuffer++ = *pImag++ * gain;
-                }
-                mFFTBuffer[0] = record.mRealFFTs[0] * (record.mGains[0] - 1.0f);
-                // The Fs/2 component is stored as the imaginary part of the DC component
-                mFFTBuffer[1] = record.mImagFFTs[0] * (record.mGains[last] - 1.0f);
-            } else {
-                for (; nn--;) {
-                    const double gain = *pGain++;
-                    *pBuffer++ = *pReal++ * gain;
-                    *pBuffer++ = *pImag++ * gain;
-                }
-                mFFTBuffer[0] = record.mRealFFTs[0] * record.mGains[0];
-                // The Fs/2 component is stored as the imaginary part of the DC component
-                mFFTBuffer[1] = record.mImagFFTs[0] * record.mGains[last];
-            }
+            NOISERED_TIMED(Gains);
+            if (mNoiseReductionChoice != NRC_ISOLATE_NOISE)
+                // Apply frequency smoothing to output gain
+                // Gains are not less than mNoiseAttenFactor
+                ApplyFreqSmoothing(gains);
+
+            // Apply gain to FFT
+            // Leaving the residue, subtract the gain we would otherwise apply
+            // from 1, and negate that to flip the phase.
+            const float offset =
+                    mNoiseReductionChoice == NRC_LEAVE_RESIDUE ? -1.0f : 0.0f;
+            // Reducing noise, the gains of 1 outside the bands affected
+            // change nothing
+            const bool inBandOnly = mNoiseReductionChoice == NRC_REDUCE_NOISE;
+            const size_t first = inBandOnly ? std::max(mBinLow, 1) : 1;
+            const size_t end = inBandOnly ? std::min<size_t>(mBinHigh, last) : last;
+            if (end > first)
+                ApplySpectralGain(&fft[2 * first], &gains[first], end - first, offset);
+            if (!inBandOnly || mBinLow == 0)
+                fft[0] *= gains[0] + offset;
+            // The Fs/2 component is stored as the imaginary part of the DC component
+            if (!inBandOnly || (size_t) mBinHigh > last)
+                fft[1] *= gains[last] + offset;
         }
 
-        // Invert the FFT into the output buffer
-        InverseRealFFTf(&mFFTBuffer[0], hFFT.get());
+        // Invert the FFT
+        {
+            NOISERED_TIMED(InverseFFT);
+            mFFT->Inverse(fft);
+        }
 
         // Overlap-add
-        if (mOutWindow.size() > 0) {
-            float *pOut = &mOutOverlapBuffer[0];
-            float *pWindow = &mOutWindow[0];
-            int *pBitReversed = &hFFT->BitReversed[0];
-            for (unsigned int jj = 0; jj < last; ++jj) {
-                int kk = *pBitReversed++;
-                *pOut++ += mFFTBuffer[kk] * (*pWindow++);
-                *pOut++ += mFFTBuffer[kk + 1] * (*pWindow++);
-            }
-        } else {
-            float *pOut = &mOutOverlapBuffer[0];
-            int *pBitReversed = &hFFT->BitReversed[0];
-            for (unsigned int jj = 0; jj < last; ++jj) {
-                int kk = *pBitReversed++;
-                *pOut++ += mFFTBuffer[kk];
-                *pOut++ += mFFTBuffer[kk + 1];
-            }
+        {
+            NOISERED_TIMED(OverlapAdd);
+            OverlapAddBitReversed(&mOutOverlapBuffer[0], fft,
+                                  mFFT->TimeOrder(),
+                                  mOutWindow,
+                                  last);
         }
 
         float *buffer = &mOutOverlapBuffer[0];
         if (mOutStepCount >= 0) {
-            // Output the first portion of the overlap buffer, they're done
-            outputTrack->Append((samplePtr) buffer, floatSample, mStepSize);
+            // Output the first portion of the overlap buffer, they're done,
+            // unless outside the part of the range being kept
+            const auto outPos = mOutStepCount * mStepSize;
+            if (outPos >= mOutKeepStart && outPos < mOutKeepEnd) {
+                if (outputTrack)
+                    outputTrack->Append((samplePtr) buffer, floatSample, mStepSize);
+                else if (mStreamOutput)
+                    mStreamOutput->insert(mStreamOutput->end(), buffer, buffer + mStepSize);
+            }
         }
 
         // Shift the remainder over.
@@ -1101,54 +2206,151 @@ void EffectNoiseReduction::Worker::ReduceNoise
     }
 }
 
+bool EffectNoiseReduction::Worker::ProcessRange
+        (const Statistics &statistics, Statistics *profile, WaveTrack *track, WaveTrack *outputTrack,
+         sampleCount start, sampleCount len,
+         sampleCount keepStart, sampleCount keepEnd) {
+    StartNewTrack();
+    mOutKeepStart = keepStart;
+    mOutKeepEnd = keepEnd;
+    if (!mDoProfile)
+        PrepareThresholds(statistics);
+    else if (mQuietFraction > 0) {
+        // Of about this many windows
+        const double windows = (len / mStepSize).as_double() + 1;
+        const auto capacity = (size_t) std::max(1.0, std::min<double>(maxQuietWindows,
+                                                                      std::ceil(mQuietFraction * windows)));
+        mQuietWindows = std::make_unique<QuietWindows>(capacity, mSpectrumSize);
+    }
+
+    const auto cancelled = [this] { return mCancel && mCancel->load(std::memory_order_relaxed); };
+    if (mReadAheadBlocks > 0) {
+        // The same chunks as below, read on another thread
+        WaveTrackReadAhead readAhead{*track, start, len, mReadAheadBlocks};
+        size_t blockSize;
+        while (const float *samples = readAhead.Next(blockSize)) {
+            if (cancelled())
+                return false;
+            mInSampleCount += blockSize;
+            ProcessSamples(statistics, profile, outputTrack, blockSize, samples);
+        }
+    } else {
+        // The callers make mArena current
+        ArenaFrame frame;
+        assert(frame.GetArena() == &mArena);
+        auto bufferSize = track->GetMaxBlockSize();
+        float *const buffer = mArena.Allocate<float>(bufferSize);
+
+        auto samplePos = start;
+        while (samplePos < start + len) {
+            if (cancelled())
+                return false;
+            //Get a blockSize of samples (smaller than the size of the buffer)
+            const auto blockSize = limitSampleBufferSize(
+                    track->GetBestBlockSize(samplePos),
+                    start + len - samplePos
+            );
+
+            //Get the samples from the track and put them in the buffer
+            track->Get((samplePtr) buffer, floatSample, samplePos, blockSize);
+            samplePos += blockSize;
+
+            mInSampleCount += blockSize;
+            ProcessSamples(statistics, profile, outputTrack, blockSize, buffer);
+
+        }
+    }
+
+    if (mDoProfile)
+        FinishTrackStatistics(*profile);
+    else
+        FinishTrack(statistics, outputTrack);
+    return true;
+}
+
+void EffectNoiseReduction::Worker::ProfileSamples
+        (Statistics &statistics, const float *buffer, size_t len) {
+    StartNewTrack();
+    mInSampleCount += len;
+    ProcessSamples(statistics, &statistics, nullptr, len, buffer);
+    FinishTrackStatistics(statistics);
+}
+
+void EffectNoiseReduction::Worker::StartStream(const Statistics &statistics) {
+    StartNewTrack();
+    mOutKeepStart = 0;
+    mOutKeepEnd = std::numeric_limits<sampleCount::type>::max();
+    PrepareThresholds(statistics);
+}
+
+void EffectNoiseReduction::Worker::PushSamples
+        (const Statistics &statistics, const float *buffer, size_t len,
+         FloatVector &output) {
+    mStreamOutput = &output;
+    mInSampleCount += len;
+    ProcessSamples(statistics, nullptr, nullptr, len, buffer);
+    mStreamOutput = nullptr;
+}
+
+void EffectNoiseReduction::Worker::FinishStream
+        (const Statistics &statistics, FloatVector &output) {
+    mStreamOutput = &output;
+    FinishTrack(statistics, nullptr);
+    mStreamOutput = nullptr;
+}
+
+size_t EffectNoiseReduction::Worker::Latency() const {
+    // The first step is output from the window that completes the history
+    // and passes the zero padded windows; see StartNewTrack()
+    return (mHistoryLen - 1 + mStepsPerWindow - 1) * mStepSize;
+}
+
+bool EffectNoiseReduction::Worker::ProcessSegment
+        (const Statistics &statistics, WaveTrack *track, WaveTrack *outputTrack,
+         sampleCount start, sampleCount len,
+         sampleCount segStart, sampleCount segLen) {
+    if (track == nullptr || outputTrack == nullptr || mDoProfile)
+        return false;
+
+    // Begin on the same step grid as a serial pass, so that all windows
+    // line up.  segStart is a multiple of the step size.
+    const auto readStart = std::max(sampleCount{0}, segStart - mSegmentOverlap);
+    const auto readEnd = std::min(len, segStart + segLen + mSegmentOverlap);
+    // The last segment keeps the tail, to be trimmed like the serial output
+    const auto keepEnd = (segStart + segLen < len)
+                         ? segStart + segLen - readStart
+                         : sampleCount{std::numeric_limits<sampleCount::type>::max()};
+
+    ArenaScope scope{mArena};
+    if (!ProcessRange(statistics, nullptr, track, outputTrack,
+                      start + readStart, readEnd - readStart,
+                      segStart - readStart, keepEnd))
+        return false;
+
+    outputTrack->Flush();
+    return true;
+}
+
 bool EffectNoiseReduction::Worker::ProcessOne
         (EffectNoiseReduction &effect, Statistics &statistics, TrackFactory &factory,
          int count, WaveTrack *track, sampleCount start, sampleCount len) {
     if (track == nullptr)
         return false;
 
-    StartNewTrack();
-
     WaveTrack::Holder outputTrack;
     if (!mDoProfile)
         outputTrack = factory.NewWaveTrack(track->GetSampleFormat(), track->GetRate());
 
-    auto bufferSize = track->GetMaxBlockSize();
-    FloatVector buffer(bufferSize);
-
-    auto samplePos = start;
-    while (samplePos < start + len) {
-        //Get a blockSize of samples (smaller than the size of the buffer)
-        const auto blockSize = limitSampleBufferSize(
-                track->GetBestBlockSize(samplePos),
-                start + len - samplePos
-        );
-
-        //Get the samples from the track and put them in the buffer
-        track->Get((samplePtr) &buffer[0], floatSample, samplePos, blockSize);
-        samplePos += blockSize;
-
-        mInSampleCount += blockSize;
-        ProcessSamples(statistics, outputTrack.get(), blockSize, &buffer[0]);
-
-    }
-
-    if (mDoProfile)
-        FinishTrackStatistics(statistics);
-    else
-        FinishTrack(statistics, &*outputTrack);
+    ArenaScope scope{mArena};
+    // Cancelled, the track is left as it was
+    if (!ProcessRange(statistics, mDoProfile ? &statistics : nullptr, track, outputTrack.get(), start, len,
+                      0, std::numeric_limits<sampleCount::type>::max()))
+        return false;
 
     if (!mDoProfile) {
         // Flush the output WaveTrack (since it's buffered)
         outputTrack->Flush();
-
-        // Take the output track and insert it in place of the original
-        // sample data (as operated on -- this may not match mT0/mT1)
-        double t0 = outputTrack->LongSamplesToTime(start);
-        double tLen = outputTrack->LongSamplesToTime(len);
-        // Filtering effects always end up with more data than they started with.  Delete this 'tail'.
-        outputTrack->HandleClear(tLen, outputTrack->GetEndTime(), false, false);
-        track->ClearAndPaste(t0, t0 + tLen, &*outputTrack, true, false);
+        ReplaceWithOutput(track, &*outputTrack, start, len);
     }
 
     return true;
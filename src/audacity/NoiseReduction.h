@@ -13,6 +13,10 @@
 #ifndef __AUDACITY_EFFECT_NOISE_REDUCTION__
 #define __AUDACITY_EFFECT_NOISE_REDUCTION__
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include "MemoryX.h"
 #include "WaveTrack.h"
 
@@ -57,8 +61,150 @@ public:
     bool Init();
     bool Process();
     bool Process(WaveTrack *waveTrack);
+    // Profiles the tracks in turn, or reduces noise in each track on its own
+    // thread, all sharing the read-only noise profile
+    bool Process(const std::vector<WaveTrack *> &waveTracks);
     bool GetProfile(WaveTrack *track, double t0, double t1, double noiseGain, double sensitivity, double freqSmoothingBands,TrackFactory *factory);
+    // A part of a track to profile
+    struct ProfileRegion {
+        WaveTrack *track;
+        double t0;
+        double t1;
+    };
+    // Profile several regions, of one track or of several files of one rate,
+    // on as many threads as SetThreadCount allows, the regions taken in turn;
+    // the profile is that of all their windows, the same however many threads
+    bool GetProfile(const std::vector<ProfileRegion> &regions, double noiseGain, double sensitivity,
+                    double freqSmoothingBands, TrackFactory *factory);
+    // Profile the quietest fraction of the windows of all of each track, for
+    // recordings with no stretch of noise alone to select, in one pass over
+    // them.  Of each track, at most 4096 windows are kept.
+    bool GetAutoProfile(const std::vector<WaveTrack *> &tracks, double fraction, double noiseGain,
+                        double sensitivity, double freqSmoothingBands, TrackFactory *factory);
+    // Profile len samples of noise at rate, without a track; the same as
+    // GetProfile of a track holding just those samples
+    bool GetProfile(const float *samples, size_t len, double rate);
     bool ReduceNoise(WaveTrack *track, double noiseGain, double sensitivity, double freqSmoothingBands, TrackFactory *factory);
+    // Reduce noise in all channels of a file, one thread per track
+    bool ReduceNoise(const std::vector<WaveTrack *> &tracks, double noiseGain, double sensitivity,
+                     double freqSmoothingBands, TrackFactory *factory);
+
+    // Noise profile persistence, so that one profile can be applied to many
+    // tracks without importing and profiling again.  Save fails when there is
+    // no profile yet; Load replaces any current profile.
+    bool SaveProfile(std::vector<char> &blob) const;
+    bool SaveProfile(const std::string &path) const;
+    bool LoadProfile(const char *data, size_t size);
+    bool LoadProfile(const std::string &path);
+
+    // Threads for noise reduction; 0 means one per hardware thread.
+    // A long track is cut into that many segments, overlapped so that the
+    // result is identical to processing it in one pass.  Several tracks
+    // share the threads, but get at least one each.
+    void SetThreadCount(unsigned threadCount) { mThreadCount = threadCount; }
+
+    // Blocks of each track read ahead on a thread of their own while
+    // earlier ones are processed, for block files on slow storage; 0, the
+    // default, reads each block when it is needed.  Results are the same.
+    void SetReadAhead(unsigned blocks) { mReadAheadBlocks = blocks; }
+
+    // Return from ReduceNoise at once, the reduced blocks of each track
+    // computed when they are first read, each exactly as a pass over the
+    // whole track would, so that a preview or a partial read costs only
+    // what is read.  With background, each track's thread also computes
+    // them meanwhile, in order from the last read.  The samples reduced
+    // and the profile are those of the call; the blocks hold on to them,
+    // and to their track's DirManager, until all are computed.  Ignored
+    // with an adaptive profile.
+    void SetLazy(bool lazy, bool background = true) {
+        mLazy = lazy;
+        mLazyBackground = background;
+    }
+
+    // Reduce noise in tracks of other rates than the profile's with the
+    // profile's spectrum mapped onto their frequency bins, instead of
+    // failing.  Above the profile's Nyquist frequency, its highest bin is
+    // assumed.
+    void SetResampleProfile(bool resample) { mResampleProfile = resample; }
+
+    // Reduce noise only in the bands from f0 to f1 Hz, leaving the others
+    // as they are; a negative bound is none, and (-1, -1), the default, is
+    // all of them.  Classification, attack, release and frequency smoothing
+    // cover only the bands affected, so a narrow range takes less work.
+    // False, changing nothing, if f1 is not above f0.
+    bool SetFrequencyRange(double f0, double f1);
+
+    // Let the profile follow background noise that drifts during reduction:
+    // the power of each window classified as noise in all bands is added to
+    // a running mean of the profile's, decaying with timeConstant seconds.
+    // 0, the default, keeps the profile as taken.  Each track and stream
+    // adapts on its own from the profile, which is left unchanged; as each
+    // result depends on all the windows before, a track is reduced on one
+    // thread.
+    void SetAdaptiveProfile(double timeConstant);
+
+    // Bound the delay of output after input, for live audio, to milliseconds
+    // where it can be:  a 512 sample window replaces the window of the
+    // preferences, and the attack reaches back only over the windows still
+    // held within the bound, rather than holding all output for it.  The
+    // window and the windows classification examines around it take their
+    // time all the same, 56 milliseconds at 16 kHz and 19 at 48 kHz, which
+    // Stream::GetLatency() tells.  The profile must be taken in the same
+    // mode, for its window size.  0, the default, is the quality mode, for
+    // offline work.
+    void SetLowLatency(double milliseconds);
+
+    // Stop profiling and noise reduction between blocks of input once
+    // *cancel becomes true, from any thread:  the call fails, leaving the
+    // tracks as they were.  Null, the default, never stops.  *cancel must
+    // outlive the calls.
+    void SetCancel(const std::atomic<bool> *cancel);
+    bool IsCancelled() const;
+
+    // The advanced settings of Audacity's dialog, to trade quality for
+    // speed.  A profile must be taken with the window size it is applied
+    // with, and the low latency mode keeps its own window size.
+    struct AdvancedSettings {
+        // The analysis and synthesis windows:  0 none, Hann; 1 Hann, none;
+        // 2 Hann, Hann, the default; 3 Blackman, Hann; 4 Hamming, none;
+        // 5 Hamming, Hann; 6 Hamming, reciprocal Hamming.  Those with a
+        // window only one way need 2 steps per window, the others 4.
+        int windowTypes{2};
+        // Windows of 2^(3 + choice) samples, 8 to 16384; 8, 2048 samples,
+        // is the default
+        int windowSizeChoice{8};
+        // 2^(1 + choice) steps per window, 2 to 64; 1, 4 steps, is the
+        // default
+        int stepsPerWindowChoice{1};
+        // Of the windows examined around each, noise is what is below the
+        // thresholds in 0, the median, or 1, the second greatest, the default
+        int method{1};
+        // In seconds, 0 to 1, for the gains to fall before and rise after
+        // the signal
+        double attackTime{0.02};
+        double releaseTime{0.10};
+    };
+
+    // False, changing nothing, unless the settings are valid together
+    bool SetAdvancedSettings(const AdvancedSettings &settings);
+    AdvancedSettings GetAdvancedSettings() const;
+
+    // Samples to a window, of the low latency mode or of the advanced
+    // settings, as profiles are taken and applied
+    size_t GetWindowSize() const;
+
+    // Named settings:  "fast", with a Hann window on input alone and 2
+    // steps, half the transforms of "default"; "default"; and "quality",
+    // 4096 samples to a window and 8 steps.  False for other names.
+    static bool GetPreset(const std::string &name, AdvancedSettings &settings);
+    bool SetPreset(const std::string &name);
+
+    // Noise reduction of a live signal, without tracks.  Returns null when
+    // there is no profile yet.  The stream keeps its own copy of the profile,
+    // and its sample rate must be that of the profile.
+    class Stream;
+    std::unique_ptr<Stream> CreateStream(double noiseGain, double sensitivity, double freqSmoothingBands);
+
     class Settings;
 
     class Statistics;
@@ -70,11 +216,73 @@ public:
 private:
     class Worker;
 
+    class LazyTask;
+
     friend class Dialog;
 
+    bool ReduceNoiseInSegments(const std::vector<WaveTrack *> &tracks, unsigned nSegments);
+
+    bool ReduceNoiseLazily(const std::vector<WaveTrack *> &tracks);
+
+    unsigned mThreadCount{1};
+    unsigned mReadAheadBlocks{0};
+    bool mLazy{false};
+    bool mLazyBackground{true};
+    bool mResampleProfile{false};
+
     TrackFactory *mFactory;
     std::unique_ptr<Settings> mSettings;
     std::unique_ptr<Statistics> mStatistics;
 };
 
+// Push input samples as they arrive and pull the reduced samples as they
+// are finished.  Output lags input by GetLatency() samples, until Flush.
+// Not thread safe, but separate streams may run on separate threads.
+class EffectNoiseReduction::Stream final {
+public:
+    ~Stream();
+
+    double GetRate() const;
+
+    // Samples of input pushed beyond those of output made available
+    size_t GetLatency() const;
+
+    void Push(const float *samples, size_t len);
+
+    // Number of samples that Pull can return now
+    size_t Available() const;
+
+    // Copies up to len finished samples; returns how many
+    size_t Pull(float *samples, size_t len);
+
+    // Finish the output for all input pushed so far, so that exactly as many
+    // samples are output as were pushed.  Then the stream starts over, as if
+    // NEW, with the same profile.
+    void Flush();
+
+    // Drop the input pushed and the output not pulled, and start over as
+    // if NEW, without finishing the output
+    void Reset();
+
+    // Samples of input on each side of a stretch that, pushed along with it
+    // into a NEW stream, make its output what a stream given all of the input
+    // makes of it; a multiple of the steps between windows
+    size_t GetSegmentOverlap() const;
+
+private:
+    friend class EffectNoiseReduction;
+
+    Stream(std::unique_ptr<Worker> worker, std::unique_ptr<Statistics> statistics);
+
+    std::unique_ptr<Statistics> mStatistics;
+    std::unique_ptr<Worker> mWorker;
+
+    // Finished samples, of which those before mOutputStart were pulled
+    std::vector<float> mOutput;
+    size_t mOutputStart{0};
+    // Totals since the start or the last Flush
+    sampleCount mPushed{0};
+    sampleCount mProduced{0};
+};
+
 #endif
@@ -0,0 +1,934 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  NoiseReductionKernels.cpp
+
+**********************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "NoiseReductionKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NR_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define NR_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+void ApplySpectralGainScalar(float *pairs, const float *gains,
+                             size_t len, float gainOffset) {
+    for (size_t ii = 0; ii < len; ++ii) {
+        const float gain = gains[ii] + gainOffset;
+        *pairs++ *= gain;
+        *pairs++ *= gain;
+    }
+}
+
+void OverlapAddScalar(float *out, const float *fft,
+                      const int *bitReversed, const float *window,
+                      size_t nPairs) {
+    if (window) {
+        for (size_t ii = 0; ii < nPairs; ++ii) {
+            const int kk = *bitReversed++;
+            *out++ += fft[kk] * (*window++);
+            *out++ += fft[kk + 1] * (*window++);
+        }
+    } else {
+        for (size_t ii = 0; ii < nPairs; ++ii) {
+            const int kk = *bitReversed++;
+            *out++ += fft[kk];
+            *out++ += fft[kk + 1];
+        }
+    }
+}
+
+
+// Cephes style approximations of logf and expf, accurate to a few units in
+// the last place for normal arguments.  Every version below performs the
+// same sequence of single precision operations as these scalar ones.
+
+const float kLogP[] = {
+        7.0376836292E-2f, -1.1514610310E-1f, 1.1676998740E-1f,
+        -1.2420140846E-1f, 1.4249322787E-1f, -1.6668057665E-1f,
+        2.0000714765E-1f, -2.4999993993E-1f, 3.3333331174E-1f,
+};
+const float kExpP[] = {
+        1.9875691500E-4f, 1.3981999507E-3f, 8.3334519073E-3f,
+        4.1665795894E-2f, 1.6666665459E-1f, 5.0000001201E-1f,
+};
+const float kSqrtHalf = 0.707106781186547524f;
+const float kLn2Hi = 0.693359375f;
+const float kLn2Lo = -2.12194440e-4f;
+const float kLog2e = 1.44269504088896341f;
+const float kExpLimit = 88.3762626647949f;
+const float kMinNormal = 1.17549435e-38f;
+
+inline uint32_t FloatBits(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    return bits;
+}
+
+inline float BitsFloat(uint32_t bits) {
+    float x;
+    memcpy(&x, &bits, sizeof x);
+    return x;
+}
+
+void LogInPlaceScalar(float *values, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii) {
+        float x = std::max(values[ii], kMinNormal);
+        const uint32_t bits = FloatBits(x);
+        float e = (float) ((int32_t) (bits >> 23) - 0x7f) + 1.0f;
+        // Mantissa in [0.5, 1)
+        x = BitsFloat((bits & ~0x7f800000u) | FloatBits(0.5f));
+        const bool small = x < kSqrtHalf;
+        const float tmp = small ? x : 0.0f;
+        x = x - 1.0f;
+        e = e - (small ? 1.0f : 0.0f);
+        x = x + tmp;
+        const float z = x * x;
+        float y = kLogP[0];
+        for (int jj = 1; jj < 9; ++jj)
+            y = y * x + kLogP[jj];
+        y = y * x;
+        y = y * z;
+        y = y + e * kLn2Lo;
+        y = y - z * 0.5f;
+        x = x + y;
+        x = x + e * kLn2Hi;
+        values[ii] = x;
+    }
+}
+
+void ExpInPlaceScalar(float *values, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii) {
+        float x = std::max(std::min(values[ii], kExpLimit), -kExpLimit);
+        float fx = x * kLog2e + 0.5f;
+        // floor
+        const float truncated = (float) (int32_t) fx;
+        fx = truncated - (truncated > fx ? 1.0f : 0.0f);
+        x = x - fx * kLn2Hi;
+        x = x - fx * kLn2Lo;
+        const float z = x * x;
+        float y = kExpP[0];
+        for (int jj = 1; jj < 6; ++jj)
+            y = y * x + kExpP[jj];
+        y = y * z;
+        y = y + x;
+        y = y + 1.0f;
+        const int32_t exponent = (int32_t) fx + 0x7f;
+        values[ii] = y * BitsFloat((uint32_t) exponent << 23);
+    }
+}
+
+bool PropagateAttackScalar(float *gains, const float *prevGains, float *active,
+                           size_t len, float attack, float floor) {
+    bool any = false;
+    for (size_t ii = 0; ii < len; ++ii) {
+        const float minimum = std::max(floor, prevGains[ii] * attack);
+        const bool raise = active[ii] != 0.0f && gains[ii] < minimum;
+        gains[ii] = raise ? minimum : gains[ii];
+        active[ii] = raise ? 1.0f : 0.0f;
+        any = any || raise;
+    }
+    return any;
+}
+
+void PropagateReleaseScalar(float *nextGains, const float *gains,
+                            size_t len, float release, float floor) {
+    for (size_t ii = 0; ii < len; ++ii)
+        nextGains[ii] = std::max(nextGains[ii],
+                                 std::max(floor, gains[ii] * release));
+}
+
+void ClassifyBandsScalar(float *isNoise, const float *const *spectrums,
+                         unsigned nWindows, unsigned rank,
+                         const float *thresholds, size_t start, size_t end) {
+    for (size_t ii = start; ii < end; ++ii) {
+        // Insert each power into a descending list of the rank greatest,
+        // carrying the smaller one down; starts at zero like Classify
+        float greatest[kMaxClassifyRank] = {};
+        for (unsigned ww = 0; ww < nWindows; ++ww) {
+            float power = spectrums[ww][ii];
+            for (unsigned kk = 0; kk < rank; ++kk) {
+                const float higher = std::max(greatest[kk], power);
+                power = std::min(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        isNoise[ii] = greatest[rank - 1] <= thresholds[ii] ? 1.0f : 0.0f;
+    }
+}
+
+// The same, with the window count and rank known at compile time, so that
+// the insertion network unrolls and its list stays in registers
+template <unsigned NWindows, unsigned Rank>
+void ClassifyBandsFixedScalar(float *isNoise, const float *const *spectrums,
+                              const float *thresholds, size_t start, size_t end) {
+    for (size_t ii = start; ii < end; ++ii) {
+        float greatest[Rank] = {};
+        for (unsigned ww = 0; ww < NWindows; ++ww) {
+            float power = spectrums[ww][ii];
+            for (unsigned kk = 0; kk < Rank; ++kk) {
+                const float higher = std::max(greatest[kk], power);
+                power = std::min(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        isNoise[ii] = greatest[Rank - 1] <= thresholds[ii] ? 1.0f : 0.0f;
+    }
+}
+
+#ifdef NR_KERNELS_X86
+
+__attribute__((target("sse2")))
+void ApplySpectralGainSSE2(float *pairs, const float *gains,
+                           size_t len, float gainOffset) {
+    const __m128 offset = _mm_set1_ps(gainOffset);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const __m128 gain = _mm_add_ps(_mm_loadu_ps(gains + ii), offset);
+        // Each gain twice, for (re, im) pairs
+        float *const pair = pairs + 2 * ii;
+        _mm_storeu_ps(pair, _mm_mul_ps(_mm_loadu_ps(pair), _mm_unpacklo_ps(gain, gain)));
+        _mm_storeu_ps(pair + 4, _mm_mul_ps(_mm_loadu_ps(pair + 4), _mm_unpackhi_ps(gain, gain)));
+    }
+    ApplySpectralGainScalar(pairs + 2 * ii, gains + ii, len - ii, gainOffset);
+}
+
+__attribute__((target("sse2")))
+void OverlapAddSSE2(float *out, const float *fft,
+                    const int *bitReversed, const float *window,
+                    size_t nPairs) {
+    size_t ii = 0;
+    for (; ii + 2 <= nPairs; ii += 2) {
+        // Each bit reversed index addresses a contiguous (re, im) pair
+        __m128 value = _mm_setzero_ps();
+        value = _mm_loadl_pi(value, (const __m64 *) (fft + bitReversed[ii]));
+        value = _mm_loadh_pi(value, (const __m64 *) (fft + bitReversed[ii + 1]));
+        if (window)
+            value = _mm_mul_ps(value, _mm_loadu_ps(window + 2 * ii));
+        _mm_storeu_ps(out + 2 * ii, _mm_add_ps(_mm_loadu_ps(out + 2 * ii), value));
+    }
+    OverlapAddScalar(out + 2 * ii, fft, bitReversed + ii,
+                     window ? window + 2 * ii : nullptr, nPairs - ii);
+}
+
+__attribute__((target("sse2")))
+void LogInPlaceSSE2(float *values, size_t len) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        __m128 x = _mm_max_ps(_mm_loadu_ps(values + ii), _mm_set1_ps(kMinNormal));
+        const __m128i bits = _mm_castps_si128(x);
+        __m128 e = _mm_add_ps(_mm_cvtepi32_ps(_mm_sub_epi32(
+                _mm_srli_epi32(bits, 23), _mm_set1_epi32(0x7f))), one);
+        x = _mm_or_ps(_mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(~0x7f800000))),
+                      _mm_set1_ps(0.5f));
+        const __m128 small = _mm_cmplt_ps(x, _mm_set1_ps(kSqrtHalf));
+        const __m128 tmp = _mm_and_ps(x, small);
+        x = _mm_sub_ps(x, one);
+        e = _mm_sub_ps(e, _mm_and_ps(one, small));
+        x = _mm_add_ps(x, tmp);
+        const __m128 z = _mm_mul_ps(x, x);
+        __m128 y = _mm_set1_ps(kLogP[0]);
+        for (int jj = 1; jj < 9; ++jj)
+            y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(kLogP[jj]));
+        y = _mm_mul_ps(y, x);
+        y = _mm_mul_ps(y, z);
+        y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(kLn2Lo)));
+        y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+        x = _mm_add_ps(x, y);
+        x = _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(kLn2Hi)));
+        _mm_storeu_ps(values + ii, x);
+    }
+    LogInPlaceScalar(values + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void ExpInPlaceSSE2(float *values, size_t len) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        __m128 x = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(values + ii),
+                                         _mm_set1_ps(kExpLimit)),
+                              _mm_set1_ps(-kExpLimit));
+        __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(kLog2e)), _mm_set1_ps(0.5f));
+        const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+        fx = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, fx), one));
+        x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(kLn2Hi)));
+        x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(kLn2Lo)));
+        const __m128 z = _mm_mul_ps(x, x);
+        __m128 y = _mm_set1_ps(kExpP[0]);
+        for (int jj = 1; jj < 6; ++jj)
+            y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(kExpP[jj]));
+        y = _mm_mul_ps(y, z);
+        y = _mm_add_ps(y, x);
+        y = _mm_add_ps(y, one);
+        const __m128i exponent = _mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(0x7f));
+        y = _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(exponent, 23)));
+        _mm_storeu_ps(values + ii, y);
+    }
+    ExpInPlaceScalar(values + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+bool PropagateAttackSSE2(float *gains, const float *prevGains, float *active,
+                         size_t len, float attack, float floor) {
+    const __m128 vAttack = _mm_set1_ps(attack);
+    const __m128 vFloor = _mm_set1_ps(floor);
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 any = _mm_setzero_ps();
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const __m128 minimum =
+                _mm_max_ps(vFloor, _mm_mul_ps(_mm_loadu_ps(prevGains + ii), vAttack));
+        const __m128 gain = _mm_loadu_ps(gains + ii);
+        const __m128 raise = _mm_and_ps(
+                _mm_cmpneq_ps(_mm_loadu_ps(active + ii), _mm_setzero_ps()),
+                _mm_cmplt_ps(gain, minimum));
+        _mm_storeu_ps(gains + ii,
+                      _mm_or_ps(_mm_and_ps(raise, minimum), _mm_andnot_ps(raise, gain)));
+        _mm_storeu_ps(active + ii, _mm_and_ps(raise, one));
+        any = _mm_or_ps(any, raise);
+    }
+    const bool tail = PropagateAttackScalar(gains + ii, prevGains + ii, active + ii,
+                                            len - ii, attack, floor);
+    return _mm_movemask_ps(any) != 0 || tail;
+}
+
+__attribute__((target("sse2")))
+void PropagateReleaseSSE2(float *nextGains, const float *gains,
+                          size_t len, float release, float floor) {
+    const __m128 vRelease = _mm_set1_ps(release);
+    const __m128 vFloor = _mm_set1_ps(floor);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const __m128 decayed =
+                _mm_max_ps(vFloor, _mm_mul_ps(_mm_loadu_ps(gains + ii), vRelease));
+        _mm_storeu_ps(nextGains + ii, _mm_max_ps(_mm_loadu_ps(nextGains + ii), decayed));
+    }
+    PropagateReleaseScalar(nextGains + ii, gains + ii, len - ii, release, floor);
+}
+
+__attribute__((target("sse2")))
+void ClassifyBandsSSE2(float *isNoise, const float *const *spectrums,
+                       unsigned nWindows, unsigned rank,
+                       const float *thresholds, size_t start, size_t end) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t ii = start;
+    for (; ii + 4 <= end; ii += 4) {
+        __m128 greatest[kMaxClassifyRank];
+        for (unsigned kk = 0; kk < rank; ++kk)
+            greatest[kk] = _mm_setzero_ps();
+        for (unsigned ww = 0; ww < nWindows; ++ww) {
+            __m128 power = _mm_loadu_ps(spectrums[ww] + ii);
+            for (unsigned kk = 0; kk < rank; ++kk) {
+                const __m128 higher = _mm_max_ps(greatest[kk], power);
+                power = _mm_min_ps(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        const __m128 noise =
+                _mm_cmple_ps(greatest[rank - 1], _mm_loadu_ps(thresholds + ii));
+        _mm_storeu_ps(isNoise + ii, _mm_and_ps(noise, one));
+    }
+    ClassifyBandsScalar(isNoise, spectrums, nWindows, rank, thresholds, ii, end);
+}
+
+template <unsigned NWindows, unsigned Rank>
+__attribute__((target("sse2")))
+void ClassifyBandsFixedSSE2(float *isNoise, const float *const *spectrums,
+                            const float *thresholds, size_t start, size_t end) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t ii = start;
+    for (; ii + 4 <= end; ii += 4) {
+        __m128 greatest[Rank];
+        for (unsigned kk = 0; kk < Rank; ++kk)
+            greatest[kk] = _mm_setzero_ps();
+        for (unsigned ww = 0; ww < NWindows; ++ww) {
+            __m128 power = _mm_loadu_ps(spectrums[ww] + ii);
+            for (unsigned kk = 0; kk < Rank; ++kk) {
+                const __m128 higher = _mm_max_ps(greatest[kk], power);
+                power = _mm_min_ps(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        const __m128 noise =
+                _mm_cmple_ps(greatest[Rank - 1], _mm_loadu_ps(thresholds + ii));
+        _mm_storeu_ps(isNoise + ii, _mm_and_ps(noise, one));
+    }
+    ClassifyBandsFixedScalar<NWindows, Rank>(isNoise, spectrums, thresholds, ii, end);
+}
+
+__attribute__((target("avx2")))
+void ApplySpectralGainAVX2(float *pairs, const float *gains,
+                           size_t len, float gainOffset) {
+    const __m256 offset = _mm256_set1_ps(gainOffset);
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        const __m256 gain = _mm256_add_ps(_mm256_loadu_ps(gains + ii), offset);
+        // Unpacking works within 128 bit lanes:  lo holds gains 0 1 4 5,
+        // hi holds gains 2 3 6 7, each twice; then swap the middle lanes
+        // into order
+        const __m256 lo = _mm256_unpacklo_ps(gain, gain);
+        const __m256 hi = _mm256_unpackhi_ps(gain, gain);
+        float *const pair = pairs + 2 * ii;
+        _mm256_storeu_ps(pair, _mm256_mul_ps(_mm256_loadu_ps(pair),
+                                             _mm256_permute2f128_ps(lo, hi, 0x20)));
+        _mm256_storeu_ps(pair + 8, _mm256_mul_ps(_mm256_loadu_ps(pair + 8),
+                                                 _mm256_permute2f128_ps(lo, hi, 0x31)));
+    }
+    ApplySpectralGainSSE2(pairs + 2 * ii, gains + ii, len - ii, gainOffset);
+}
+
+__attribute__((target("avx2")))
+void OverlapAddAVX2(float *out, const float *fft,
+                    const int *bitReversed, const float *window,
+                    size_t nPairs) {
+    size_t ii = 0;
+    for (; ii + 4 <= nPairs; ii += 4) {
+        // Gather four (re, im) pairs as doubles; the index is in floats.
+        // Masked, with all lanes taken, so that the source is defined
+        const __m128i indices =
+                _mm_loadu_si128((const __m128i *) (bitReversed + ii));
+        __m256 value = _mm256_castpd_ps(
+                _mm256_mask_i32gather_pd(_mm256_setzero_pd(), (const double *) fft, indices,
+                                         _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 4));
+        if (window)
+            value = _mm256_mul_ps(value, _mm256_loadu_ps(window + 2 * ii));
+        _mm256_storeu_ps(out + 2 * ii,
+                         _mm256_add_ps(_mm256_loadu_ps(out + 2 * ii), value));
+    }
+    OverlapAddSSE2(out + 2 * ii, fft, bitReversed + ii,
+                   window ? window + 2 * ii : nullptr, nPairs - ii);
+}
+
+__attribute__((target("avx2")))
+void LogInPlaceAVX2(float *values, size_t len) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        __m256 x = _mm256_max_ps(_mm256_loadu_ps(values + ii), _mm256_set1_ps(kMinNormal));
+        const __m256i bits = _mm256_castps_si256(x);
+        __m256 e = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(
+                _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0x7f))), one);
+        x = _mm256_or_ps(_mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(~0x7f800000))),
+                         _mm256_set1_ps(0.5f));
+        const __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(kSqrtHalf), _CMP_LT_OQ);
+        const __m256 tmp = _mm256_and_ps(x, small);
+        x = _mm256_sub_ps(x, one);
+        e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+        x = _mm256_add_ps(x, tmp);
+        const __m256 z = _mm256_mul_ps(x, x);
+        __m256 y = _mm256_set1_ps(kLogP[0]);
+        for (int jj = 1; jj < 9; ++jj)
+            y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(kLogP[jj]));
+        y = _mm256_mul_ps(y, x);
+        y = _mm256_mul_ps(y, z);
+        y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(kLn2Lo)));
+        y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+        x = _mm256_add_ps(x, y);
+        x = _mm256_add_ps(x, _mm256_mul_ps(e, _mm256_set1_ps(kLn2Hi)));
+        _mm256_storeu_ps(values + ii, x);
+    }
+    LogInPlaceSSE2(values + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void ExpInPlaceAVX2(float *values, size_t len) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        __m256 x = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(values + ii),
+                                               _mm256_set1_ps(kExpLimit)),
+                                 _mm256_set1_ps(-kExpLimit));
+        __m256 fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(kLog2e)),
+                                  _mm256_set1_ps(0.5f));
+        fx = _mm256_floor_ps(fx);
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(kLn2Hi)));
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(kLn2Lo)));
+        const __m256 z = _mm256_mul_ps(x, x);
+        __m256 y = _mm256_set1_ps(kExpP[0]);
+        for (int jj = 1; jj < 6; ++jj)
+            y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(kExpP[jj]));
+        y = _mm256_mul_ps(y, z);
+        y = _mm256_add_ps(y, x);
+        y = _mm256_add_ps(y, one);
+        const __m256i exponent = _mm256_add_epi32(_mm256_cvttps_epi32(fx),
+                                                  _mm256_set1_epi32(0x7f));
+        y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23)));
+        _mm256_storeu_ps(values + ii, y);
+    }
+    ExpInPlaceSSE2(values + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+bool PropagateAttackAVX2(float *gains, const float *prevGains, float *active,
+                         size_t len, float attack, float floor) {
+    const __m256 vAttack = _mm256_set1_ps(attack);
+    const __m256 vFloor = _mm256_set1_ps(floor);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 any = _mm256_setzero_ps();
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        const __m256 minimum = _mm256_max_ps(
+                vFloor, _mm256_mul_ps(_mm256_loadu_ps(prevGains + ii), vAttack));
+        const __m256 gain = _mm256_loadu_ps(gains + ii);
+        const __m256 raise = _mm256_and_ps(
+                _mm256_cmp_ps(_mm256_loadu_ps(active + ii), _mm256_setzero_ps(), _CMP_NEQ_UQ),
+                _mm256_cmp_ps(gain, minimum, _CMP_LT_OQ));
+        _mm256_storeu_ps(gains + ii, _mm256_blendv_ps(gain, minimum, raise));
+        _mm256_storeu_ps(active + ii, _mm256_and_ps(raise, one));
+        any = _mm256_or_ps(any, raise);
+    }
+    const bool tail = PropagateAttackSSE2(gains + ii, prevGains + ii, active + ii,
+                                          len - ii, attack, floor);
+    return _mm256_movemask_ps(any) != 0 || tail;
+}
+
+__attribute__((target("avx2")))
+void PropagateReleaseAVX2(float *nextGains, const float *gains,
+                          size_t len, float release, float floor) {
+    const __m256 vRelease = _mm256_set1_ps(release);
+    const __m256 vFloor = _mm256_set1_ps(floor);
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        const __m256 decayed = _mm256_max_ps(
+                vFloor, _mm256_mul_ps(_mm256_loadu_ps(gains + ii), vRelease));
+        _mm256_storeu_ps(nextGains + ii,
+                         _mm256_max_ps(_mm256_loadu_ps(nextGains + ii), decayed));
+    }
+    PropagateReleaseSSE2(nextGains + ii, gains + ii, len - ii, release, floor);
+}
+
+__attribute__((target("avx2")))
+void ClassifyBandsAVX2(float *isNoise, const float *const *spectrums,
+                       unsigned nWindows, unsigned rank,
+                       const float *thresholds, size_t start, size_t end) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t ii = start;
+    for (; ii + 8 <= end; ii += 8) {
+        __m256 greatest[kMaxClassifyRank];
+        for (unsigned kk = 0; kk < rank; ++kk)
+            greatest[kk] = _mm256_setzero_ps();
+        for (unsigned ww = 0; ww < nWindows; ++ww) {
+            __m256 power = _mm256_loadu_ps(spectrums[ww] + ii);
+            for (unsigned kk = 0; kk < rank; ++kk) {
+                const __m256 higher = _mm256_max_ps(greatest[kk], power);
+                power = _mm256_min_ps(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        const __m256 noise = _mm256_cmp_ps(greatest[rank - 1],
+                                           _mm256_loadu_ps(thresholds + ii), _CMP_LE_OQ);
+        _mm256_storeu_ps(isNoise + ii, _mm256_and_ps(noise, one));
+    }
+    ClassifyBandsSSE2(isNoise, spectrums, nWindows, rank, thresholds, ii, end);
+}
+
+template <unsigned NWindows, unsigned Rank>
+__attribute__((target("avx2")))
+void ClassifyBandsFixedAVX2(float *isNoise, const float *const *spectrums,
+                            const float *thresholds, size_t start, size_t end) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t ii = start;
+    for (; ii + 8 <= end; ii += 8) {
+        __m256 greatest[Rank];
+        for (unsigned kk = 0; kk < Rank; ++kk)
+            greatest[kk] = _mm256_setzero_ps();
+        for (unsigned ww = 0; ww < NWindows; ++ww) {
+            __m256 power = _mm256_loadu_ps(spectrums[ww] + ii);
+            for (unsigned kk = 0; kk < Rank; ++kk) {
+                const __m256 higher = _mm256_max_ps(greatest[kk], power);
+                power = _mm256_min_ps(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        const __m256 noise = _mm256_cmp_ps(greatest[Rank - 1],
+                                           _mm256_loadu_ps(thresholds + ii), _CMP_LE_OQ);
+        _mm256_storeu_ps(isNoise + ii, _mm256_and_ps(noise, one));
+    }
+    ClassifyBandsFixedSSE2<NWindows, Rank>(isNoise, spectrums, thresholds, ii, end);
+}
+
+#endif
+
+#ifdef NR_KERNELS_NEON
+
+// As the SSE2 versions, four floats to a vector.  Comparisons give masks of
+// all ones, selected by bits.
+
+inline float32x4_t AndMask(float32x4_t x, uint32x4_t mask) {
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(x), mask));
+}
+
+void ApplySpectralGainNEON(float *pairs, const float *gains,
+                           size_t len, float gainOffset) {
+    const float32x4_t offset = vdupq_n_f32(gainOffset);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const float32x4_t gain = vaddq_f32(vld1q_f32(gains + ii), offset);
+        // Each gain twice, for (re, im) pairs
+        float *const pair = pairs + 2 * ii;
+        vst1q_f32(pair, vmulq_f32(vld1q_f32(pair), vzip1q_f32(gain, gain)));
+        vst1q_f32(pair + 4, vmulq_f32(vld1q_f32(pair + 4), vzip2q_f32(gain, gain)));
+    }
+    ApplySpectralGainScalar(pairs + 2 * ii, gains + ii, len - ii, gainOffset);
+}
+
+void OverlapAddNEON(float *out, const float *fft,
+                    const int *bitReversed, const float *window,
+                    size_t nPairs) {
+    size_t ii = 0;
+    for (; ii + 2 <= nPairs; ii += 2) {
+        // Each bit reversed index addresses a contiguous (re, im) pair
+        float32x4_t value = vcombine_f32(vld1_f32(fft + bitReversed[ii]),
+                                         vld1_f32(fft + bitReversed[ii + 1]));
+        if (window)
+            value = vmulq_f32(value, vld1q_f32(window + 2 * ii));
+        vst1q_f32(out + 2 * ii, vaddq_f32(vld1q_f32(out + 2 * ii), value));
+    }
+    OverlapAddScalar(out + 2 * ii, fft, bitReversed + ii,
+                     window ? window + 2 * ii : nullptr, nPairs - ii);
+}
+
+void LogInPlaceNEON(float *values, size_t len) {
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        float32x4_t x = vmaxq_f32(vld1q_f32(values + ii), vdupq_n_f32(kMinNormal));
+        const uint32x4_t bits = vreinterpretq_u32_f32(x);
+        float32x4_t e = vaddq_f32(vcvtq_f32_s32(vsubq_s32(
+                vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(0x7f))), one);
+        x = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, vdupq_n_u32(~0x7f800000u)),
+                                            vreinterpretq_u32_f32(vdupq_n_f32(0.5f))));
+        const uint32x4_t small = vcltq_f32(x, vdupq_n_f32(kSqrtHalf));
+        const float32x4_t tmp = AndMask(x, small);
+        x = vsubq_f32(x, one);
+        e = vsubq_f32(e, AndMask(one, small));
+        x = vaddq_f32(x, tmp);
+        const float32x4_t z = vmulq_f32(x, x);
+        float32x4_t y = vdupq_n_f32(kLogP[0]);
+        for (int jj = 1; jj < 9; ++jj)
+            y = vaddq_f32(vmulq_f32(y, x), vdupq_n_f32(kLogP[jj]));
+        y = vmulq_f32(y, x);
+        y = vmulq_f32(y, z);
+        y = vaddq_f32(y, vmulq_f32(e, vdupq_n_f32(kLn2Lo)));
+        y = vsubq_f32(y, vmulq_f32(z, vdupq_n_f32(0.5f)));
+        x = vaddq_f32(x, y);
+        x = vaddq_f32(x, vmulq_f32(e, vdupq_n_f32(kLn2Hi)));
+        vst1q_f32(values + ii, x);
+    }
+    LogInPlaceScalar(values + ii, len - ii);
+}
+
+void ExpInPlaceNEON(float *values, size_t len) {
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        float32x4_t x = vmaxq_f32(vminq_f32(vld1q_f32(values + ii), vdupq_n_f32(kExpLimit)),
+                                  vdupq_n_f32(-kExpLimit));
+        float32x4_t fx = vaddq_f32(vmulq_f32(x, vdupq_n_f32(kLog2e)), vdupq_n_f32(0.5f));
+        fx = vrndmq_f32(fx);
+        x = vsubq_f32(x, vmulq_f32(fx, vdupq_n_f32(kLn2Hi)));
+        x = vsubq_f32(x, vmulq_f32(fx, vdupq_n_f32(kLn2Lo)));
+        const float32x4_t z = vmulq_f32(x, x);
+        float32x4_t y = vdupq_n_f32(kExpP[0]);
+        for (int jj = 1; jj < 6; ++jj)
+            y = vaddq_f32(vmulq_f32(y, x), vdupq_n_f32(kExpP[jj]));
+        y = vmulq_f32(y, z);
+        y = vaddq_f32(y, x);
+        y = vaddq_f32(y, one);
+        const int32x4_t exponent = vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(0x7f));
+        y = vmulq_f32(y, vreinterpretq_f32_s32(vshlq_n_s32(exponent, 23)));
+        vst1q_f32(values + ii, y);
+    }
+    ExpInPlaceScalar(values + ii, len - ii);
+}
+
+bool PropagateAttackNEON(float *gains, const float *prevGains, float *active,
+                         size_t len, float attack, float floor) {
+    const float32x4_t vAttack = vdupq_n_f32(attack);
+    const float32x4_t vFloor = vdupq_n_f32(floor);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    uint32x4_t any = vdupq_n_u32(0);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const float32x4_t minimum = vmaxq_f32(vFloor, vmulq_f32(vld1q_f32(prevGains + ii), vAttack));
+        const float32x4_t gain = vld1q_f32(gains + ii);
+        const uint32x4_t raise = vandq_u32(
+                vmvnq_u32(vceqq_f32(vld1q_f32(active + ii), vdupq_n_f32(0.0f))),
+                vcltq_f32(gain, minimum));
+        vst1q_f32(gains + ii, vbslq_f32(raise, minimum, gain));
+        vst1q_f32(active + ii, AndMask(one, raise));
+        any = vorrq_u32(any, raise);
+    }
+    const bool tail = PropagateAttackScalar(gains + ii, prevGains + ii, active + ii,
+                                            len - ii, attack, floor);
+    return vmaxvq_u32(any) != 0 || tail;
+}
+
+void PropagateReleaseNEON(float *nextGains, const float *gains,
+                          size_t len, float release, float floor) {
+    const float32x4_t vRelease = vdupq_n_f32(release);
+    const float32x4_t vFloor = vdupq_n_f32(floor);
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const float32x4_t decayed = vmaxq_f32(vFloor, vmulq_f32(vld1q_f32(gains + ii), vRelease));
+        vst1q_f32(nextGains + ii, vmaxq_f32(vld1q_f32(nextGains + ii), decayed));
+    }
+    PropagateReleaseScalar(nextGains + ii, gains + ii, len - ii, release, floor);
+}
+
+void ClassifyBandsNEON(float *isNoise, const float *const *spectrums,
+                       unsigned nWindows, unsigned rank,
+                       const float *thresholds, size_t start, size_t end) {
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    size_t ii = start;
+    for (; ii + 4 <= end; ii += 4) {
+        float32x4_t greatest[kMaxClassifyRank];
+        for (unsigned kk = 0; kk < rank; ++kk)
+            greatest[kk] = vdupq_n_f32(0.0f);
+        for (unsigned ww = 0; ww < nWindows; ++ww) {
+            float32x4_t power = vld1q_f32(spectrums[ww] + ii);
+            for (unsigned kk = 0; kk < rank; ++kk) {
+                const float32x4_t higher = vmaxq_f32(greatest[kk], power);
+                power = vminq_f32(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        const uint32x4_t noise = vcleq_f32(greatest[rank - 1], vld1q_f32(thresholds + ii));
+        vst1q_f32(isNoise + ii, AndMask(one, noise));
+    }
+    ClassifyBandsScalar(isNoise, spectrums, nWindows, rank, thresholds, ii, end);
+}
+
+template <unsigned NWindows, unsigned Rank>
+void ClassifyBandsFixedNEON(float *isNoise, const float *const *spectrums,
+                            const float *thresholds, size_t start, size_t end) {
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    size_t ii = start;
+    for (; ii + 4 <= end; ii += 4) {
+        float32x4_t greatest[Rank];
+        for (unsigned kk = 0; kk < Rank; ++kk)
+            greatest[kk] = vdupq_n_f32(0.0f);
+        for (unsigned ww = 0; ww < NWindows; ++ww) {
+            float32x4_t power = vld1q_f32(spectrums[ww] + ii);
+            for (unsigned kk = 0; kk < Rank; ++kk) {
+                const float32x4_t higher = vmaxq_f32(greatest[kk], power);
+                power = vminq_f32(greatest[kk], power);
+                greatest[kk] = higher;
+            }
+        }
+        const uint32x4_t noise = vcleq_f32(greatest[Rank - 1], vld1q_f32(thresholds + ii));
+        vst1q_f32(isNoise + ii, AndMask(one, noise));
+    }
+    ClassifyBandsFixedScalar<NWindows, Rank>(isNoise, spectrums, thresholds, ii, end);
+}
+
+#endif
+
+using FixedClassify = void (*)(float *, const float *const *, const float *, size_t, size_t);
+
+// Classification specialized for what the standard settings need: two
+// steps per window with either method, four with either, eight with the
+// second greatest
+struct FixedClassifier {
+    unsigned nWindows;
+    unsigned rank;
+    FixedClassify classify;
+};
+enum : unsigned { nFixedClassifiers = 4 };
+
+struct Kernels {
+    SimdLevel level;
+    decltype(&ApplySpectralGainScalar) applySpectralGain;
+    decltype(&OverlapAddScalar) overlapAdd;
+    decltype(&LogInPlaceScalar) logInPlace;
+    decltype(&ExpInPlaceScalar) expInPlace;
+    decltype(&PropagateAttackScalar) propagateAttack;
+    decltype(&PropagateReleaseScalar) propagateRelease;
+    decltype(&ClassifyBandsScalar) classifyBands;
+    FixedClassifier fixedClassifiers[nFixedClassifiers];
+};
+
+bool IsSupported(SimdLevel level) {
+    return SimdLevelSupported(level);
+}
+
+Kernels MakeKernels(SimdLevel level) {
+    switch (level) {
+#ifdef NR_KERNELS_X86
+        // No wider kernels yet
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2:
+            return {level, ApplySpectralGainAVX2, OverlapAddAVX2,
+                    LogInPlaceAVX2, ExpInPlaceAVX2,
+                    PropagateAttackAVX2, PropagateReleaseAVX2,
+                    ClassifyBandsAVX2,
+                    {{3, 2, ClassifyBandsFixedAVX2<3, 2>},
+                     {5, 2, ClassifyBandsFixedAVX2<5, 2>},
+                     {5, 3, ClassifyBandsFixedAVX2<5, 3>},
+                     {9, 2, ClassifyBandsFixedAVX2<9, 2>}}};
+        case SimdLevel::SSE2:
+            return {level, ApplySpectralGainSSE2, OverlapAddSSE2,
+                    LogInPlaceSSE2, ExpInPlaceSSE2,
+                    PropagateAttackSSE2, PropagateReleaseSSE2,
+                    ClassifyBandsSSE2,
+                    {{3, 2, ClassifyBandsFixedSSE2<3, 2>},
+                     {5, 2, ClassifyBandsFixedSSE2<5, 2>},
+                     {5, 3, ClassifyBandsFixedSSE2<5, 3>},
+                     {9, 2, ClassifyBandsFixedSSE2<9, 2>}}};
+#endif
+#ifdef NR_KERNELS_NEON
+        case SimdLevel::NEON:
+            return {level, ApplySpectralGainNEON, OverlapAddNEON,
+                    LogInPlaceNEON, ExpInPlaceNEON,
+                    PropagateAttackNEON, PropagateReleaseNEON,
+                    ClassifyBandsNEON,
+                    {{3, 2, ClassifyBandsFixedNEON<3, 2>},
+                     {5, 2, ClassifyBandsFixedNEON<5, 2>},
+                     {5, 3, ClassifyBandsFixedNEON<5, 3>},
+                     {9, 2, ClassifyBandsFixedNEON<9, 2>}}};
+#endif
+        default:
+            return {SimdLevel::Scalar, ApplySpectralGainScalar, OverlapAddScalar,
+                    LogInPlaceScalar, ExpInPlaceScalar,
+                    PropagateAttackScalar, PropagateReleaseScalar,
+                    ClassifyBandsScalar,
+                    {{3, 2, ClassifyBandsFixedScalar<3, 2>},
+                     {5, 2, ClassifyBandsFixedScalar<5, 2>},
+                     {5, 3, ClassifyBandsFixedScalar<5, 3>},
+                     {9, 2, ClassifyBandsFixedScalar<9, 2>}}};
+    }
+}
+
+// The kernels of every level are made once, and forcing a level swaps the
+// pointer alone, so that threads processing meanwhile dispatch through the
+// table of one level or the other, never one half written
+const Kernels &KernelsFor(SimdLevel level) {
+    static const Kernels tables[] = {
+            MakeKernels(SimdLevel::Scalar), MakeKernels(SimdLevel::SSE2), MakeKernels(SimdLevel::AVX2),
+            MakeKernels(SimdLevel::AVX512), MakeKernels(SimdLevel::NEON),
+    };
+    return tables[static_cast<size_t>(level)];
+}
+
+std::atomic<const Kernels *> &CurrentTable() {
+    static std::atomic<const Kernels *> current{&KernelsFor(CpuSimdLevel())};
+    return current;
+}
+
+inline const Kernels &CurrentKernels() {
+    return *CurrentTable().load(std::memory_order_acquire);
+}
+
+}
+
+void ApplySpectralGain(float *pairs, const float *gains,
+                       size_t len, float gainOffset) {
+    CurrentKernels().applySpectralGain(pairs, gains, len, gainOffset);
+}
+
+void OverlapAddBitReversed(float *out, const float *fft,
+                           const int *bitReversed, const float *window,
+                           size_t nPairs) {
+    CurrentKernels().overlapAdd(out, fft, bitReversed, window, nPairs);
+}
+
+void LogInPlace(float *values, size_t len) {
+    CurrentKernels().logInPlace(values, len);
+}
+
+void ExpInPlace(float *values, size_t len) {
+    CurrentKernels().expInPlace(values, len);
+}
+
+bool PropagateAttack(float *gains, const float *prevGains, float *active,
+                     size_t len, float attack, float floor) {
+    return CurrentKernels().propagateAttack(gains, prevGains, active,
+                                            len, attack, floor);
+}
+
+void PropagateRelease(float *nextGains, const float *gains,
+                      size_t len, float release, float floor) {
+    CurrentKernels().propagateRelease(nextGains, gains, len, release, floor);
+}
+
+void SmoothGainsGeometrically(float *gains, double *scratch, size_t len, size_t bins) {
+    // Don't multiply and take nth root -- that may quickly cause
+    // underflows.  Instead, average the logs.
+    LogInPlace(gains, len);
+
+    // Prefix sums, so that each neighborhood average costs O(1) however
+    // many bands are smoothed.  Accumulate in double so the differences
+    // of large sums don't lose precision.
+    double *pPrefix = scratch;
+    pPrefix[0] = 0.0;
+    for (size_t ii = 0; ii < len; ++ii)
+        pPrefix[ii + 1] = pPrefix[ii] + gains[ii];
+
+    for (size_t ii = 0; ii < len; ++ii) {
+        const size_t j0 = ii > bins ? ii - bins : 0;
+        const size_t j1 = std::min(len - 1, ii + bins);
+        gains[ii] = (pPrefix[j1 + 1] - pPrefix[j0]) / (j1 - j0 + 1);
+    }
+
+    ExpInPlace(gains, len);
+}
+
+void ClassifyBands(float *isNoise, const float *const *spectrums,
+                   unsigned nWindows, unsigned rank,
+                   const float *thresholds, size_t start, size_t end) {
+    const auto &kernels = CurrentKernels();
+    for (const auto &fixed : kernels.fixedClassifiers)
+        if (fixed.nWindows == nWindows && fixed.rank == rank) {
+            fixed.classify(isNoise, spectrums, thresholds, start, end);
+            return;
+        }
+    kernels.classifyBands(isNoise, spectrums, nWindows, rank,
+                          thresholds, start, end);
+}
+
+void InsertSortedBands(float *sorted, size_t stride, unsigned count,
+                       const float *values, size_t start, size_t end) {
+    for (size_t ii = start; ii < end; ++ii) {
+        float *const column = sorted + ii * stride;
+        const float value = values[ii];
+        float *const place = std::upper_bound(column, column + count, value);
+        std::copy_backward(place, column + count, column + count + 1);
+        *place = value;
+    }
+}
+
+void RemoveSortedBands(float *sorted, size_t stride, unsigned count,
+                       const float *values, size_t start, size_t end) {
+    for (size_t ii = start; ii < end; ++ii) {
+        float *const column = sorted + ii * stride;
+        // Something is removed even if the search fails (a NaN), so
+        // that the count stays right
+        float *const found = std::min(std::lower_bound(column, column + count, values[ii]),
+                                      column + count - 1);
+        std::copy(found + 1, column + count, found);
+    }
+}
+
+SimdLevel GetKernelSimdLevel() {
+    return CurrentKernels().level;
+}
+
+bool SetKernelSimdLevel(SimdLevel level) {
+    if (!IsSupported(level))
+        return false;
+    CurrentTable().store(&KernelsFor(level), std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,90 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  NoiseReductionKernels.h
+
+  Inner loops of EffectNoiseReduction::Worker::ReduceNoise, with
+  SSE2, AVX2 and NEON versions selected at run time and a scalar fallback.
+  All versions do the same single precision arithmetic (no fused
+  multiply-add), so they give identical results.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_NOISE_REDUCTION_KERNELS__
+#define __AUDACITY_NOISE_REDUCTION_KERNELS__
+
+#include <cstddef>
+#include "CpuFeatures.h"
+
+/// For ii in [0, len), multiply both of the pair pairs[2 ii],
+/// pairs[2 ii + 1] by gains[ii] + gainOffset.
+/// gainOffset is -1 when leaving the residue, 0 otherwise.
+void ApplySpectralGain(float *pairs, const float *gains,
+                       size_t len, float gainOffset);
+
+/// For ii in [0, nPairs): take the pair starting at fft[bitReversed[ii]],
+/// multiply it by the next two window values (if window is not null) and
+/// add it into out[2 ii], out[2 ii + 1].
+void OverlapAddBitReversed(float *out, const float *fft,
+                           const int *bitReversed, const float *window,
+                           size_t nPairs);
+
+/// Replace each value by an approximation of its natural logarithm.
+/// Arguments are clamped below to the least normal float.
+void LogInPlace(float *values, size_t len);
+
+/// Replace each value by an approximation of its exponential.
+/// Arguments are clamped to [-88.37, 88.37].
+void ExpInPlace(float *values, size_t len);
+
+/// One step of the attack, which goes backward in time:  where active[ii]
+/// is nonzero, raise gains[ii] to max(floor, prevGains[ii] * attack) if it
+/// is less.  active[ii] becomes 1 where the gain was raised, else 0.
+/// Returns whether any gain was raised.
+bool PropagateAttack(float *gains, const float *prevGains, float *active,
+                     size_t len, float attack, float floor);
+
+/// One step of the release:  nextGains[ii] =
+/// max(nextGains[ii], max(floor, gains[ii] * release))
+void PropagateRelease(float *nextGains, const float *gains,
+                      size_t len, float release, float floor);
+
+/// Replace each of gains[0] ... gains[len - 1] by the geometric mean of
+/// those within bins of it (fewer at the ends).  scratch holds len + 1.
+void SmoothGainsGeometrically(float *gains, double *scratch, size_t len, size_t bins);
+
+enum : unsigned { kMaxClassifyRank = 8 };
+
+/// For ii in [start, end):  isNoise[ii] = 1 if the rank-th greatest (1 based)
+/// of spectrums[0][ii] ... spectrums[nWindows - 1][ii] is at most
+/// thresholds[ii], else 0.  Requires 1 <= rank <= kMaxClassifyRank.
+/// The (nWindows, rank) pairs of the standard settings, (3, 2), (5, 2),
+/// (5, 3) and (9, 2), use versions unrolled at compile time.
+void ClassifyBands(float *isNoise, const float *const *spectrums,
+                   unsigned nWindows, unsigned rank,
+                   const float *thresholds, size_t start, size_t end);
+
+/// Sliding ranks for ClassifyBands with more windows than it ranks
+/// cheaply:  the column of band ii, at sorted + ii * stride, holds count
+/// powers ascending, so that any rank is read from it.  For ii in [start,
+/// end), insert values[ii] into the column, which must have room
+/// (count < stride).  Costs a binary search and the moves of the powers
+/// between it and its place, not a scan of the windows.
+void InsertSortedBands(float *sorted, size_t stride, unsigned count,
+                       const float *values, size_t start, size_t end);
+
+/// The reverse:  remove a power equal to values[ii] from each column of
+/// count (at least 1), as the window that had it leaves
+void RemoveSortedBands(float *sorted, size_t stride, unsigned count,
+                       const float *values, size_t start, size_t end);
+
+/// The level the kernels currently dispatch to; defaults to CpuSimdLevel()
+SimdLevel GetKernelSimdLevel();
+
+/// Force a level (for testing and benchmarking).  Returns false, changing
+/// nothing, if this CPU does not support it.  Threads processing meanwhile
+/// go on with either level, each kernel call with one of them.
+bool SetKernelSimdLevel(SimdLevel level);
+
+#endif
@@ -0,0 +1,66 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ODComputedBlockFile.cpp
+
+*******************************************************************//**
+
+\class ODComputedBlockFile
+\brief A BlockFile that reads through to the block its ODTask computes,
+once that is demanded.
+
+*//*******************************************************************/
+
+#include "ODComputedBlockFile.h"
+
+#include "InconsistencyException.h"
+#include "SampleFormat.h"
+
+ODComputedBlockFile::ODComputedBlockFile(const std::shared_ptr<ODTask> &task, size_t index, size_t sampleLen)
+        : BlockFile{wxFileNameWrapper{}, sampleLen}, mTask{task}, mIndex{index} {
+}
+
+ODComputedBlockFile::~ODComputedBlockFile() {
+}
+
+BlockFilePtr ODComputedBlockFile::GetComputed() const {
+    auto file = mTask->Demand(mIndex);
+    if (!file || file->GetLength() != mLen)
+        THROW_INCONSISTENCY_EXCEPTION;
+    return file;
+}
+
+bool ODComputedBlockFile::ReadSummary(ArrayOf<char> &data) {
+    return GetComputed()->ReadSummary(data);
+}
+
+size_t ODComputedBlockFile::ReadData(samplePtr data, sampleFormat format,
+                                     size_t start, size_t len, bool mayThrow) const {
+    BlockFilePtr file;
+    try {
+        file = GetComputed();
+    } catch (...) {
+        if (mayThrow)
+            throw;
+        ClearSamples(data, format, 0, len);
+        return 0;
+    }
+    return file->ReadData(data, format, start, len, mayThrow);
+}
+
+BlockFilePtr ODComputedBlockFile::Copy(wxFileNameWrapper &&) {
+    return make_blockfile<ODComputedBlockFile>(mTask, mIndex, mLen);
+}
+
+auto ODComputedBlockFile::GetSpaceUsage() const -> DiskByteCount {
+    return 0;
+}
+
+bool ODComputedBlockFile::IsSummaryAvailable() const {
+    return mTask->IsComputed(mIndex);
+}
+
+bool ODComputedBlockFile::IsDataAvailable() const {
+    return mTask->IsComputed(mIndex);
+}
@@ -0,0 +1,51 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ODComputedBlockFile.h
+
+  A block of a track whose samples an ODTask computes when they are first
+  read; until then it takes no space.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_OD_COMPUTED_BLOCKFILE__
+#define __AUDACITY_OD_COMPUTED_BLOCKFILE__
+
+#include "BlockFile.h"
+#include "ODTask.h"
+
+class ODComputedBlockFile final : public BlockFile {
+public:
+    /// Block index of task, of sampleLen samples
+    ODComputedBlockFile(const std::shared_ptr<ODTask> &task, size_t index, size_t sampleLen);
+
+    ~ODComputedBlockFile() override;
+
+    /// Those of the computed block
+    bool ReadSummary(ArrayOf<char> &data) override;
+
+    size_t ReadData(samplePtr data, sampleFormat format,
+                    size_t start, size_t len, bool mayThrow) const override;
+
+    /// Another of the same block of the same task
+    BlockFilePtr Copy(wxFileNameWrapper &&newFileName) override;
+
+    /// None; the computed block counts its own
+    DiskByteCount GetSpaceUsage() const override;
+
+    void Recover() override {}
+
+    bool IsSummaryAvailable() const override;
+
+    bool IsDataAvailable() const override;
+
+private:
+    // The computed block, computing it if need be; throws on failure
+    BlockFilePtr GetComputed() const;
+
+    std::shared_ptr<ODTask> mTask;
+    size_t mIndex;
+};
+
+#endif
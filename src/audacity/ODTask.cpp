@@ -0,0 +1,136 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ODTask.cpp
+
+*******************************************************************//**
+
+\class ODTask
+\brief Blocks of a track computed on demand, on the thread reading them
+or on the task's thread.
+
+Each block is pending, computing or computed.  A demand for a pending
+block computes it on the demanding thread, so that a read never waits for
+blocks before it; one for a block being computed waits for that.  The
+task's thread meanwhile takes the pending blocks after the last demanded,
+so that a reader going through the track in order finds them computed.
+
+*//*******************************************************************/
+
+#include "ODTask.h"
+
+#include <cassert>
+
+ODTask::ODTask(size_t nBlocks)
+        : mBlocks(nBlocks) {
+}
+
+ODTask::~ODTask() {
+    assert(!mThread);
+}
+
+bool ODTask::IsComputed(size_t ii) const {
+    ODLocker locker{&mLock};
+    return mBlocks[ii].state == State::Computed;
+}
+
+size_t ODTask::GetComputedCount() const {
+    ODLocker locker{&mLock};
+    return mComputed;
+}
+
+size_t ODTask::TakeNext() {
+    const auto nBlocks = mBlocks.size();
+    for (size_t nn = 0; nn < nBlocks; ++nn) {
+        const auto ii = (mNext + nn) % nBlocks;
+        if (mBlocks[ii].state == State::Pending) {
+            mBlocks[ii].state = State::Computing;
+            mNext = ii + 1;
+            return ii;
+        }
+    }
+    return nBlocks;
+}
+
+BlockFilePtr ODTask::Compute(size_t ii) {
+    BlockFilePtr file;
+    bool all = false;
+    auto finish = [&] {
+        {
+            ODLocker locker{&mLock};
+            auto &block = mBlocks[ii];
+            if (file) {
+                block.state = State::Computed;
+                block.file = file;
+                all = ++mComputed == mBlocks.size();
+            } else
+                block.state = State::Pending;
+        }
+        mChanged.notify_all();
+    };
+
+    try {
+        file = ComputeBlock(ii);
+    } catch (...) {
+        file.reset();
+        finish();
+        throw;
+    }
+    finish();
+    if (all)
+        OnComputed();
+    return file;
+}
+
+BlockFilePtr ODTask::Demand(size_t ii) {
+    {
+        std::unique_lock<std::mutex> lock{mLock};
+        auto &block = mBlocks[ii];
+        mChanged.wait(lock, [&block] { return block.state != State::Computing; });
+        if (block.state == State::Computed)
+            return block.file;
+        block.state = State::Computing;
+        mNext = ii + 1;
+    }
+    return Compute(ii);
+}
+
+bool ODTask::DoAll() {
+    while (true) {
+        size_t ii;
+        {
+            std::unique_lock<std::mutex> lock{mLock};
+            // Until there is a block to take, or the others are done
+            while (true) {
+                if (mStopping)
+                    return false;
+                if ((ii = TakeNext()) < mBlocks.size())
+                    break;
+                if (mComputed == mBlocks.size())
+                    return true;
+                mChanged.wait(lock);
+            }
+        }
+        try {
+            if (!Compute(ii))
+                return false;
+        } catch (...) {
+            return false;
+        }
+    }
+}
+
+void ODTask::Start() {
+    if (!mThread)
+        mThread = std::make_unique<ODTaskThread>(this);
+}
+
+void ODTask::Stop() {
+    {
+        ODLocker locker{&mLock};
+        mStopping = true;
+    }
+    mChanged.notify_all();
+    mThread.reset();
+}
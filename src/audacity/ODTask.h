@@ -0,0 +1,99 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ODTask.h
+
+  Block files computed on demand:  each of a task's blocks is computed
+  the first time it is read, or before that by the task's thread, which
+  goes through them in order from the last one read.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_ODTASK__
+#define __AUDACITY_ODTASK__
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+
+#include "BlockFile.h"
+#include "ODTaskThread.h"
+
+class ODTask /* not final, abstract */ {
+public:
+    explicit ODTask(size_t nBlocks);
+
+    ODTask(const ODTask &) = delete;
+
+    ODTask &operator=(const ODTask &) = delete;
+
+    /// Derived classes must Stop() in their destructors, before the
+    /// members ComputeBlock() uses go
+    virtual ~ODTask();
+
+    size_t GetBlockCount() const { return mBlocks.size(); }
+
+    /// Whether block ii is computed
+    bool IsComputed(size_t ii) const;
+
+    size_t GetComputedCount() const;
+
+    /// The computed block ii:  as computed before, or now on this thread,
+    /// or, if another thread is computing it, when that is done.  Those
+    /// after it are computed next by the task's thread.  Null if
+    /// ComputeBlock() failed; an exception it throws propagates, and the
+    /// block is tried again on the next demand.
+    BlockFilePtr Demand(size_t ii);
+
+    /// Compute the blocks not yet computed or being computed, in order from
+    /// the last demanded, on this thread; several threads may at once.
+    /// True once all are computed, false if one failed, or on Stop().
+    bool DoAll();
+
+    /// Start the task's thread, which does DoAll()
+    void Start();
+
+    /// Stop the task's thread between blocks, and wait for it; the calls
+    /// of DoAll() on other threads return too
+    void Stop();
+
+protected:
+    /// Block ii, of the DirManager of the track it is in; null on failure
+    virtual BlockFilePtr ComputeBlock(size_t ii) = 0;
+
+    /// Called once, when the last block is computed, to release what only
+    /// computing them needs
+    virtual void OnComputed() {}
+
+    /// Becomes true on Stop(), for the computation of a block to stop
+    const std::atomic<bool> &GetStopping() const { return mStopping; }
+
+private:
+    enum class State : char {
+        Pending, Computing, Computed
+    };
+
+    struct Block {
+        State state{State::Pending};
+        BlockFilePtr file;
+    };
+
+    // With mLock held, marks the first block pending at or after mNext,
+    // wrapping around, as computing, and returns it; GetBlockCount() if none
+    size_t TakeNext();
+
+    // Of a block marked as computing, without mLock
+    BlockFilePtr Compute(size_t ii);
+
+    mutable ODLock mLock;
+    std::condition_variable mChanged;
+    std::vector<Block> mBlocks;
+    size_t mNext{0};
+    size_t mComputed{0};
+    std::atomic<bool> mStopping{false};
+    std::unique_ptr<ODTaskThread> mThread;
+};
+
+#endif
@@ -17,3 +17,14 @@
 
 
 #include "ODTaskThread.h"
+#include "ODTask.h"
+
+ODTaskThread::ODTaskThread(ODTask *task)
+   : mThread{[task] { task->DoAll(); }}
+{
+}
+
+ODTaskThread::~ODTaskThread()
+{
+   mThread.join();
+}
@@ -23,12 +23,26 @@
 #define __AUDACITY_ODTASKTHREAD__
 
 #include <mutex>
+#include <thread>
 
-class ODTaskThread {
+class ODTask;
 
-};
-class ODLocker {
+/// Runs ODTask::DoAll() on a thread of its own, from construction until
+/// the task is done or stopped.  The destructor waits for the thread.
+class ODTaskThread final {
+public:
+   ///Constructs a ODTaskThread
+   ///@param task the task to be launched as an
+   explicit ODTaskThread(ODTask *task);
 
+   ODTaskThread(const ODTaskThread &) = delete;
+
+   ODTaskThread &operator=(const ODTaskThread &) = delete;
+
+   ~ODTaskThread();
+
+private:
+   std::thread mThread;
 };
 
 //a wrapper for wxMutex.
@@ -41,4 +55,33 @@ public:
   virtual ~ODLock(){}
 };
 
+/// Holds the lock, if any, from construction until destruction or reset(),
+/// and may be moved out of a function still holding it
+class ODLocker {
+public:
+   explicit ODLocker(ODLock *pLock = nullptr) : mpLock{pLock}
+   {
+      if (mpLock)
+         mpLock->lock();
+   }
+
+   ODLocker(ODLocker &&that) : mpLock{that.mpLock} { that.mpLock = nullptr; }
+
+   ODLocker(const ODLocker &) = delete;
+
+   ODLocker &operator=(const ODLocker &) = delete;
+
+   ~ODLocker() { reset(); }
+
+   void reset()
+   {
+      if (mpLock)
+         mpLock->unlock();
+      mpLock = nullptr;
+   }
+
+private:
+   ODLock *mpLock;
+};
+
 #endif
@@ -0,0 +1,226 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ProfileCache.cpp
+
+*******************************************************************//**
+
+\class ProfileCache
+\brief Saved noise profiles, by the content they were taken from.
+
+A profile is kept as EffectNoiseReduction::SaveProfile() writes it, and
+found again with LoadProfile(), so that a profile from the cache reduces
+noise exactly as the one taken.  The key is a 64 bit FNV-1a hash and the
+size of the sound file's bytes, the bits of the range, and the window
+size, window types and steps per window; nothing else of the settings
+changes a profile.  The file is read to hash it whether or not it is
+found, but decoding, the tracks and the transforms are skipped.
+
+Profiling is done without the lock, so that threads taking different
+profiles do not wait for each other; two taking the same one at once
+both profile it.
+
+*//*******************************************************************/
+
+#include "ProfileCache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <unistd.h>   // getpid
+
+#include "DirManager.h"
+#include "ImportPCM.h"
+
+namespace {
+class ContentHash {
+public:
+    void Add(const void *data, size_t size) {
+        const auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t ii = 0; ii < size; ++ii)
+            mHash = (mHash ^ bytes[ii]) * 0x100000001b3ull;
+        mSize += size;
+    }
+
+    uint64_t GetHash() const { return mHash; }
+
+    size_t GetSize() const { return mSize; }
+
+private:
+    uint64_t mHash{0xcbf29ce484222325ull};
+    size_t mSize{0};
+};
+
+uint64_t Bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+}
+
+ProfileCache &ProfileCache::Get() {
+    static ProfileCache cache;
+    return cache;
+}
+
+auto ProfileCache::MakeKey(uint64_t hash, size_t size, double t0, double t1,
+                           const EffectNoiseReduction &effect) -> Key {
+    const auto settings = effect.GetAdvancedSettings();
+    // Also the name of the file in the directory
+    char key[128];
+    snprintf(key, sizeof(key), "%016" PRIx64 "-%zx-%016" PRIx64 "-%016" PRIx64 "-%zu-%d-%d",
+             hash, size, Bits(t0), Bits(t1), effect.GetWindowSize(), settings.windowTypes,
+             settings.stepsPerWindowChoice);
+    return key;
+}
+
+bool ProfileCache::GetProfile(EffectNoiseReduction &effect, const std::string &path, double t0, double t1) {
+    ContentHash hash;
+    {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Could not open noise profile source: " << path << std::endl;
+            return false;
+        }
+        char buffer[65536];
+        while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+            hash.Add(buffer, (size_t) file.gcount());
+        if (file.bad())
+            return false;
+    }
+
+    const auto key = MakeKey(hash.GetHash(), hash.GetSize(), t0, t1, effect);
+    return Find(key, effect) || Take(key, effect, PCMImportFileHandle::Open(path), t0, t1);
+}
+
+bool ProfileCache::GetProfile(EffectNoiseReduction &effect, const void *data, size_t size, double t0, double t1) {
+    ContentHash hash;
+    hash.Add(data, size);
+    const auto key = MakeKey(hash.GetHash(), hash.GetSize(), t0, t1, effect);
+    return Find(key, effect) || Take(key, effect, PCMImportFileHandle::OpenMemory(data, size), t0, t1);
+}
+
+bool ProfileCache::Find(const Key &key, EffectNoiseReduction &effect) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        const auto found = mIndex.find(key);
+        if (found != mIndex.end()) {
+            mEntries.splice(mEntries.begin(), mEntries, found->second);
+            ++mCounts.hits;
+            const auto &blob = found->second->second;
+            return effect.LoadProfile(blob.data(), blob.size());
+        }
+        if (mDirectory.empty())
+            return false;
+        path = mDirectory + "/" + key + ".nrprof";
+    }
+
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    std::vector<char> blob{std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>()};
+    // A corrupt file is profiled again, and replaced
+    if (file.bad() || !effect.LoadProfile(blob.data(), blob.size()))
+        return false;
+
+    std::lock_guard<std::mutex> lock{mMutex};
+    ++mCounts.diskHits;
+    Insert(key, std::move(blob));
+    return true;
+}
+
+bool ProfileCache::Take(const Key &key, EffectNoiseReduction &effect, std::unique_ptr<ImportFileHandle> handle,
+                        double t0, double t1) {
+    if (!handle)
+        return false;
+    {
+        // Blocks of the profile source exist only while profiling
+        const auto dirManager = std::make_shared<DirManager>(true);
+        TrackFactory factory{dirManager};
+        TrackHolders holders;
+        if (handle->Import(&factory, holders) != ProgressResult::Success || holders.empty())
+            return false;
+        // Noise gain, sensitivity and smoothing do not affect the profile
+        if (!effect.GetProfile(holders[0].get(), t0, t1, 12.0, 6.0, 3.0, &factory))
+            return false;
+    }
+
+    std::vector<char> blob;
+    if (!effect.SaveProfile(blob))
+        return false;
+
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        ++mCounts.misses;
+        directory = mDirectory;
+        Insert(key, blob);
+    }
+    if (!directory.empty()) {
+        // Written whole under a name of this process and thread's, then
+        // renamed, so that other processes never read part of it
+        const auto path = directory + "/" + key + ".nrprof";
+        const auto temporary = path + "." + std::to_string((long) getpid()) + "." +
+                               std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+        std::ofstream file(temporary, std::ios::out | std::ios::binary);
+        if (file.is_open() && file.write(blob.data(), blob.size()) && (file.close(), !file.fail()))
+            std::rename(temporary.c_str(), path.c_str());
+        else {
+            std::cerr << "Could not write noise profile to the cache: " << path << std::endl;
+            std::remove(temporary.c_str());
+        }
+    }
+    return true;
+}
+
+void ProfileCache::Insert(const Key &key, std::vector<char> blob) {
+    if (mCapacity == 0)
+        return;
+    const auto found = mIndex.find(key);
+    if (found != mIndex.end()) {
+        found->second->second = std::move(blob);
+        mEntries.splice(mEntries.begin(), mEntries, found->second);
+        return;
+    }
+    mEntries.emplace_front(key, std::move(blob));
+    mIndex[key] = mEntries.begin();
+    while (mEntries.size() > mCapacity) {
+        mIndex.erase(mEntries.back().first);
+        mEntries.pop_back();
+    }
+}
+
+void ProfileCache::SetCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock{mMutex};
+    mCapacity = capacity;
+    while (mEntries.size() > mCapacity) {
+        mIndex.erase(mEntries.back().first);
+        mEntries.pop_back();
+    }
+}
+
+void ProfileCache::SetDirectory(const std::string &directory) {
+    std::lock_guard<std::mutex> lock{mMutex};
+    mDirectory = directory;
+}
+
+void ProfileCache::Clear() {
+    std::lock_guard<std::mutex> lock{mMutex};
+    mEntries.clear();
+    mIndex.clear();
+}
+
+auto ProfileCache::GetCounts() const -> Counts {
+    std::lock_guard<std::mutex> lock{mMutex};
+    auto counts = mCounts;
+    counts.entries = mEntries.size();
+    return counts;
+}
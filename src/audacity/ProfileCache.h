@@ -0,0 +1,99 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ProfileCache.h
+
+  Noise profiles taken from ranges of sound files, kept so that taking
+  the same one again skips the import and the profiling:  in memory, and
+  optionally as files in a directory, found again by later processes.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_PROFILE_CACHE__
+#define __AUDACITY_PROFILE_CACHE__
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ImportPlugin.h"
+#include "NoiseReduction.h"
+
+class ProfileCache final {
+public:
+    /// Profiles kept in memory by default
+    static const size_t DefaultCapacity = 64;
+
+    /// The cache of the process
+    static ProfileCache &Get();
+
+    ProfileCache() = default;
+
+    ProfileCache(const ProfileCache &) = delete;
+
+    ProfileCache &operator=(const ProfileCache &) = delete;
+
+    /// Into effect, the profile of [t0, t1) of the first channel of the
+    /// sound file at path, as EffectNoiseReduction::GetProfile() takes it
+    /// with the effect's settings; from the cache when the file's content,
+    /// the range and the settings that shape a profile (window size, window
+    /// types and steps per window) are those of one taken before.  False,
+    /// caching nothing, if the file cannot be read or profiled.
+    bool GetProfile(EffectNoiseReduction &effect, const std::string &path, double t0, double t1);
+
+    /// The same of the size bytes of a sound file at data
+    bool GetProfile(EffectNoiseReduction &effect, const void *data, size_t size, double t0, double t1);
+
+    /// Most profiles kept in memory, the least recently used dropped first;
+    /// 0 keeps none, though the directory still does
+    void SetCapacity(size_t capacity);
+
+    /// Also keep each profile as a file of the directory, which must exist,
+    /// and look there for those not in memory; empty, the default, for
+    /// memory only
+    void SetDirectory(const std::string &directory);
+
+    /// Forget the profiles in memory; those in the directory stay
+    void Clear();
+
+    struct Counts {
+        unsigned long long hits;     // found in memory
+        unsigned long long diskHits; // found in the directory
+        unsigned long long misses;   // imported and profiled
+        size_t entries;              // in memory now
+    };
+
+    Counts GetCounts() const;
+
+private:
+    using Key = std::string;
+
+    // The key of content with hash and size, for the effect's settings
+    static Key MakeKey(uint64_t hash, size_t size, double t0, double t1,
+                       const EffectNoiseReduction &effect);
+
+    // Loads the profile of key into effect, if there is one
+    bool Find(const Key &key, EffectNoiseReduction &effect);
+
+    // Takes the profile of the opened file into effect, and keeps it
+    bool Take(const Key &key, EffectNoiseReduction &effect, std::unique_ptr<ImportFileHandle> handle,
+              double t0, double t1);
+
+    // Adds to memory, with mMutex held
+    void Insert(const Key &key, std::vector<char> blob);
+
+    mutable std::mutex mMutex;
+    size_t mCapacity{DefaultCapacity};
+    std::string mDirectory;
+    // Most recently used first
+    std::list<std::pair<Key, std::vector<char>>> mEntries;
+    std::unordered_map<Key, decltype(mEntries)::iterator> mIndex;
+    Counts mCounts{};
+};
+
+#endif
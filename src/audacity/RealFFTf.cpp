@@ -18,6 +18,8 @@
 *                   and BitReversed tables so they don't need to be reallocated
 *                   and recomputed on every call.
 *                 - Added Reorder* functions to undo the bit-reversal
+*              GetFFT now shares tables through reference counting, and
+*                 may be called on any thread.
 *
 *  Copyright (C) 2009  Philip VanBaren
 *
@@ -39,9 +41,13 @@
 #include <vector>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
-#include <thread>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <cstdint>
 
 #include "RealFFTf.h"
 #ifdef EXPERIMENTAL_EQ_SSE_THREADED
@@ -56,10 +62,10 @@
 *  Initialize the Sine table and Twiddle pointers (bit-reversed pointers)
 *  for the FFT routine.
 */
-HFFT InitializeFFT(size_t fftlen)
+static std::unique_ptr<FFTParam> InitializeFFT(size_t fftlen)
 {
    int temp;
-   HFFT h{ safenew FFTParam };
+   auto h = std::make_unique<FFTParam>();
 
    /*
    *  FFT size is only half the number of data points
@@ -97,46 +103,695 @@ HFFT InitializeFFT(size_t fftlen)
    return h;
 }
 
-enum : size_t { MAX_HFFT = 10 };
-
-// Maintain a pool:
-static std::vector< std::unique_ptr<FFTParam> > hFFTArray(MAX_HFFT);
+// Maintain a cache of tables by size; there are few sizes in use
+static std::mutex hFFTMutex;
+static std::map< size_t, HFFT > hFFTCache;
 
 /* Get a handle to the FFT tables of the desired length */
 /* This version keeps common tables rather than allocating a NEW table every time */
 HFFT GetFFT(size_t fftlen)
 {
-   // To do:  smarter policy about when to retain in the pool and when to
-   // allocate a unique instance.
-
-   size_t h = 0;
-   auto n = fftlen/2;
-   auto size = hFFTArray.size();
-   for(;
-       (h < size) && hFFTArray[h] && (n != hFFTArray[h]->Points);
-       h++)
-      ;
-   if(h < size) {
-      if(hFFTArray[h] == NULL) {
-         hFFTArray[h].reset( InitializeFFT(fftlen).release() );
+   std::lock_guard<std::mutex> lock{ hFFTMutex };
+   auto &h = hFFTCache[fftlen];
+   if (!h)
+      h = InitializeFFT(fftlen);
+   return h;
+}
+
+/*
+*  Butterfly stages, in scalar and SIMD versions chosen at run time.
+*
+*  Butterfly:
+*     Ain-----Aout
+*         \ /
+*         / \
+*     Bin-----Bout
+*
+*  Within one group of a stage all butterflies share a twiddle factor, so
+*  a vector holds consecutive complex values of A or B.  Stages with fewer
+*  butterflies per group than a vector holds use a narrower version.  All
+*  versions do the same single precision operations in the same order
+*  (contraction to fused multiply-add is disabled), so results are
+*  identical.
+*/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FFT_SIMD_X86
+#include <immintrin.h>
+#define FFT_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define FFT_SIMD_NEON
+#include <arm_neon.h>
+// Every AArch64 CPU has NEON; only contraction needs turning off
+#define FFT_TARGET_NEON __attribute__((optimize("fp-contract=off")))
+#endif
+
+namespace {
+
+void ForwardStageScalar(fft_type *buffer, const fft_type *sinTable,
+                        size_t points, size_t butterfliesPerGroup)
+{
+   fft_type *A = buffer, *B = buffer + butterfliesPerGroup * 2;
+   const fft_type *sptr = sinTable;
+   const fft_type *endptr1 = buffer + points * 2;
+   while(A < endptr1)
+   {
+      const fft_type sin = *sptr;
+      const fft_type cos = *(sptr+1);
+      const fft_type *endptr2 = B;
+      while(A < endptr2)
+      {
+         const fft_type v1 = *B * cos + *(B + 1) * sin;
+         const fft_type v2 = *B * sin - *(B + 1) * cos;
+         *B = (*A + v1);
+         *(A++) = *(B++) - 2 * v1;
+         *B = (*A - v2);
+         *(A++) = *(B++) + 2 * v2;
+      }
+      A = B;
+      B += butterfliesPerGroup * 2;
+      sptr += 2;
+   }
+}
+
+void InverseStageScalar(fft_type *buffer, const fft_type *sinTable,
+                        size_t points, size_t butterfliesPerGroup)
+{
+   fft_type *A = buffer, *B = buffer + butterfliesPerGroup * 2;
+   const fft_type *sptr = sinTable;
+   const fft_type *endptr1 = buffer + points * 2;
+   while(A < endptr1)
+   {
+      const fft_type sin = *(sptr++);
+      const fft_type cos = *(sptr++);
+      const fft_type *endptr2 = B;
+      while(A < endptr2)
+      {
+         const fft_type v1 = *B * cos - *(B + 1) * sin;
+         const fft_type v2 = *B * sin + *(B + 1) * cos;
+         *B = (*A + v1) * (fft_type)0.5;
+         *(A++) = *(B++) - v1;
+         *B = (*A + v2) * (fft_type)0.5;
+         *(A++) = *(B++) - v2;
       }
-      return HFFT{ hFFTArray[h].get() };
-   } else {
-      // All buffers used, so fall back to allocating a NEW set of tables
-      return InitializeFFT(fftlen);
+      A = B;
+      B += butterfliesPerGroup * 2;
    }
 }
 
-/* Release a previously requested handle to the FFT tables */
-void FFTDeleter::operator() (FFTParam *hFFT) const
+/*
+*  The first forward stage, taking its input windowed from another array.
+*  It has one group, the second half of the buffer being the B values.
+*/
+void ForwardWindowedStageScalar(fft_type *buffer, const fft_type *input,
+                                const fft_type *window, const fft_type *sinTable,
+                                size_t points)
 {
-   auto it = hFFTArray.begin(), end = hFFTArray.end();
-   while (it != end && it->get() != hFFT)
-      ++it;
-   if ( it != end )
-      ;
-   else
-      delete hFFT;
+   fft_type *A = buffer, *B = buffer + points;
+   const fft_type *inB = input + points, *winB = window + points;
+   const fft_type sin = sinTable[0];
+   const fft_type cos = sinTable[1];
+   for (size_t ii = 0; ii < points; ii += 2)
+   {
+      const fft_type aR = input[ii] * window[ii];
+      const fft_type aI = input[ii + 1] * window[ii + 1];
+      const fft_type bR = inB[ii] * winB[ii];
+      const fft_type bI = inB[ii + 1] * winB[ii + 1];
+      const fft_type v1 = bR * cos + bI * sin;
+      const fft_type v2 = bR * sin - bI * cos;
+      B[ii] = (aR + v1);
+      A[ii] = B[ii] - 2 * v1;
+      B[ii + 1] = (aI - v2);
+      A[ii + 1] = B[ii + 1] + 2 * v2;
+   }
+}
+
+#ifdef FFT_SIMD_X86
+
+/*
+*  With b = (bR, bI), X = b * cos and Y = swapped b * sin:
+*     forward:  (v1, -v2) = (XR + YR, XI - YI);
+*               Bout = Ain + (v1, -v2);  Aout = Bout - 2 (v1, -v2)
+*     inverse:  (v1, v2) = (XR - YR, XI + YI);
+*               Bout = (Ain + (v1, v2)) / 2;  Aout = Bout - (v1, v2)
+*  which round exactly as the scalar expressions do.
+*/
+
+FFT_TARGET("sse2")
+void ForwardStageSSE2(fft_type *buffer, const fft_type *sinTable,
+                      size_t points, size_t butterfliesPerGroup)
+{
+   const __m128 negateImag = _mm_castsi128_ps(_mm_set_epi32(INT32_MIN, 0, INT32_MIN, 0));
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const __m128 sin = _mm_set1_ps(sinTable[2 * group]);
+      const __m128 cos = _mm_set1_ps(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 4) {
+         const __m128 a = _mm_loadu_ps(A + ii);
+         const __m128 b = _mm_loadu_ps(B + ii);
+         const __m128 x = _mm_mul_ps(b, cos);
+         const __m128 y = _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1)), sin);
+         const __m128 w = _mm_add_ps(x, _mm_xor_ps(y, negateImag));
+         const __m128 bOut = _mm_add_ps(a, w);
+         _mm_storeu_ps(B + ii, bOut);
+         _mm_storeu_ps(A + ii, _mm_sub_ps(bOut, _mm_add_ps(w, w)));
+      }
+   }
+}
+
+FFT_TARGET("sse2")
+void ForwardWindowedStageSSE2(fft_type *buffer, const fft_type *input,
+                              const fft_type *window, const fft_type *sinTable,
+                              size_t points)
+{
+   const __m128 negateImag = _mm_castsi128_ps(_mm_set_epi32(INT32_MIN, 0, INT32_MIN, 0));
+   fft_type *A = buffer, *B = buffer + points;
+   const fft_type *inB = input + points, *winB = window + points;
+   const __m128 sin = _mm_set1_ps(sinTable[0]);
+   const __m128 cos = _mm_set1_ps(sinTable[1]);
+   for (size_t ii = 0; ii < points; ii += 4) {
+      const __m128 a = _mm_mul_ps(_mm_loadu_ps(input + ii), _mm_loadu_ps(window + ii));
+      const __m128 b = _mm_mul_ps(_mm_loadu_ps(inB + ii), _mm_loadu_ps(winB + ii));
+      const __m128 x = _mm_mul_ps(b, cos);
+      const __m128 y = _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1)), sin);
+      const __m128 w = _mm_add_ps(x, _mm_xor_ps(y, negateImag));
+      const __m128 bOut = _mm_add_ps(a, w);
+      _mm_storeu_ps(B + ii, bOut);
+      _mm_storeu_ps(A + ii, _mm_sub_ps(bOut, _mm_add_ps(w, w)));
+   }
+}
+
+FFT_TARGET("sse2")
+void InverseStageSSE2(fft_type *buffer, const fft_type *sinTable,
+                      size_t points, size_t butterfliesPerGroup)
+{
+   const __m128 negateReal = _mm_castsi128_ps(_mm_set_epi32(0, INT32_MIN, 0, INT32_MIN));
+   const __m128 half = _mm_set1_ps(0.5f);
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const __m128 sin = _mm_set1_ps(sinTable[2 * group]);
+      const __m128 cos = _mm_set1_ps(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 4) {
+         const __m128 a = _mm_loadu_ps(A + ii);
+         const __m128 b = _mm_loadu_ps(B + ii);
+         const __m128 x = _mm_mul_ps(b, cos);
+         const __m128 y = _mm_mul_ps(_mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1)), sin);
+         const __m128 v = _mm_add_ps(x, _mm_xor_ps(y, negateReal));
+         const __m128 bOut = _mm_mul_ps(_mm_add_ps(a, v), half);
+         _mm_storeu_ps(B + ii, bOut);
+         _mm_storeu_ps(A + ii, _mm_sub_ps(bOut, v));
+      }
+   }
+}
+
+FFT_TARGET("avx2")
+void ForwardStageAVX2(fft_type *buffer, const fft_type *sinTable,
+                      size_t points, size_t butterfliesPerGroup)
+{
+   const __m256 negateImag = _mm256_castsi256_ps(_mm256_set_epi32(
+      INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0));
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const __m256 sin = _mm256_set1_ps(sinTable[2 * group]);
+      const __m256 cos = _mm256_set1_ps(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 8) {
+         const __m256 a = _mm256_loadu_ps(A + ii);
+         const __m256 b = _mm256_loadu_ps(B + ii);
+         const __m256 x = _mm256_mul_ps(b, cos);
+         const __m256 y = _mm256_mul_ps(_mm256_permute_ps(b, 0xB1), sin);
+         const __m256 w = _mm256_add_ps(x, _mm256_xor_ps(y, negateImag));
+         const __m256 bOut = _mm256_add_ps(a, w);
+         _mm256_storeu_ps(B + ii, bOut);
+         _mm256_storeu_ps(A + ii, _mm256_sub_ps(bOut, _mm256_add_ps(w, w)));
+      }
+   }
+}
+
+FFT_TARGET("avx2")
+void ForwardWindowedStageAVX2(fft_type *buffer, const fft_type *input,
+                              const fft_type *window, const fft_type *sinTable,
+                              size_t points)
+{
+   const __m256 negateImag = _mm256_castsi256_ps(_mm256_set_epi32(
+      INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0));
+   fft_type *A = buffer, *B = buffer + points;
+   const fft_type *inB = input + points, *winB = window + points;
+   const __m256 sin = _mm256_set1_ps(sinTable[0]);
+   const __m256 cos = _mm256_set1_ps(sinTable[1]);
+   for (size_t ii = 0; ii < points; ii += 8) {
+      const __m256 a = _mm256_mul_ps(_mm256_loadu_ps(input + ii), _mm256_loadu_ps(window + ii));
+      const __m256 b = _mm256_mul_ps(_mm256_loadu_ps(inB + ii), _mm256_loadu_ps(winB + ii));
+      const __m256 x = _mm256_mul_ps(b, cos);
+      const __m256 y = _mm256_mul_ps(_mm256_permute_ps(b, 0xB1), sin);
+      const __m256 w = _mm256_add_ps(x, _mm256_xor_ps(y, negateImag));
+      const __m256 bOut = _mm256_add_ps(a, w);
+      _mm256_storeu_ps(B + ii, bOut);
+      _mm256_storeu_ps(A + ii, _mm256_sub_ps(bOut, _mm256_add_ps(w, w)));
+   }
+}
+
+FFT_TARGET("avx2")
+void InverseStageAVX2(fft_type *buffer, const fft_type *sinTable,
+                      size_t points, size_t butterfliesPerGroup)
+{
+   const __m256 negateReal = _mm256_castsi256_ps(_mm256_set_epi32(
+      0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN));
+   const __m256 half = _mm256_set1_ps(0.5f);
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const __m256 sin = _mm256_set1_ps(sinTable[2 * group]);
+      const __m256 cos = _mm256_set1_ps(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 8) {
+         const __m256 a = _mm256_loadu_ps(A + ii);
+         const __m256 b = _mm256_loadu_ps(B + ii);
+         const __m256 x = _mm256_mul_ps(b, cos);
+         const __m256 y = _mm256_mul_ps(_mm256_permute_ps(b, 0xB1), sin);
+         const __m256 v = _mm256_add_ps(x, _mm256_xor_ps(y, negateReal));
+         const __m256 bOut = _mm256_mul_ps(_mm256_add_ps(a, v), half);
+         _mm256_storeu_ps(B + ii, bOut);
+         _mm256_storeu_ps(A + ii, _mm256_sub_ps(bOut, v));
+      }
+   }
+}
+
+FFT_TARGET("avx512f")
+void ForwardStageAVX512(fft_type *buffer, const fft_type *sinTable,
+                        size_t points, size_t butterfliesPerGroup)
+{
+   const __m512 negateImag = _mm512_castsi512_ps(_mm512_set_epi32(
+      INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0,
+      INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0));
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const __m512 sin = _mm512_set1_ps(sinTable[2 * group]);
+      const __m512 cos = _mm512_set1_ps(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 16) {
+         const __m512 a = _mm512_loadu_ps(A + ii);
+         const __m512 b = _mm512_loadu_ps(B + ii);
+         const __m512 x = _mm512_mul_ps(b, cos);
+         const __m512 y = _mm512_mul_ps(_mm512_shuffle_ps(b, b, 0xB1), sin);
+         const __m512 w = _mm512_add_ps(x, _mm512_castsi512_ps(_mm512_xor_si512(
+            _mm512_castps_si512(y), _mm512_castps_si512(negateImag))));
+         const __m512 bOut = _mm512_add_ps(a, w);
+         _mm512_storeu_ps(B + ii, bOut);
+         _mm512_storeu_ps(A + ii, _mm512_sub_ps(bOut, _mm512_add_ps(w, w)));
+      }
+   }
+}
+
+FFT_TARGET("avx512f")
+void ForwardWindowedStageAVX512(fft_type *buffer, const fft_type *input,
+                                const fft_type *window, const fft_type *sinTable,
+                                size_t points)
+{
+   const __m512 negateImag = _mm512_castsi512_ps(_mm512_set_epi32(
+      INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0,
+      INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0));
+   fft_type *A = buffer, *B = buffer + points;
+   const fft_type *inB = input + points, *winB = window + points;
+   const __m512 sin = _mm512_set1_ps(sinTable[0]);
+   const __m512 cos = _mm512_set1_ps(sinTable[1]);
+   for (size_t ii = 0; ii < points; ii += 16) {
+      const __m512 a = _mm512_mul_ps(_mm512_loadu_ps(input + ii), _mm512_loadu_ps(window + ii));
+      const __m512 b = _mm512_mul_ps(_mm512_loadu_ps(inB + ii), _mm512_loadu_ps(winB + ii));
+      const __m512 x = _mm512_mul_ps(b, cos);
+      const __m512 y = _mm512_mul_ps(_mm512_shuffle_ps(b, b, 0xB1), sin);
+      const __m512 w = _mm512_add_ps(x, _mm512_castsi512_ps(_mm512_xor_si512(
+         _mm512_castps_si512(y), _mm512_castps_si512(negateImag))));
+      const __m512 bOut = _mm512_add_ps(a, w);
+      _mm512_storeu_ps(B + ii, bOut);
+      _mm512_storeu_ps(A + ii, _mm512_sub_ps(bOut, _mm512_add_ps(w, w)));
+   }
+}
+
+FFT_TARGET("avx512f")
+void InverseStageAVX512(fft_type *buffer, const fft_type *sinTable,
+                        size_t points, size_t butterfliesPerGroup)
+{
+   const __m512 negateReal = _mm512_castsi512_ps(_mm512_set_epi32(
+      0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN,
+      0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN, 0, INT32_MIN));
+   const __m512 half = _mm512_set1_ps(0.5f);
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const __m512 sin = _mm512_set1_ps(sinTable[2 * group]);
+      const __m512 cos = _mm512_set1_ps(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 16) {
+         const __m512 a = _mm512_loadu_ps(A + ii);
+         const __m512 b = _mm512_loadu_ps(B + ii);
+         const __m512 x = _mm512_mul_ps(b, cos);
+         const __m512 y = _mm512_mul_ps(_mm512_shuffle_ps(b, b, 0xB1), sin);
+         const __m512 v = _mm512_add_ps(x, _mm512_castsi512_ps(_mm512_xor_si512(
+            _mm512_castps_si512(y), _mm512_castps_si512(negateReal))));
+         const __m512 bOut = _mm512_mul_ps(_mm512_add_ps(a, v), half);
+         _mm512_storeu_ps(B + ii, bOut);
+         _mm512_storeu_ps(A + ii, _mm512_sub_ps(bOut, v));
+      }
+   }
+}
+
+#endif
+
+#ifdef FFT_SIMD_NEON
+
+/*
+*  As the SSE2 versions, two complex values to a vector:  vrev64q swaps the
+*  parts of each, and the signs of y are flipped by bits as there.
+*/
+
+inline float32x4_t FlipSigns(float32x4_t x, uint32x4_t signs)
+{
+   return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(x), signs));
+}
+
+FFT_TARGET_NEON
+void ForwardStageNEON(fft_type *buffer, const fft_type *sinTable,
+                      size_t points, size_t butterfliesPerGroup)
+{
+   const uint32x4_t negateImag = {0, 0x80000000u, 0, 0x80000000u};
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const float32x4_t sin = vdupq_n_f32(sinTable[2 * group]);
+      const float32x4_t cos = vdupq_n_f32(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 4) {
+         const float32x4_t a = vld1q_f32(A + ii);
+         const float32x4_t b = vld1q_f32(B + ii);
+         const float32x4_t x = vmulq_f32(b, cos);
+         const float32x4_t y = vmulq_f32(vrev64q_f32(b), sin);
+         const float32x4_t w = vaddq_f32(x, FlipSigns(y, negateImag));
+         const float32x4_t bOut = vaddq_f32(a, w);
+         vst1q_f32(B + ii, bOut);
+         vst1q_f32(A + ii, vsubq_f32(bOut, vaddq_f32(w, w)));
+      }
+   }
+}
+
+FFT_TARGET_NEON
+void ForwardWindowedStageNEON(fft_type *buffer, const fft_type *input,
+                              const fft_type *window, const fft_type *sinTable,
+                              size_t points)
+{
+   const uint32x4_t negateImag = {0, 0x80000000u, 0, 0x80000000u};
+   fft_type *A = buffer, *B = buffer + points;
+   const fft_type *inB = input + points, *winB = window + points;
+   const float32x4_t sin = vdupq_n_f32(sinTable[0]);
+   const float32x4_t cos = vdupq_n_f32(sinTable[1]);
+   for (size_t ii = 0; ii < points; ii += 4) {
+      const float32x4_t a = vmulq_f32(vld1q_f32(input + ii), vld1q_f32(window + ii));
+      const float32x4_t b = vmulq_f32(vld1q_f32(inB + ii), vld1q_f32(winB + ii));
+      const float32x4_t x = vmulq_f32(b, cos);
+      const float32x4_t y = vmulq_f32(vrev64q_f32(b), sin);
+      const float32x4_t w = vaddq_f32(x, FlipSigns(y, negateImag));
+      const float32x4_t bOut = vaddq_f32(a, w);
+      vst1q_f32(B + ii, bOut);
+      vst1q_f32(A + ii, vsubq_f32(bOut, vaddq_f32(w, w)));
+   }
+}
+
+FFT_TARGET_NEON
+void InverseStageNEON(fft_type *buffer, const fft_type *sinTable,
+                      size_t points, size_t butterfliesPerGroup)
+{
+   const uint32x4_t negateReal = {0x80000000u, 0, 0x80000000u, 0};
+   const float32x4_t half = vdupq_n_f32(0.5f);
+   const size_t groupStride = butterfliesPerGroup * 4;
+   for (size_t group = 0; group * groupStride < points * 2; ++group) {
+      fft_type *A = buffer + group * groupStride;
+      fft_type *B = A + butterfliesPerGroup * 2;
+      const float32x4_t sin = vdupq_n_f32(sinTable[2 * group]);
+      const float32x4_t cos = vdupq_n_f32(sinTable[2 * group + 1]);
+      for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 4) {
+         const float32x4_t a = vld1q_f32(A + ii);
+         const float32x4_t b = vld1q_f32(B + ii);
+         const float32x4_t x = vmulq_f32(b, cos);
+         const float32x4_t y = vmulq_f32(vrev64q_f32(b), sin);
+         const float32x4_t v = vaddq_f32(x, FlipSigns(y, negateReal));
+         const float32x4_t bOut = vmulq_f32(vaddq_f32(a, v), half);
+         vst1q_f32(B + ii, bOut);
+         vst1q_f32(A + ii, vsubq_f32(bOut, v));
+      }
+   }
+}
+
+#endif
+
+/*
+*  Forward transform of W frames at once, interleaved with the given stride,
+*  so that a vector holds the same sample of consecutive frames.  Every lane
+*  does exactly the operations of the scalar RealFFTf on its own frame.
+*/
+
+template <size_t W> struct FrameBatch;
+template <> struct FrameBatch<1> {
+   using type = fft_type;
+   using access = fft_type;
+};
+
+#if defined(FFT_SIMD_X86) || defined(FFT_SIMD_NEON)
+// The access types allow loads and stores at any float boundary
+#define FFT_FRAME_BATCH(W) \
+   typedef fft_type FrameVector##W __attribute__((vector_size(W * sizeof(fft_type)))); \
+   typedef fft_type FrameAccess##W __attribute__((vector_size(W * sizeof(fft_type)), \
+      aligned(sizeof(fft_type)), may_alias)); \
+   template <> struct FrameBatch<W> { \
+      using type = FrameVector##W; \
+      using access = FrameAccess##W; \
+   };
+FFT_FRAME_BATCH(4)
+#ifdef FFT_SIMD_X86
+FFT_FRAME_BATCH(8)
+FFT_FRAME_BATCH(16)
+#endif
+#undef FFT_FRAME_BATCH
+#endif
+
+template <size_t W>
+inline __attribute__((always_inline))
+void ForwardFrames(fft_type *buffer, size_t stride, const FFTParam *h)
+{
+   using V = typename FrameBatch<W>::type;
+   using Access = typename FrameBatch<W>::access;
+   // Sample ii of the frames; the return type is explicit so that the
+   // reduced alignment of Access is not lost in deduction
+   const auto at = [=](size_t ii) -> Access * { return reinterpret_cast<Access *>(buffer + ii * stride); };
+   const size_t points = h->Points;
+   const fft_type *const sinTable = h->SinTable.get();
+
+   for (size_t butterfliesPerGroup = points / 2; butterfliesPerGroup > 0; butterfliesPerGroup >>= 1) {
+      const size_t groupStride = butterfliesPerGroup * 4;
+      for (size_t group = 0; group * groupStride < points * 2; ++group) {
+         // Subtracting zero broadcasts exactly, even negative zero
+         const V sin = sinTable[2 * group] - V{};
+         const V cos = sinTable[2 * group + 1] - V{};
+         for (size_t ii = 0; ii < butterfliesPerGroup * 2; ii += 2) {
+            const size_t a = group * groupStride + ii;
+            const size_t b = a + butterfliesPerGroup * 2;
+            const V aR = *at(a), aI = *at(a + 1);
+            const V bR = *at(b), bI = *at(b + 1);
+            const V v1 = bR * cos + bI * sin;
+            const V v2 = bR * sin - bI * cos;
+            const V bOutR = aR + v1;
+            const V bOutI = aI - v2;
+            *at(b) = bOutR;
+            *at(a) = bOutR - (fft_type)2 * v1;
+            *at(b + 1) = bOutI;
+            *at(a + 1) = bOutI + (fft_type)2 * v2;
+         }
+      }
+   }
+
+   /* Massage output to get the output for a real input sequence. */
+   const int *br1 = h->BitReversed.get() + 1;
+   const int *br2 = h->BitReversed.get() + points - 1;
+   const V half = (fft_type)0.5 - V{};
+   while (br1 < br2) {
+      const V sin = sinTable[*br1] - V{};
+      const V cos = sinTable[*br1 + 1] - V{};
+      const size_t a = *br1, b = *br2;
+      const V aR = *at(a), aI = *at(a + 1);
+      const V bR = *at(b), bI = *at(b + 1);
+      const V HRminus = aR - bR;
+      const V HRplus = HRminus + bR * (fft_type)2;
+      const V HIminus = aI - bI;
+      const V HIplus = HIminus + bI * (fft_type)2;
+      const V v1 = sin * HRminus - cos * HIplus;
+      const V v2 = cos * HRminus + sin * HIplus;
+      const V aOutR = (HRplus + v1) * half;
+      const V aOutI = (HIminus + v2) * half;
+      *at(a) = aOutR;
+      *at(b) = aOutR - v1;
+      *at(a + 1) = aOutI;
+      *at(b + 1) = aOutI - HIminus;
+      br1++;
+      br2--;
+   }
+   /* Handle the center bin (just need a conjugate) */
+   *at(*br1 + 1) = -*at(*br1 + 1);
+   /* Put the Fs/2 value into the imaginary part of the DC bin */
+   const V dc = *at(0);
+   const V nyquist = *at(1);
+   *at(0) = dc + nyquist;
+   *at(1) = dc - nyquist;
+}
+
+void ForwardFramesScalar(fft_type *buffer, size_t stride, const FFTParam *h)
+{
+   ForwardFrames<1>(buffer, stride, h);
+}
+
+#ifdef FFT_SIMD_X86
+
+FFT_TARGET("sse2")
+void ForwardFramesSSE2(fft_type *buffer, size_t stride, const FFTParam *h)
+{
+   ForwardFrames<4>(buffer, stride, h);
+}
+
+FFT_TARGET("avx2")
+void ForwardFramesAVX2(fft_type *buffer, size_t stride, const FFTParam *h)
+{
+   ForwardFrames<8>(buffer, stride, h);
+}
+
+FFT_TARGET("avx512f")
+void ForwardFramesAVX512(fft_type *buffer, size_t stride, const FFTParam *h)
+{
+   ForwardFrames<16>(buffer, stride, h);
+}
+
+#endif
+
+#ifdef FFT_SIMD_NEON
+
+FFT_TARGET_NEON
+void ForwardFramesNEON(fft_type *buffer, size_t stride, const FFTParam *h)
+{
+   ForwardFrames<4>(buffer, stride, h);
+}
+
+#endif
+
+using Stage = void (*)(fft_type *, const fft_type *, size_t, size_t);
+using WindowedStage = void (*)(fft_type *, const fft_type *, const fft_type *,
+                               const fft_type *, size_t);
+using FrameTransform = void (*)(fft_type *, size_t, const FFTParam *);
+
+struct Stages {
+   Stage forward;
+   Stage inverse;
+   WindowedStage forwardWindowed;
+   size_t width; // complex values per vector
+   FrameTransform forwardFrames;
+   size_t frameWidth; // frames per vector
+};
+
+// Widest first
+size_t GetStages(SimdLevel level, Stages stages[])
+{
+   size_t nn = 0;
+#ifdef FFT_SIMD_X86
+   if (level >= SimdLevel::AVX512)
+      stages[nn++] = { ForwardStageAVX512, InverseStageAVX512, ForwardWindowedStageAVX512, 8, ForwardFramesAVX512, 16 };
+   if (level >= SimdLevel::AVX2)
+      stages[nn++] = { ForwardStageAVX2, InverseStageAVX2, ForwardWindowedStageAVX2, 4, ForwardFramesAVX2, 8 };
+   if (level >= SimdLevel::SSE2)
+      stages[nn++] = { ForwardStageSSE2, InverseStageSSE2, ForwardWindowedStageSSE2, 2, ForwardFramesSSE2, 4 };
+#endif
+#ifdef FFT_SIMD_NEON
+   if (level == SimdLevel::NEON)
+      stages[nn++] = { ForwardStageNEON, InverseStageNEON, ForwardWindowedStageNEON, 2, ForwardFramesNEON, 4 };
+#endif
+   stages[nn++] = { ForwardStageScalar, InverseStageScalar, ForwardWindowedStageScalar, 1, ForwardFramesScalar, 1 };
+   return nn;
+}
+
+struct StageTable {
+   SimdLevel level;
+   size_t count;
+   Stages stages[4];
+};
+
+// Made once for every level; forcing one swaps the pointer alone, so that
+// threads transforming meanwhile never see a table half written
+const StageTable &StagesOf(SimdLevel level)
+{
+   static const auto tables = [] {
+      const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2,
+                                   SimdLevel::AVX512, SimdLevel::NEON };
+      std::vector<StageTable> tables(sizeof(levels) / sizeof(levels[0]));
+      for (auto level : levels) {
+         auto &table = tables[static_cast<size_t>(level)];
+         table.level = level;
+         table.count = GetStages(level, table.stages);
+      }
+      return tables;
+   }();
+   return tables[static_cast<size_t>(level)];
+}
+
+std::atomic<const StageTable *> &CurrentTable()
+{
+   static std::atomic<const StageTable *> current{ &StagesOf(CpuSimdLevel()) };
+   return current;
+}
+
+inline const StageTable &CurrentStages()
+{
+   return *CurrentTable().load(std::memory_order_acquire);
+}
+
+const Stages &StagesFor(size_t butterfliesPerGroup)
+{
+   const auto &table = CurrentStages();
+   size_t ii = 0;
+   while (table.stages[ii].width > butterfliesPerGroup)
+      ++ii;
+   return table.stages[ii];
+}
+
+// Stages after the first may start from a windowed first stage
+void ForwardButterflies(fft_type *buffer, const FFTParam *h,
+                        size_t firstButterfliesPerGroup)
+{
+   for (auto ButterfliesPerGroup = firstButterfliesPerGroup; ButterfliesPerGroup > 0; ButterfliesPerGroup >>= 1)
+      StagesFor(ButterfliesPerGroup).forward(
+         buffer, h->SinTable.get(), h->Points, ButterfliesPerGroup);
+}
+
+void InverseButterflies(fft_type *buffer, const FFTParam *h)
+{
+   for (auto ButterfliesPerGroup = h->Points/2; ButterfliesPerGroup > 0; ButterfliesPerGroup >>= 1)
+      StagesFor(ButterfliesPerGroup).inverse(
+         buffer, h->SinTable.get(), h->Points, ButterfliesPerGroup);
+}
+
+}
+
+SimdLevel GetFFTSimdLevel()
+{
+   return CurrentStages().level;
+}
+
+bool SetFFTSimdLevel(SimdLevel level)
+{
+   if (!SimdLevelSupported(level))
+      return false;
+   CurrentTable().store(&StagesOf(level), std::memory_order_release);
+   return true;
 }
 
 /*
@@ -160,50 +815,12 @@ void FFTDeleter::operator() (FFTParam *hFFT) const
 void RealFFTf(fft_type *buffer, const FFTParam *h)
 {
    fft_type *A,*B;
-   const fft_type *sptr;
-   const fft_type *endptr1,*endptr2;
    const int *br1,*br2;
    fft_type HRplus,HRminus,HIplus,HIminus;
    fft_type v1,v2,sin,cos;
 
-   auto ButterfliesPerGroup = h->Points/2;
-
-   /*
-   *  Butterfly:
-   *     Ain-----Aout
-   *         \ /
-   *         / \
-   *     Bin-----Bout
-   */
+   ForwardButterflies(buffer, h, h->Points/2);
 
-   endptr1 = buffer + h->Points * 2;
-
-   while(ButterfliesPerGroup > 0)
-   {
-      A = buffer;
-      B = buffer + ButterfliesPerGroup * 2;
-      sptr = h->SinTable.get();
-
-      while(A < endptr1)
-      {
-         sin = *sptr;
-         cos = *(sptr+1);
-         endptr2 = B;
-         while(A < endptr2)
-         {
-            v1 = *B * cos + *(B + 1) * sin;
-            v2 = *B * sin - *(B + 1) * cos;
-            *B = (*A + v1);
-            *(A++) = *(B++) - 2 * v1;
-            *B = (*A - v2);
-            *(A++) = *(B++) + 2 * v2;
-         }
-         A = B;
-         B += ButterfliesPerGroup * 2;
-         sptr += 2;
-      }
-      ButterfliesPerGroup >>= 1;
-   }
    /* Massage output to get the output for a real input sequence. */
    br1 = h->BitReversed.get() + 1;
    br2 = h->BitReversed.get() + h->Points - 1;
@@ -240,6 +857,101 @@ void RealFFTf(fft_type *buffer, const FFTParam *h)
 }
 
 
+/*
+*  Forward FFT of input, multiplied by the window if that is not null,
+*  using buffer as scratch.  The output is packed as InverseRealFFTf takes
+*  it, in natural order: (real, imaginary) of bin i at packed[2 i] for
+*  0 < i < h->Points, the DC bin at packed[0] and the Fs/2 bin at
+*  packed[1].  power[i] is the squared magnitude of bin i, for
+*  0 <= i <= h->Points.  The values are exactly those of RealFFTf, but
+*  windowing is done in the first butterfly stage, and reordering in the
+*  last pass.
+*/
+void RealFFTfSpectrum(const fft_type *input, const fft_type *window,
+                      fft_type *buffer, fft_type *packed,
+                      fft_type *power, const FFTParam *h)
+{
+   const size_t points = h->Points;
+   if (window && points > 1) {
+      StagesFor(points / 2).forwardWindowed(buffer, input, window,
+                                            h->SinTable.get(), points);
+      ForwardButterflies(buffer, h, points / 4);
+   }
+   else {
+      if (window)
+         for (size_t i = 0; i < points * 2; ++i)
+            buffer[i] = input[i] * window[i];
+      else
+         memmove(buffer, input, points * 2 * sizeof(fft_type));
+      ForwardButterflies(buffer, h, points / 2);
+   }
+
+   /* Massage output as RealFFTf does, storing each pair of bins when done */
+   const int *br1 = h->BitReversed.get() + 1;
+   const int *br2 = h->BitReversed.get() + points - 1;
+   size_t i1 = 1, i2 = points - 1;
+   while(br1<br2)
+   {
+      const fft_type sin=h->SinTable[*br1];
+      const fft_type cos=h->SinTable[*br1+1];
+      fft_type *A=buffer+*br1;
+      fft_type *B=buffer+*br2;
+      fft_type HRminus, HIminus;
+      const fft_type HRplus = (HRminus = *A     - *B    ) + (*B     * 2);
+      const fft_type HIplus = (HIminus = *(A+1) - *(B+1)) + (*(B+1) * 2);
+      const fft_type v1 = (sin*HRminus - cos*HIplus);
+      const fft_type v2 = (cos*HRminus + sin*HIplus);
+      const fft_type aR = (HRplus  + v1) * (fft_type)0.5;
+      const fft_type bR = aR - v1;
+      const fft_type aI = (HIminus + v2) * (fft_type)0.5;
+      const fft_type bI = aI - HIminus;
+      packed[2 * i1] = aR;
+      packed[2 * i1 + 1] = aI;
+      power[i1] = aR * aR + aI * aI;
+      packed[2 * i2] = bR;
+      packed[2 * i2 + 1] = bI;
+      power[i2] = bR * bR + bI * bI;
+
+      br1++;
+      br2--;
+      i1++;
+      i2--;
+   }
+   /* The center bin (just needs a conjugate) */
+   if (points > 1) {
+      const fft_type cR = buffer[*br1];
+      const fft_type cI = -buffer[*br1+1];
+      packed[2 * i1] = cR;
+      packed[2 * i1 + 1] = cI;
+      power[i1] = cR * cR + cI * cI;
+   }
+   /* DC and Fs/2 bins */
+   const fft_type dc = buffer[0] + buffer[1];
+   const fft_type nyquist = buffer[0] - buffer[1];
+   packed[0] = dc;
+   power[0] = dc * dc;
+   packed[1] = nyquist;
+   power[points] = nyquist * nyquist;
+}
+
+/*
+*  Forward FFT of nFrames frames at once.  Sample ii of frame ff is
+*  buffer[ii * nFrames + ff], before and after, and each frame transforms
+*  exactly as by RealFFTf.  Vectors span frames, using the widest for as
+*  many frames as fill it and narrower ones for the rest.
+*/
+void RealFFTfFrames(fft_type *buffer, size_t nFrames, const FFTParam *h)
+{
+   const auto &table = CurrentStages();
+   size_t ff = 0;
+   for (size_t ii = 0; ii < table.count; ++ii) {
+      const auto &stages = table.stages[ii];
+      for (; ff + stages.frameWidth <= nFrames; ff += stages.frameWidth)
+         stages.forwardFrames(buffer + ff, nFrames, h);
+   }
+}
+
+
 /* Description: This routine performs an inverse FFT to real data.
 *              This code is for floating point data.
 *
@@ -262,14 +974,10 @@ void RealFFTf(fft_type *buffer, const FFTParam *h)
 void InverseRealFFTf(fft_type *buffer, const FFTParam *h)
 {
    fft_type *A,*B;
-   const fft_type *sptr;
-   const fft_type *endptr1,*endptr2;
    const int *br1;
    fft_type HRplus,HRminus,HIplus,HIminus;
    fft_type v1,v2,sin,cos;
 
-   auto ButterfliesPerGroup = h->Points / 2;
-
    /* Massage input to get the input for a real output sequence. */
    A = buffer + 2;
    B = buffer + h->Points * 2 - 2;
@@ -305,41 +1013,7 @@ void InverseRealFFTf(fft_type *buffer, const FFTParam *h)
    buffer[0]=v1;
    buffer[1]=v2;
 
-   /*
-   *  Butterfly:
-   *     Ain-----Aout
-   *         \ /
-   *         / \
-   *     Bin-----Bout
-   */
-
-   endptr1 = buffer + h->Points * 2;
-
-   while(ButterfliesPerGroup > 0)
-   {
-      A = buffer;
-      B = buffer + ButterfliesPerGroup * 2;
-      sptr = h->SinTable.get();
-
-      while(A < endptr1)
-      {
-         sin = *(sptr++);
-         cos = *(sptr++);
-         endptr2 = B;
-         while(A < endptr2)
-         {
-            v1 = *B * cos - *(B + 1) * sin;
-            v2 = *B * sin + *(B + 1) * cos;
-            *B = (*A + v1) * (fft_type)0.5;
-            *(A++) = *(B++) - v1;
-            *B = (*A + v2) * (fft_type)0.5;
-            *(A++) = *(B++) - v2;
-         }
-         A = B;
-         B += ButterfliesPerGroup * 2;
-      }
-      ButterfliesPerGroup >>= 1;
-   }
+   InverseButterflies(buffer, h);
 }
 
 void ReorderToFreq(const FFTParam *hFFT, const fft_type *buffer,
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include "MemoryX.h"
+#include "CpuFeatures.h"
 
 using fft_type = float;
 struct FFTParam {
@@ -14,17 +15,29 @@ struct FFTParam {
 #endif
 };
 
-struct FFTDeleter{
-   void operator () (FFTParam *p) const;
-};
-
-using HFFT = std::unique_ptr<
-   FFTParam, FFTDeleter
->;
+// Tables are immutable once made, and shared by all users of one size
+using HFFT = std::shared_ptr<const FFTParam>;
 
+// Thread safe; tables of each size are computed once per process
 HFFT GetFFT(size_t);
 void RealFFTf(fft_type *, const FFTParam *);
 void InverseRealFFTf(fft_type *, const FFTParam *);
+// Forward transform of the input, windowed if window is not null, with
+// the spectrum packed in natural order, ready for InverseRealFFTf, and its
+// power; see RealFFTf.cpp
+void RealFFTfSpectrum(const fft_type *input, const fft_type *window,
+                      fft_type *buffer, fft_type *packed,
+                      fft_type *power, const FFTParam *);
+// Forward transform of frames interleaved sample by sample, so that SIMD
+// spans frames; sample ii of frame ff is buffer[ii * nFrames + ff]
+void RealFFTfFrames(fft_type *buffer, size_t nFrames, const FFTParam *);
+
+// The butterflies use the best SIMD level of the CPU by default.  Forcing
+// another (for testing and benchmarking) fails if it is unsupported;
+// threads transforming meanwhile use either level, each stage one of them.
+SimdLevel GetFFTSimdLevel();
+bool SetFFTSimdLevel(SimdLevel level);
+
 void ReorderToTime(const FFTParam *hFFT, const fft_type *buffer, fft_type *TimeOut);
 void ReorderToFreq(const FFTParam *hFFT, const fft_type *buffer,
 		   fft_type *RealOut, fft_type *ImagOut);
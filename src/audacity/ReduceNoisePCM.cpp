@@ -0,0 +1,726 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ReduceNoisePCM.cpp
+
+*******************************************************************//**
+
+\file ReduceNoisePCM.cpp
+\brief Streaming noise reduction of a sound file.
+
+Importing a whole file into WaveTracks, reducing noise into another
+track and mixing that out through ExportPCM holds about three copies of
+the decoded file.  Here each chunk read with sf_readf_float is
+deinterleaved into one EffectNoiseReduction::Stream per channel, and
+whatever the streams have finished is converted as the Mixer would and
+queued for a SoundFileWriter, so memory stays at a few chunks and the
+history of the noise reduction, whatever the length of the file, and
+reduction of the next chunk goes on while earlier ones are written.
+
+*//*******************************************************************/
+
+
+#include "ReduceNoisePCM.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "sndfile.h"
+#include "ExportPCM.h"
+#include "FileFormats.h"
+#include "SampleFormat.h"
+#include "SampleKernels.h"
+#include "SoundFileWriter.h"
+#include "Utils.h"
+
+namespace {
+
+// Frames read from the source file in one go
+const size_t chunkFrames = 65536;
+
+struct FileCloser {
+    void operator()(FILE *f) const { fclose(f); }
+};
+using FilePtr = std::unique_ptr<FILE, FileCloser>;
+
+// Streams for the first nChannels channels, adding any missing
+bool PrepareStreams(EffectNoiseReduction &effect, NoiseReductionStreams &streams, size_t nChannels,
+                    double noiseGain, double sensitivity, double freqSmoothingBands) {
+    while (streams.size() < nChannels) {
+        auto stream = effect.CreateStream(noiseGain, sensitivity, freqSmoothingBands);
+        if (!stream)
+            return false;
+        streams.push_back(std::move(stream));
+    }
+    return true;
+}
+
+// A source opened as PCMImportFileHandle::Open does
+struct SourceFile {
+    SF_INFO info;
+    FilePtr file;
+    SFFile sf;
+
+    bool Open(const std::string &name) {
+        memset(&info, 0, sizeof(info));
+        file.reset(fopen(name.c_str(), "r"));
+        if (file)
+            sf.reset(SFCall<SNDFILE *>(sf_open_fd, fileno(file.get()), SFM_READ, &info, false));
+        if (!sf || (info.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_OGG) {
+            std::cerr << string_format("Cannot import audio from %s", name.c_str()) << std::endl;
+            return false;
+        }
+        return info.channels >= 1;
+    }
+};
+
+// A destination for the samples of src, opened as ExportPCM::Export does
+struct DestinationFile {
+    SF_INFO info;
+    FilePtr file;
+    SFFile sf;
+    sampleFormat format;
+
+    ProgressResult Open(const std::string &name, const SF_INFO &srcInfo, int subformat) {
+        memset(&info, 0, sizeof(info));
+        info.samplerate = srcInfo.samplerate;
+        info.frames = srcInfo.frames;
+        info.channels = srcInfo.channels;
+        info.format = ExportPCM::GetSFFormat(subformat);
+        info.sections = 1;
+        info.seekable = 0;
+        if (!sf_format_check(&info))
+            info.format = (info.format & SF_FORMAT_TYPEMASK);
+        if (!sf_format_check(&info)) {
+            std::cerr << "Cannot export audio in this format." << std::endl;
+            return ProgressResult::Cancelled;
+        }
+
+        file.reset(fopen(name.c_str(), "wb"));
+        if (file) {
+            sf.reset(SFCall<SNDFILE *>(sf_open_fd, fileno(file.get()), SFM_WRITE, &info, false));
+            if (sf)
+                sf_command(sf.get(), SFC_SET_CLIPPING, nullptr,
+                           sf_subtype_is_integer(info.format) ? SF_TRUE : SF_FALSE);
+        }
+        if (!sf) {
+            std::cerr << string_format("Cannot export audio to %s", name.c_str()) << std::endl;
+            return ProgressResult::Cancelled;
+        }
+        format = sf_subtype_more_than_16_bits(info.format) ? floatSample : int16Sample;
+        return ProgressResult::Success;
+    }
+
+    // Closes explicitly, not ignoring errors
+    bool Close() {
+        if (0 != sf.close()) {
+            std::cerr << "Unable to export" << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Of len interleaved float frames into format, as the Mixer converts each channel
+void ConvertFrames(const float *frames, samplePtr dst, sampleFormat format, size_t len, size_t nChannels) {
+    for (size_t cc = 0; cc < nChannels; ++cc)
+        CopySamples((samplePtr) (frames + cc), floatSample,
+                    dst + cc * SAMPLE_SIZE(format), format,
+                    len, true, nChannels, nChannels);
+}
+
+ProgressResult ReduceNoisePCMWith(EffectNoiseReduction &effect, NoiseReductionStreams &streams,
+                                  SourceFile &source, const std::string &dstName,
+                                  double noiseGain, double sensitivity, double freqSmoothingBands,
+                                  int subformat, size_t writeQueueDepth) {
+    const auto &srcInfo = source.info;
+    const size_t nChannels = srcInfo.channels;
+
+    if (!PrepareStreams(effect, streams, nChannels, noiseGain, sensitivity, freqSmoothingBands))
+        return ProgressResult::Failed;
+
+    DestinationFile destination;
+    const auto opened = destination.Open(dstName, srcInfo, subformat);
+    if (opened != ProgressResult::Success)
+        return opened;
+    auto &src = source.sf;
+    auto &dst = destination.sf;
+
+    const sampleFormat format = destination.format;
+
+    Floats interleaved{chunkFrames * nChannels};
+    Floats channel{chunkFrames};
+    SampleBuffer converted(chunkFrames * nChannels, format);
+    SoundFileWriter writer(dst.get(), format, nChannels, writeQueueDepth);
+    auto reportError = [&] {
+        std::cerr << string_format(
+                "Error while writing %s file (disk full?).\nLibsndfile says \"%s\"",
+                dstName.c_str(), writer.GetError().c_str()) << std::endl;
+    };
+
+    // Write all that every stream has finished
+    auto writeAvailable = [&]() -> bool {
+        while (true) {
+            size_t len = chunkFrames;
+            for (size_t cc = 0; cc < nChannels; ++cc)
+                len = std::min(len, streams[cc]->Available());
+            if (len == 0)
+                return true;
+
+            for (size_t cc = 0; cc < nChannels; ++cc) {
+                streams[cc]->Pull(channel.get(), len);
+                for (size_t ii = 0; ii < len; ++ii)
+                    interleaved[ii * nChannels + cc] = channel[ii];
+            }
+
+            bool written;
+            if (format == int16Sample) {
+                ConvertFrames(interleaved.get(), converted.ptr(), format, len, nChannels);
+                written = writer.Write(converted.ptr(), len);
+            } else
+                written = writer.Write((samplePtr) interleaved.get(), len);
+
+            if (!written) {
+                reportError();
+                return false;
+            }
+        }
+    };
+
+    while (true) {
+        // As the Worker does between blocks of a track
+        if (effect.IsCancelled())
+            return ProgressResult::Cancelled;
+        const auto block = SFCall<sf_count_t>(sf_readf_float, src.get(), interleaved.get(), chunkFrames);
+        if (block <= 0)
+            break;
+
+        for (size_t cc = 0; cc < nChannels; ++cc) {
+            for (sf_count_t ii = 0; ii < block; ++ii)
+                channel[ii] = interleaved[ii * nChannels + cc];
+            streams[cc]->Push(channel.get(), block);
+        }
+        if (!writeAvailable())
+            return ProgressResult::Cancelled;
+    }
+
+    for (size_t cc = 0; cc < nChannels; ++cc)
+        streams[cc]->Flush();
+    if (!writeAvailable())
+        return ProgressResult::Cancelled;
+    if (!writer.Finish()) {
+        reportError();
+        return ProgressResult::Cancelled;
+    }
+
+    return destination.Close() ? ProgressResult::Success : ProgressResult::Cancelled;
+}
+
+// Work stealing over the files of a batch.  Each thread has a deque of
+// tasks, dealt the files in turn.  The thread that takes a file longer than
+// a slice opens its destination and puts the slices after the first at the
+// front of its deque; a thread takes from the front of its own deque, and
+// when that is empty, from the front of another's, so that the slices of a
+// file are reduced about in order, and few wait to be written.  Whichever
+// thread finishes the next slice of a file to be written writes it, with any
+// finished after it.  Each thread keeps its own effect and streams, made
+// when it takes its first task, from one task to the next.
+class BatchScheduler {
+public:
+    BatchScheduler(const EffectNoiseReduction::AdvancedSettings &settings, const std::vector<char> &profile,
+                   double noiseGain, double sensitivity, double freqSmoothingBands,
+                   const std::vector<std::pair<std::string, std::string>> &files,
+                   std::vector<ReduceNoiseBatchResult> &results,
+                   unsigned threads, int subformat, size_t sliceFrames)
+            : mSettings(settings), mProfile(profile),
+              mNoiseGain(noiseGain), mSensitivity(sensitivity), mFreqSmoothingBands(freqSmoothingBands),
+              mFiles(files), mResults(results), mSubformat(subformat), mSliceFrames(sliceFrames),
+              mSplits(files.size()), mQueued(files.size()), mUnfinished(files.size()) {
+        for (unsigned tt = 0; tt < threads; ++tt)
+            mQueues.push_back(std::make_unique<Queue>());
+        for (size_t ii = 0; ii < files.size(); ++ii)
+            mQueues[ii % threads]->tasks.push_back({ii, wholeFile});
+    }
+
+    /// Does tasks on thread tt until none are left on any
+    void Run(unsigned tt) {
+        Thread thread;
+        Task task;
+        while (Take(tt, task)) {
+            if (task.slice == wholeFile)
+                DoFile(tt, thread, task.file);
+            else
+                DoSlice(thread, task.file, task.slice, nullptr);
+            if (--mUnfinished == 0)
+                Notify();
+        }
+    }
+
+private:
+    static const size_t wholeFile = std::numeric_limits<size_t>::max();
+
+    struct Task {
+        size_t file;
+        // Of the file split, or wholeFile
+        size_t slice;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // What a thread keeps from one task to the next
+    struct Thread {
+        std::unique_ptr<EffectNoiseReduction> effect;
+        NoiseReductionStreams streams;
+        size_t overlap{0};
+        // A multiple of overlap; 0 for no slices
+        size_t sliceLen{0};
+        bool failed{false};
+    };
+
+    // A file split into slices
+    struct Split {
+        std::chrono::steady_clock::time_point start;
+        sf_count_t frames;
+        size_t nChannels;
+        size_t sliceLen;
+        size_t nSlices;
+        size_t overlap;
+        DestinationFile destination;
+        std::unique_ptr<SoundFileWriter> writer;
+        // Cleared to skip the slices not yet reduced
+        std::atomic<bool> ok{true};
+
+        // The rest with mutex held
+        std::mutex mutex;
+        // Finished slices not yet written
+        std::vector<std::unique_ptr<SampleBuffer>> finished;
+        size_t nextWrite{0};
+        bool writing{false};
+        bool done{false};
+        ProgressResult failure{ProgressResult::Failed};
+
+        size_t SliceFrames(size_t ii) const {
+            return std::min<sf_count_t>(sliceLen, frames - (sf_count_t) (ii * sliceLen));
+        }
+    };
+
+    // The effect and streams of a thread, made on its first task; false if
+    // there is no reducing with them
+    bool Prepare(Thread &thread) {
+        if (thread.effect || thread.failed)
+            return !thread.failed;
+        thread.effect = std::make_unique<EffectNoiseReduction>();
+        thread.failed = !thread.effect->SetAdvancedSettings(mSettings) ||
+                        !thread.effect->LoadProfile(mProfile.data(), mProfile.size()) ||
+                        !PrepareStreams(*thread.effect, thread.streams, 1,
+                                        mNoiseGain, mSensitivity, mFreqSmoothingBands);
+        if (!thread.failed) {
+            thread.overlap = thread.streams[0]->GetSegmentOverlap();
+            if (mSliceFrames > 0)
+                thread.sliceLen = std::max<size_t>(1, mSliceFrames / thread.overlap) * thread.overlap;
+        }
+        return !thread.failed;
+    }
+
+    void Notify() {
+        // Not between a waiting thread's test and its wait
+        { std::lock_guard<std::mutex> lock{mIdleMutex}; }
+        mIdle.notify_all();
+    }
+
+    // The front task of thread tt's deque, or of the first other one with
+    // any, waiting while none are queued but a file may yet be split; false
+    // once all are done
+    bool Take(unsigned tt, Task &task) {
+        const auto nQueues = mQueues.size();
+        while (true) {
+            for (size_t nn = 0; nn < nQueues; ++nn) {
+                auto &queue = *mQueues[(tt + nn) % nQueues];
+                std::lock_guard<std::mutex> lock{queue.mutex};
+                if (!queue.tasks.empty()) {
+                    task = queue.tasks.front();
+                    queue.tasks.pop_front();
+                    --mQueued;
+                    return true;
+                }
+            }
+            std::unique_lock<std::mutex> lock{mIdleMutex};
+            mIdle.wait(lock, [this] { return mQueued > 0 || mUnfinished == 0; });
+            if (mUnfinished == 0)
+                return false;
+        }
+    }
+
+    void DoFile(unsigned tt, Thread &thread, size_t ii) {
+        const auto start = std::chrono::steady_clock::now();
+        auto &result = mResults[ii];
+        auto finish = [&](ProgressResult value) {
+            result.result = value;
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        SourceFile source;
+        if (!Prepare(thread) || !source.Open(mFiles[ii].first))
+            return finish(ProgressResult::Failed);
+
+        const auto frames = source.info.frames;
+        if (thread.sliceLen == 0 || frames <= (sf_count_t) thread.sliceLen) {
+            // The other threads keep the cores busy while this one writes
+            const auto value = ReduceNoisePCMWith(*thread.effect, thread.streams, source, mFiles[ii].second,
+                                                  mNoiseGain, mSensitivity, mFreqSmoothingBands, mSubformat, 0);
+            // Streams stopped part way are not reused
+            if (value != ProgressResult::Success)
+                thread.streams.clear();
+            return finish(value);
+        }
+
+        auto split = std::make_unique<Split>();
+        split->start = start;
+        split->frames = frames;
+        split->nChannels = source.info.channels;
+        split->sliceLen = thread.sliceLen;
+        split->nSlices = (frames + thread.sliceLen - 1) / thread.sliceLen;
+        split->overlap = thread.overlap;
+        const auto opened = split->destination.Open(mFiles[ii].second, source.info, mSubformat);
+        if (opened != ProgressResult::Success)
+            return finish(opened);
+        split->writer = std::make_unique<SoundFileWriter>(
+                split->destination.sf.get(), split->destination.format, split->nChannels, 0);
+        split->finished.resize(split->nSlices);
+        const auto nSlices = split->nSlices;
+        mSplits[ii] = std::move(split);
+
+        // Counted first, so that neither count goes below 0 as other threads
+        // take the slices, or reaches it before they are done
+        mUnfinished += nSlices - 1;
+        mQueued += nSlices - 1;
+        {
+            auto &queue = *mQueues[tt];
+            std::lock_guard<std::mutex> lock{queue.mutex};
+            for (auto kk = nSlices - 1; kk > 0; --kk)
+                queue.tasks.push_front({ii, kk});
+        }
+        Notify();
+
+        DoSlice(thread, ii, 0, &source);
+    }
+
+    // Slice kk of split file ii, of source if not null, or else opened anew
+    void DoSlice(Thread &thread, size_t ii, size_t kk, SourceFile *source) {
+        auto &split = *mSplits[ii];
+        std::unique_ptr<SampleBuffer> reduced;
+        if (split.ok && Prepare(thread)) {
+            reduced = ReduceSlice(thread, split, ii, kk, source);
+            if (!reduced)
+                thread.streams.clear();
+        }
+        Finish(split, ii, kk, std::move(reduced));
+    }
+
+    // Frames of slice kk in the format of the destination, reduced as
+    // ProcessSegment() reduces a segment of a track; null on failure
+    std::unique_ptr<SampleBuffer> ReduceSlice(Thread &thread, Split &split, size_t ii, size_t kk,
+                                              SourceFile *source) {
+        SourceFile own;
+        if (!source) {
+            if (!own.Open(mFiles[ii].first))
+                return {};
+            source = &own;
+        }
+        const auto nChannels = split.nChannels;
+        if ((size_t) source->info.channels != nChannels ||
+            !PrepareStreams(*thread.effect, thread.streams, nChannels,
+                            mNoiseGain, mSensitivity, mFreqSmoothingBands))
+            return {};
+        auto &streams = thread.streams;
+
+        // From the same step grid as the whole file, with enough around the
+        // slice that its output is the same
+        const sf_count_t segStart = kk * split.sliceLen;
+        const size_t segLen = split.SliceFrames(kk);
+        const sf_count_t readStart = std::max<sf_count_t>(0, segStart - (sf_count_t) split.overlap);
+        const sf_count_t readEnd = std::min<sf_count_t>(split.frames, segStart + segLen + split.overlap);
+        if (readStart > 0 &&
+            SFCall<sf_count_t>(sf_seek, source->sf.get(), readStart, SEEK_SET) != readStart)
+            return {};
+
+        Floats interleaved{chunkFrames * nChannels};
+        Floats channel{chunkFrames};
+        Floats output{segLen * nChannels};
+        const size_t skip = segStart - readStart;
+        size_t pulled = 0;
+        // Keep the output of the slice among all the streams have finished
+        auto pullAvailable = [&] {
+            while (true) {
+                size_t len = chunkFrames;
+                for (size_t cc = 0; cc < nChannels; ++cc)
+                    len = std::min(len, streams[cc]->Available());
+                if (len == 0)
+                    return;
+                const auto first = std::max(pulled, skip), last = std::min(pulled + len, skip + segLen);
+                for (size_t cc = 0; cc < nChannels; ++cc) {
+                    streams[cc]->Pull(channel.get(), len);
+                    for (auto jj = first; jj < last; ++jj)
+                        output[(jj - skip) * nChannels + cc] = channel[jj - pulled];
+                }
+                pulled += len;
+            }
+        };
+
+        for (auto remaining = readEnd - readStart; remaining > 0;) {
+            const auto block = SFCall<sf_count_t>(sf_readf_float, source->sf.get(), interleaved.get(),
+                                                  std::min<sf_count_t>(chunkFrames, remaining));
+            if (block <= 0)
+                break;
+            remaining -= block;
+            for (size_t cc = 0; cc < nChannels; ++cc) {
+                for (sf_count_t jj = 0; jj < block; ++jj)
+                    channel[jj] = interleaved[jj * nChannels + cc];
+                streams[cc]->Push(channel.get(), block);
+            }
+            pullAvailable();
+        }
+        // Only the last slice, read to the end of the file, needs the tail
+        if (pulled < skip + segLen) {
+            for (size_t cc = 0; cc < nChannels; ++cc)
+                streams[cc]->Flush();
+            pullAvailable();
+        }
+        for (size_t cc = 0; cc < nChannels; ++cc)
+            streams[cc]->Reset();
+        if (pulled < skip + segLen)
+            return {};
+
+        auto reduced = std::make_unique<SampleBuffer>(segLen * nChannels, split.destination.format);
+        ConvertFrames(output.get(), reduced->ptr(), split.destination.format, segLen, nChannels);
+        return reduced;
+    }
+
+    // Slice kk of split file ii is reduced, or failed if reduced is null;
+    // write what is next in order, unless another thread is writing
+    void Finish(Split &split, size_t ii, size_t kk, std::unique_ptr<SampleBuffer> reduced) {
+        std::unique_lock<std::mutex> lock{split.mutex};
+        // Once the file is done, for failure, finished is gone and the slice
+        // is dropped
+        if (split.done)
+            return;
+        if (reduced)
+            split.finished[kk] = std::move(reduced);
+        else
+            split.ok = false;
+        if (split.writing)
+            return;
+
+        split.writing = true;
+        while (split.ok && split.nextWrite < split.nSlices && split.finished[split.nextWrite]) {
+            const auto slice = std::move(split.finished[split.nextWrite]);
+            const auto len = split.SliceFrames(split.nextWrite);
+            lock.unlock();
+            const bool written = split.writer->Write(slice->ptr(), len);
+            lock.lock();
+            if (written)
+                ++split.nextWrite;
+            else {
+                std::cerr << string_format(
+                        "Error while writing %s file (disk full?).\nLibsndfile says \"%s\"",
+                        mFiles[ii].second.c_str(), split.writer->GetError().c_str()) << std::endl;
+                split.failure = ProgressResult::Cancelled;
+                split.ok = false;
+            }
+        }
+        split.writing = false;
+
+        if (!split.ok || split.nextWrite == split.nSlices) {
+            auto value = split.failure;
+            if (split.ok)
+                value = split.writer->Finish() && split.destination.Close()
+                        ? ProgressResult::Success : ProgressResult::Cancelled;
+            split.writer.reset();
+            split.destination.sf.reset();
+            split.finished.clear();
+            split.done = true;
+            mResults[ii].result = value;
+            mResults[ii].seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - split.start).count();
+        }
+    }
+
+    const EffectNoiseReduction::AdvancedSettings mSettings;
+    const std::vector<char> &mProfile;
+    const double mNoiseGain, mSensitivity, mFreqSmoothingBands;
+    const std::vector<std::pair<std::string, std::string>> &mFiles;
+    std::vector<ReduceNoiseBatchResult> &mResults;
+    const int mSubformat;
+    const size_t mSliceFrames;
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    // Of the files split, set before their slices are queued
+    std::vector<std::unique_ptr<Split>> mSplits;
+    std::atomic<size_t> mQueued;
+    // Tasks queued or being done
+    std::atomic<size_t> mUnfinished;
+    std::mutex mIdleMutex;
+    std::condition_variable mIdle;
+};
+
+}
+
+ProgressResult ReduceNoisePCM(EffectNoiseReduction &effect, NoiseReductionStreams &streams,
+                              const std::string &srcName, const std::string &dstName,
+                              double noiseGain, double sensitivity, double freqSmoothingBands,
+                              int subformat, size_t writeQueueDepth) {
+    SourceFile source;
+    const auto result = !source.Open(srcName)
+                        ? ProgressResult::Failed
+                        : ReduceNoisePCMWith(effect, streams, source, dstName,
+                                             noiseGain, sensitivity, freqSmoothingBands,
+                                             subformat, writeQueueDepth);
+    // Streams stopped part way are not reused
+    if (result != ProgressResult::Success)
+        streams.clear();
+    return result;
+}
+
+ProgressResult ReduceNoisePCM(EffectNoiseReduction &effect,
+                              const std::string &srcName, const std::string &dstName,
+                              double noiseGain, double sensitivity, double freqSmoothingBands,
+                              int subformat, size_t writeQueueDepth) {
+    NoiseReductionStreams streams;
+    SourceFile source;
+    if (!source.Open(srcName))
+        return ProgressResult::Failed;
+    return ReduceNoisePCMWith(effect, streams, source, dstName,
+                              noiseGain, sensitivity, freqSmoothingBands, subformat, writeQueueDepth);
+}
+
+std::vector<ReduceNoiseBatchResult>
+ReduceNoisePCMBatch(const EffectNoiseReduction &effect,
+                    const std::vector<std::pair<std::string, std::string>> &files,
+                    double noiseGain, double sensitivity, double freqSmoothingBands,
+                    unsigned threads, int subformat, size_t sliceFrames) {
+    std::vector<ReduceNoiseBatchResult> results(files.size());
+    std::vector<char> profile;
+    if (files.empty() || !effect.SaveProfile(profile))
+        return results;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    // Without slices, a thread beyond one per file would have nothing to do
+    if (sliceFrames == 0)
+        threads = std::min<size_t>(threads, files.size());
+
+    BatchScheduler scheduler{effect.GetAdvancedSettings(), profile, noiseGain, sensitivity, freqSmoothingBands,
+                             files, results, threads, subformat, sliceFrames};
+    std::vector<std::thread> pool;
+    for (unsigned tt = 1; tt < threads; ++tt)
+        pool.emplace_back([&scheduler, tt] { scheduler.Run(tt); });
+    scheduler.Run(0);
+    for (auto &thread : pool)
+        thread.join();
+    return results;
+}
+
+bool ReduceNoiseSamples(EffectNoiseReduction &effect,
+                        const void *src, sampleFormat srcFormat,
+                        void *dst, sampleFormat dstFormat,
+                        size_t frames, unsigned nChannels, double rate,
+                        double noiseGain, double sensitivity, double freqSmoothingBands) {
+    NoiseReductionStreams streams;
+    return ReduceNoiseSamples(effect, streams, src, srcFormat, dst, dstFormat, frames, nChannels, rate,
+                                  noiseGain, sensitivity, freqSmoothingBands);
+}
+
+bool ReduceNoiseSamples(EffectNoiseReduction &effect, NoiseReductionStreams &streams,
+                        const void *src, sampleFormat srcFormat,
+                        void *dst, sampleFormat dstFormat,
+                        size_t frames, unsigned nChannels, double rate,
+                        double noiseGain, double sensitivity, double freqSmoothingBands) {
+    if ((srcFormat != floatSample && srcFormat != int16Sample) ||
+        (dstFormat != floatSample && dstFormat != int16Sample) || nChannels < 1)
+        return false;
+
+    if (!PrepareStreams(effect, streams, nChannels, noiseGain, sensitivity, freqSmoothingBands))
+        return false;
+    if (streams[0]->GetRate() != rate) {
+        std::cerr << "The sample rate of the noise profile must match that of the sound to be processed."
+                  << std::endl;
+        return false;
+    }
+
+    // Mono float is pushed and pulled in place; anything else goes through
+    // a chunk of each channel
+    const bool inPlace = nChannels == 1 && srcFormat == floatSample;
+    const bool outPlace = nChannels == 1 && dstFormat == floatSample;
+    const size_t chunk = std::min(chunkFrames, frames);
+    Floats channels{inPlace && outPlace ? 0 : chunk * nChannels};
+    std::vector<float *> channelPtrs(nChannels);
+    for (unsigned cc = 0; cc < nChannels; ++cc)
+        channelPtrs[cc] = channels.get() + cc * chunk;
+
+    const size_t srcFrameBytes = nChannels * SAMPLE_SIZE(srcFormat);
+    const size_t dstFrameBytes = nChannels * SAMPLE_SIZE(dstFormat);
+    size_t written = 0;
+
+    // Write all that every stream has finished
+    auto pullAvailable = [&] {
+        while (true) {
+            size_t len = chunk;
+            for (unsigned cc = 0; cc < nChannels; ++cc)
+                len = std::min(len, streams[cc]->Available());
+            if (len == 0)
+                return;
+
+            const samplePtr out = static_cast<samplePtr>(dst) + written * dstFrameBytes;
+            if (outPlace) {
+                streams[0]->Pull((float *) out, len);
+            } else {
+                for (unsigned cc = 0; cc < nChannels; ++cc) {
+                    streams[cc]->Pull(channelPtrs[cc], len);
+                    // Converted as the Mixer does
+                    CopySamples((samplePtr) channelPtrs[cc], floatSample,
+                                out + cc * SAMPLE_SIZE(dstFormat), dstFormat,
+                                len, true, 1, nChannels);
+                }
+            }
+            written += len;
+        }
+    };
+
+    for (size_t start = 0; start < frames; start += chunk) {
+        const size_t len = std::min(chunk, frames - start);
+        const auto in = static_cast<const char *>(src) + start * srcFrameBytes;
+        if (inPlace)
+            streams[0]->Push((const float *) in, len);
+        else {
+            if (srcFormat == floatSample)
+                Deinterleave((const float *) in, nChannels, channelPtrs.data(), len);
+            else
+                Deinterleave((const short *) in, nChannels, channelPtrs.data(), len);
+            for (unsigned cc = 0; cc < nChannels; ++cc)
+                streams[cc]->Push(channelPtrs[cc], len);
+        }
+        pullAvailable();
+    }
+
+    // Each is then as NEW, for the next call
+    for (unsigned cc = 0; cc < nChannels; ++cc)
+        streams[cc]->Flush();
+    pullAvailable();
+    assert(written == frames);
+    return true;
+}
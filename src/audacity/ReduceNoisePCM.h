@@ -0,0 +1,100 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ReduceNoisePCM.h
+
+  Noise reduction from one sound file to another through libsndfile,
+  or of interleaved samples in memory, a chunk at a time, without
+  importing into tracks.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_REDUCE_NOISE_PCM__
+#define __AUDACITY_REDUCE_NOISE_PCM__
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ImportPlugin.h"
+#include "NoiseReduction.h"
+#include "SampleFormat.h"
+#include "SoundFileWriter.h"
+
+/// Read srcName, reduce noise in every channel with the effect's profile
+/// and write the result to dstName, as ExportPCM would with subformat.
+/// Memory use does not grow with the length of the file, and the output
+/// is the same as importing, ReduceNoise() and ExportPCM::Export().
+/// Up to writeQueueDepth chunks wait for a writer thread, as with
+/// ExportPCM::SetWriteQueueDepth().  Cancelled, as set with
+/// EffectNoiseReduction::SetCancel(), between chunks.
+ProgressResult ReduceNoisePCM(EffectNoiseReduction &effect,
+                              const std::string &srcName, const std::string &dstName,
+                              double noiseGain, double sensitivity, double freqSmoothingBands,
+                              int subformat = 0,
+                              size_t writeQueueDepth = SoundFileWriter::DefaultQueueDepth);
+
+/// Streams of one effect, one per channel, kept from one call to the next
+/// so that their Workers, FFT state and buffers are allocated only once.
+/// The calls taking them add streams for any more channels, and leave them
+/// all as NEW; all must be for the same effect and parameters.
+using NoiseReductionStreams = std::vector<std::unique_ptr<EffectNoiseReduction::Stream>>;
+
+/// The same reusing streams, which are dropped on failure
+ProgressResult ReduceNoisePCM(EffectNoiseReduction &effect, NoiseReductionStreams &streams,
+                              const std::string &srcName, const std::string &dstName,
+                              double noiseGain, double sensitivity, double freqSmoothingBands,
+                              int subformat = 0,
+                              size_t writeQueueDepth = SoundFileWriter::DefaultQueueDepth);
+
+/// Outcome of one file of ReduceNoisePCMBatch()
+struct ReduceNoiseBatchResult {
+    ProgressResult result{ProgressResult::Failed};
+    /// Wall clock time taken by the file
+    double seconds{0};
+};
+
+/// Frames of a slice of a long file in ReduceNoisePCMBatch(), about 22
+/// seconds at 48 kHz
+const size_t ReduceNoiseBatchSliceFrames = 1 << 20;
+
+/// ReduceNoisePCM() of each (source, destination) pair of files, spread
+/// over threads threads (0 for one per hardware thread), each with its own
+/// copy of the effect's profile and its own Worker, FFT state and buffers,
+/// kept from one task to the next.  Files longer than sliceFrames (rounded
+/// down to a multiple of the overlap the windows need, and 0 for none) are
+/// split into slices of as many frames, which idle threads steal from the
+/// thread that split the file while others reduce whole short files, so
+/// that all stay busy to the end of the batch.  Files are written on the
+/// threads that reduce them, slices in order by the thread finishing the
+/// next, and are the same as ReduceNoisePCM() writes.  Results are in the
+/// order of files, the seconds of a split file from its start until its
+/// last slice is written; all fail if the effect has no profile.
+std::vector<ReduceNoiseBatchResult>
+ReduceNoisePCMBatch(const EffectNoiseReduction &effect,
+                    const std::vector<std::pair<std::string, std::string>> &files,
+                    double noiseGain, double sensitivity, double freqSmoothingBands,
+                    unsigned threads = 0, int subformat = 0,
+                    size_t sliceFrames = ReduceNoiseBatchSliceFrames);
+
+/// Reduce noise in frames frames of nChannels interleaved samples at src,
+/// float or 16 bit (scaled by 1/32768, as libsndfile reads them), into as
+/// many at dst, which may be either format, converted as ExportPCM
+/// would.  Channels are reduced separately, without tracks.  False if the
+/// effect has no profile or its rate is not rate.
+bool ReduceNoiseSamples(EffectNoiseReduction &effect,
+                        const void *src, sampleFormat srcFormat,
+                        void *dst, sampleFormat dstFormat,
+                        size_t frames, unsigned nChannels, double rate,
+                        double noiseGain, double sensitivity, double freqSmoothingBands);
+
+/// The same reusing streams
+bool ReduceNoiseSamples(EffectNoiseReduction &effect, NoiseReductionStreams &streams,
+                        const void *src, sampleFormat srcFormat,
+                        void *dst, sampleFormat dstFormat,
+                        size_t frames, unsigned nChannels, double rate,
+                        double noiseGain, double sensitivity, double freqSmoothingBands);
+
+#endif
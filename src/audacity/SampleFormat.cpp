@@ -42,9 +42,10 @@
 #include "SampleFormat.h"
 #include "Dither.h"
 
-static DitherType gLowQualityDither = DitherType::none;
-static DitherType gHighQualityDither = DitherType::none;
-static Dither gDitherAlgorithm;
+static const DitherType gLowQualityDither = DitherType::none;
+static const DitherType gHighQualityDither = DitherType::none;
+// Dithers keep state between samples; one per thread, for concurrent exports
+static thread_local Dither gDitherAlgorithm;
 
 const char *GetSampleFormatStr(sampleFormat format)
 {
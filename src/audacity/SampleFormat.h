@@ -12,6 +12,8 @@
 #define __AUDACITY_SAMPLE_FORMAT__
 
 #include "Audacity.h"
+#include "Arena.h"
+#include "Instrumentation.h"
 #include "MemoryX.h"
 
 #include "Types.h"
@@ -54,24 +56,42 @@ public:
     SampleBuffer()
             : mPtr(0) {}
 
-    SampleBuffer(size_t count, sampleFormat format)
-            : mPtr((samplePtr) malloc(count * SAMPLE_SIZE(format))) {}
+    // With an arena, the memory is the arena's, and freeing it does nothing;
+    // see ArenaFrame
+    SampleBuffer(size_t count, sampleFormat format, Arena *arena = nullptr)
+            : mPtr(0) {
+        Allocate(count, format, arena);
+    }
 
     ~SampleBuffer() {
         Free();
     }
 
     // WARNING!  May not preserve contents.
-    SampleBuffer &Allocate(size_t count, sampleFormat format) {
+    SampleBuffer &Allocate(size_t count, sampleFormat format, Arena *arena = nullptr) {
         Free();
-        mPtr = (samplePtr) malloc(count * SAMPLE_SIZE(format));
+        const size_t bytes = count * SAMPLE_SIZE(format);
+        if (arena)
+            mPtr = arena->Allocate<char>(bytes);
+        else {
+            mPtr = (samplePtr) malloc(bytes);
+            // Of the Instrumentation::SampleBuffers gauge
+            mBytes = mPtr ? bytes : 0;
+            NOISERED_GAUGE_ADD(SampleBuffers, mBytes);
+        }
+        mFromArena = arena != nullptr;
         return *this;
     }
 
 
     void Free() {
-        free(mPtr);
+        if (!mFromArena) {
+            free(mPtr);
+            NOISERED_GAUGE_SUBTRACT(SampleBuffers, mBytes);
+        }
         mPtr = 0;
+        mBytes = 0;
+        mFromArena = false;
     }
 
     samplePtr ptr() const { return mPtr; }
@@ -79,6 +99,8 @@ public:
 
 private:
     samplePtr mPtr;
+    size_t mBytes{0};
+    bool mFromArena{false};
 };
 
 class GrowableSampleBuffer : private SampleBuffer {
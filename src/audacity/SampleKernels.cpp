@@ -0,0 +1,878 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  SampleKernels.cpp
+
+**********************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include "float_cast.h"
+#include "SampleKernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLE_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define SAMPLE_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// libsndfile's normalization of 16 bit samples; a power of 2, so that
+// the product is exact in every version
+const float kShortScale = 1.0f / 0x8000;
+
+inline float ToFloat(float x) {
+    return x;
+}
+
+inline float ToFloat(short x) {
+    return (float) x * kShortScale;
+}
+
+template<typename Sample>
+void DeinterleaveScalar(const Sample *src, unsigned nChannels, float *const *dst, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii)
+        for (unsigned cc = 0; cc < nChannels; ++cc)
+            dst[cc][ii] = ToFloat(*src++);
+}
+
+// Frames [ii, len), src pointing at frame ii, after a vectorized loop
+template<unsigned NChannels, typename Sample>
+void DeinterleaveTail(const Sample *src, float *const *dst, size_t ii, size_t len) {
+    for (; ii < len; ++ii)
+        for (unsigned cc = 0; cc < NChannels; ++cc)
+            dst[cc][ii] = ToFloat(*src++);
+}
+
+template<unsigned NChannels, typename Sample>
+void DeinterleaveFixedScalar(const Sample *src, float *const *dst, size_t len) {
+    DeinterleaveScalar(src, NChannels, dst, len);
+}
+
+// Conversions, exactly as Dither::Apply makes them sample by sample
+// (without dithering).  libsndfile's 16 bit normalization is the same as
+// Dither's.
+
+const float kInt24Scale = 1.0f / (1 << 23);
+
+inline void ConvertScalar(const short *src, float *dst, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii)
+        dst[ii] = src[ii] / float(1 << 15);
+}
+
+inline void ConvertScalar(const int *src, float *dst, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii)
+        dst[ii] = src[ii] / float(1 << 23);
+}
+
+inline void ConvertScalar(const short *src, int *dst, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii)
+        dst[ii] = (int) src[ii] * 256;
+}
+
+// Clip to [-1, 1], round, and clip to the range of the integer.  NaN
+// passes the clipping; the conversion instructions below make it the
+// "integer indefinite" INT_MIN, and so the minimum, which lrintf may not.
+template<typename Int, int Bits>
+inline void ConvertFloatScalar(const float *src, Int *dst, size_t len) {
+    const int maxBound = (1 << (Bits - 1)) - 1;
+    const int minBound = -(1 << (Bits - 1));
+    for (size_t ii = 0; ii < len; ++ii) {
+        const float x = src[ii];
+        const float clipped = x > 1.0f ? 1.0f : x < -1.0f ? -1.0f : x;
+        const int rounded = x != x ? minBound : lrintf(clipped * float(1 << (Bits - 1)));
+        dst[ii] = rounded > maxBound ? maxBound : rounded < minBound ? minBound : (Int) rounded;
+    }
+}
+
+inline void ConvertScalar(const float *src, short *dst, size_t len) {
+    ConvertFloatScalar<short, 16>(src, dst, len);
+}
+
+inline void ConvertScalar(const float *src, int *dst, size_t len) {
+    ConvertFloatScalar<int, 24>(src, dst, len);
+}
+
+inline void ConvertScalar(const int *src, short *dst, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii) {
+        const int rounded = lrintf(src[ii] / float(1 << 23) * float(1 << 15));
+        dst[ii] = rounded > 32767 ? 32767 : rounded < -32768 ? -32768 : (short) rounded;
+    }
+}
+
+// Mixing
+
+inline void ApplyGainsScalar(float *samples, const double *gains, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii)
+        samples[ii] *= gains[ii];
+}
+
+inline void MixScalar(const float *src, float gain, float *dst, unsigned dstStride, size_t len) {
+    for (size_t ii = 0; ii < len; ++ii)
+        dst[ii * dstStride] += src[ii] * gain;
+}
+
+void MixSamplesScalar(const float *src, float gain, float *dst, unsigned dstStride, size_t len) {
+    MixScalar(src, gain, dst, dstStride, len);
+}
+
+// Dither noise:  Marsaglia's 13, 17, 5 xorshift, the top 24 bits of
+// which convert to float exactly
+const float kNoiseScale = 1.0f / (1 << 24);
+
+inline uint32_t XorShift(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    return x ^ (x << 5);
+}
+
+void FillDitherNoiseScalar(uint32_t *state, float *noise, size_t len) {
+    for (size_t ii = 0; ii < len; ii += nDitherNoiseLanes)
+        for (unsigned ll = 0; ll < nDitherNoiseLanes; ++ll) {
+            state[ll] = XorShift(state[ll]);
+            noise[ii + ll] = (float) (state[ll] >> 8) * kNoiseScale - 0.5f;
+        }
+}
+
+template<typename Src, typename Dst>
+void ConvertScalarKernel(const Src *src, Dst *dst, size_t len) {
+    ConvertScalar(src, dst, len);
+}
+
+#ifdef SAMPLE_KERNELS_X86
+
+// Four consecutive samples as floats
+
+__attribute__((target("sse2")))
+inline __m128 Load4SSE2(const float *src) {
+    return _mm_loadu_ps(src);
+}
+
+__attribute__((target("sse2")))
+inline __m128 Load4SSE2(const short *src) {
+    const __m128i x = _mm_loadl_epi64((const __m128i *) src);
+    // Sign extend by shifting the duplicated halves down
+    const __m128i wide = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    return _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(kShortScale));
+}
+
+// Four frames at a time.  With more than two channels, transpose blocks of
+// four frames by four channels; with six, the second block overlaps the
+// first by two channels, which are stored twice.
+template<unsigned NChannels, typename Sample>
+__attribute__((target("sse2")))
+void DeinterleaveFixedSSE2(const Sample *src, float *const *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4, src += 4 * NChannels) {
+        if (NChannels == 2) {
+            const __m128 a = Load4SSE2(src);
+            const __m128 b = Load4SSE2(src + 4);
+            _mm_storeu_ps(dst[0] + ii, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(dst[1] + ii, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        } else
+            for (unsigned c0 = 0; c0 < NChannels; c0 += 4) {
+                const unsigned first = std::min(c0, NChannels - 4);
+                __m128 r0 = Load4SSE2(src + first);
+                __m128 r1 = Load4SSE2(src + NChannels + first);
+                __m128 r2 = Load4SSE2(src + 2 * NChannels + first);
+                __m128 r3 = Load4SSE2(src + 3 * NChannels + first);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(dst[first] + ii, r0);
+                _mm_storeu_ps(dst[first + 1] + ii, r1);
+                _mm_storeu_ps(dst[first + 2] + ii, r2);
+                _mm_storeu_ps(dst[first + 3] + ii, r3);
+            }
+    }
+    DeinterleaveTail<NChannels>(src, dst, ii, len);
+}
+
+// Four floats clipped to [-1, 1] and scaled to integers; NaN to INT_MIN
+__attribute__((target("sse2")))
+inline __m128i ScaleClippedSSE2(__m128 x, float scale) {
+    // min and max return the second operand of an unordered pair
+    x = _mm_max_ps(_mm_set1_ps(-1.0f), _mm_min_ps(_mm_set1_ps(1.0f), x));
+    return _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(scale)));
+}
+
+__attribute__((target("sse2")))
+void ConvertSSE2(const short *src, float *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4)
+        _mm_storeu_ps(dst + ii, Load4SSE2(src + ii));
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void ConvertSSE2(const int *src, float *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const __m128i x = _mm_loadu_si128((const __m128i *) (src + ii));
+        _mm_storeu_ps(dst + ii, _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(kInt24Scale)));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void ConvertSSE2(const short *src, int *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const __m128i x = _mm_loadl_epi64((const __m128i *) (src + ii));
+        // In the upper halves, then sign extended down to bit 8
+        _mm_storeu_si128((__m128i *) (dst + ii),
+                         _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), x), 8));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void ConvertSSE2(const float *src, short *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        const __m128i a = ScaleClippedSSE2(_mm_loadu_ps(src + ii), 1 << 15);
+        const __m128i b = ScaleClippedSSE2(_mm_loadu_ps(src + ii + 4), 1 << 15);
+        // Saturation clips 32768
+        _mm_storeu_si128((__m128i *) (dst + ii), _mm_packs_epi32(a, b));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void ConvertSSE2(const float *src, int *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        __m128i x = ScaleClippedSSE2(_mm_loadu_ps(src + ii), 1 << 23);
+        // Clip 8388608 by adding -1, and INT_MIN by selecting the minimum
+        x = _mm_add_epi32(x, _mm_cmpgt_epi32(x, _mm_set1_epi32((1 << 23) - 1)));
+        const __m128i minBound = _mm_set1_epi32(-(1 << 23));
+        const __m128i under = _mm_cmplt_epi32(x, minBound);
+        x = _mm_or_si128(_mm_andnot_si128(under, x), _mm_and_si128(under, minBound));
+        _mm_storeu_si128((__m128i *) (dst + ii), x);
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void ConvertSSE2(const int *src, short *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        // x / 2^23 * 2^15, exactly
+        const __m128 scale = _mm_set1_ps(1.0f / (1 << 8));
+        const __m128i a = _mm_cvtps_epi32(_mm_mul_ps(
+                _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (src + ii))), scale));
+        const __m128i b = _mm_cvtps_epi32(_mm_mul_ps(
+                _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (src + ii + 4))), scale));
+        _mm_storeu_si128((__m128i *) (dst + ii), _mm_packs_epi32(a, b));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void ApplyGainsSSE2(float *samples, const double *gains, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        // The products of float and double, rounded to float
+        const __m128 x = _mm_loadu_ps(samples + ii);
+        const __m128 lo = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(x), _mm_loadu_pd(gains + ii)));
+        const __m128 hi = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)),
+                                                  _mm_loadu_pd(gains + ii + 2)));
+        _mm_storeu_ps(samples + ii, _mm_movelh_ps(lo, hi));
+    }
+    ApplyGainsScalar(samples + ii, gains + ii, len - ii);
+}
+
+__attribute__((target("sse2")))
+void MixSamplesSSE2(const float *src, float gain, float *dst, unsigned dstStride, size_t len) {
+    const __m128 g = _mm_set1_ps(gain);
+    size_t ii = 0;
+    if (dstStride == 1)
+        for (; ii + 4 <= len; ii += 4) {
+            const __m128 x = _mm_mul_ps(_mm_loadu_ps(src + ii), g);
+            _mm_storeu_ps(dst + ii, _mm_add_ps(_mm_loadu_ps(dst + ii), x));
+        }
+    else if (dstStride == 2) {
+        // Sums in the even lanes, the other channel (untouched, not even by
+        // adding 0 to -0) in the odd
+        const __m128 even = _mm_castsi128_ps(_mm_set_epi32(0, -1, 0, -1));
+        for (; ii + 4 <= len; ii += 4) {
+            const __m128 x = _mm_mul_ps(_mm_loadu_ps(src + ii), g);
+            float *const d = dst + 2 * ii;
+            const __m128 a = _mm_loadu_ps(d), b = _mm_loadu_ps(d + 4);
+            const __m128 sa = _mm_add_ps(a, _mm_unpacklo_ps(x, x));
+            const __m128 sb = _mm_add_ps(b, _mm_unpackhi_ps(x, x));
+            _mm_storeu_ps(d, _mm_or_ps(_mm_and_ps(even, sa), _mm_andnot_ps(even, a)));
+            _mm_storeu_ps(d + 4, _mm_or_ps(_mm_and_ps(even, sb), _mm_andnot_ps(even, b)));
+        }
+    }
+    MixScalar(src + ii, gain, dst + ii * dstStride, dstStride, len - ii);
+}
+
+__attribute__((target("sse2")))
+inline __m128i XorShiftSSE2(__m128i x) {
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+__attribute__((target("sse2")))
+inline __m128 NoiseSSE2(__m128i x) {
+    return _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 8)),
+                                 _mm_set1_ps(kNoiseScale)),
+                      _mm_set1_ps(0.5f));
+}
+
+__attribute__((target("sse2")))
+void FillDitherNoiseSSE2(uint32_t *state, float *noise, size_t len) {
+    __m128i lo = _mm_loadu_si128((const __m128i *) state);
+    __m128i hi = _mm_loadu_si128((const __m128i *) (state + 4));
+    for (size_t ii = 0; ii < len; ii += nDitherNoiseLanes) {
+        lo = XorShiftSSE2(lo);
+        hi = XorShiftSSE2(hi);
+        _mm_storeu_ps(noise + ii, NoiseSSE2(lo));
+        _mm_storeu_ps(noise + ii + 4, NoiseSSE2(hi));
+    }
+    _mm_storeu_si128((__m128i *) state, lo);
+    _mm_storeu_si128((__m128i *) (state + 4), hi);
+}
+
+template<typename Src, typename Dst>
+__attribute__((target("sse2")))
+void ConvertSSE2Kernel(const Src *src, Dst *dst, size_t len) {
+    ConvertSSE2(src, dst, len);
+}
+
+// Eight consecutive samples, and four from each of two places, as floats.
+// (Results are passed by reference; returning AVX vectors by value changes
+// the ABI in a translation unit compiled for the baseline.)
+
+__attribute__((target("avx2")))
+inline void Load8AVX2(const float *src, __m256 &out) {
+    out = _mm256_loadu_ps(src);
+}
+
+__attribute__((target("avx2")))
+inline void Load8AVX2(const short *src, __m256 &out) {
+    const __m256i wide = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) src));
+    out = _mm256_mul_ps(_mm256_cvtepi32_ps(wide), _mm256_set1_ps(kShortScale));
+}
+
+__attribute__((target("avx2")))
+inline void Load4x2AVX2(const float *lo, const float *hi, __m256 &out) {
+    out = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)), _mm_loadu_ps(hi), 1);
+}
+
+__attribute__((target("avx2")))
+inline void Load4x2AVX2(const short *lo, const short *hi, __m256 &out) {
+    const __m128i both = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *) lo),
+                                            _mm_loadl_epi64((const __m128i *) hi));
+    const __m256i wide = _mm256_cvtepi16_epi32(both);
+    out = _mm256_mul_ps(_mm256_cvtepi32_ps(wide), _mm256_set1_ps(kShortScale));
+}
+
+// Eight frames at a time, as the SSE2 version does four, with frames 4 to 7
+// in the upper lanes
+template<unsigned NChannels, typename Sample>
+__attribute__((target("avx2")))
+void DeinterleaveFixedAVX2(const Sample *src, float *const *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8, src += 8 * NChannels) {
+        if (NChannels == 2) {
+            __m256 a, b;
+            Load8AVX2(src, a);
+            Load8AVX2(src + 8, b);
+            // Within lanes, then put the 64 bit halves in order
+            const __m256 left = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            const __m256 right = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            _mm256_storeu_ps(dst[0] + ii, _mm256_castpd_ps(
+                    _mm256_permute4x64_pd(_mm256_castps_pd(left), _MM_SHUFFLE(3, 1, 2, 0))));
+            _mm256_storeu_ps(dst[1] + ii, _mm256_castpd_ps(
+                    _mm256_permute4x64_pd(_mm256_castps_pd(right), _MM_SHUFFLE(3, 1, 2, 0))));
+        } else
+            for (unsigned c0 = 0; c0 < NChannels; c0 += 4) {
+                const unsigned first = std::min(c0, NChannels - 4);
+                __m256 r0, r1, r2, r3;
+                Load4x2AVX2(src + first, src + 4 * NChannels + first, r0);
+                Load4x2AVX2(src + NChannels + first, src + 5 * NChannels + first, r1);
+                Load4x2AVX2(src + 2 * NChannels + first, src + 6 * NChannels + first, r2);
+                Load4x2AVX2(src + 3 * NChannels + first, src + 7 * NChannels + first, r3);
+                // _MM_TRANSPOSE4_PS in each lane
+                const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+                const __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+                const __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+                const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+                _mm256_storeu_ps(dst[first] + ii, _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0)));
+                _mm256_storeu_ps(dst[first + 1] + ii, _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2)));
+                _mm256_storeu_ps(dst[first + 2] + ii, _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0)));
+                _mm256_storeu_ps(dst[first + 3] + ii, _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2)));
+            }
+    }
+    DeinterleaveTail<NChannels>(src, dst, ii, len);
+}
+
+// As ScaleClippedSSE2, for eight floats
+__attribute__((target("avx2")))
+inline void ScaleClippedAVX2(__m256 x, float scale, __m256i &out) {
+    x = _mm256_max_ps(_mm256_set1_ps(-1.0f), _mm256_min_ps(_mm256_set1_ps(1.0f), x));
+    out = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(scale)));
+}
+
+// Sixteen ints, saturated to shorts, in order (packs works within lanes)
+__attribute__((target("avx2")))
+inline void Store16AVX2(short *dst, __m256i a, __m256i b) {
+    _mm256_storeu_si256((__m256i *) dst,
+                        _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+__attribute__((target("avx2")))
+void ConvertAVX2(const short *src, float *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        __m256 x;
+        Load8AVX2(src + ii, x);
+        _mm256_storeu_ps(dst + ii, x);
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void ConvertAVX2(const int *src, float *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        const __m256i x = _mm256_loadu_si256((const __m256i *) (src + ii));
+        _mm256_storeu_ps(dst + ii, _mm256_mul_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(kInt24Scale)));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void ConvertAVX2(const short *src, int *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        const __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (src + ii)));
+        _mm256_storeu_si256((__m256i *) (dst + ii), _mm256_slli_epi32(x, 8));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void ConvertAVX2(const float *src, short *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 16 <= len; ii += 16) {
+        __m256i a, b;
+        ScaleClippedAVX2(_mm256_loadu_ps(src + ii), 1 << 15, a);
+        ScaleClippedAVX2(_mm256_loadu_ps(src + ii + 8), 1 << 15, b);
+        Store16AVX2(dst + ii, a, b);
+    }
+    ConvertSSE2(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void ConvertAVX2(const float *src, int *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        __m256i x;
+        ScaleClippedAVX2(_mm256_loadu_ps(src + ii), 1 << 23, x);
+        x = _mm256_min_epi32(x, _mm256_set1_epi32((1 << 23) - 1));
+        _mm256_storeu_si256((__m256i *) (dst + ii), _mm256_max_epi32(x, _mm256_set1_epi32(-(1 << 23))));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void ConvertAVX2(const int *src, short *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 16 <= len; ii += 16) {
+        const __m256 scale = _mm256_set1_ps(1.0f / (1 << 8));
+        const __m256i a = _mm256_cvtps_epi32(_mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *) (src + ii))), scale));
+        const __m256i b = _mm256_cvtps_epi32(_mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *) (src + ii + 8))), scale));
+        Store16AVX2(dst + ii, a, b);
+    }
+    ConvertSSE2(src + ii, dst + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void ApplyGainsAVX2(float *samples, const double *gains, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(samples + ii));
+        _mm_storeu_ps(samples + ii, _mm256_cvtpd_ps(_mm256_mul_pd(x, _mm256_loadu_pd(gains + ii))));
+    }
+    ApplyGainsScalar(samples + ii, gains + ii, len - ii);
+}
+
+__attribute__((target("avx2")))
+void MixSamplesAVX2(const float *src, float gain, float *dst, unsigned dstStride, size_t len) {
+    const __m256 g = _mm256_set1_ps(gain);
+    size_t ii = 0;
+    if (dstStride == 1)
+        for (; ii + 8 <= len; ii += 8) {
+            const __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src + ii), g);
+            _mm256_storeu_ps(dst + ii, _mm256_add_ps(_mm256_loadu_ps(dst + ii), x));
+        }
+    else if (dstStride == 2)
+        for (; ii + 4 <= len; ii += 4) {
+            // Each product twice, summed into the even lanes only
+            const __m256 x = _mm256_permutevar8x32_ps(
+                    _mm256_castps128_ps256(_mm_mul_ps(_mm_loadu_ps(src + ii), _mm256_castps256_ps128(g))),
+                    _mm256_set_epi32(3, 3, 2, 2, 1, 1, 0, 0));
+            float *const d = dst + 2 * ii;
+            const __m256 a = _mm256_loadu_ps(d);
+            _mm256_storeu_ps(d, _mm256_blend_ps(a, _mm256_add_ps(a, x), 0x55));
+        }
+    MixScalar(src + ii, gain, dst + ii * dstStride, dstStride, len - ii);
+}
+
+__attribute__((target("avx2")))
+void FillDitherNoiseAVX2(uint32_t *state, float *noise, size_t len) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) state);
+    for (size_t ii = 0; ii < len; ii += nDitherNoiseLanes) {
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+        x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+        _mm256_storeu_ps(noise + ii, _mm256_sub_ps(
+                _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8)),
+                              _mm256_set1_ps(kNoiseScale)),
+                _mm256_set1_ps(0.5f)));
+    }
+    _mm256_storeu_si256((__m256i *) state, x);
+}
+
+template<typename Src, typename Dst>
+__attribute__((target("avx2")))
+void ConvertAVX2Kernel(const Src *src, Dst *dst, size_t len) {
+    ConvertAVX2(src, dst, len);
+}
+
+#endif
+
+#ifdef SAMPLE_KERNELS_NEON
+
+// Four consecutive samples as floats
+
+inline float32x4_t Load4NEON(const float *src) {
+    return vld1q_f32(src);
+}
+
+inline float32x4_t Load4NEON(const short *src) {
+    return vmulq_f32(vcvtq_f32_s32(vmovl_s16(vld1_s16(src))), vdupq_n_f32(kShortScale));
+}
+
+// Four frames at a time, in blocks of four channels as the SSE2 version
+template<unsigned NChannels, typename Sample>
+void DeinterleaveFixedNEON(const Sample *src, float *const *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4, src += 4 * NChannels) {
+        if (NChannels == 2) {
+            const float32x4_t a = Load4NEON(src);
+            const float32x4_t b = Load4NEON(src + 4);
+            vst1q_f32(dst[0] + ii, vuzp1q_f32(a, b));
+            vst1q_f32(dst[1] + ii, vuzp2q_f32(a, b));
+        } else
+            for (unsigned c0 = 0; c0 < NChannels; c0 += 4) {
+                const unsigned first = std::min(c0, NChannels - 4);
+                const float32x4x2_t t0 = vtrnq_f32(Load4NEON(src + first),
+                                                   Load4NEON(src + NChannels + first));
+                const float32x4x2_t t1 = vtrnq_f32(Load4NEON(src + 2 * NChannels + first),
+                                                   Load4NEON(src + 3 * NChannels + first));
+                vst1q_f32(dst[first] + ii,
+                          vcombine_f32(vget_low_f32(t0.val[0]), vget_low_f32(t1.val[0])));
+                vst1q_f32(dst[first + 1] + ii,
+                          vcombine_f32(vget_low_f32(t0.val[1]), vget_low_f32(t1.val[1])));
+                vst1q_f32(dst[first + 2] + ii,
+                          vcombine_f32(vget_high_f32(t0.val[0]), vget_high_f32(t1.val[0])));
+                vst1q_f32(dst[first + 3] + ii,
+                          vcombine_f32(vget_high_f32(t0.val[1]), vget_high_f32(t1.val[1])));
+            }
+    }
+    DeinterleaveTail<NChannels>(src, dst, ii, len);
+}
+
+// Four floats clipped to [-1, 1], scaled and rounded to even; NaN to
+// INT_MIN as on x86, where the conversion itself would make it 0
+inline int32x4_t ScaleClippedNEON(float32x4_t x, float scale) {
+    const float32x4_t clipped = vmaxq_f32(vdupq_n_f32(-1.0f), vminq_f32(vdupq_n_f32(1.0f), x));
+    const int32x4_t rounded = vcvtnq_s32_f32(vmulq_f32(clipped, vdupq_n_f32(scale)));
+    return vbslq_s32(vceqq_f32(x, x), rounded, vdupq_n_s32(INT32_MIN));
+}
+
+void ConvertNEON(const short *src, float *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4)
+        vst1q_f32(dst + ii, Load4NEON(src + ii));
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+void ConvertNEON(const int *src, float *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4)
+        vst1q_f32(dst + ii, vmulq_f32(vcvtq_f32_s32(vld1q_s32(src + ii)), vdupq_n_f32(kInt24Scale)));
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+void ConvertNEON(const short *src, int *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4)
+        vst1q_s32(dst + ii, vshlq_n_s32(vmovl_s16(vld1_s16(src + ii)), 8));
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+void ConvertNEON(const float *src, short *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        const int32x4_t a = ScaleClippedNEON(vld1q_f32(src + ii), 1 << 15);
+        const int32x4_t b = ScaleClippedNEON(vld1q_f32(src + ii + 4), 1 << 15);
+        // Saturation clips 32768
+        vst1q_s16(dst + ii, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+void ConvertNEON(const float *src, int *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        const int32x4_t x = ScaleClippedNEON(vld1q_f32(src + ii), 1 << 23);
+        vst1q_s32(dst + ii, vmaxq_s32(vminq_s32(x, vdupq_n_s32((1 << 23) - 1)),
+                                      vdupq_n_s32(-(1 << 23))));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+void ConvertNEON(const int *src, short *dst, size_t len) {
+    size_t ii = 0;
+    for (; ii + 8 <= len; ii += 8) {
+        // x / 2^23 * 2^15, exactly
+        const float32x4_t scale = vdupq_n_f32(1.0f / (1 << 8));
+        const int32x4_t a = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vld1q_s32(src + ii)), scale));
+        const int32x4_t b = vcvtnq_s32_f32(vmulq_f32(vcvtq_f32_s32(vld1q_s32(src + ii + 4)), scale));
+        vst1q_s16(dst + ii, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+    ConvertScalar(src + ii, dst + ii, len - ii);
+}
+
+void ApplyGainsNEON(float *samples, const double *gains, size_t len) {
+    size_t ii = 0;
+    for (; ii + 4 <= len; ii += 4) {
+        // The products of float and double, rounded to float
+        const float32x4_t x = vld1q_f32(samples + ii);
+        const float64x2_t lo = vmulq_f64(vcvt_f64_f32(vget_low_f32(x)), vld1q_f64(gains + ii));
+        const float64x2_t hi = vmulq_f64(vcvt_high_f64_f32(x), vld1q_f64(gains + ii + 2));
+        vst1q_f32(samples + ii, vcvt_high_f32_f64(vcvt_f32_f64(lo), hi));
+    }
+    ApplyGainsScalar(samples + ii, gains + ii, len - ii);
+}
+
+void MixSamplesNEON(const float *src, float gain, float *dst, unsigned dstStride, size_t len) {
+    const float32x4_t g = vdupq_n_f32(gain);
+    size_t ii = 0;
+    if (dstStride == 1)
+        for (; ii + 4 <= len; ii += 4) {
+            const float32x4_t x = vmulq_f32(vld1q_f32(src + ii), g);
+            vst1q_f32(dst + ii, vaddq_f32(vld1q_f32(dst + ii), x));
+        }
+    else if (dstStride == 2)
+        // The other channel is stored back as it was loaded
+        for (; ii + 4 <= len; ii += 4) {
+            float *const d = dst + 2 * ii;
+            float32x4x2_t frames = vld2q_f32(d);
+            frames.val[0] = vaddq_f32(frames.val[0], vmulq_f32(vld1q_f32(src + ii), g));
+            vst2q_f32(d, frames);
+        }
+    MixScalar(src + ii, gain, dst + ii * dstStride, dstStride, len - ii);
+}
+
+inline uint32x4_t XorShiftNEON(uint32x4_t x) {
+    x = veorq_u32(x, vshlq_n_u32(x, 13));
+    x = veorq_u32(x, vshrq_n_u32(x, 17));
+    return veorq_u32(x, vshlq_n_u32(x, 5));
+}
+
+inline float32x4_t NoiseNEON(uint32x4_t x) {
+    return vsubq_f32(vmulq_f32(vcvtq_f32_u32(vshrq_n_u32(x, 8)), vdupq_n_f32(kNoiseScale)),
+                     vdupq_n_f32(0.5f));
+}
+
+void FillDitherNoiseNEON(uint32_t *state, float *noise, size_t len) {
+    uint32x4_t lo = vld1q_u32(state);
+    uint32x4_t hi = vld1q_u32(state + 4);
+    for (size_t ii = 0; ii < len; ii += nDitherNoiseLanes) {
+        lo = XorShiftNEON(lo);
+        hi = XorShiftNEON(hi);
+        vst1q_f32(noise + ii, NoiseNEON(lo));
+        vst1q_f32(noise + ii + 4, NoiseNEON(hi));
+    }
+    vst1q_u32(state, lo);
+    vst1q_u32(state + 4, hi);
+}
+
+template<typename Src, typename Dst>
+void ConvertNEONKernel(const Src *src, Dst *dst, size_t len) {
+    ConvertNEON(src, dst, len);
+}
+
+#endif
+
+template<typename Sample>
+using DeinterleaveFixed = void (*)(const Sample *src, float *const *dst, size_t len);
+
+// For 2, 4, 6 and 8 channels
+enum : unsigned { nFixedLayouts = 4 };
+
+template<typename Src, typename Dst>
+using Convert = void (*)(const Src *src, Dst *dst, size_t len);
+
+struct Conversions {
+    Convert<short, float> shortToFloat;
+    Convert<int, float> int24ToFloat;
+    Convert<short, int> shortToInt24;
+    Convert<float, short> floatToShort;
+    Convert<float, int> floatToInt24;
+    Convert<int, short> int24ToShort;
+};
+
+struct Kernels {
+    SimdLevel level;
+    DeinterleaveFixed<float> floats[nFixedLayouts];
+    DeinterleaveFixed<short> shorts[nFixedLayouts];
+    Conversions conversions;
+    void (*applyGains)(float *samples, const double *gains, size_t len);
+    void (*mixSamples)(const float *src, float gain, float *dst, unsigned dstStride, size_t len);
+    void (*fillDitherNoise)(uint32_t *state, float *noise, size_t len);
+};
+
+#define SAMPLE_KERNELS_FIXED(name, Sample) \
+    {name<2, Sample>, name<4, Sample>, name<6, Sample>, name<8, Sample>}
+
+#define SAMPLE_KERNELS_CONVERSIONS(name) \
+    {name<short, float>, name<int, float>, name<short, int>, \
+     name<float, short>, name<float, int>, name<int, short>}
+
+bool IsSupported(SimdLevel level) {
+    return SimdLevelSupported(level);
+}
+
+Kernels MakeKernels(SimdLevel level) {
+    switch (level) {
+#ifdef SAMPLE_KERNELS_X86
+        // No wider kernels yet
+        case SimdLevel::AVX512:
+        case SimdLevel::AVX2:
+            return {level,
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedAVX2, float),
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedAVX2, short),
+                    SAMPLE_KERNELS_CONVERSIONS(ConvertAVX2Kernel),
+                    ApplyGainsAVX2, MixSamplesAVX2, FillDitherNoiseAVX2};
+        case SimdLevel::SSE2:
+            return {level,
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedSSE2, float),
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedSSE2, short),
+                    SAMPLE_KERNELS_CONVERSIONS(ConvertSSE2Kernel),
+                    ApplyGainsSSE2, MixSamplesSSE2, FillDitherNoiseSSE2};
+#endif
+#ifdef SAMPLE_KERNELS_NEON
+        case SimdLevel::NEON:
+            return {level,
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedNEON, float),
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedNEON, short),
+                    SAMPLE_KERNELS_CONVERSIONS(ConvertNEONKernel),
+                    ApplyGainsNEON, MixSamplesNEON, FillDitherNoiseNEON};
+#endif
+        default:
+            return {SimdLevel::Scalar,
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedScalar, float),
+                    SAMPLE_KERNELS_FIXED(DeinterleaveFixedScalar, short),
+                    SAMPLE_KERNELS_CONVERSIONS(ConvertScalarKernel),
+                    ApplyGainsScalar, MixSamplesScalar, FillDitherNoiseScalar};
+    }
+}
+
+// The kernels of every level are made once, and forcing a level swaps the
+// pointer alone, so that threads processing meanwhile dispatch through the
+// table of one level or the other, never one half written
+const Kernels &KernelsFor(SimdLevel level) {
+    static const Kernels tables[] = {
+            MakeKernels(SimdLevel::Scalar), MakeKernels(SimdLevel::SSE2), MakeKernels(SimdLevel::AVX2),
+            MakeKernels(SimdLevel::AVX512), MakeKernels(SimdLevel::NEON),
+    };
+    return tables[static_cast<size_t>(level)];
+}
+
+std::atomic<const Kernels *> &CurrentTable() {
+    static std::atomic<const Kernels *> current{&KernelsFor(CpuSimdLevel())};
+    return current;
+}
+
+inline const Kernels &CurrentKernels() {
+    return *CurrentTable().load(std::memory_order_acquire);
+}
+
+inline bool IsFixedLayout(unsigned nChannels) {
+    return nChannels % 2 == 0 && nChannels >= 2 && nChannels <= 2 * nFixedLayouts;
+}
+
+}
+
+void Deinterleave(const float *src, unsigned nChannels, float *const *dst, size_t len) {
+    if (IsFixedLayout(nChannels))
+        CurrentKernels().floats[nChannels / 2 - 1](src, dst, len);
+    else
+        DeinterleaveScalar(src, nChannels, dst, len);
+}
+
+void Deinterleave(const short *src, unsigned nChannels, float *const *dst, size_t len) {
+    if (IsFixedLayout(nChannels))
+        CurrentKernels().shorts[nChannels / 2 - 1](src, dst, len);
+    else
+        DeinterleaveScalar(src, nChannels, dst, len);
+}
+
+void ConvertSamples(const short *src, float *dst, size_t len) {
+    CurrentKernels().conversions.shortToFloat(src, dst, len);
+}
+
+void ConvertSamples(const int *src, float *dst, size_t len) {
+    CurrentKernels().conversions.int24ToFloat(src, dst, len);
+}
+
+void ConvertSamples(const short *src, int *dst, size_t len) {
+    CurrentKernels().conversions.shortToInt24(src, dst, len);
+}
+
+void ConvertSamples(const float *src, short *dst, size_t len) {
+    CurrentKernels().conversions.floatToShort(src, dst, len);
+}
+
+void ConvertSamples(const float *src, int *dst, size_t len) {
+    CurrentKernels().conversions.floatToInt24(src, dst, len);
+}
+
+void ConvertSamples(const int *src, short *dst, size_t len) {
+    CurrentKernels().conversions.int24ToShort(src, dst, len);
+}
+
+void ApplyGains(float *samples, const double *gains, size_t len) {
+    CurrentKernels().applyGains(samples, gains, len);
+}
+
+void MixSamples(const float *src, float gain, float *dst, unsigned dstStride, size_t len) {
+    CurrentKernels().mixSamples(src, gain, dst, dstStride, len);
+}
+
+void FillDitherNoise(uint32_t *state, float *noise, size_t len) {
+    CurrentKernels().fillDitherNoise(state, noise, len);
+}
+
+SimdLevel GetSampleKernelSimdLevel() {
+    return CurrentKernels().level;
+}
+
+bool SetSampleKernelSimdLevel(SimdLevel level) {
+    if (!IsSupported(level))
+        return false;
+    CurrentTable().store(&KernelsFor(level), std::memory_order_release);
+    return true;
+}
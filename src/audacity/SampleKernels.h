@@ -0,0 +1,72 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  SampleKernels.h
+
+  Inner loops of sample import, format conversion and mixing, with SSE2, AVX2
+  and NEON versions selected at run time and a scalar fallback.  All versions
+  give identical results.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_SAMPLE_KERNELS__
+#define __AUDACITY_SAMPLE_KERNELS__
+
+#include <cstddef>
+#include <cstdint>
+#include "CpuFeatures.h"
+
+/// Split len frames of nChannels interleaved samples, in one pass, into a
+/// buffer per channel:  dst[c][ii] = src[ii * nChannels + c].  2, 4, 6 and 8
+/// channels use vectorized versions.
+void Deinterleave(const float *src, unsigned nChannels, float *const *dst, size_t len);
+
+/// The same from 16 bit samples, converted to float as libsndfile
+/// normalizes them:  dst[c][ii] = src[ii * nChannels + c] / 32768.
+void Deinterleave(const short *src, unsigned nChannels, float *const *dst, size_t len);
+
+/// Conversion of len contiguous samples between the sample formats (int
+/// holding int24Sample), with the results of Dither::Apply without
+/// dithering:  integers scale to float by 1 / 32768 or 1 / 2^23; float
+/// clips to [-1, 1] and rounds, and int24 rounds, to the nearest integer
+/// in range.
+void ConvertSamples(const short *src, float *dst, size_t len);
+
+void ConvertSamples(const int *src, float *dst, size_t len);
+
+void ConvertSamples(const short *src, int *dst, size_t len);
+
+void ConvertSamples(const float *src, short *dst, size_t len);
+
+void ConvertSamples(const float *src, int *dst, size_t len);
+
+void ConvertSamples(const int *src, short *dst, size_t len);
+
+/// A gain envelope applied as Mixer does, in double:
+/// samples[ii] = samples[ii] * gains[ii]
+void ApplyGains(float *samples, const double *gains, size_t len);
+
+/// Accumulation into a mix, as MixBuffers does:
+/// dst[ii * dstStride] += src[ii] * gain.  Strides 1 and 2 (a channel of
+/// interleaved stereo) are vectorized.
+void MixSamples(const float *src, float gain, float *dst, unsigned dstStride, size_t len);
+
+/// Generators of Dither's noise, interleaved
+enum : unsigned { nDitherNoiseLanes = 8 };
+
+/// Uniform noise in [-0.5, 0.5), in steps of 2^-24, from nDitherNoiseLanes
+/// xorshift32 generators with nonzero states in state:  noise[ii] comes
+/// from generator ii % nDitherNoiseLanes.  len must be a multiple of
+/// nDitherNoiseLanes.
+void FillDitherNoise(uint32_t *state, float *noise, size_t len);
+
+/// The level the kernels currently dispatch to; defaults to CpuSimdLevel()
+SimdLevel GetSampleKernelSimdLevel();
+
+/// Force a level (for testing and benchmarking).  Returns false, changing
+/// nothing, if this CPU does not support it.  Threads importing meanwhile
+/// go on with either level, each kernel call with one of them.
+bool SetSampleKernelSimdLevel(SimdLevel level);
+
+#endif
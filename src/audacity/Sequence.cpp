@@ -35,6 +35,7 @@
 #include "Utils.h"
 #include "BlockFile.h"
 #include "SilentBlockFile.h"
+#include "Instrumentation.h"
 
 #include <algorithm>
 #include <float.h>
@@ -42,7 +43,7 @@
 #include <cstring>
 #include <iostream>
 
-size_t Sequence::sMaxDiskBlockSize = 1048576;
+const size_t Sequence::sMaxDiskBlockSize = 1048576;
 
 namespace {
     inline bool Overflows(double numSamples) {
@@ -107,18 +108,21 @@ bool Sequence::Get(int b, samplePtr buffer, sampleFormat format,
     return result;
 }
 
+// Scratch buffers of the functions below come from an ArenaFrame:  from
+// the arena of the thread's run, when there is one, and otherwise the heap
+
 namespace {
     void ensureSampleBufferSize(SampleBuffer &buffer, sampleFormat format,
-                                size_t &size, size_t required,
+                                size_t &size, size_t required, Arena *arena,
                                 SampleBuffer *pSecondBuffer = nullptr) {
         // This should normally do nothing, but it is a defense against corrupt
         // projects than might have inconsistent block files bigger than the
         // expected maximum size.
         if (size < required) {
             // reallocate
-            buffer.Allocate(required, format);
+            buffer.Allocate(required, format, arena);
             if (pSecondBuffer && pSecondBuffer->ptr())
-                pSecondBuffer->Allocate(required, format);
+                pSecondBuffer->Allocate(required, format, arena);
             if (!buffer.ptr() || (pSecondBuffer && !pSecondBuffer->ptr())) {
                 // malloc failed
                 // Perhaps required is a really crazy value,
@@ -136,6 +140,8 @@ void Sequence::SetSamples(samplePtr buffer, sampleFormat format,
                           sampleCount start, sampleCount len)
 // STRONG-GUARANTEE
 {
+    ArenaFrame frame;
+
     const auto size = mBlock.size();
 
     if (start < 0 || start + len > mNumSamples)
@@ -143,11 +149,11 @@ void Sequence::SetSamples(samplePtr buffer, sampleFormat format,
 
     size_t tempSize = mMaxSamples;
     // to do:  allocate this only on demand
-    SampleBuffer scratch(tempSize, mSampleFormat);
+    SampleBuffer scratch(tempSize, mSampleFormat, frame.GetArena());
 
     SampleBuffer temp;
     if (buffer && format != mSampleFormat) {
-        temp.Allocate(tempSize, mSampleFormat);
+        temp.Allocate(tempSize, mSampleFormat, frame.GetArena());
     }
 
     int b = FindBlock(start);
@@ -185,7 +191,7 @@ void Sequence::SetSamples(samplePtr buffer, sampleFormat format,
 #endif
 
         ensureSampleBufferSize(scratch, mSampleFormat, tempSize, fileLength,
-                               &temp);
+                               frame.GetArena(), &temp);
 
         samplePtr useBuffer = buffer;
         if (buffer && format != mSampleFormat) {
@@ -272,22 +278,30 @@ void Sequence::Append(samplePtr buffer, sampleFormat format,
                       size_t len)
 // STRONG-GUARANTEE
 {
+    NOISERED_TIMED(Append);
+    ArenaFrame frame;
+
     if (len == 0)
         return;
+    NOISERED_COUNT(SamplesAppended, len);
 
     // Quick check to make sure that it doesn't overflow
     if (Overflows(mNumSamples.as_double() + ((double) len)))
         THROW_INCONSISTENCY_EXCEPTION;
 
     BlockArray newBlock;
+    newBlock.reserve(len / mMaxSamples + 2);
     sampleCount newNumSamples = mNumSamples;
 
     // If the last block is not full, we need to add samples to it
     int numBlocks = mBlock.size();
     SeqBlock *pLastBlock;
     decltype(pLastBlock->f->GetLength()) length;
-    size_t bufferSize = mMaxSamples;
-    SampleBuffer buffer2(bufferSize, mSampleFormat);
+    // Only for the last block, or for conversion:  samples of this format
+    // go to block files straight from the buffer
+    SampleBuffer buffer2;
+    if (format != mSampleFormat)
+        buffer2.Allocate(mMaxSamples, mSampleFormat, frame.GetArena());
     bool replaceLast = false;
     if (numBlocks > 0 &&
         (length =
@@ -296,6 +310,8 @@ void Sequence::Append(samplePtr buffer, sampleFormat format,
         const SeqBlock &lastBlock = *pLastBlock;
         const auto addLen = std::min(mMaxSamples - length, len);
 
+        if (!buffer2.ptr())
+            buffer2.Allocate(mMaxSamples, mSampleFormat, frame.GetArena());
         Read(buffer2.ptr(), mSampleFormat, lastBlock, 0, length, true);
 
         CopySamples(buffer,
@@ -352,6 +368,76 @@ void Sequence::Append(samplePtr buffer, sampleFormat format,
 #endif
 }
 
+void Sequence::AppendBlockFile(const BlockFilePtr &blockFile)
+// STRONG-GUARANTEE
+{
+    if (!blockFile || blockFile->GetLength() == 0 || blockFile->GetLength() > mMaxSamples ||
+        Overflows(mNumSamples.as_double() + blockFile->GetLength()))
+        THROW_INCONSISTENCY_EXCEPTION;
+
+    BlockArray newBlock;
+    newBlock.push_back(SeqBlock(blockFile, mNumSamples));
+    AppendBlocksIfConsistent(newBlock, false, mNumSamples + blockFile->GetLength(), "AppendBlockFile");
+}
+
+void Sequence::Replace(sampleCount s0, sampleCount len, Sequence &src)
+// STRONG-GUARANTEE
+{
+    ArenaFrame frame;
+
+    if (len < 0 || s0 < 0 || s0 + len > mNumSamples || len > src.mNumSamples ||
+        src.mSampleFormat != mSampleFormat || src.mDirManager != mDirManager)
+        THROW_INCONSISTENCY_EXCEPTION;
+
+    if (len == 0)
+        return;
+
+    const auto end = s0 + len;
+    const unsigned b0 = FindBlock(s0);
+    const unsigned b1 = FindBlock(end - 1);
+    const unsigned bs = src.FindBlock(len - 1);
+
+    SampleBuffer scratch(mMaxSamples, mSampleFormat, frame.GetArena());
+    // A NEW block of samples [from, to) of block b, at start
+    auto part = [&](const SeqBlock &b, sampleCount from, sampleCount to, sampleCount start) {
+        const auto partLen = (to - from).as_size_t();
+        Read(scratch.ptr(), mSampleFormat, b, (from - b.start).as_size_t(), partLen, true);
+        return SeqBlock(
+                mDirManager->NewSimpleBlockFile(scratch.ptr(), partLen, mSampleFormat), start);
+    };
+
+    BlockArray newBlock;
+    newBlock.reserve(b0 + 1 + bs + 1 + 1 + (mBlock.size() - b1 - 1));
+
+    // Blocks before the range, and the part of b0 before it
+    newBlock.insert(newBlock.end(), mBlock.begin(), mBlock.begin() + b0);
+    const SeqBlock &first = mBlock[b0];
+    if (first.start < s0)
+        newBlock.push_back(part(first, first.start, s0, first.start));
+
+    // src's blocks, and the part of the last one needed
+    for (unsigned ii = 0; ii < bs; ++ii)
+        newBlock.push_back(src.mBlock[ii].Plus(s0));
+    const SeqBlock &lastSrc = src.mBlock[bs];
+    if (lastSrc.start + lastSrc.f->GetLength() > len)
+        newBlock.push_back(part(lastSrc, lastSrc.start, len, s0 + lastSrc.start));
+    else
+        newBlock.push_back(lastSrc.Plus(s0));
+
+    // The part of b1 after the range, and blocks after it
+    const SeqBlock &last = mBlock[b1];
+    const auto lastEnd = last.start + last.f->GetLength();
+    if (lastEnd > end)
+        newBlock.push_back(part(last, end, lastEnd, end));
+    newBlock.insert(newBlock.end(), mBlock.begin() + b1 + 1, mBlock.end());
+
+    CommitChangesIfConsistent(newBlock, mNumSamples, "Replace");
+
+    // use NOFAIL-GUARANTEE
+    src.mBlock.clear();
+    src.mNumSamples = 0;
+}
+
 sampleFormat Sequence::GetSampleFormat() const {
     return mSampleFormat;
 }
@@ -373,6 +459,8 @@ size_t Sequence::GetIdealAppendLen() const {
 void Sequence::Delete(sampleCount start, sampleCount len)
 // STRONG-GUARANTEE
 {
+    ArenaFrame frame;
+
     if (len == 0)
         return;
 
@@ -415,8 +503,8 @@ void Sequence::Delete(sampleCount start, sampleCount len)
         // because start + len - 1 is also in the block...
         auto newLen = (length - limitSampleBufferSize(length, len));
 
-        scratch.Allocate(scratchSize, mSampleFormat);
-        ensureSampleBufferSize(scratch, mSampleFormat, scratchSize, newLen);
+        scratch.Allocate(scratchSize, mSampleFormat, frame.GetArena());
+        ensureSampleBufferSize(scratch, mSampleFormat, scratchSize, newLen, frame.GetArena());
 
         Read(scratch.ptr(), mSampleFormat, b, 0, pos, true);
         Read(scratch.ptr() + (pos * sampleSize), mSampleFormat,
@@ -466,8 +554,8 @@ void Sequence::Delete(sampleCount start, sampleCount len)
     if (preBufferLen) {
         if (preBufferLen >= mMinSamples || b0 == 0) {
             if (!scratch.ptr())
-                scratch.Allocate(scratchSize, mSampleFormat);
-            ensureSampleBufferSize(scratch, mSampleFormat, scratchSize, preBufferLen);
+                scratch.Allocate(scratchSize, mSampleFormat, frame.GetArena());
+            ensureSampleBufferSize(scratch, mSampleFormat, scratchSize, preBufferLen, frame.GetArena());
             Read(scratch.ptr(), mSampleFormat, preBlock, 0, preBufferLen, true);
             auto pFile =
                     mDirManager->NewSimpleBlockFile(scratch.ptr(), preBufferLen, mSampleFormat);
@@ -479,9 +567,9 @@ void Sequence::Delete(sampleCount start, sampleCount len)
             const auto sum = prepreLen + preBufferLen;
 
             if (!scratch.ptr())
-                scratch.Allocate(scratchSize, mSampleFormat);
+                scratch.Allocate(scratchSize, mSampleFormat, frame.GetArena());
             ensureSampleBufferSize(scratch, mSampleFormat, scratchSize,
-                                   sum);
+                                   sum, frame.GetArena());
 
             Read(scratch.ptr(), mSampleFormat, prepreBlock, 0, prepreLen, true);
             Read(scratch.ptr() + prepreLen * sampleSize, mSampleFormat,
@@ -510,7 +598,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
         if (postBufferLen >= mMinSamples || b1 == numBlocks - 1) {
             if (!scratch.ptr())
                 // Last use of scratch, can ask for smaller
-                scratch.Allocate(postBufferLen, mSampleFormat);
+                scratch.Allocate(postBufferLen, mSampleFormat, frame.GetArena());
             // start + len - 1 lies within postBlock
             auto pos = (start + len - postBlock.start).as_size_t();
             Read(scratch.ptr(), mSampleFormat, postBlock, pos, postBufferLen, true);
@@ -525,7 +613,7 @@ void Sequence::Delete(sampleCount start, sampleCount len)
 
             if (!scratch.ptr())
                 // Last use of scratch, can ask for smaller
-                scratch.Allocate(sum, mSampleFormat);
+                scratch.Allocate(sum, mSampleFormat, frame.GetArena());
             // start + len - 1 lies within postBlock
             auto pos = (start + len - postBlock.start).as_size_t();
             Read(scratch.ptr(), mSampleFormat, postBlock, pos, postBufferLen, true);
@@ -552,6 +640,8 @@ void Sequence::Delete(sampleCount start, sampleCount len)
 void Sequence::Paste(sampleCount s, const Sequence *src)
 // STRONG-GUARANTEE
 {
+    ArenaFrame frame;
+
     if ((s < 0) || (s > mNumSamples)) {
         std::cerr <<
                   string_format("Sequence::Paste: sampleCount s %lf is < 0 or > mNumSamples %lf).",
@@ -620,7 +710,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
 
         SeqBlock &block = *pBlock;
         // largerBlockLen is not more than mMaxSamples...
-        SampleBuffer buffer(largerBlockLen.as_size_t(), mSampleFormat);
+        SampleBuffer buffer(largerBlockLen.as_size_t(), mSampleFormat, frame.GetArena());
 
         // ...and addedLen is not more than largerBlockLen
         auto sAddedLen = addedLen.as_size_t();
@@ -675,7 +765,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
         auto sAddedLen = addedLen.as_size_t();
         const auto sum = splitLen + sAddedLen;
 
-        SampleBuffer sumBuffer(sum, mSampleFormat);
+        SampleBuffer sumBuffer(sum, mSampleFormat, frame.GetArena());
         Read(sumBuffer.ptr(), mSampleFormat, splitBlock, 0, splitPoint, true);
         src->Get(0, sumBuffer.ptr() + splitPoint * sampleSize,
                  mSampleFormat,
@@ -705,7 +795,7 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
         const auto rightSplit = splitBlock.f->GetLength() - splitPoint;
         const auto rightLen = rightSplit + srcLastTwoLen;
 
-        SampleBuffer sampleBuffer(std::max(leftLen, rightLen), mSampleFormat);
+        SampleBuffer sampleBuffer(std::max(leftLen, rightLen), mSampleFormat, frame.GetArena());
 
         Read(sampleBuffer.ptr(), mSampleFormat, splitBlock, 0, splitPoint, true);
         src->Get(0, sampleBuffer.ptr() + splitPoint * sampleSize,
@@ -741,6 +831,8 @@ void Sequence::Paste(sampleCount s, const Sequence *src)
 }
 
 std::unique_ptr<Sequence> Sequence::Copy(sampleCount s0, sampleCount s1) const {
+    ArenaFrame frame;
+
     auto dest = std::make_unique<Sequence>(mDirManager, mSampleFormat);
     if (s0 >= s1 || s0 >= mNumSamples || s1 < 0) {
         return dest;
@@ -758,7 +850,7 @@ std::unique_ptr<Sequence> Sequence::Copy(sampleCount s0, sampleCount s1) const {
     dest->mBlock.reserve(b1 - b0 + 1);
 
     auto bufferSize = mMaxSamples;
-    SampleBuffer buffer(bufferSize, mSampleFormat);
+    SampleBuffer buffer(bufferSize, mSampleFormat, frame.GetArena());
 
     int blocklen;
 
@@ -771,7 +863,7 @@ std::unique_ptr<Sequence> Sequence::Copy(sampleCount s0, sampleCount s1) const {
         blocklen =
                 (std::min(s1, block0.start + file->GetLength()) - s0).as_size_t();
         assert(file->IsAlias() || (blocklen <= (int) mMaxSamples)); // Vaughan, 2012-02-29
-        ensureSampleBufferSize(buffer, mSampleFormat, bufferSize, blocklen);
+        ensureSampleBufferSize(buffer, mSampleFormat, bufferSize, blocklen, frame.GetArena());
         Get(b0, buffer.ptr(), mSampleFormat, s0, blocklen, true);
 
         dest->Append(buffer.ptr(), mSampleFormat, blocklen);
@@ -791,7 +883,7 @@ std::unique_ptr<Sequence> Sequence::Copy(sampleCount s0, sampleCount s1) const {
         blocklen = (s1 - block.start).as_size_t();
         assert(file->IsAlias() || (blocklen <= (int) mMaxSamples)); // Vaughan, 2012-02-29
         if (blocklen < (int) file->GetLength()) {
-            ensureSampleBufferSize(buffer, mSampleFormat, bufferSize, blocklen);
+            ensureSampleBufferSize(buffer, mSampleFormat, bufferSize, blocklen, frame.GetArena());
             Get(b1, buffer.ptr(), mSampleFormat, block.start, blocklen, true);
             dest->Append(buffer.ptr(), mSampleFormat, blocklen);
         } else
@@ -910,7 +1002,8 @@ void Sequence::AppendBlocksIfConsistent
         }
     });
 
-    std::copy(additionalBlocks.begin(), additionalBlocks.end(),
+    mBlock.reserve(prevSize + additionalBlocks.size());
+    std::move(additionalBlocks.begin(), additionalBlocks.end(),
               std::back_inserter(mBlock));
 
     // Check consistency only of the blocks that were added,
@@ -1013,6 +1106,8 @@ void Sequence::CommitChangesIfConsistent
 bool Sequence::ConvertToSampleFormat(sampleFormat format)
 // STRONG-GUARANTEE
 {
+    ArenaFrame frame;
+
     if (format == mSampleFormat)
         // no change
         return false;
@@ -1048,18 +1143,18 @@ bool Sequence::ConvertToSampleFormat(sampleFormat format)
 
     {
         size_t oldSize = oldMaxSamples;
-        SampleBuffer bufferOld(oldSize, oldFormat);
+        SampleBuffer bufferOld(oldSize, oldFormat, frame.GetArena());
         size_t newSize = oldMaxSamples;
-        SampleBuffer bufferNew(newSize, format);
+        SampleBuffer bufferNew(newSize, format, frame.GetArena());
 
         for (size_t i = 0, nn = mBlock.size(); i < nn; i++) {
             SeqBlock &oldSeqBlock = mBlock[i];
             const auto &oldBlockFile = oldSeqBlock.f;
             const auto len = oldBlockFile->GetLength();
-            ensureSampleBufferSize(bufferOld, oldFormat, oldSize, len);
+            ensureSampleBufferSize(bufferOld, oldFormat, oldSize, len, frame.GetArena());
             Read(bufferOld.ptr(), oldFormat, oldSeqBlock, 0, len, true);
 
-            ensureSampleBufferSize(bufferNew, format, newSize, len);
+            ensureSampleBufferSize(bufferNew, format, newSize, len, frame.GetArena());
             CopySamples(bufferOld.ptr(), oldFormat, bufferNew.ptr(), format, len);
 
             // Note this fix for http://bugzilla.audacityteam.org/show_bug.cgi?id=451,
@@ -96,6 +96,11 @@ public:
 
     void Append(samplePtr buffer, sampleFormat format, size_t len);
 
+    // Append a blockfile.  The blockfile pointer is then "owned" by the
+    // sequence.  Its samples must be of the sequence's format, and no more
+    // than GetMaxBlockSize().
+    void AppendBlockFile(const BlockFilePtr &blockFile);
+
     size_t GetIdealAppendLen() const;
     //
     // Manipulating Sample Format
@@ -107,6 +112,12 @@ public:
 
     void Paste(sampleCount s0, const Sequence *src);
 
+    // Replace samples [s0, s0 + len) with the first len samples of src,
+    // which must have the same format and DirManager, taking its block
+    // files.  Only the blocks at the ends of the range, and the last one
+    // taken, are read and written again.  src is left empty.
+    void Replace(sampleCount s0, sampleCount len, Sequence &src);
+
     // Return non-null, or else throw!
     std::unique_ptr<Sequence> Copy(sampleCount s0, sampleCount s1) const;
 
@@ -116,6 +127,7 @@ public:
 
     size_t GetIdealBlockSize() const;
 
+    // Moves from additionalBlocks, whether or not it throws
     void AppendBlocksIfConsistent
             (BlockArray &additionalBlocks, bool replaceLast,
              sampleCount numSamples, const char *whereStr);
@@ -166,7 +178,7 @@ private:
     // Private static variables
     //
 
-    static size_t sMaxDiskBlockSize;
+    static const size_t sMaxDiskBlockSize;
 
     //
     // Private variables
@@ -26,27 +26,22 @@ supply data and have the constructor write the file.  The other
 is for when the file already exists and we simply want to create
 the data structure to refer to it.
 
-The block file can be cached in two ways. Caching is enabled if the
-preference "/Directories/CacheBlockFiles" is set, otherwise disabled. The
-default is to disable caching.
+The block file can be cached in two ways. Caching is enabled when
+SimpleBlockFile::SetCacheBudget() gives it a nonzero number of bytes for
+all block files of the process; the default is to disable caching.
 
-* Read-caching: If caching is enabled, all block files will always be
-  read-cached. Block files on disk will be read as soon as they are created
-  and held in memory. New block files will be written to disk, but held in
-  memory, so they are never read from disk in the current session.
+* Read-caching: If caching is enabled, block files read from disk are
+  read whole and held in memory; NEW block files are held in memory as they
+  are written, so they are not read from disk while they stay cached.
 
 * Write-caching: If caching is enabled and the parameter allowDeferredWrite
   is enabled at the block file constructor, NEW block files are held in memory
-  and written to disk only when WriteCacheToDisk() is called. This is used
-  during recording to prevent disk access. After recording, WriteCacheToDisk()
-  will be called on all block files and they will be written to disk. During
-  normal editing, no write cache is active, that is, any block files will be
-  written to disk instantly.
+  and written to disk only when WriteCacheToDisk() is called or they are
+  evicted. Block files deleted first never touch the disk at all.
 
-  Even with write cache, auto recovery during normal editing will work as
-  expected. However, auto recovery during recording will not work (not even
-  manual auto recovery, because the files are never written physically to
-  disk).
+  When the cached data exceed the budget, the least recently used block
+  files are evicted, deferred ones being written first, so that memory stays
+  within the budget whatever the length of the project.
 
 *//****************************************************************//**
 
@@ -58,11 +53,37 @@ to get its definition, rather than rolling our own.
 *//*******************************************************************/
 
 
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
 #include <fstream>
+#include <mutex>
+#include <sys/stat.h> // stat
 #include "SimpleBlockFile.h"
 #include "FileException.h"
 #include "SampleFormat.h"
+#include "Instrumentation.h"
+
+namespace {
+
+// The cache of all simple block files of the process
+struct BlockCache {
+    // Guards all below, and the mCache of every block file
+    std::mutex mutex;
+    std::atomic<size_t> budget{0};
+    // Most recently used first; blocks being written are out of it
+    std::list<const SimpleBlockFile *> order;
+    SimpleBlockFile::CacheStatistics statistics;
+    // Notified as each block being written is done
+    std::condition_variable written;
+};
+
+BlockCache &GetBlockCache() {
+    static BlockCache cache;
+    return cache;
+}
+
+}
 
 /// Constructs a SimpleBlockFile based on sample data and writes
 /// it to disk.
@@ -74,23 +95,35 @@ to get its definition, rather than rolling our own.
 /// @param sampleLen    The number of samples to be written to this block.
 /// @param format       The format of the given samples.
 /// @param allowDeferredWrite    Allow deferred write-caching
+/// @param withSummary  Compute the summary and write it before the samples
 SimpleBlockFile::SimpleBlockFile(wxFileNameWrapper &&baseFileName,
                                  samplePtr sampleData, size_t sampleLen,
                                  sampleFormat format,
                                  bool allowDeferredWrite /* = false */,
-                                 bool bypassCache /* = false */) :
+                                 bool bypassCache /* = false */,
+                                 bool withSummary /* = true */) :
         BlockFile{
                 (baseFileName.SetExt("au"), std::move(baseFileName)),
                 sampleLen
         } {
     mFormat = format;
+    mHasSummary = withSummary;
+    if (!mHasSummary)
+        mMin = mMax = mRMS = 0;
 
     mCache.active = false;
+    mCache.writing = false;
 
     bool useCache = GetCache() && (!bypassCache);
+    const bool deferWrite = allowDeferredWrite && useCache;
 
-    if (!(allowDeferredWrite && useCache) && !bypassCache) {
-        bool bSuccess = WriteSimpleBlockFile(sampleData, sampleLen, format, NULL);
+    ArrayOf<char> cleanup;
+    void *summaryData = nullptr;
+    if (!bypassCache && mHasSummary)
+        summaryData = BlockFile::CalcSummary(sampleData, sampleLen, format, cleanup);
+
+    if (!deferWrite && !bypassCache) {
+        bool bSuccess = WriteSimpleBlockFile(sampleData, sampleLen, format, summaryData);
         if (!bSuccess)
             throw FileException{
                     FileException::Cause::Write, GetFileName().name};
@@ -98,18 +131,20 @@ SimpleBlockFile::SimpleBlockFile(wxFileNameWrapper &&baseFileName,
 
     if (useCache) {
         //wxLogDebug("SimpleBlockFile::SimpleBlockFile(): Caching block file data.");
-        mCache.active = true;
-        mCache.needWrite = true;
+        mCache.needWrite = deferWrite;
         mCache.format = format;
         const auto sampleDataSize = sampleLen * SAMPLE_SIZE(format);
-        mCache.sampleData.reinit(sampleDataSize);
-        memcpy(mCache.sampleData.get(), sampleData, sampleDataSize);
-        ArrayOf<char> cleanup;
-        void *summaryData = BlockFile::CalcSummary(sampleData, sampleLen,
-                                                   format, cleanup);
-        mCache.summaryData.reinit(mSummaryInfo.totalSummaryBytes);
-        memcpy(mCache.summaryData.get(), summaryData,
-               mSummaryInfo.totalSummaryBytes);
+        std::shared_ptr<char> cached{new char[sampleDataSize], std::default_delete<char[]>()};
+        memcpy(cached.get(), sampleData, sampleDataSize);
+        mCache.sampleData = std::move(cached);
+        if (deferWrite && mHasSummary) {
+            mCache.summaryData.reinit(mSummaryInfo.totalSummaryBytes);
+            memcpy(mCache.summaryData.get(), summaryData,
+                   mSummaryInfo.totalSummaryBytes);
+        }
+
+        std::unique_lock<std::mutex> lock(GetBlockCache().mutex);
+        InsertInCache(lock);
     }
 }
 
@@ -128,9 +163,152 @@ SimpleBlockFile::SimpleBlockFile(wxFileNameWrapper &&existingFile, size_t len,
     mRMS = rms;
 
     mCache.active = false;
+    mCache.writing = false;
 }
 
 SimpleBlockFile::~SimpleBlockFile() {
+    // Deferred data are simply dropped, with the block, once any thread
+    // writing them is done
+    auto &cache = GetBlockCache();
+    std::unique_lock<std::mutex> lock(cache.mutex);
+    cache.written.wait(lock, [this] { return !mCache.writing; });
+    if (mCache.active) {
+        cache.order.erase(mCache.position);
+        cache.statistics.bytes -= CachedBytes();
+    }
+}
+
+auto SimpleBlockFile::GetSpaceUsage() const -> DiskByteCount {
+    if (mFormat != (sampleFormat) 0)
+        return sizeof(auHeader) + SummaryBytes() + mLen * SAMPLE_SIZE(mFormat);
+
+    // An existing file, of a format not yet read
+    struct stat info;
+    if (stat(mFileName.GetFullPath().c_str(), &info) != 0)
+        return 0;
+    return info.st_size;
+}
+
+size_t SimpleBlockFile::CachedBytes() const {
+    return mLen * SAMPLE_SIZE(mCache.format) +
+           (mCache.needWrite ? SummaryBytes() : 0);
+}
+
+void SimpleBlockFile::InsertInCache(std::unique_lock<std::mutex> &lock) const {
+    auto &cache = GetBlockCache();
+    mCache.active = true;
+    mCache.writing = false;
+    cache.order.push_front(this);
+    mCache.position = cache.order.begin();
+    cache.statistics.bytes += CachedBytes();
+    EvictOverBudget(lock, cache.budget);
+}
+
+void SimpleBlockFile::TouchInCache() const {
+    // Put back in the order once written
+    if (mCache.writing)
+        return;
+    auto &order = GetBlockCache().order;
+    order.splice(order.begin(), order, mCache.position);
+}
+
+bool SimpleBlockFile::WriteCacheUnlocked(std::unique_lock<std::mutex> &lock) const {
+    auto &cache = GetBlockCache();
+    // Out of the order, so that no other thread evicts or writes it
+    // meanwhile; reads still find the data.  (Writing changes nothing a
+    // const reader can see.)
+    cache.order.erase(mCache.position);
+    mCache.writing = true;
+    const auto sampleData = mCache.sampleData;
+    lock.unlock();
+    const bool written = const_cast<SimpleBlockFile *>(this)->WriteSimpleBlockFile(
+            (samplePtr) sampleData.get(), mLen, mCache.format, mCache.summaryData.get());
+    lock.lock();
+
+    mCache.writing = false;
+    if (written) {
+        cache.statistics.bytes -= CachedBytes();
+        mCache.needWrite = false;
+        mCache.summaryData.reset();
+        cache.statistics.bytes += CachedBytes();
+    } else
+        std::cerr << "Could not write cached block file " << mFileName.GetFullPath() << std::endl;
+    cache.written.notify_all();
+    return written;
+}
+
+bool SimpleBlockFile::EvictFromCache(std::unique_lock<std::mutex> &lock) const {
+    auto &cache = GetBlockCache();
+    if (mCache.needWrite) {
+        // The file is complete before any read can find the block uncached
+        if (!WriteCacheUnlocked(lock)) {
+            // Back in the order, to be evicted first
+            cache.order.push_back(this);
+            mCache.position = std::prev(cache.order.end());
+            return false;
+        }
+        ++cache.statistics.spills;
+    } else
+        cache.order.erase(mCache.position);
+    cache.statistics.bytes -= CachedBytes();
+    mCache.active = false;
+    mCache.sampleData.reset();
+    ++cache.statistics.evictions;
+    return true;
+}
+
+// static
+void SimpleBlockFile::EvictOverBudget(std::unique_lock<std::mutex> &lock, size_t budget) {
+    auto &cache = GetBlockCache();
+    // Blocks being written by other threads meanwhile are out of the
+    // order, and still count until they are evicted
+    while (cache.statistics.bytes > budget && !cache.order.empty())
+        if (!cache.order.back()->EvictFromCache(lock))
+            // Keep the data, rather than lose them or try forever
+            break;
+}
+
+// static
+void SimpleBlockFile::SetCacheBudget(size_t bytes) {
+    auto &cache = GetBlockCache();
+    std::unique_lock<std::mutex> lock(cache.mutex);
+    cache.budget = bytes;
+    EvictOverBudget(lock, bytes);
+}
+
+// static
+size_t SimpleBlockFile::GetCacheBudget() {
+    return GetBlockCache().budget;
+}
+
+// static
+auto SimpleBlockFile::GetCacheStatistics() -> CacheStatistics {
+    auto &cache = GetBlockCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    return cache.statistics;
+}
+
+// static
+void SimpleBlockFile::ResetCacheStatistics() {
+    auto &cache = GetBlockCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    CacheStatistics statistics;
+    statistics.bytes = cache.statistics.bytes;
+    cache.statistics = statistics;
+}
+
+bool SimpleBlockFile::WriteCacheToDisk() {
+    auto &cache = GetBlockCache();
+    std::unique_lock<std::mutex> lock(cache.mutex);
+    // Unless another thread is writing it, or has
+    cache.written.wait(lock, [this] { return !mCache.writing; });
+    if (!mCache.active || !mCache.needWrite)
+        return true;
+    const bool written = WriteCacheUnlocked(lock);
+    // As most recently used
+    cache.order.push_front(this);
+    mCache.position = cache.order.begin();
+    return written;
 }
 
 bool SimpleBlockFile::WriteSimpleBlockFile(
@@ -138,6 +316,9 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
         size_t sampleLen,
         sampleFormat format,
         void *summaryData) {
+    NOISERED_TIMED(BlockWrite);
+    NOISERED_COUNT(BlocksWritten, 1);
+    NOISERED_COUNT(BytesWritten, SummaryBytes() + sampleLen * SAMPLE_SIZE(format));
     std::ofstream file;
     file.open(mFileName.GetFullPath(), std::ios::out | std::ios::binary);
     if (!file.is_open()) {
@@ -156,7 +337,7 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
 
     // We store the summary data at the end of the header, so the data
     // offset is the length of the summary data plus the length of the header
-    header.dataOffset = sizeof(auHeader) + mSummaryInfo.totalSummaryBytes;
+    header.dataOffset = sizeof(auHeader) + SummaryBytes();
 
     // dataSize is optional, and we opt out
     header.dataSize = 0xffffffff;
@@ -183,7 +364,7 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
 
     // Write the file
     ArrayOf<char> cleanup;
-    if (!summaryData)
+    if (!summaryData && mHasSummary)
         summaryData = /*BlockFile::*/CalcSummary(sampleData, sampleLen, format, cleanup);
     //mchinen:allowing virtual override of calc summary for ODDecodeBlockFile.
     // PRL: cleanup fixes a possible memory leak!
@@ -191,8 +372,9 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
     size_t nBytesToWrite = sizeof(header);
     file.write ((char *)&header, (int32_t)nBytesToWrite);
 
-    nBytesToWrite = mSummaryInfo.totalSummaryBytes;
-    file.write((char *)summaryData, nBytesToWrite);
+    nBytesToWrite = SummaryBytes();
+    if (nBytesToWrite > 0)
+        file.write((char *)summaryData, nBytesToWrite);
 
     if (format == int24Sample) {
         // we can't write the buffer directly to disk, because 24-bit samples
@@ -222,22 +404,7 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
 }
 
 bool SimpleBlockFile::GetCache() {
-#ifdef DEPRECATED_AUDIO_CACHE
-    // See http://bugzilla.audacityteam.org/show_bug.cgi?id=545.
-    bool cacheBlockFiles = false;
-    gPrefs->Read(wxT("/Directories/CacheBlockFiles"), &cacheBlockFiles);
-    if (!cacheBlockFiles)
-       return false;
-
-    int lowMem = gPrefs->Read(wxT("/Directories/CacheLowMem"), 16l);
-    if (lowMem < 16) {
-       lowMem = 16;
-    }
-    lowMem <<= 20;
-    return (GetFreeMemory() > lowMem);
-#else
-    return false;
-#endif
+    return GetBlockCache().budget > 0;
 }
 
 /// Read the data portion of the block file using libsndfile.  Convert it
@@ -250,15 +417,51 @@ bool SimpleBlockFile::GetCache() {
 size_t SimpleBlockFile::ReadData(samplePtr data, sampleFormat format,
                         size_t start, size_t len, bool mayThrow) const
 {
-   if (mCache.active)
+   NOISERED_TIMED(BlockRead);
+   NOISERED_COUNT(BlocksRead, 1);
+   NOISERED_COUNT(BytesRead, len * SAMPLE_SIZE(mFormat != (sampleFormat) 0 ? mFormat : format));
+   auto &cache = GetBlockCache();
+   std::shared_ptr<const char> cached;
+   sampleFormat cachedFormat = floatSample;
+   if (GetCache()) {
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      if (mCache.active) {
+         cached = mCache.sampleData;
+         cachedFormat = mCache.format;
+         TouchInCache();
+         ++cache.statistics.hits;
+      }
+      else
+         ++cache.statistics.misses;
+   }
+
+   if (!cached && GetCache() && mFormat != (sampleFormat) 0) {
+      // Read the whole block, to keep
+      std::shared_ptr<char> whole{new char[mLen * SAMPLE_SIZE(mFormat)], std::default_delete<char[]>()};
+      if (CommonReadData(false, mFileName, mSilentLog, nullptr, 0, 0,
+                         whole.get(), mFormat, 0, mLen) == mLen) {
+         cached = whole;
+         cachedFormat = mFormat;
+         std::unique_lock<std::mutex> lock(cache.mutex);
+         // Unless another thread got there first
+         if (!mCache.active && GetCache()) {
+            mCache.needWrite = false;
+            mCache.format = mFormat;
+            mCache.sampleData = std::move(whole);
+            InsertInCache(lock);
+         }
+      }
+   }
+
+   if (cached)
    {
       //wxLogDebug("SimpleBlockFile::ReadData(): Data are already in cache.");
 
       auto framesRead = std::min(len, std::max(start, mLen) - start);
       CopySamples(
-         (samplePtr)(mCache.sampleData.get() +
-            start * SAMPLE_SIZE(mCache.format)),
-         mCache.format, data, format, framesRead);
+         (samplePtr)(cached.get() +
+            start * SAMPLE_SIZE(cachedFormat)),
+         cachedFormat, data, format, framesRead);
 
       if ( framesRead < len ) {
          if (mayThrow)
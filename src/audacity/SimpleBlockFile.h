@@ -12,14 +12,27 @@
 #define __AUDACITY_SIMPLE_BLOCKFILE__
 
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include "BlockFile.h"
 #include "DirManager.h"
 
+class SimpleBlockFile;
+
 struct SimpleBlockFileCache {
     bool active;
     bool needWrite;
+    // Being written by a thread without the cache lock, and out of the
+    // least recently used order meanwhile
+    bool writing;
     sampleFormat format;
-    ArrayOf<char> sampleData, summaryData;
+    // Shared, so that a read can finish copying while the block is evicted
+    std::shared_ptr<const char> sampleData;
+    // Only while needWrite
+    ArrayOf<char> summaryData;
+    // Place in the least recently used order, while active and not writing
+    std::list<const SimpleBlockFile *>::iterator position;
 
     SimpleBlockFileCache() {}
 };
@@ -42,12 +55,14 @@ typedef struct {
 
 class SimpleBlockFile : public BlockFile {
 public:
-    /// Create a disk file and write summary and sample data to it
+    /// Create a disk file and write summary and sample data to it; or
+    /// without withSummary, just the samples
     SimpleBlockFile(wxFileNameWrapper &&baseFileName,
                     samplePtr sampleData, size_t sampleLen,
                     sampleFormat format,
                     bool allowDeferredWrite = false,
-                    bool bypassCache = false);
+                    bool bypassCache = false,
+                    bool withSummary = true);
 
     /// Create the memory structure to refer to the given block file
     SimpleBlockFile(wxFileNameWrapper &&existingFile, size_t len,
@@ -55,9 +70,39 @@ public:
 
     virtual ~SimpleBlockFile();
 
+    /// Whether the block cache is on
     static bool GetCache();
 
-    SimpleBlockFileCache mCache;
+    /// Bytes of sample (and unwritten summary) data that the cache of all
+    /// simple block files in the process may hold; 0, the default, turns it
+    /// off.  NEW blocks allowing deferred write are then written only when
+    /// evicted, and blocks read from disk are kept; the least recently used
+    /// are evicted beyond the budget.  Lowering it evicts at once.
+    static void SetCacheBudget(size_t bytes);
+
+    static size_t GetCacheBudget();
+
+    struct CacheStatistics {
+        /// Reads served from memory
+        unsigned long hits{0};
+        /// Reads from disk, while the cache was on
+        unsigned long misses{0};
+        unsigned long evictions{0};
+        /// Deferred writes done on eviction
+        unsigned long spills{0};
+        /// Now held
+        size_t bytes{0};
+    };
+
+    static CacheStatistics GetCacheStatistics();
+
+    /// Zero the counters, but not bytes
+    static void ResetCacheStatistics();
+
+    /// Write a deferred block now; it stays cached.  False if writing failed.
+    bool WriteCacheToDisk() override;
+
+    mutable SimpleBlockFileCache mCache;
 
     bool WriteSimpleBlockFile(samplePtr sampleData, size_t sampleLen,
                               sampleFormat format, void *summaryData);
@@ -78,16 +123,41 @@ public:
        return nullptr;
    }
 
-   DiskByteCount GetSpaceUsage() const override {
-       std::cerr << "SimpleBlockFile::GetSpaceUsage unimplemented." << std::endl;
-       return 0;
-   }
+   /// Of the file as written, whether or not it is written yet
+   DiskByteCount GetSpaceUsage() const override;
    void Recover() override {
        std::cerr << "SimpleBlockFile::Recover unimplemented." << std::endl;
     }
 
 private:
+    // With the cache lock held; those taking it release it while they
+    // write files, so that reads and NEW blocks on other threads go on:
+
+    // Enter mCache as it is filled, taking the place of the most recently
+    // used, and evict others beyond the budget
+    void InsertInCache(std::unique_lock<std::mutex> &lock) const;
+
+    // Move to the most recently used place
+    void TouchInCache() const;
+
+    // Write the deferred data of a block in the order, taking it out of the
+    // order; false if writing failed.  The caller puts it back.
+    bool WriteCacheUnlocked(std::unique_lock<std::mutex> &lock) const;
+
+    // Drop mCache, first writing it if needed; false, keeping it, when
+    // writing fails
+    bool EvictFromCache(std::unique_lock<std::mutex> &lock) const;
+
+    static void EvictOverBudget(std::unique_lock<std::mutex> &lock, size_t budget);
+
+    size_t CachedBytes() const;
+
+    // Of the file, between the header and the samples
+    size_t SummaryBytes() const { return mHasSummary ? mSummaryInfo.totalSummaryBytes : 0; }
+
     mutable sampleFormat mFormat; // may be found lazily
+    // Without a summary, mMin, mMax and mRMS are 0 too
+    bool mHasSummary{true};
 };
 
 
@@ -0,0 +1,119 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  SoundFileWriter.cpp
+
+*******************************************************************//**
+
+\class SoundFileWriter
+\brief A bounded queue of output blocks drained by a writer thread.
+
+The producer copies each block into a buffer taken from a pool (so that
+no more than queueDepth + 1 are ever allocated) and goes back to
+computing; the writer thread hands the blocks to libsndfile in order.
+libsndfile is only ever called for this handle from the writer thread,
+until Finish() has joined it.
+
+*//*******************************************************************/
+
+#include "SoundFileWriter.h"
+
+#include <cstring>
+#include "FileFormats.h"
+#include "Instrumentation.h"
+
+SoundFileWriter::SoundFileWriter(SNDFILE *sf, sampleFormat format, unsigned channels,
+                                 size_t queueDepth)
+        : mFile{sf}, mFormat{format}, mChannels{channels},
+          mQueueDepth{queueDepth} {
+    if (mQueueDepth > 0)
+        mThread = std::thread{[this] { Run(); }};
+}
+
+SoundFileWriter::~SoundFileWriter() {
+    Finish();
+}
+
+bool SoundFileWriter::WriteBlock(constSamplePtr frames, size_t numFrames) {
+    NOISERED_TIMED(ExportWrite);
+    sf_count_t written;
+    if (mFormat == int16Sample)
+        written = SFCall<sf_count_t>(sf_writef_short, mFile, (const short *) frames, numFrames);
+    else
+        written = SFCall<sf_count_t>(sf_writef_float, mFile, (const float *) frames, numFrames);
+    if (static_cast<size_t>(written) == numFrames)
+        return true;
+
+    char message[1000];
+    sf_error_str(mFile, message, 1000);
+    mError = message;
+    return false;
+}
+
+bool SoundFileWriter::Write(constSamplePtr frames, size_t numFrames) {
+    if (mQueueDepth == 0) {
+        if (!mFailed && !WriteBlock(frames, numFrames))
+            mFailed = true;
+        return !mFailed;
+    }
+
+    std::unique_ptr<Block> block;
+    {
+        std::unique_lock<std::mutex> lock{mMutex};
+        mCondition.wait(lock, [this] { return mFailed || mPending.size() < mQueueDepth; });
+        if (mFailed)
+            return false;
+        if (!mFree.empty()) {
+            block = std::move(mFree.back());
+            mFree.pop_back();
+        }
+    }
+
+    if (!block)
+        block = std::make_unique<Block>();
+    block->buffer.Resize(numFrames * mChannels, mFormat);
+    memcpy(block->buffer.ptr(), frames, numFrames * mChannels * SAMPLE_SIZE(mFormat));
+    block->frames = numFrames;
+
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        mPending.push_back(std::move(block));
+    }
+    mCondition.notify_all();
+    return true;
+}
+
+bool SoundFileWriter::Finish() {
+    if (mThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            mFinishing = true;
+        }
+        mCondition.notify_all();
+        mThread.join();
+    }
+    return !mFailed;
+}
+
+void SoundFileWriter::Run() {
+    std::unique_lock<std::mutex> lock{mMutex};
+    while (true) {
+        mCondition.wait(lock, [this] { return mFinishing || !mPending.empty(); });
+        if (mPending.empty())
+            // Finishing, with everything written
+            return;
+
+        auto block = std::move(mPending.front());
+        mPending.pop_front();
+        if (!mFailed) {
+            lock.unlock();
+            const bool written = WriteBlock(block->buffer.ptr(), block->frames);
+            lock.lock();
+            if (!written)
+                mFailed = true;
+        }
+        mFree.push_back(std::move(block));
+        mCondition.notify_all();
+    }
+}
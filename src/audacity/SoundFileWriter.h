@@ -0,0 +1,84 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  SoundFileWriter.h
+
+  Writing of interleaved blocks to a libsndfile handle, from a thread of
+  its own, so that mixing or noise reduction of the next blocks goes on
+  while slow (network) storage takes the earlier ones.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_SOUND_FILE_WRITER__
+#define __AUDACITY_SOUND_FILE_WRITER__
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sndfile.h"
+#include "SampleFormat.h"
+
+class SoundFileWriter {
+public:
+    /// Blocks waiting by default:  one being written, one being filled
+    static const size_t DefaultQueueDepth = 2;
+
+    /// Writes to sf, which must outlive this, frames of channels samples in
+    /// format (int16Sample with sf_writef_short, floatSample with
+    /// sf_writef_float).  With queueDepth 0, Write() writes before it
+    /// returns; otherwise a writer thread takes copies of up to
+    /// queueDepth blocks.
+    SoundFileWriter(SNDFILE *sf, sampleFormat format, unsigned channels,
+                    size_t queueDepth = DefaultQueueDepth);
+
+    SoundFileWriter(const SoundFileWriter &) = delete;
+
+    SoundFileWriter &operator=(const SoundFileWriter &) = delete;
+
+    /// Finish()es
+    ~SoundFileWriter();
+
+    /// Queues (or writes) numFrames frames, waiting while the queue is
+    /// full.  False if this or an earlier write failed; later blocks are
+    /// then dropped.
+    bool Write(constSamplePtr frames, size_t numFrames);
+
+    /// Waits until all queued blocks are written.  False if any failed.
+    bool Finish();
+
+    /// What libsndfile said about the failed write
+    const std::string &GetError() const { return mError; }
+
+private:
+    struct Block {
+        GrowableSampleBuffer buffer;
+        size_t frames{};
+    };
+
+    bool WriteBlock(constSamplePtr frames, size_t numFrames);
+
+    void Run();
+
+    SNDFILE *const mFile;
+    const sampleFormat mFormat;
+    const unsigned mChannels;
+    const size_t mQueueDepth;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    // Blocks to write, in order, and written ones for reuse
+    std::deque<std::unique_ptr<Block>> mPending;
+    std::vector<std::unique_ptr<Block>> mFree;
+    bool mFinishing{false};
+    bool mFailed{false};
+    std::string mError;
+    std::thread mThread;
+};
+
+#endif
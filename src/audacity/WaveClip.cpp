@@ -184,6 +184,18 @@ void WaveClip::SetOffset(double offset)
     mOffset = offset;
 }
 
+void WaveClip::AppendBlockFile(const BlockFilePtr &blockFile)
+// STRONG-GUARANTEE
+{
+    if (mAppendBufferLen > 0)
+        THROW_INCONSISTENCY_EXCEPTION;
+    mSequence->AppendBlockFile(blockFile);
+
+    // use NOFAIL-GUARANTEE
+    UpdateEnvelopeTrackLen();
+    MarkChanged();
+}
+
 void WaveClip::Append(samplePtr buffer, sampleFormat format,
                       size_t len, unsigned int stride /* = 1 */)
 // PARTIAL-GUARANTEE in case of exceptions:
@@ -205,6 +217,24 @@ void WaveClip::Append(samplePtr buffer, sampleFormat format,
         MarkChanged();
     });
 
+    if (mAppendBufferLen == 0 && format == seqFormat && stride == 1) {
+        // Flush straight from the buffer, as the loop below would from the
+        // append buffer, and once the last block is full, all the whole
+        // blocks at once, with one consistency check
+        while (len >= blockSize && blockSize < maxBlockSize) {
+            mSequence->Append(buffer, seqFormat, blockSize);
+            buffer += blockSize * SAMPLE_SIZE(format);
+            len -= blockSize;
+            blockSize = mSequence->GetIdealAppendLen();
+        }
+        const auto bulkLen = len - len % maxBlockSize;
+        if (bulkLen > 0) {
+            mSequence->Append(buffer, seqFormat, bulkLen);
+            buffer += bulkLen * SAMPLE_SIZE(format);
+            len -= bulkLen;
+        }
+    }
+
     for (;;) {
         if (mAppendBufferLen >= blockSize) {
             // flush some previously appended contents
@@ -377,6 +407,23 @@ bool WaveClip::WithinClip(double t) const
    return ts > GetStartSample() && ts < GetEndSample() + mAppendBufferLen;
 }
 
+bool WaveClip::ReplaceSamples(sampleCount start, sampleCount len, WaveClip &other)
+// STRONG-GUARANTEE
+{
+    if (mAppendBufferLen > 0 || other.mAppendBufferLen > 0 || other.mRate != mRate ||
+        other.mSequence->GetSampleFormat() != mSequence->GetSampleFormat() ||
+        other.mSequence->GetDirManager() != mSequence->GetDirManager())
+        return false;
+
+    mSequence->Replace(start, len, *other.mSequence);
+
+    // use NOFAIL-GUARANTEE
+    MarkChanged();
+    other.UpdateEnvelopeTrackLen();
+    other.MarkChanged();
+    return true;
+}
+
 void WaveClip::Paste(double t0, const WaveClip* other)
 // STRONG-GUARANTEE
 {
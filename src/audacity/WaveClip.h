@@ -114,6 +114,9 @@ public:
     void Append(samplePtr buffer, sampleFormat format,
                 size_t len, unsigned int stride = 1);
 
+    /// After the samples flushed, as Sequence::AppendBlockFile()
+    void AppendBlockFile(const BlockFilePtr &blockFile);
+
     /** Whenever you do an operation to the sequence that will change the number
      * of samples (that is, the length of the clip), you will want to call this
      * function to tell the envelope about it. */
@@ -142,6 +145,12 @@ public:
     /// Paste data from other clip, resampling it if not equal rate
     void Paste(double t0, const WaveClip *other);
 
+    /// Replace samples [start, start + len) of this clip, which keeps its
+    /// envelope and cut lines, with the first len samples of other, taking
+    /// its block files.  False, changing nothing, if either clip is not
+    /// flushed, or other is not of the same rate, format and DirManager.
+    bool ReplaceSamples(sampleCount start, sampleCount len, WaveClip &other);
+
     // Resample clip. This also will set the rate, but without changing
     // the length of the clip
     void Resample(int rate);
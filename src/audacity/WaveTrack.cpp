@@ -24,6 +24,13 @@ can accommodate merged regions.
 of the functions of this class are dispersed through the different
 Track classes.
 
+*//****************************************************************//**
+
+\class WaveTrackReadAhead
+\brief Reads the chunks of a range of a WaveTrack on a thread, ahead of
+the caller.  The chunks are those a loop over GetBestBlockSize() would
+get, so that the caller sees the same samples in the same pieces.
+
 *//*******************************************************************/
 
 #include <float.h>
@@ -45,6 +52,11 @@ WaveTrack::Holder TrackFactory::NewWaveTrack(sampleFormat format, double rate) {
             {safenew WaveTrack(mDirManager, format, rate)};
 }
 
+// Of the DirManager of orig, sharing its block files
+std::unique_ptr<WaveTrack> TrackFactory::DuplicateWaveTrack(const WaveTrack &orig) {
+    return std::make_unique<WaveTrack>(orig);
+}
+
 WaveTrack::WaveTrack(const std::shared_ptr<DirManager> &projDirManager, sampleFormat format, double rate) :
         mDirManager(projDirManager) {
     mFormat = format;
@@ -54,7 +66,8 @@ WaveTrack::WaveTrack(const std::shared_ptr<DirManager> &projDirManager, sampleFo
     mChannel = MonoChannel;
 }
 
-WaveTrack::WaveTrack(const WaveTrack &orig) {
+WaveTrack::WaveTrack(const WaveTrack &orig) :
+        mDirManager(orig.mDirManager) {
     Init(orig);
 
     for (const auto &clip : orig.mClips)
@@ -302,6 +315,12 @@ void WaveTrack::Append(samplePtr buffer, sampleFormat format,
     RightmostOrNewClip()->Append(buffer, format, len, stride);
 }
 
+void WaveTrack::AppendBlockFile(const BlockFilePtr &blockFile)
+// STRONG-GUARANTEE
+{
+    RightmostOrNewClip()->AppendBlockFile(blockFile);
+}
+
 namespace {
 WaveClipHolders::const_iterator
 FindClip(const WaveClipHolders &list, const WaveClip *clip, int *distance = nullptr) {
@@ -704,6 +723,13 @@ void WaveTrack::GetEnvelopeValues(double *buffer, size_t bufferLen,
     }
 }
 
+bool WaveTrack::HasUnitEnvelope() const {
+    return std::all_of(mClips.begin(), mClips.end(), [](const WaveClipHolder &clip) {
+        const auto envelope = clip->GetEnvelope();
+        return envelope->GetNumberOfPoints() == 0 && envelope->GetDefaultValue() == 1.0;
+    });
+}
+
 float WaveTrack::GetChannelGain(int channel) const {
     float left = 1.0;
     float right = 1.0;
@@ -1152,3 +1178,102 @@ void WaveTrack::ClearAndPaste(double t0, // Start of time to clear
         }
     }
 }
+
+bool WaveTrack::ReplaceSamples(sampleCount start, sampleCount len, WaveTrack &src)
+// STRONG-GUARANTEE
+{
+    if (src.mClips.size() != 1)
+        return false;
+    WaveClip &srcClip = *src.mClips[0];
+    if (srcClip.GetStartSample() != 0 || srcClip.NumCutLines() > 0 || srcClip.GetNumSamples() < len)
+        return false;
+
+    for (const auto &clip : mClips)
+        if (clip->GetStartSample() <= start && start + len <= clip->GetEndSample())
+            return clip->ReplaceSamples(start - clip->GetStartSample(), len, srcClip);
+    return false;
+}
+
+WaveTrackReadAhead::WaveTrackReadAhead(const WaveTrack &track, sampleCount start, sampleCount len,
+                                       size_t depth)
+        : mTrack{track}, mEnd{start + len}, mDepth{std::max<size_t>(depth, 1)} {
+    mThread = std::thread{[this, start] { Run(start); }};
+}
+
+WaveTrackReadAhead::~WaveTrackReadAhead() {
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        mStopping = true;
+    }
+    mCondition.notify_all();
+    mThread.join();
+}
+
+const float *WaveTrackReadAhead::Next(size_t &len) {
+    std::unique_lock<std::mutex> lock{mMutex};
+    if (mCurrent)
+        mFree.push_back(std::move(mCurrent));
+    mCondition.wait(lock, [this] { return mDone || !mReady.empty(); });
+    if (mReady.empty()) {
+        len = 0;
+        if (mError) {
+            auto error = mError;
+            mError = nullptr;
+            std::rethrow_exception(error);
+        }
+        return nullptr;
+    }
+
+    mCurrent = std::move(mReady.front());
+    mReady.pop_front();
+    lock.unlock();
+    mCondition.notify_all();
+
+    len = mCurrent->len;
+    return mCurrent->data.get();
+}
+
+void WaveTrackReadAhead::Run(sampleCount start) {
+    const auto bufferSize = mTrack.GetMaxBlockSize();
+    auto pos = start;
+    while (pos < mEnd) {
+        std::unique_ptr<Chunk> chunk;
+        {
+            std::unique_lock<std::mutex> lock{mMutex};
+            mCondition.wait(lock, [this] { return mStopping || mReady.size() < mDepth; });
+            if (mStopping)
+                return;
+            if (!mFree.empty()) {
+                chunk = std::move(mFree.back());
+                mFree.pop_back();
+            }
+        }
+        if (!chunk) {
+            chunk = std::make_unique<Chunk>();
+            chunk->data = Floats{bufferSize};
+        }
+
+        const auto blockSize = limitSampleBufferSize(mTrack.GetBestBlockSize(pos), mEnd - pos);
+        try {
+            mTrack.Get((samplePtr) chunk->data.get(), floatSample, pos, blockSize);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock{mMutex};
+            mError = std::current_exception();
+            break;
+        }
+        chunk->len = blockSize;
+        pos += blockSize;
+
+        {
+            std::lock_guard<std::mutex> lock{mMutex};
+            mReady.push_back(std::move(chunk));
+        }
+        mCondition.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{mMutex};
+        mDone = true;
+    }
+    mCondition.notify_all();
+}
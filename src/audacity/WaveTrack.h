@@ -12,6 +12,12 @@
 #define __AUDACITY_WAVETRACK__
 
 #include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "Types.h"
 #include "WaveClip.h"
@@ -169,6 +175,9 @@ public:
     void Append(samplePtr buffer, sampleFormat format,
                 size_t len, unsigned int stride = 1);
 
+    /// To the rightmost clip, which must be flushed
+    void AppendBlockFile(const BlockFilePtr &blockFile);
+
     // May assume precondition: t0 <= t1
     void HandleClear(double t0, double t1, bool addCutLines, bool split);
 
@@ -203,6 +212,10 @@ public:
     void GetEnvelopeValues(double *buffer, size_t bufferLen,
                            double t0) const;
 
+    // True when GetEnvelopeValues() can only give 1.0:  no clip's envelope
+    // has points, or another default
+    bool HasUnitEnvelope() const;
+
     // Takes gain and pan into account
     float GetChannelGain(int channel) const;
 
@@ -213,6 +226,13 @@ public:
                        bool merge = true,
                        const TimeWarper *effectWarper = nullptr) /* not override */;
 
+    // ClearAndPaste of the first len samples of src, for a range
+    // [start, start + len) within one clip and a src of one clip starting
+    // at time 0, but only the blocks at the ends of the range are written.
+    // src loses its samples.  False, changing nothing, for other ranges or
+    // tracks.
+    bool ReplaceSamples(sampleCount start, sampleCount len, WaveTrack &src);
+
     // Add all wave clips to the given array 'clips' and sort the array by
     // clip start time. The array is emptied prior to adding the clips.
     WaveClipPointers SortedClipArray();
@@ -308,4 +328,49 @@ private:
     int mNValidBuffers;
 };
 
+// Sequential reading of samples [start, start + len) of a track, as floats,
+// in the chunks of GetBestBlockSize() in which WaveTrack::Get() reads whole
+// block files.  A thread of its own reads up to depth chunks ahead, while
+// the caller works on the current one.  Like a WaveTrackCache, meant for a
+// track whose contents do not change meanwhile.
+class WaveTrackReadAhead {
+public:
+    WaveTrackReadAhead(const WaveTrack &track, sampleCount start, sampleCount len,
+                       size_t depth);
+
+    WaveTrackReadAhead(const WaveTrackReadAhead &) = delete;
+
+    WaveTrackReadAhead &operator=(const WaveTrackReadAhead &) = delete;
+
+    // Stops reading ahead
+    ~WaveTrackReadAhead();
+
+    // The next chunk and its length, or null after the last.  The pointer
+    // is valid until the next call.  Throws what WaveTrack::Get() threw.
+    const float *Next(size_t &len);
+
+private:
+    struct Chunk {
+        Floats data;
+        size_t len{};
+    };
+
+    void Run(sampleCount start);
+
+    const WaveTrack &mTrack;
+    const sampleCount mEnd;
+    const size_t mDepth;
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    // Chunks read, in order, and those the caller is done with, for reuse
+    std::deque<std::unique_ptr<Chunk>> mReady;
+    std::vector<std::unique_ptr<Chunk>> mFree;
+    std::unique_ptr<Chunk> mCurrent;
+    bool mStopping{false};
+    bool mDone{false};
+    std::exception_ptr mError;
+    std::thread mThread;
+};
+
 #endif // __AUDACITY_WAVETRACK__
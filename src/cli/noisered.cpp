@@ -0,0 +1,413 @@
+/**********************************************************************
+
+  Noise reduction of a stream from stdin to stdout, for pipelines such as
+
+    ffmpeg -i in.mp3 -f wav - | noisered --noise 0.5 | lame - out.mp3
+
+  WAV (or any other format libsndfile reads from a pipe) or raw samples
+  are read a chunk at a time and pushed through an
+  EffectNoiseReduction::Stream per channel, and what they finish is
+  written at once, so memory stays constant and nothing touches the file
+  system but a saved profile.  Output is WAV, its sizes left at the most
+  when stdout cannot seek, as ffmpeg writes them, or raw samples.
+
+  noisered [--profile file | --noise seconds]
+           [--noise-gain db] [--sensitivity n] [--smoothing bands]
+           [--band low,high] [--low-latency ms]
+           [--input wav|s16le|f32le] [--rate hz] [--channels n]
+           [--output wav|s16le|f32le] [--float]
+
+  --profile    a profile written by EffectNoiseReduction::SaveProfile()
+               (or pyaudacity.save_profile), at the rate of the input
+  --noise      seconds at the start of the input to profile, held back
+               until profiled; 0.5 by default, without --profile
+  --input      raw input is little endian, of --channels channels (1 by
+               default) at --rate Hz, which it needs
+  --output     as the input by default, and WAV for other formats read;
+               --float makes WAV output 32 bit float rather than 16 bit
+
+**********************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "sndfile.h"
+#include "FileFormats.h"
+#include "NoiseReduction.h"
+#include "SampleFormat.h"
+
+namespace {
+
+// Frames read from stdin in one go
+const size_t chunkFrames = 16384;
+
+enum class Format {
+    WAV, S16LE, F32LE
+};
+
+bool ParseFormat(const std::string &text, Format &format) {
+    if (text == "wav")
+        format = Format::WAV;
+    else if (text == "s16le")
+        format = Format::S16LE;
+    else if (text == "f32le")
+        format = Format::F32LE;
+    else
+        return false;
+    return true;
+}
+
+bool Usage(const char *program) {
+    std::cerr << "usage: " << program
+              << " [--profile file | --noise seconds] [--noise-gain db] [--sensitivity n]"
+                 " [--smoothing bands] [--band low,high] [--low-latency ms]"
+                 " [--input wav|s16le|f32le] [--rate hz] [--channels n]"
+                 " [--output wav|s16le|f32le] [--float]" << std::endl;
+    return false;
+}
+
+struct Options {
+    std::string profile;
+    double noise{0.5};
+    double noiseGain{12.0};
+    double sensitivity{6.0};
+    double smoothing{3.0};
+    double f0{-1.0};
+    double f1{-1.0};
+    double lowLatency{0.0};
+    Format input{Format::WAV};
+    double rate{0.0};
+    unsigned channels{1};
+    bool hasOutput{false};
+    Format output{Format::WAV};
+    bool floatOutput{false};
+};
+
+bool ParseOptions(int argc, char **argv, Options &options) {
+    for (int ii = 1; ii < argc; ++ii) {
+        const std::string arg = argv[ii];
+        const bool hasValue = ii + 1 < argc;
+        if (arg == "--profile" && hasValue)
+            options.profile = argv[++ii];
+        else if (arg == "--noise" && hasValue)
+            options.noise = atof(argv[++ii]);
+        else if (arg == "--noise-gain" && hasValue)
+            options.noiseGain = atof(argv[++ii]);
+        else if (arg == "--sensitivity" && hasValue)
+            options.sensitivity = atof(argv[++ii]);
+        else if (arg == "--smoothing" && hasValue)
+            options.smoothing = atof(argv[++ii]);
+        else if (arg == "--band" && hasValue) {
+            if (sscanf(argv[++ii], "%lf,%lf", &options.f0, &options.f1) != 2)
+                return Usage(argv[0]);
+        } else if (arg == "--low-latency" && hasValue)
+            options.lowLatency = atof(argv[++ii]);
+        else if (arg == "--input" && hasValue) {
+            if (!ParseFormat(argv[++ii], options.input))
+                return Usage(argv[0]);
+        } else if (arg == "--rate" && hasValue)
+            options.rate = atof(argv[++ii]);
+        else if (arg == "--channels" && hasValue)
+            options.channels = (unsigned) atoi(argv[++ii]);
+        else if (arg == "--output" && hasValue) {
+            if (!ParseFormat(argv[++ii], options.output))
+                return Usage(argv[0]);
+            options.hasOutput = true;
+        } else if (arg == "--float")
+            options.floatOutput = true;
+        else
+            return Usage(argv[0]);
+    }
+    if (options.input != Format::WAV && !(options.rate > 0)) {
+        std::cerr << "Raw input needs --rate." << std::endl;
+        return false;
+    }
+    if (options.channels < 1 || (options.profile.empty() && !(options.noise > 0))) {
+        std::cerr << "There must be a channel, and a profile or some noise to profile." << std::endl;
+        return false;
+    }
+    if (!options.hasOutput)
+        options.output = options.input;
+    return true;
+}
+
+// Interleaved float frames from stdin, through libsndfile or raw
+class Reader {
+public:
+    bool Open(const Options &options) {
+        if (options.input != Format::WAV) {
+            mFormat = options.input;
+            mRate = options.rate;
+            mChannels = options.channels;
+            return true;
+        }
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        mFile.reset(SFCall<SNDFILE *>(sf_open_fd, STDIN_FILENO, SFM_READ, &info, false));
+        if (!mFile || info.channels < 1) {
+            std::cerr << "Cannot read audio from stdin" << std::endl;
+            return false;
+        }
+        mFormat = Format::WAV;
+        mRate = info.samplerate;
+        mChannels = info.channels;
+        return true;
+    }
+
+    double GetRate() const { return mRate; }
+
+    unsigned GetChannels() const { return mChannels; }
+
+    // Frames read into frames, at most len; 0 at the end
+    size_t Read(float *frames, size_t len) {
+        if (mFormat == Format::WAV) {
+            const auto count = SFCall<sf_count_t>(sf_readf_float, mFile.get(), frames, len);
+            return count > 0 ? count : 0;
+        }
+        const size_t bytesPerSample = mFormat == Format::S16LE ? 2 : 4;
+        mRaw.resize(len * mChannels * bytesPerSample);
+        // Whole frames, keeping any part of one for the next read
+        size_t got = mPartial;
+        while (got < mRaw.size()) {
+            const auto count = fread(&mRaw[got], 1, mRaw.size() - got, stdin);
+            if (count == 0)
+                break;
+            got += count;
+        }
+        const size_t frameBytes = mChannels * bytesPerSample;
+        const size_t count = got / frameBytes;
+        const size_t samples = count * mChannels;
+        if (mFormat == Format::S16LE) {
+            // Scaled as libsndfile reads them
+            for (size_t ii = 0; ii < samples; ++ii) {
+                int16_t value;
+                memcpy(&value, &mRaw[2 * ii], 2);
+                frames[ii] = value / 32768.0f;
+            }
+        } else
+            memcpy(frames, mRaw.data(), samples * 4);
+        mPartial = got - count * frameBytes;
+        memmove(mRaw.data(), &mRaw[count * frameBytes], mPartial);
+        return count;
+    }
+
+private:
+    Format mFormat{Format::WAV};
+    double mRate{0};
+    unsigned mChannels{0};
+    SFFile mFile;
+    std::vector<char> mRaw;
+    size_t mPartial{0};
+};
+
+void PutLE(std::vector<unsigned char> &bytes, uint32_t value, unsigned size) {
+    for (unsigned ii = 0; ii < size; ++ii)
+        bytes.push_back((value >> (8 * ii)) & 0xff);
+}
+
+// Interleaved float frames to stdout, converted as ExportPCM would
+class Writer {
+public:
+    Writer(Format format, bool floatWAV, double rate, unsigned channels)
+            : mFormat{format}, mSampleFormat{format == Format::F32LE || (format == Format::WAV && floatWAV)
+                                             ? floatSample : int16Sample},
+              mRate{rate}, mChannels{channels}, mConverted(chunkFrames * channels, mSampleFormat) {}
+
+    bool Start() {
+        if (mFormat != Format::WAV)
+            return true;
+        MakeHeader(0xffffffffu);
+        return fwrite(mHeader.data(), 1, mHeader.size(), stdout) == mHeader.size();
+    }
+
+    bool Write(float *frames, size_t len) {
+        const size_t samples = len * mChannels;
+        if (mSampleFormat == int16Sample) {
+            // Each channel as the Mixer does
+            for (unsigned cc = 0; cc < mChannels; ++cc)
+                CopySamples((samplePtr) (frames + cc), floatSample,
+                            mConverted.ptr() + cc * SAMPLE_SIZE(int16Sample), int16Sample,
+                            len, true, mChannels, mChannels);
+        } else
+            memcpy(mConverted.ptr(), frames, samples * sizeof(float));
+        const size_t bytes = samples * SAMPLE_SIZE(mSampleFormat);
+        mDataBytes += bytes;
+        return fwrite(mConverted.ptr(), 1, bytes, stdout) == bytes;
+    }
+
+    // Flush, and give the WAV header its sizes where stdout can seek
+    bool Finish() {
+        if (fflush(stdout) != 0)
+            return false;
+        if (mFormat == Format::WAV && mDataBytes <= 0xffffffffu - mHeader.size() &&
+            fseek(stdout, 0, SEEK_SET) == 0) {
+            MakeHeader((uint32_t) mDataBytes);
+            if (fwrite(mHeader.data(), 1, mHeader.size(), stdout) != mHeader.size() || fflush(stdout) != 0)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    // RIFF WAVE of PCM or IEEE float samples; dataBytes of 0xffffffff for
+    // sizes unknown
+    void MakeHeader(uint32_t dataBytes) {
+        const unsigned bytesPerSample = SAMPLE_SIZE(mSampleFormat);
+        const uint32_t riffBytes = dataBytes == 0xffffffffu ? dataBytes : 36 + dataBytes;
+        mHeader.clear();
+        mHeader.insert(mHeader.end(), {'R', 'I', 'F', 'F'});
+        PutLE(mHeader, riffBytes, 4);
+        mHeader.insert(mHeader.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+        PutLE(mHeader, 16, 4);
+        // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+        PutLE(mHeader, mSampleFormat == floatSample ? 3 : 1, 2);
+        PutLE(mHeader, mChannels, 2);
+        PutLE(mHeader, (uint32_t) mRate, 4);
+        PutLE(mHeader, (uint32_t) mRate * mChannels * bytesPerSample, 4);
+        PutLE(mHeader, mChannels * bytesPerSample, 2);
+        PutLE(mHeader, 8 * bytesPerSample, 2);
+        mHeader.insert(mHeader.end(), {'d', 'a', 't', 'a'});
+        PutLE(mHeader, dataBytes, 4);
+    }
+
+    const Format mFormat;
+    const sampleFormat mSampleFormat;
+    const double mRate;
+    const unsigned mChannels;
+    SampleBuffer mConverted;
+    std::vector<unsigned char> mHeader;
+    unsigned long long mDataBytes{0};
+};
+
+bool Run(const Options &options) {
+    Reader reader;
+    if (!reader.Open(options))
+        return false;
+    const double rate = reader.GetRate();
+    const unsigned nChannels = reader.GetChannels();
+
+    EffectNoiseReduction effect;
+    if (!effect.SetFrequencyRange(options.f0, options.f1)) {
+        std::cerr << "The band must be from low to high." << std::endl;
+        return false;
+    }
+    effect.SetLowLatency(options.lowLatency);
+
+    std::vector<float> interleaved(chunkFrames * nChannels);
+    // Frames read before there is a profile, when taking it from the input
+    std::vector<float> held;
+    bool atEnd = false;
+    if (!options.profile.empty()) {
+        if (!effect.LoadProfile(options.profile))
+            return false;
+    } else {
+        const auto noiseFrames = (size_t) std::max(1.0, options.noise * rate);
+        while (held.size() < noiseFrames * nChannels) {
+            const auto count = reader.Read(interleaved.data(), chunkFrames);
+            if (count == 0) {
+                atEnd = true;
+                break;
+            }
+            held.insert(held.end(), interleaved.begin(), interleaved.begin() + count * nChannels);
+        }
+        // Of the first channel, as GetProfile() of a track
+        std::vector<float> noise;
+        for (size_t ii = 0; ii < std::min(noiseFrames * nChannels, held.size()); ii += nChannels)
+            noise.push_back(held[ii]);
+        if (!effect.GetProfile(noise.data(), noise.size(), rate)) {
+            std::cerr << "Cannot profile the start of the input." << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<std::unique_ptr<EffectNoiseReduction::Stream>> streams;
+    for (unsigned cc = 0; cc < nChannels; ++cc) {
+        auto stream = effect.CreateStream(options.noiseGain, options.sensitivity, options.smoothing);
+        if (!stream)
+            return false;
+        if (stream->GetRate() != rate) {
+            std::cerr << "The sample rate of the noise profile must match that of the sound to be processed."
+                      << std::endl;
+            return false;
+        }
+        streams.push_back(std::move(stream));
+    }
+
+    Writer writer{options.output, options.floatOutput, rate, nChannels};
+    if (!writer.Start()) {
+        std::cerr << "Cannot write to stdout" << std::endl;
+        return false;
+    }
+
+    std::vector<float> channel(chunkFrames);
+    std::vector<float> finished(chunkFrames * nChannels);
+    const auto push = [&](const float *frames, size_t len) {
+        for (unsigned cc = 0; cc < nChannels; ++cc) {
+            for (size_t ii = 0; ii < len; ++ii)
+                channel[ii] = frames[ii * nChannels + cc];
+            streams[cc]->Push(channel.data(), len);
+        }
+    };
+    // Write all that every stream has finished
+    const auto writeAvailable = [&]() -> bool {
+        while (true) {
+            size_t len = chunkFrames;
+            for (const auto &stream : streams)
+                len = std::min(len, stream->Available());
+            if (len == 0)
+                return true;
+            for (unsigned cc = 0; cc < nChannels; ++cc) {
+                streams[cc]->Pull(channel.data(), len);
+                for (size_t ii = 0; ii < len; ++ii)
+                    finished[ii * nChannels + cc] = channel[ii];
+            }
+            if (!writer.Write(finished.data(), len)) {
+                std::cerr << "Cannot write to stdout" << std::endl;
+                return false;
+            }
+        }
+    };
+
+    for (size_t start = 0; start < held.size(); start += chunkFrames * nChannels) {
+        push(&held[start], std::min(chunkFrames * nChannels, held.size() - start) / nChannels);
+        if (!writeAvailable())
+            return false;
+    }
+    held = std::vector<float>();
+
+    while (!atEnd) {
+        const auto count = reader.Read(interleaved.data(), chunkFrames);
+        if (count == 0)
+            break;
+        push(interleaved.data(), count);
+        if (!writeAvailable())
+            return false;
+    }
+
+    for (const auto &stream : streams)
+        stream->Flush();
+    if (!writeAvailable())
+        return false;
+    if (!writer.Finish()) {
+        std::cerr << "Cannot write to stdout" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+        return EXIT_FAILURE;
+    return Run(options) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,9 +1,244 @@
-import os, sys
+import asyncio, atexit, functools, os, sys
 sys.path.append(os.path.dirname(__file__))
 
 import cmodule
 
+# the jobs of the coroutines stop before the interpreter does
+atexit.register(cmodule.shutdown_pool)
+
+# the names of the presets of the advanced settings, from fastest to best
+PRESETS = ("fast", "default", "quality")
+
+
+# the totals of the process of the stage timers and counters, while enabled,
+# and the live and peak bytes of memory and block files, always kept:
+# {"stages": {"import": {"calls": n, "seconds": s}, "fft": ..., ...},
+#  "counters": {"windows": n, "bytes_written": n, ...},
+#  "gauges": {"block_file_bytes": {"live": n, "peak": n}, ...}}
+def stats():
+    return cmodule.stats()
+
+
+# make the peaks of the gauges what is live now, to find the peak of what follows
+def reset_peaks():
+    cmodule.reset_peaks()
+
+
+# record a timeline of every thread (block reads and writes, the batches of steps of
+# noise reduction and of profile FFTs, export writes) until stop_trace, which writes
+# it to path as Chrome trace event JSON, for Perfetto or chrome://tracing
+# returns False if a trace is already started, or if the file cannot be written
+def start_trace():
+    return cmodule.start_trace()
+
+
+def stop_trace(path):
+    return cmodule.stop_trace(path)
+
+
+# profiles taken from ranges of sound files (by noisered, save_profile, noisered_bytes,
+# NoiseReducer and the coroutines) are cached, keyed by the content of the file, the
+# range and the window settings, so that taking one again skips the import and the
+# profiling; the results are the same.  capacity: profiles kept in memory, the least
+# recently used dropped first, 0 for none; directory: an existing directory to keep
+# them in as files too, found again by later processes, None for memory only
+def set_profile_cache(capacity=64, directory=None):
+    cmodule.set_profile_cache(capacity, directory)
+
+
+# forget the profiles in memory; those in the directory stay
+def clear_profile_cache():
+    cmodule.clear_profile_cache()
+
+
+# {"hits": n, "disk_hits": n, "misses": n, "entries": n}: profiles found in memory,
+# found in the directory and taken, since the start, and those in memory now
+def profile_cache_stats():
+    return cmodule.profile_cache_stats()
+
+
+def _stats_difference(after, before, peaks):
+    return {"stages": {name: {key: value - before["stages"][name][key] for key, value in timing.items()}
+                       for name, timing in after["stages"].items()},
+            "counters": {name: value - before["counters"][name] for name, value in after["counters"].items()},
+            "gauges": {name: {"live": level["live"], "peak": max(level["live"], peaks[name])}
+                       for name, level in after["gauges"].items()}}
+
+
+# with stats, (result of call, what the call added to stats()), with the peaks
+# of the gauges since the call began, watched for the call alone so that other
+# calls with stats meanwhile do not reset them; the timers, counters and gauges
+# are of the process, so that work on other threads meanwhile adds too
+def _call(stats, call, *args):
+    if not stats:
+        return call(*args)
+    cmodule.enable_stats(True)
+    watch = cmodule.watch_peaks()
+    try:
+        before = cmodule.stats()
+        result = call(*args)
+        after = cmodule.stats()
+    finally:
+        peaks = cmodule.unwatch_peaks(watch)
+        cmodule.enable_stats(False)
+    return result, _stats_difference(after, before, peaks)
+
 
 # pyaudacity_module c extension wrapper
-def noisered(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path):
-    return cmodule.noisered(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path)
+# threads: threads for noise reduction, 0 for one per cpu
+# streaming: read, reduce and write a chunk at a time on one thread, in memory
+#            independent of the file length; threads is then ignored
+# stats: return (result, stats), the time of each stage and the counts of the call
+# budget: bytes that the tracks of the file may take in memory, 0 for no limit;
+#         a file whose tracks would not fit is streamed instead
+# band: (low, high) in Hz, to reduce noise only between them (either may be None);
+#       None for all frequencies
+# settings: the advanced settings, to trade quality for speed; None for the
+#           defaults, a name of PRESETS, or a dict of any of window_types (0 to 6,
+#           as Audacity lists them), window_size (8 to 16384 samples, a power of 2),
+#           steps_per_window (2 to 64, a power of 2), method ("median" or
+#           "second_greatest"), attack_time and release_time (0 to 1 second), the
+#           rest as "default"; invalid ones raise ValueError.  A saved profile
+#           must be applied with the window size it was taken with.
+def noisered(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing, dst_path,
+             threads=1, streaming=False, stats=False, budget=0, band=None, settings=None):
+    return _call(stats, cmodule.noisered, profile_path, profile_start, profile_end, src_path, noise_gain,
+                 sensitivity, smoothing, dst_path, threads, streaming, budget, *_band(band), settings)
+
+
+# noise reduction without a selection of noise:  the profile is of the quietest
+# quiet_fraction (0.1, say) of the windows of src_path, taken from the same import
+# of it as is reduced; the tracks must fit in the budget, as there is no streaming
+def noisered_auto(src_path, quiet_fraction, noise_gain, sensitivity, smoothing, dst_path, threads=1, stats=False,
+                  budget=0, band=None, settings=None):
+    return _call(stats, cmodule.noisered_auto, src_path, quiet_fraction, noise_gain, sensitivity, smoothing,
+                 dst_path, threads, budget, *_band(band), settings)
+
+
+# noisered as a coroutine, for asyncio:  the job is queued on a native pool of a
+# thread per cpu and runs without the GIL, so many may be awaited at once without a
+# Python thread each; the result is that of noisered, without stats.  Cancelling
+# the awaiting task stops the job before it starts, or between blocks of its input.
+async def noisered_async(profile_path, profile_start, profile_end, src_path, noise_gain, sensitivity, smoothing,
+                         dst_path, threads=1, streaming=False, budget=0, band=None, settings=None):
+    return await _await_job(cmodule.noisered_submit, profile_path, profile_start, profile_end, src_path,
+                            noise_gain, sensitivity, smoothing, dst_path, threads, streaming, budget, *_band(band),
+                            settings)
+
+
+# settings: of the window size the profile is to be applied with
+def save_profile(profile_path, profile_start, profile_end, profile_file, settings=None):
+    return cmodule.save_profile(profile_path, profile_start, profile_end, profile_file, settings)
+
+
+def noisered_with_profile(profile_file, src_path, noise_gain, sensitivity, smoothing, dst_path, threads=1,
+                          streaming=False, stats=False, budget=0, band=None, settings=None):
+    return _call(stats, cmodule.noisered_with_profile, profile_file, src_path, noise_gain, sensitivity, smoothing,
+                 dst_path, threads, streaming, budget, *_band(band), settings)
+
+
+# noisered_with_profile as a coroutine, as noisered_async
+async def noisered_with_profile_async(profile_file, src_path, noise_gain, sensitivity, smoothing, dst_path, threads=1,
+                                      streaming=False, budget=0, band=None, settings=None):
+    return await _await_job(cmodule.noisered_with_profile_submit, profile_file, src_path, noise_gain,
+                            sensitivity, smoothing, dst_path, threads, streaming, budget, *_band(band), settings)
+
+
+# the same on the contents of sound files as bytes (or any bytes-like object),
+# returning the contents of the reduced file as bytes, or None; nothing is
+# read from or written to the file system
+# budget: as for noisered, but a sound file whose tracks would not fit fails
+def noisered_bytes(profile_audio, profile_start, profile_end, src, noise_gain, sensitivity, smoothing, threads=1,
+                   stats=False, budget=0, band=None, settings=None):
+    return _call(stats, cmodule.noisered_bytes, profile_audio, profile_start, profile_end, src, noise_gain,
+                 sensitivity, smoothing, threads, budget, *_band(band), settings)
+
+
+# profile: the contents of a file written by save_profile
+def noisered_bytes_with_profile(profile, src, noise_gain, sensitivity, smoothing, threads=1, stats=False,
+                                budget=0, band=None, settings=None):
+    return _call(stats, cmodule.noisered_bytes_with_profile, profile, src, noise_gain, sensitivity, smoothing,
+                 threads, budget, *_band(band), settings)
+
+
+# noise reduction of samples held in any buffer-protocol object (a NumPy array, say),
+# float32 or int16, 1-D for mono or 2-D of frames by channels, read in place
+# profile: noise samples at rate (only the first channel is used)
+# out: written in place, float32 or int16 of the shape of src; by default a new
+#      NumPy array of the type of src
+# returns out, or None on failure
+def noisered_array(profile, src, rate, noise_gain, sensitivity, smoothing, out=None, settings=None):
+    if out is None:
+        out = _empty_like(src)
+    if not cmodule.noisered_array(profile, src, rate, noise_gain, sensitivity, smoothing, out, settings):
+        return None
+    return out
+
+
+# profile: the contents of a file written by save_profile
+def noisered_array_with_profile(profile, src, rate, noise_gain, sensitivity, smoothing, out=None, settings=None):
+    if out is None:
+        out = _empty_like(src)
+    if not cmodule.noisered_array_with_profile(profile, src, rate, noise_gain, sensitivity, smoothing, out,
+                                               settings):
+        return None
+    return out
+
+
+# noise reduction of each (src_path, dst_path) of files with the profile written by
+# save_profile to profile_file, taken once, on a pool of native threads (0 for one
+# per cpu), each streaming a file at a time
+# slice_frames: files longer than this are split into slices that idle threads take,
+#               0 for none; by default, 1048576
+# returns [(ok, seconds), ...] in the order of files
+def noisered_batch(profile_file, files, noise_gain, sensitivity, smoothing, threads=0, settings=None,
+                   slice_frames=None):
+    if slice_frames is None:
+        return cmodule.noisered_batch(profile_file, files, noise_gain, sensitivity, smoothing, threads, settings)
+    return cmodule.noisered_batch(profile_file, files, noise_gain, sensitivity, smoothing, threads, settings,
+                                  slice_frames)
+
+
+# a noise profile taken from [profile_start, profile_end) of profile_path, with the
+# reduction parameters, keeping the FFT state and buffers of one call for the next;
+# for many short clips; settings as for noisered
+# process(src_path, dst_path): reduce a file a chunk at a time, returning True on success
+# process_array(src, out=None): as noisered_array, at the rate of the profile
+# rate: sample rate of the profile
+# initialized once, as calls of other threads may be using it
+class NoiseReducer(cmodule.NoiseReducer):
+    def process_array(self, src, out=None):
+        if out is None:
+            out = _empty_like(src)
+        if not super().process_array(src, out):
+            return None
+        return out
+
+
+# submit a job to the native pool, completing a future of the running loop
+async def _await_job(submit, *args):
+    loop = asyncio.get_running_loop()
+    future = loop.create_future()
+    job = submit(loop, functools.partial(_set_result, future), *args)
+    try:
+        return await future
+    except asyncio.CancelledError:
+        job.cancel()
+        raise
+
+
+def _set_result(future, result):
+    # not if the awaiting task was cancelled
+    if not future.done():
+        future.set_result(result)
+
+
+# (low, high) of band as the C module takes them, -1 for no bound
+def _band(band):
+    low, high = band if band is not None else (None, None)
+    return (-1.0 if low is None else float(low)), (-1.0 if high is None else float(high))
+
+
+def _empty_like(src):
+    import numpy
+    return numpy.empty_like(src)
@@ -1,73 +1,404 @@
 #include <Python.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "ExportPCM.h"
+#include "FileException.h"
 #include "Mix.h"
 #include "DirManager.h"
 #include "ImportPCM.h"
+#include "Instrumentation.h"
+#include "NoiseReduction.h"
+#include "ProfileCache.h"
+#include "ReduceNoisePCM.h"
 
 #define PYTHON_AUDACITY_NOISERED_MODULE
 
 
+// bytes of block files that import and noise reduction of a file take at
+// most: its samples, and the reduced copy made before they are replaced
+static ImportFileHandle::ByteCount
+PyAudacity_TrackBytes(ImportFileHandle &handler) {
+    return 2 * handler.GetFileUncompressedBytes();
+}
+
+// settings of Python: None for the defaults, the name of a preset, or a dict
+// of any of window_types (0 to 6), window_size (8 to 16384 samples, a power
+// of 2), steps_per_window (2 to 64, a power of 2), method ("median" or
+// "second_greatest"), attack_time and release_time (0 to 1 second), the
+// rest as in the "default" preset; false, with an exception set, if invalid
 static bool
-PyAudacity_Noisered(const char *profile_path, double profile_start, double profile_end,
-                    const char *src_path, double noise_gain, double sensitivity, double smoothing,
-                    const char *dst_path) {
-    // import audio file for profile
-    const auto dir_manager = std::make_shared<DirManager>();
-    auto factory = new TrackFactory(dir_manager);
-    auto profile_handler = PCMImportFileHandle::Open(profile_path);
-    TrackHolders profile_holders{};
-    auto import_result = profile_handler->Import(factory, profile_holders);
-    if (import_result != ProgressResult::Success) {
-        delete factory;
+PyAudacity_ParseSettings(PyObject *object, EffectNoiseReduction::AdvancedSettings &settings) {
+    settings = EffectNoiseReduction::AdvancedSettings{};
+    if (!object || object == Py_None)
+        return true;
+    if (PyUnicode_Check(object)) {
+        const char *name = PyUnicode_AsUTF8(object);
+        if (!name)
+            return false;
+        if (!EffectNoiseReduction::GetPreset(name, settings)) {
+            PyErr_Format(PyExc_ValueError, "unknown preset: %s", name);
+            return false;
+        }
+        return true;
+    }
+    if (!PyDict_Check(object)) {
+        PyErr_SetString(PyExc_TypeError, "settings must be None, a preset name or a dict");
         return false;
     }
 
-    // get profile
-    auto effect = new EffectNoiseReduction();
-    auto profile_result = effect->GetProfile(profile_holders[0].get(), profile_start, profile_end,
-                                             noise_gain, sensitivity, smoothing, factory);
-    if (!profile_result) {
-        delete factory;
-        delete effect;
+    // a power of 2 from 2^(offset) to 2^(offset + max) as its choice
+    const auto power_choice = [](PyObject *value, int offset, int max, int &choice) {
+        const long number = PyLong_AsLong(value);
+        if (number == -1 && PyErr_Occurred())
+            return false;
+        for (int ii = 0; ii <= max; ++ii)
+            if (number == 1L << (offset + ii)) {
+                choice = ii;
+                return true;
+            }
+        PyErr_Format(PyExc_ValueError, "%ld is not a power of 2 from %ld to %ld",
+                     number, 1L << offset, 1L << (offset + max));
         return false;
+    };
+    PyObject *key;
+    PyObject *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(object, &pos, &key, &value)) {
+        const char *name = PyUnicode_Check(key) ? PyUnicode_AsUTF8(key) : nullptr;
+        if (!name) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError, "the keys of settings must be strings");
+            return false;
+        }
+        const std::string setting{name};
+        bool ok;
+        if (setting == "window_types") {
+            settings.windowTypes = (int) PyLong_AsLong(value);
+            ok = !PyErr_Occurred();
+        } else if (setting == "window_size")
+            ok = power_choice(value, 3, 11, settings.windowSizeChoice);
+        else if (setting == "steps_per_window")
+            ok = power_choice(value, 1, 5, settings.stepsPerWindowChoice);
+        else if (setting == "method") {
+            const char *method = PyUnicode_Check(value) ? PyUnicode_AsUTF8(value) : nullptr;
+            if (method && method == std::string("median"))
+                settings.method = 0;
+            else if (method && method == std::string("second_greatest"))
+                settings.method = 1;
+            else if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_ValueError, "method must be \"median\" or \"second_greatest\"");
+            ok = !PyErr_Occurred();
+        } else if (setting == "attack_time") {
+            settings.attackTime = PyFloat_AsDouble(value);
+            ok = !PyErr_Occurred();
+        } else if (setting == "release_time") {
+            settings.releaseTime = PyFloat_AsDouble(value);
+            ok = !PyErr_Occurred();
+        } else {
+            PyErr_Format(PyExc_ValueError, "unknown setting: %s", name);
+            ok = false;
+        }
+        if (!ok)
+            return false;
     }
 
-    // import src file
-    TrackHolders src_holders{};
-    auto src_handler = PCMImportFileHandle::Open(src_path);
-    import_result = src_handler->Import(factory, src_holders);
-    if (import_result != ProgressResult::Success) {
-        delete factory;
-        delete effect;
+    // as each call will, to fail before any work
+    EffectNoiseReduction effect;
+    if (!effect.SetAdvancedSettings(settings)) {
+        PyErr_SetString(PyExc_ValueError, "the settings are not valid together");
         return false;
     }
-    // execute noise reduction
-    auto noisered_result = effect->ReduceNoise(src_holders[0].get(),
-                                               noise_gain, sensitivity, smoothing, factory);
-    if (!noisered_result) {
-        delete factory;
-        delete effect;
+    return true;
+}
+
+// import src, reduce noise with the effect's profile into tracks to export;
+// or, given a quiet_fraction, with a profile of that fraction of the windows
+// of the tracks, the quietest, so that src is imported once for both
+static bool
+PyAudacity_ReduceNoiseTracks(EffectNoiseReduction &effect, TrackFactory *factory,
+                             ImportFileHandle *src_handler, double noise_gain, double sensitivity,
+                             double smoothing, unsigned threads, double quiet_fraction,
+                             WaveTrackConstArray &audioArray) {
+    // import src; the export is 16 bit, so 16 bit samples are stored as
+    // they are, at half the size, and the reduced ones converted as they
+    // are appended rather than as they are exported
+    TrackHolders src_holders{};
+    if (!src_handler)
+        return false;
+    src_handler->SetSampleFormat(int16Sample);
+    // fail fast when the tracks will not fit in the budget of the DirManager
+    if (!factory->mDirManager->HasSpaceFor(PyAudacity_TrackBytes(*src_handler)))
         return false;
+
+    try {
+        auto import_result = src_handler->Import(factory, src_holders);
+        if (import_result != ProgressResult::Success)
+            return false;
+
+        // execute noise reduction on every channel
+        effect.SetThreadCount(threads);
+        std::vector<WaveTrack *> tracks;
+        for (const auto &holder : src_holders)
+            tracks.push_back(holder.get());
+        if (quiet_fraction > 0 &&
+            !effect.GetAutoProfile(tracks, quiet_fraction, noise_gain, sensitivity, smoothing, factory))
+            return false;
+        auto noisered_result = effect.ReduceNoise(tracks,
+                                                  noise_gain, sensitivity, smoothing, factory);
+        if (!noisered_result)
+            return false;
+    } catch (const FileException &) {
+        // the budget was exceeded after all
+        return false;
+    }
+
+    for (auto &holder : src_holders)
+        audioArray.emplace_back(std::move(holder));
+    return true;
+}
+
+// import src file, reduce noise with the effect's profile and export to dst;
+// or, streaming, read, reduce and write a chunk at a time on one thread, as
+// is also done when the tracks would not fit in the budget of the DirManager
+static bool
+PyAudacity_ReduceNoise(EffectNoiseReduction &effect, TrackFactory *factory,
+                       const char *src_path, double noise_gain, double sensitivity, double smoothing,
+                       const char *dst_path, unsigned threads, bool streaming) {
+    auto src_handler = streaming ? nullptr : PCMImportFileHandle::Open(src_path);
+    if (src_handler) {
+        src_handler->SetSampleFormat(int16Sample);
+        streaming = !factory->mDirManager->HasSpaceFor(PyAudacity_TrackBytes(*src_handler));
     }
+    if (streaming)
+        return ReduceNoisePCM(effect, src_path, dst_path,
+                              noise_gain, sensitivity, smoothing) == ProgressResult::Success;
+
+    auto audioArray = WaveTrackConstArray();
+    if (!PyAudacity_ReduceNoiseTracks(effect, factory, src_handler.get(),
+                                      noise_gain, sensitivity, smoothing, threads, 0.0, audioArray))
+        return false;
 
     // export
     auto exporter = ExportPCM();
+    auto export_result = exporter.Export(audioArray, std::string(dst_path));
+    return export_result == ProgressResult::Success;
+}
+
+// the same from the bytes of a sound file in src to those of another in dst
+static bool
+PyAudacity_ReduceNoiseBytes(EffectNoiseReduction &effect, TrackFactory *factory,
+                            const Py_buffer &src, double noise_gain, double sensitivity, double smoothing,
+                            std::vector<char> &dst, unsigned threads) {
+    auto audioArray = WaveTrackConstArray();
+    if (!PyAudacity_ReduceNoiseTracks(effect, factory, PCMImportFileHandle::OpenMemory(src.buf, src.len).get(),
+                                      noise_gain, sensitivity, smoothing, threads, 0.0, audioArray))
+        return false;
+
+    auto exporter = ExportPCM();
+    return exporter.ExportToMemory(audioArray, dst) == ProgressResult::Success;
+}
+
+static bool
+PyAudacity_Noisered(const char *profile_path, double profile_start, double profile_end,
+                    const char *src_path, double noise_gain, double sensitivity, double smoothing,
+                    const char *dst_path, unsigned threads, bool streaming,
+                    BlockFile::DiskByteCount budget, double f0, double f1,
+                    const EffectNoiseReduction::AdvancedSettings &advanced,
+                    const std::atomic<bool> *cancel = nullptr) {
+    // headless use: keep blocks in memory rather than under the temp dir
+    const auto dir_manager = std::make_shared<DirManager>(true);
+    dir_manager->SetSpaceBudget(budget);
+    auto factory = std::make_unique<TrackFactory>(dir_manager);
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!effect->SetFrequencyRange(f0, f1) || !effect->SetAdvancedSettings(advanced))
+        return false;
+    effect->SetCancel(cancel);
+
+    if (!ProfileCache::Get().GetProfile(*effect, profile_path, profile_start, profile_end))
+        return false;
+
+    return PyAudacity_ReduceNoise(*effect, factory.get(), src_path,
+                                  noise_gain, sensitivity, smoothing, dst_path, threads, streaming);
+}
+
+static bool
+PyAudacity_NoiseredAuto(const char *src_path, double quiet_fraction,
+                        double noise_gain, double sensitivity, double smoothing,
+                        const char *dst_path, unsigned threads, BlockFile::DiskByteCount budget,
+                        double f0, double f1, const EffectNoiseReduction::AdvancedSettings &advanced) {
+    const auto dir_manager = std::make_shared<DirManager>(true);
+    dir_manager->SetSpaceBudget(budget);
+    auto factory = std::make_unique<TrackFactory>(dir_manager);
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!effect->SetFrequencyRange(f0, f1) || !effect->SetAdvancedSettings(advanced))
+        return false;
+
+    // the profile needs all of the tracks, so there is no streaming
     auto audioArray = WaveTrackConstArray();
-    audioArray.emplace_back(std::move(src_holders.at(0)));
+    if (!PyAudacity_ReduceNoiseTracks(*effect, factory.get(), PCMImportFileHandle::Open(src_path).get(),
+                                      noise_gain, sensitivity, smoothing, threads, quiet_fraction, audioArray))
+        return false;
+
+    auto exporter = ExportPCM();
     auto export_result = exporter.Export(audioArray, std::string(dst_path));
-    if (export_result != ProgressResult::Success) {
-        delete factory;
-        delete effect;
+    return export_result == ProgressResult::Success;
+}
+
+static bool
+PyAudacity_SaveProfile(const char *profile_path, double profile_start, double profile_end,
+                       const char *profile_file, const EffectNoiseReduction::AdvancedSettings &advanced) {
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!effect->SetAdvancedSettings(advanced))
         return false;
-    }
 
-    delete factory;
-    delete effect;
+    if (!ProfileCache::Get().GetProfile(*effect, profile_path, profile_start, profile_end))
+        return false;
+
+    return effect->SaveProfile(std::string(profile_file));
+}
+
+static bool
+PyAudacity_NoiseredWithProfile(const char *profile_file,
+                               const char *src_path, double noise_gain, double sensitivity, double smoothing,
+                               const char *dst_path, unsigned threads, bool streaming,
+                               BlockFile::DiskByteCount budget, double f0, double f1,
+                               const EffectNoiseReduction::AdvancedSettings &advanced,
+                               const std::atomic<bool> *cancel = nullptr) {
+    const auto dir_manager = std::make_shared<DirManager>(true);
+    dir_manager->SetSpaceBudget(budget);
+    auto factory = std::make_unique<TrackFactory>(dir_manager);
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!effect->SetFrequencyRange(f0, f1) || !effect->SetAdvancedSettings(advanced))
+        return false;
+    effect->SetCancel(cancel);
+
+    if (!effect->LoadProfile(std::string(profile_file)))
+        return false;
+
+    return PyAudacity_ReduceNoise(*effect, factory.get(), src_path,
+                                  noise_gain, sensitivity, smoothing, dst_path, threads, streaming);
+}
+
+static bool
+PyAudacity_NoiseredBytes(const Py_buffer &profile_audio, double profile_start, double profile_end,
+                         const Py_buffer &src, double noise_gain, double sensitivity, double smoothing,
+                         std::vector<char> &dst, unsigned threads, BlockFile::DiskByteCount budget,
+                         double f0, double f1, const EffectNoiseReduction::AdvancedSettings &advanced) {
+    const auto dir_manager = std::make_shared<DirManager>(true);
+    dir_manager->SetSpaceBudget(budget);
+    auto factory = std::make_unique<TrackFactory>(dir_manager);
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!effect->SetFrequencyRange(f0, f1) || !effect->SetAdvancedSettings(advanced))
+        return false;
+
+    if (!ProfileCache::Get().GetProfile(*effect, profile_audio.buf, profile_audio.len,
+                                        profile_start, profile_end))
+        return false;
+
+    return PyAudacity_ReduceNoiseBytes(*effect, factory.get(), src,
+                                       noise_gain, sensitivity, smoothing, dst, threads);
+}
+
+static bool
+PyAudacity_NoiseredBytesWithProfile(const Py_buffer &profile,
+                                    const Py_buffer &src, double noise_gain, double sensitivity,
+                                    double smoothing, std::vector<char> &dst, unsigned threads,
+                                    BlockFile::DiskByteCount budget, double f0, double f1,
+                                    const EffectNoiseReduction::AdvancedSettings &advanced) {
+    const auto dir_manager = std::make_shared<DirManager>(true);
+    dir_manager->SetSpaceBudget(budget);
+    auto factory = std::make_unique<TrackFactory>(dir_manager);
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    if (!effect->SetFrequencyRange(f0, f1) || !effect->SetAdvancedSettings(advanced))
+        return false;
+
+    if (!effect->LoadProfile(static_cast<const char *>(profile.buf), profile.len))
+        return false;
+
+    return PyAudacity_ReduceNoiseBytes(*effect, factory.get(), src,
+                                       noise_gain, sensitivity, smoothing, dst, threads);
+}
+
+// samples of a 1-D (mono) or 2-D (frames, channels) C contiguous float32 or int16 buffer
+static bool
+PyAudacity_GetSamples(const Py_buffer &view, sampleFormat &format, size_t &frames, unsigned &channels) {
+    const char *code = view.format ? view.format : "B";
+    if (*code == '@' || *code == '=' || *code == '<')
+        ++code;
+    if (code == std::string("f") && view.itemsize == 4)
+        format = floatSample;
+    else if (code == std::string("h") && view.itemsize == 2)
+        format = int16Sample;
+    else {
+        PyErr_SetString(PyExc_TypeError, "samples must be float32 or int16");
+        return false;
+    }
+    if (view.ndim != 1 && view.ndim != 2) {
+        PyErr_SetString(PyExc_ValueError, "samples must be 1-D, or 2-D of frames by channels");
+        return false;
+    }
+    frames = view.shape[0];
+    channels = view.ndim == 2 ? view.shape[1] : 1;
+    if (channels < 1) {
+        PyErr_SetString(PyExc_ValueError, "samples must have a channel");
+        return false;
+    }
     return true;
 }
 
+// reduce noise in src into out, in place through the buffer protocol, with streams
+// of the effect, holding lock (if any) while they are in use
+static PyObject *
+PyAudacity_ReduceNoiseArray(EffectNoiseReduction &effect, NoiseReductionStreams &streams, std::mutex *lock,
+                            PyObject *src_object, double rate,
+                            double noise_gain, double sensitivity, double smoothing, PyObject *out_object) {
+    Py_buffer src, out;
+    if (PyObject_GetBuffer(src_object, &src, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+        return nullptr;
+    if (PyObject_GetBuffer(out_object, &out, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) != 0) {
+        PyBuffer_Release(&src);
+        return nullptr;
+    }
+
+    sampleFormat src_format, out_format;
+    size_t frames, out_frames;
+    unsigned channels, out_channels;
+    bool result = false;
+    if (PyAudacity_GetSamples(src, src_format, frames, channels) &&
+        PyAudacity_GetSamples(out, out_format, out_frames, out_channels)) {
+        if (out_frames != frames || out_channels != channels)
+            PyErr_SetString(PyExc_ValueError, "out must have the shape of src");
+        else {
+            Py_BEGIN_ALLOW_THREADS
+            std::unique_lock<std::mutex> guard;
+            if (lock)
+                guard = std::unique_lock<std::mutex>{*lock};
+            result = ReduceNoiseSamples(effect, streams, src.buf, src_format, out.buf, out_format,
+                                        frames, channels, rate, noise_gain, sensitivity, smoothing);
+            Py_END_ALLOW_THREADS
+        }
+    }
+    PyBuffer_Release(&src);
+    PyBuffer_Release(&out);
+
+    if (PyErr_Occurred())
+        return nullptr;
+    if (result) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
 static PyObject *
 pyaudacity_noisered(PyObject *self, PyObject *args) {
     const char *profile_path;
@@ -78,27 +409,1040 @@ pyaudacity_noisered(PyObject *self, PyObject *args) {
     double sensitivity;
     double smoothing;
     const char *dst_path;
+    unsigned threads = 1;
+    int streaming = 0;
+    unsigned long long budget = 0;
+    // the bands to reduce, in Hz; negative for no bound
+    double f0 = -1.0;
+    double f1 = -1.0;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "sddsddds|IpKddO",
+                          &profile_path, &profile_start, &profile_end,
+                          &src_path, &noise_gain, &sensitivity, &smoothing,
+                          &dst_path, &threads, &streaming, &budget, &f0, &f1, &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    // the strings belong to args, which outlives the call
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudacity_Noisered(profile_path, profile_start, profile_end,
+                                 src_path, noise_gain, sensitivity, smoothing,
+                                 dst_path, threads, streaming != 0, budget, f0, f1, advanced);
+    Py_END_ALLOW_THREADS
+    if (result) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject *
+pyaudacity_noisered_auto(PyObject *self, PyObject *args) {
+    const char *src_path;
+    double quiet_fraction;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    const char *dst_path;
+    unsigned threads = 1;
+    unsigned long long budget = 0;
+    // the bands to reduce, in Hz; negative for no bound
+    double f0 = -1.0;
+    double f1 = -1.0;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "sdddds|IKddO",
+                          &src_path, &quiet_fraction, &noise_gain, &sensitivity, &smoothing,
+                          &dst_path, &threads, &budget, &f0, &f1, &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudacity_NoiseredAuto(src_path, quiet_fraction, noise_gain, sensitivity, smoothing,
+                                     dst_path, threads, budget, f0, f1, advanced);
+    Py_END_ALLOW_THREADS
+    if (result) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject *
+pyaudacity_save_profile(PyObject *self, PyObject *args) {
+    const char *profile_path;
+    double profile_start;
+    double profile_end;
+    const char *profile_file;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "sdds|O",
+                          &profile_path, &profile_start, &profile_end, &profile_file, &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudacity_SaveProfile(profile_path, profile_start, profile_end, profile_file, advanced);
+    Py_END_ALLOW_THREADS
+    if (result) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject *
+pyaudacity_noisered_with_profile(PyObject *self, PyObject *args) {
+    const char *profile_file;
+    const char *src_path;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    const char *dst_path;
+    unsigned threads = 1;
+    int streaming = 0;
+    unsigned long long budget = 0;
+    // the bands to reduce, in Hz; negative for no bound
+    double f0 = -1.0;
+    double f1 = -1.0;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "ssddds|IpKddO",
+                          &profile_file, &src_path, &noise_gain, &sensitivity, &smoothing,
+                          &dst_path, &threads, &streaming, &budget, &f0, &f1, &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudacity_NoiseredWithProfile(profile_file, src_path,
+                                            noise_gain, sensitivity, smoothing, dst_path, threads,
+                                            streaming != 0, budget, f0, f1, advanced);
+    Py_END_ALLOW_THREADS
+    if (result) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+// bytes of the reduced sound file, or None
+static PyObject *
+pyaudacity_noisered_bytes(PyObject *self, PyObject *args) {
+    Py_buffer profile_audio;
+    double profile_start;
+    double profile_end;
+    Py_buffer src;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    unsigned threads = 1;
+    unsigned long long budget = 0;
+    // the bands to reduce, in Hz; negative for no bound
+    double f0 = -1.0;
+    double f1 = -1.0;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "y*ddy*ddd|IKddO",
+                          &profile_audio, &profile_start, &profile_end,
+                          &src, &noise_gain, &sensitivity, &smoothing, &threads, &budget, &f0, &f1,
+                          &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced)) {
+        PyBuffer_Release(&profile_audio);
+        PyBuffer_Release(&src);
+        return nullptr;
+    }
+
+    // the buffers stay exported, and so unchanged, until released
+    std::vector<char> dst;
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudacity_NoiseredBytes(profile_audio, profile_start, profile_end,
+                                      src, noise_gain, sensitivity, smoothing, dst, threads, budget, f0, f1,
+                                      advanced);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&profile_audio);
+    PyBuffer_Release(&src);
+    if (result) {
+        return PyBytes_FromStringAndSize(dst.data(), dst.size());
+    } else {
+        Py_RETURN_NONE;
+    }
+}
+
+// bytes of the reduced sound file, or None
+static PyObject *
+pyaudacity_noisered_bytes_with_profile(PyObject *self, PyObject *args) {
+    Py_buffer profile;
+    Py_buffer src;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    unsigned threads = 1;
+    unsigned long long budget = 0;
+    // the bands to reduce, in Hz; negative for no bound
+    double f0 = -1.0;
+    double f1 = -1.0;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "y*y*ddd|IKddO",
+                          &profile, &src, &noise_gain, &sensitivity, &smoothing, &threads, &budget, &f0, &f1,
+                          &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced)) {
+        PyBuffer_Release(&profile);
+        PyBuffer_Release(&src);
+        return nullptr;
+    }
+
+    std::vector<char> dst;
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = PyAudacity_NoiseredBytesWithProfile(profile, src, noise_gain, sensitivity, smoothing,
+                                                 dst, threads, budget, f0, f1, advanced);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&profile);
+    PyBuffer_Release(&src);
+    if (result) {
+        return PyBytes_FromStringAndSize(dst.data(), dst.size());
+    } else {
+        Py_RETURN_NONE;
+    }
+}
+
+// profile: noise samples, of which the first channel is taken
+static PyObject *
+pyaudacity_noisered_array(PyObject *self, PyObject *args) {
+    PyObject *profile_object;
+    PyObject *src_object;
+    double rate;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    PyObject *out_object;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "OOddddO|O",
+                          &profile_object, &src_object, &rate,
+                          &noise_gain, &sensitivity, &smoothing, &out_object, &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    Py_buffer profile;
+    if (PyObject_GetBuffer(profile_object, &profile, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+        return nullptr;
+    sampleFormat format;
+    size_t frames;
+    unsigned channels;
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    effect->SetAdvancedSettings(advanced);
+    bool profiled = false;
+    if (PyAudacity_GetSamples(profile, format, frames, channels)) {
+        Py_BEGIN_ALLOW_THREADS
+        if (format == floatSample && channels == 1)
+            profiled = effect->GetProfile(static_cast<const float *>(profile.buf), frames, rate);
+        else {
+            // only the first channel, as of a file, scaled as libsndfile reads it
+            std::vector<float> noise(frames);
+            for (size_t ii = 0; ii < frames; ++ii)
+                noise[ii] = format == floatSample
+                            ? static_cast<const float *>(profile.buf)[ii * channels]
+                            : static_cast<const short *>(profile.buf)[ii * channels] * (1.0f / 0x8000);
+            profiled = effect->GetProfile(noise.data(), frames, rate);
+        }
+        Py_END_ALLOW_THREADS
+    }
+    PyBuffer_Release(&profile);
+    if (PyErr_Occurred())
+        return nullptr;
+    if (!profiled)
+        Py_RETURN_FALSE;
+
+    NoiseReductionStreams streams;
+    return PyAudacity_ReduceNoiseArray(*effect, streams, nullptr, src_object, rate,
+                                       noise_gain, sensitivity, smoothing, out_object);
+}
+
+// profile: the contents of a saved noise profile
+static PyObject *
+pyaudacity_noisered_array_with_profile(PyObject *self, PyObject *args) {
+    Py_buffer profile;
+    PyObject *src_object;
+    double rate;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    PyObject *out_object;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "y*OddddO|O",
+                          &profile, &src_object, &rate,
+                          &noise_gain, &sensitivity, &smoothing, &out_object, &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced)) {
+        PyBuffer_Release(&profile);
+        return nullptr;
+    }
+
+    auto effect = std::make_unique<EffectNoiseReduction>();
+    effect->SetAdvancedSettings(advanced);
+    bool loaded;
+    Py_BEGIN_ALLOW_THREADS
+    loaded = effect->LoadProfile(static_cast<const char *>(profile.buf), profile.len);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&profile);
+    if (!loaded)
+        Py_RETURN_FALSE;
+
+    NoiseReductionStreams streams;
+    return PyAudacity_ReduceNoiseArray(*effect, streams, nullptr, src_object, rate,
+                                       noise_gain, sensitivity, smoothing, out_object);
+}
+
+// [(ok, seconds), ...] for each (src_path, dst_path) of files, reduced on a pool of threads
+static PyObject *
+pyaudacity_noisered_batch(PyObject *self, PyObject *args) {
+    const char *profile_file;
+    PyObject *files_object;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    unsigned threads = 0;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+    // frames of the slices of long files, 0 for none
+    Py_ssize_t slice_frames = ReduceNoiseBatchSliceFrames;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "sOddd|IOn",
+                          &profile_file, &files_object, &noise_gain, &sensitivity, &smoothing, &threads,
+                          &settings_object, &slice_frames)) {
+        return nullptr;
+    }
+    if (slice_frames < 0) {
+        PyErr_SetString(PyExc_ValueError, "slice_frames must not be negative");
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    PyObject *files_sequence = PySequence_Fast(files_object, "files must be a sequence of (src, dst) pairs");
+    if (!files_sequence)
+        return nullptr;
+    std::vector<std::pair<std::string, std::string>> files;
+    const Py_ssize_t size = PySequence_Fast_GET_SIZE(files_sequence);
+    for (Py_ssize_t ii = 0; ii < size; ++ii) {
+        const char *src_path;
+        const char *dst_path;
+        if (!PyArg_Parse(PySequence_Fast_GET_ITEM(files_sequence, ii), "(ss)", &src_path, &dst_path)) {
+            Py_DECREF(files_sequence);
+            return nullptr;
+        }
+        files.emplace_back(src_path, dst_path);
+    }
+    Py_DECREF(files_sequence);
+
+    std::vector<ReduceNoiseBatchResult> results;
+    Py_BEGIN_ALLOW_THREADS
+    EffectNoiseReduction effect;
+    effect.SetAdvancedSettings(advanced);
+    if (effect.LoadProfile(std::string(profile_file)))
+        results = ReduceNoisePCMBatch(effect, files, noise_gain, sensitivity, smoothing, threads, 0,
+                                      slice_frames);
+    else
+        results.resize(files.size());
+    Py_END_ALLOW_THREADS
+
+    PyObject *list = PyList_New(results.size());
+    if (!list)
+        return nullptr;
+    for (size_t ii = 0; ii < results.size(); ++ii) {
+        PyObject *item = Py_BuildValue("(Nd)", PyBool_FromLong(results[ii].result == ProgressResult::Success),
+                                       results[ii].seconds);
+        if (!item) {
+            Py_DECREF(list);
+            return nullptr;
+        }
+        PyList_SET_ITEM(list, ii, item);
+    }
+    return list;
+}
+
+// a job of the native pool, for the coroutines of the Python module:  work
+// runs without the GIL, then callback(result) is scheduled on loop with
+// loop.call_soon_threadsafe
+struct PyAudacity_PoolJob {
+    std::function<bool(const std::atomic<bool> *cancel)> work;
+    std::atomic<bool> cancel{false};
+    // owned references, dropped with the GIL held once the job is done
+    PyObject *loop;
+    PyObject *callback;
+};
+
+// threads, one per cpu, started with the first job, taking jobs in the
+// order submitted, however many are queued
+class PyAudacity_Pool {
+public:
+    void Submit(std::shared_ptr<PyAudacity_PoolJob> job) {
+        std::lock_guard<std::mutex> guard{mutex};
+        if (threads.empty()) {
+            const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned ii = 0; ii < count; ++ii)
+                threads.emplace_back([this] { Run(); });
+        }
+        queue.push_back(std::move(job));
+        available.notify_one();
+    }
+
+    // cancel every job, let the queued ones complete as failed and wait for
+    // the threads; called without the GIL, which completion takes
+    void Shutdown() {
+        std::vector<std::thread> stopped;
+        {
+            std::lock_guard<std::mutex> guard{mutex};
+            stopping = true;
+            for (const auto &job : queue)
+                job->cancel = true;
+            for (const auto &job : running)
+                job->cancel = true;
+            available.notify_all();
+            stopped.swap(threads);
+        }
+        for (auto &thread : stopped)
+            thread.join();
+        std::lock_guard<std::mutex> guard{mutex};
+        stopping = false;
+    }
+
+private:
+    void Run() {
+        std::unique_lock<std::mutex> lock{mutex};
+        while (true) {
+            available.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            auto job = std::move(queue.front());
+            queue.pop_front();
+            running.push_back(job);
+            lock.unlock();
+
+            const bool result = !job->cancel && job->work(&job->cancel);
+            Complete(*job, result);
+
+            lock.lock();
+            running.erase(std::find(running.begin(), running.end(), job));
+        }
+    }
+
+    static void Complete(PyAudacity_PoolJob &job, bool result) {
+        PyGILState_STATE gil = PyGILState_Ensure();
+        PyObject *value = PyObject_CallMethod(job.loop, "call_soon_threadsafe", "OO", job.callback,
+                                              result ? Py_True : Py_False);
+        // the loop may be closed, with nothing left waiting for the result
+        if (!value)
+            PyErr_Clear();
+        Py_XDECREF(value);
+        Py_CLEAR(job.loop);
+        Py_CLEAR(job.callback);
+        PyGILState_Release(gil);
+    }
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::deque<std::shared_ptr<PyAudacity_PoolJob>> queue;
+    std::vector<std::shared_ptr<PyAudacity_PoolJob>> running;
+    std::vector<std::thread> threads;
+    bool stopping{false};
+};
+
+// never destroyed, so that no thread is left joinable at exit; the module
+// shuts the pool down at exit instead
+static PyAudacity_Pool &
+PyAudacity_GetPool() {
+    static auto *pool = new PyAudacity_Pool;
+    return *pool;
+}
+
+// Job: the handle of a job of the pool returned to Python, to cancel it
+typedef struct {
+    PyObject_HEAD
+    std::shared_ptr<PyAudacity_PoolJob> *job;
+} PyAudacity_Job;
+
+static void
+PyAudacity_Job_dealloc(PyAudacity_Job *self) {
+    PyTypeObject *type = Py_TYPE(self);
+    delete self->job;
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+static PyObject *
+PyAudacity_Job_cancel(PyAudacity_Job *self, PyObject *args) {
+    if (self->job)
+        (*self->job)->cancel = true;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef PyAudacity_Job_methods[] = {
+        {"cancel", (PyCFunction) PyAudacity_Job_cancel, METH_NOARGS,
+         "stop the job before it starts, or between blocks of its input; it then completes with False."},
+        {nullptr,    nullptr, 0,                        nullptr}        /* Sentinel */
+};
+
+static PyType_Slot PyAudacity_Job_slots[] = {
+        {Py_tp_doc, (void *) "a job queued on the native pool."},
+        {Py_tp_dealloc, (void *) PyAudacity_Job_dealloc},
+        {Py_tp_methods, PyAudacity_Job_methods},
+        {0,          nullptr}        /* Sentinel */
+};
+
+static PyType_Spec PyAudacity_Job_spec = {
+        "cmodule.Job",
+        sizeof(PyAudacity_Job),
+        0,
+        Py_TPFLAGS_DEFAULT,
+        PyAudacity_Job_slots,
+};
+
+// the type of Job, made with the module
+static PyObject *PyAudacity_JobType = nullptr;
+
+// queue work on the pool, to call back on loop with its result; a Job, or
+// nullptr with an exception set
+static PyObject *
+PyAudacity_Submit(PyObject *loop, PyObject *callback,
+                  std::function<bool(const std::atomic<bool> *cancel)> work) {
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return nullptr;
+    }
+    auto job = std::make_shared<PyAudacity_PoolJob>();
+    job->work = std::move(work);
+    // tp_alloc takes the reference to the (heap) type that dealloc drops
+    auto type = (PyTypeObject *) PyAudacity_JobType;
+    auto handle = (PyAudacity_Job *) type->tp_alloc(type, 0);
+    if (!handle)
+        return nullptr;
+    handle->job = new std::shared_ptr<PyAudacity_PoolJob>(job);
+    Py_INCREF(loop);
+    job->loop = loop;
+    Py_INCREF(callback);
+    job->callback = callback;
+    PyAudacity_GetPool().Submit(std::move(job));
+    return (PyObject *) handle;
+}
+
+// noisered on the pool:  a Job, completed by callback(result) on loop
+static PyObject *
+pyaudacity_noisered_submit(PyObject *self, PyObject *args) {
+    PyObject *loop;
+    PyObject *callback;
+    const char *profile_path;
+    double profile_start;
+    double profile_end;
+    const char *src_path;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    const char *dst_path;
+    unsigned threads = 1;
+    int streaming = 0;
+    unsigned long long budget = 0;
+    double f0 = -1.0;
+    double f1 = -1.0;
+    PyObject *settings_object = Py_None;
 
     // parse args
-    if (!PyArg_ParseTuple(args, "sddsddds",
+    if (!PyArg_ParseTuple(args, "OOsddsddds|IpKddO", &loop, &callback,
                           &profile_path, &profile_start, &profile_end,
                           &src_path, &noise_gain, &sensitivity, &smoothing,
-                          &dst_path)) {
-        return Py_False;
+                          &dst_path, &threads, &streaming, &budget, &f0, &f1, &settings_object)) {
+        return nullptr;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    // the strings are copied, as args does not outlive the call
+    return PyAudacity_Submit(loop, callback,
+                             [=, profile_path = std::string(profile_path), src_path = std::string(src_path),
+                                 dst_path = std::string(dst_path)](const std::atomic<bool> *cancel) {
+                                 return PyAudacity_Noisered(profile_path.c_str(), profile_start, profile_end,
+                                                            src_path.c_str(), noise_gain, sensitivity,
+                                                            smoothing, dst_path.c_str(), threads,
+                                                            streaming != 0, budget, f0, f1, advanced,
+                                                            cancel);
+                             });
+}
+
+// noisered_with_profile on the pool, as noisered_submit
+static PyObject *
+pyaudacity_noisered_with_profile_submit(PyObject *self, PyObject *args) {
+    PyObject *loop;
+    PyObject *callback;
+    const char *profile_file;
+    const char *src_path;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    const char *dst_path;
+    unsigned threads = 1;
+    int streaming = 0;
+    unsigned long long budget = 0;
+    double f0 = -1.0;
+    double f1 = -1.0;
+    PyObject *settings_object = Py_None;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "OOssddds|IpKddO", &loop, &callback,
+                          &profile_file, &src_path, &noise_gain, &sensitivity, &smoothing,
+                          &dst_path, &threads, &streaming, &budget, &f0, &f1, &settings_object)) {
+        return nullptr;
     }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return nullptr;
+
+    return PyAudacity_Submit(loop, callback,
+                             [=, profile_file = std::string(profile_file), src_path = std::string(src_path),
+                                 dst_path = std::string(dst_path)](const std::atomic<bool> *cancel) {
+                                 return PyAudacity_NoiseredWithProfile(profile_file.c_str(), src_path.c_str(),
+                                                                       noise_gain, sensitivity, smoothing,
+                                                                       dst_path.c_str(), threads,
+                                                                       streaming != 0, budget, f0, f1,
+                                                                       advanced, cancel);
+                             });
+}
 
-    auto result = PyAudacity_Noisered(profile_path, profile_start, profile_end,
-                                      src_path, noise_gain, sensitivity, smoothing,
-                                      dst_path);
+// cancel the jobs of the pool and wait for its threads, before the
+// interpreter finalizes
+static PyObject *
+pyaudacity_shutdown_pool(PyObject *self, PyObject *args) {
+    Py_BEGIN_ALLOW_THREADS
+    PyAudacity_GetPool().Shutdown();
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// NoiseReducer: a noise profile and reduction parameters, with the streams
+// (and so the FFT state and buffers) of one call kept for the next
+struct PyAudacity_NoiseReducerState {
+    EffectNoiseReduction effect;
+    NoiseReductionStreams streams;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    double rate;
+    // calls from several Python threads take turns
+    std::mutex lock;
+};
+
+typedef struct {
+    PyObject_HEAD
+    PyAudacity_NoiseReducerState *state;
+} PyAudacity_NoiseReducer;
+
+static int
+PyAudacity_NoiseReducer_init(PyAudacity_NoiseReducer *self, PyObject *args, PyObject *kwds) {
+    static const char *keywords[] = {"profile_path", "profile_start", "profile_end",
+                                     "noise_gain", "sensitivity", "smoothing", "settings", nullptr};
+    const char *profile_path;
+    double profile_start;
+    double profile_end;
+    double noise_gain;
+    double sensitivity;
+    double smoothing;
+    // None, a preset name or a dict of advanced settings
+    PyObject *settings_object = Py_None;
+
+    // the state may be in use by another thread, in process with the GIL released
+    if (self->state) {
+        PyErr_SetString(PyExc_RuntimeError, "NoiseReducer is already initialized");
+        return -1;
+    }
+
+    // parse args
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sddddd|O", const_cast<char **>(keywords),
+                                     &profile_path, &profile_start, &profile_end,
+                                     &noise_gain, &sensitivity, &smoothing, &settings_object)) {
+        return -1;
+    }
+    EffectNoiseReduction::AdvancedSettings advanced;
+    if (!PyAudacity_ParseSettings(settings_object, advanced))
+        return -1;
+
+    auto state = std::make_unique<PyAudacity_NoiseReducerState>();
+    state->effect.SetAdvancedSettings(advanced);
+    state->noise_gain = noise_gain;
+    state->sensitivity = sensitivity;
+    state->smoothing = smoothing;
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = ProfileCache::Get().GetProfile(state->effect, profile_path, profile_start, profile_end);
+    if (result) {
+        // the first stream, at once, to check the parameters and learn the rate
+        state->streams.push_back(state->effect.CreateStream(noise_gain, sensitivity, smoothing));
+        result = state->streams.back() != nullptr;
+    }
+    Py_END_ALLOW_THREADS
+    if (!result) {
+        PyErr_Format(PyExc_ValueError, "cannot take a noise profile from %s", profile_path);
+        return -1;
+    }
+    state->rate = state->streams[0]->GetRate();
+
+    self->state = state.release();
+    return 0;
+}
+
+static void
+PyAudacity_NoiseReducer_dealloc(PyAudacity_NoiseReducer *self) {
+    // instances hold a reference to their (heap) type
+    PyTypeObject *type = Py_TYPE(self);
+    delete self->state;
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+static bool
+PyAudacity_NoiseReducer_Check(PyAudacity_NoiseReducer *self) {
+    if (!self->state)
+        PyErr_SetString(PyExc_RuntimeError, "NoiseReducer is not initialized");
+    return self->state != nullptr;
+}
+
+static PyObject *
+PyAudacity_NoiseReducer_process(PyAudacity_NoiseReducer *self, PyObject *args) {
+    const char *src_path;
+    const char *dst_path;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "ss", &src_path, &dst_path) || !PyAudacity_NoiseReducer_Check(self)) {
+        return nullptr;
+    }
+
+    auto &state = *self->state;
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    std::lock_guard<std::mutex> guard{state.lock};
+    result = ReduceNoisePCM(state.effect, state.streams, src_path, dst_path,
+                            state.noise_gain, state.sensitivity, state.smoothing) == ProgressResult::Success;
+    Py_END_ALLOW_THREADS
     if (result) {
-        return Py_True;
+        Py_RETURN_TRUE;
     } else {
-        return Py_False;
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject *
+PyAudacity_NoiseReducer_process_array(PyAudacity_NoiseReducer *self, PyObject *args) {
+    PyObject *src_object;
+    PyObject *out_object;
+
+    // parse args
+    if (!PyArg_ParseTuple(args, "OO", &src_object, &out_object) || !PyAudacity_NoiseReducer_Check(self)) {
+        return nullptr;
     }
+
+    auto &state = *self->state;
+    return PyAudacity_ReduceNoiseArray(state.effect, state.streams, &state.lock, src_object, state.rate,
+                                       state.noise_gain, state.sensitivity, state.smoothing, out_object);
+}
+
+static PyObject *
+PyAudacity_NoiseReducer_get_rate(PyAudacity_NoiseReducer *self, void *closure) {
+    if (!PyAudacity_NoiseReducer_Check(self))
+        return nullptr;
+    return PyFloat_FromDouble(self->state->rate);
+}
+
+static PyMethodDef PyAudacity_NoiseReducer_methods[] = {
+        {"process", (PyCFunction) PyAudacity_NoiseReducer_process, METH_VARARGS,
+         "noise reduction of a file into another, a chunk at a time."},
+        {"process_array", (PyCFunction) PyAudacity_NoiseReducer_process_array, METH_VARARGS,
+         "noise reduction of samples in a buffer, into another."},
+        {nullptr,    nullptr, 0,                        nullptr}        /* Sentinel */
+};
+
+static PyGetSetDef PyAudacity_NoiseReducer_getset[] = {
+        {"rate", (getter) PyAudacity_NoiseReducer_get_rate, nullptr, "sample rate of the noise profile.", nullptr},
+        {nullptr,    nullptr, nullptr,                   nullptr, nullptr}        /* Sentinel */
+};
+
+static PyType_Slot PyAudacity_NoiseReducer_slots[] = {
+        {Py_tp_doc, (void *) "noise profile and reduction parameters, reused from one call to the next."},
+        {Py_tp_new, (void *) PyType_GenericNew},
+        {Py_tp_init, (void *) PyAudacity_NoiseReducer_init},
+        {Py_tp_dealloc, (void *) PyAudacity_NoiseReducer_dealloc},
+        {Py_tp_methods, PyAudacity_NoiseReducer_methods},
+        {Py_tp_getset, PyAudacity_NoiseReducer_getset},
+        {0,          nullptr}        /* Sentinel */
+};
+
+static PyType_Spec PyAudacity_NoiseReducer_spec = {
+        "cmodule.NoiseReducer",
+        sizeof(PyAudacity_NoiseReducer),
+        0,
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+        PyAudacity_NoiseReducer_slots,
+};
+
+// Instrumentation::Enable or Disable; they nest
+static PyObject *
+pyaudacity_enable_stats(PyObject *self, PyObject *args) {
+    int enable;
+    if (!PyArg_ParseTuple(args, "p", &enable))
+        return nullptr;
+    if (enable)
+        Instrumentation::Enable();
+    else
+        Instrumentation::Disable();
+    Py_RETURN_NONE;
+}
+
+// {"stages": {name: {"calls": n, "seconds": s}, ...}, "counters": {name: n, ...},
+//  "gauges": {name: {"live": bytes, "peak": bytes}, ...}}, the totals of the process
+static PyObject *
+pyaudacity_stats(PyObject *self, PyObject *args) {
+    const auto report = Instrumentation::GetReport();
+    PyObject *stages = PyDict_New();
+    if (!stages)
+        return nullptr;
+    for (unsigned ii = 0; ii < Instrumentation::nStages; ++ii) {
+        const auto &timing = report.stages[ii];
+        PyObject *item = Py_BuildValue("{s:K,s:d}", "calls", timing.calls,
+                                       "seconds", timing.nanoseconds * 1e-9);
+        if (!item || PyDict_SetItemString(stages, Instrumentation::GetName((Instrumentation::Stage) ii), item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(stages);
+            return nullptr;
+        }
+        Py_DECREF(item);
+    }
+    PyObject *counters = PyDict_New();
+    if (!counters) {
+        Py_DECREF(stages);
+        return nullptr;
+    }
+    for (unsigned ii = 0; ii < Instrumentation::nCounters; ++ii) {
+        PyObject *item = PyLong_FromUnsignedLongLong(report.counters[ii]);
+        if (!item ||
+            PyDict_SetItemString(counters, Instrumentation::GetName((Instrumentation::Counter) ii), item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(stages);
+            Py_DECREF(counters);
+            return nullptr;
+        }
+        Py_DECREF(item);
+    }
+    PyObject *gauges = PyDict_New();
+    if (!gauges) {
+        Py_DECREF(stages);
+        Py_DECREF(counters);
+        return nullptr;
+    }
+    for (unsigned ii = 0; ii < Instrumentation::nGauges; ++ii) {
+        const auto &level = report.gauges[ii];
+        PyObject *item = Py_BuildValue("{s:K,s:K}", "live", level.live, "peak", level.peak);
+        if (!item || PyDict_SetItemString(gauges, Instrumentation::GetName((Instrumentation::Gauge) ii), item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(stages);
+            Py_DECREF(counters);
+            Py_DECREF(gauges);
+            return nullptr;
+        }
+        Py_DECREF(item);
+    }
+    return Py_BuildValue("{s:N,s:N,s:N}", "stages", stages, "counters", counters, "gauges", gauges);
+}
+
+// Instrumentation::ResetPeaks
+static PyObject *
+pyaudacity_reset_peaks(PyObject *self, PyObject *args) {
+    Instrumentation::ResetPeaks();
+    Py_RETURN_NONE;
+}
+
+// Instrumentation::WatchPeaks, returning the watch
+static PyObject *
+pyaudacity_watch_peaks(PyObject *self, PyObject *args) {
+    return PyLong_FromLong(Instrumentation::WatchPeaks());
+}
+
+// Instrumentation::UnwatchPeaks(watch), returning {name: peak bytes, ...}
+static PyObject *
+pyaudacity_unwatch_peaks(PyObject *self, PyObject *args) {
+    int watch;
+    if (!PyArg_ParseTuple(args, "i", &watch))
+        return nullptr;
+    if (watch >= (int) SpaceGauge::nWatches) {
+        PyErr_SetString(PyExc_ValueError, "not a watch of the peaks");
+        return nullptr;
+    }
+    unsigned long long peaks[Instrumentation::nGauges];
+    Instrumentation::UnwatchPeaks(watch, peaks);
+    PyObject *gauges = PyDict_New();
+    if (!gauges)
+        return nullptr;
+    for (unsigned ii = 0; ii < Instrumentation::nGauges; ++ii) {
+        PyObject *item = PyLong_FromUnsignedLongLong(peaks[ii]);
+        if (!item || PyDict_SetItemString(gauges, Instrumentation::GetName((Instrumentation::Gauge) ii), item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(gauges);
+            return nullptr;
+        }
+        Py_DECREF(item);
+    }
+    return gauges;
+}
+
+// Instrumentation::StartTrace
+static PyObject *
+pyaudacity_start_trace(PyObject *self, PyObject *args) {
+    if (Instrumentation::StartTrace()) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+// Instrumentation::StopTrace, writing the trace to path
+static PyObject *
+pyaudacity_stop_trace(PyObject *self, PyObject *args) {
+    const char *path;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return nullptr;
+
+    bool result;
+    Py_BEGIN_ALLOW_THREADS
+    result = Instrumentation::StopTrace(std::string(path));
+    Py_END_ALLOW_THREADS
+    if (result) {
+        Py_RETURN_TRUE;
+    } else {
+        Py_RETURN_FALSE;
+    }
+}
+
+// ProfileCache::SetCapacity and SetDirectory; directory None (or empty) for
+// memory only
+static PyObject *
+pyaudacity_set_profile_cache(PyObject *self, PyObject *args) {
+    Py_ssize_t capacity;
+    const char *directory = nullptr;
+    if (!PyArg_ParseTuple(args, "n|z", &capacity, &directory))
+        return nullptr;
+    if (capacity < 0) {
+        PyErr_SetString(PyExc_ValueError, "capacity must not be negative");
+        return nullptr;
+    }
+
+    auto &cache = ProfileCache::Get();
+    cache.SetCapacity((size_t) capacity);
+    cache.SetDirectory(directory ? directory : "");
+    Py_RETURN_NONE;
+}
+
+// ProfileCache::Clear
+static PyObject *
+pyaudacity_clear_profile_cache(PyObject *self, PyObject *args) {
+    ProfileCache::Get().Clear();
+    Py_RETURN_NONE;
+}
+
+// {"hits": n, "disk_hits": n, "misses": n, "entries": n} of ProfileCache::GetCounts
+static PyObject *
+pyaudacity_profile_cache_stats(PyObject *self, PyObject *args) {
+    const auto counts = ProfileCache::Get().GetCounts();
+    return Py_BuildValue("{s:K,s:K,s:K,s:n}", "hits", counts.hits, "disk_hits", counts.diskHits,
+                         "misses", counts.misses, "entries", (Py_ssize_t) counts.entries);
 }
 
 static PyMethodDef NoiseredMethods[] = {
         {"noisered", pyaudacity_noisered, METH_VARARGS, "noise reduction."},
+        {"noisered_auto", pyaudacity_noisered_auto, METH_VARARGS,
+         "noise reduction with a profile of the quietest windows of the file."},
+        {"save_profile", pyaudacity_save_profile, METH_VARARGS, "save noise profile to a file."},
+        {"noisered_with_profile", pyaudacity_noisered_with_profile, METH_VARARGS,
+         "noise reduction with a saved noise profile."},
+        {"noisered_bytes", pyaudacity_noisered_bytes, METH_VARARGS,
+         "noise reduction of a sound file in memory."},
+        {"noisered_bytes_with_profile", pyaudacity_noisered_bytes_with_profile, METH_VARARGS,
+         "noise reduction of a sound file in memory with a saved noise profile."},
+        {"noisered_array", pyaudacity_noisered_array, METH_VARARGS,
+         "noise reduction of samples in a buffer, into another."},
+        {"noisered_array_with_profile", pyaudacity_noisered_array_with_profile, METH_VARARGS,
+         "noise reduction of samples in a buffer, into another, with a saved noise profile."},
+        {"noisered_batch", pyaudacity_noisered_batch, METH_VARARGS,
+         "noise reduction of many files with a saved noise profile, on a pool of threads."},
+        {"noisered_submit", pyaudacity_noisered_submit, METH_VARARGS,
+         "noise reduction on the native pool, calling back on an event loop with the result."},
+        {"noisered_with_profile_submit", pyaudacity_noisered_with_profile_submit, METH_VARARGS,
+         "noise reduction with a saved noise profile on the native pool, calling back on an event loop."},
+        {"shutdown_pool", pyaudacity_shutdown_pool, METH_NOARGS,
+         "cancel the jobs of the native pool and wait for its threads."},
+        {"enable_stats", pyaudacity_enable_stats, METH_VARARGS,
+         "enable (True) or disable (False) the stage timers and counters; calls nest."},
+        {"stats", pyaudacity_stats, METH_NOARGS, "totals of the stage timers and counters of the process."},
+        {"reset_peaks", pyaudacity_reset_peaks, METH_NOARGS, "make the peaks of the gauges their live bytes."},
+        {"watch_peaks", pyaudacity_watch_peaks, METH_NOARGS,
+         "keep peaks of the gauges from now for one caller, returning the watch (-1 if too many)."},
+        {"unwatch_peaks", pyaudacity_unwatch_peaks, METH_VARARGS,
+         "the peaks of the gauges since watch_peaks returned the watch, which ends."},
+        {"start_trace", pyaudacity_start_trace, METH_NOARGS, "record spans of the stages on every thread."},
+        {"stop_trace", pyaudacity_stop_trace, METH_VARARGS,
+         "stop recording, and write the spans to a file as Chrome trace event JSON."},
+        {"set_profile_cache", pyaudacity_set_profile_cache, METH_VARARGS,
+         "set the profiles kept in memory, and a directory to keep them in too."},
+        {"clear_profile_cache", pyaudacity_clear_profile_cache, METH_NOARGS,
+         "forget the profiles kept in memory."},
+        {"profile_cache_stats", pyaudacity_profile_cache_stats, METH_NOARGS,
+         "hits, disk hits and misses of the profile cache, and its entries in memory."},
         {nullptr,    nullptr, 0,                        nullptr}        /* Sentinel */
 };
 
@@ -117,5 +1461,29 @@ static struct PyModuleDef noiseredmodule = {
 
 PyMODINIT_FUNC
 PyInit_cmodule(void) {
-    return PyModule_Create(&noiseredmodule);
-}
+    PyObject *module = PyModule_Create(&noiseredmodule);
+    if (!module)
+        return nullptr;
+    PyObject *type = PyType_FromSpec(&PyAudacity_NoiseReducer_spec);
+    if (!type || PyModule_AddObject(module, "NoiseReducer", type) < 0) {
+        Py_XDECREF(type);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    // the module keeps a reference, and so does PyAudacity_JobType
+    type = PyType_FromSpec(&PyAudacity_Job_spec);
+    if (!type) {
+        Py_DECREF(module);
+        return nullptr;
+    }
+    Py_INCREF(type);
+    if (PyModule_AddObject(module, "Job", type) < 0) {
+        Py_DECREF(type);
+        Py_DECREF(type);
+        Py_DECREF(module);
+        return nullptr;
+    }
+    Py_XDECREF(PyAudacity_JobType);
+    PyAudacity_JobType = type;
+    return module;
+}
\ No newline at end of file
@@ -1,3 +1,6 @@
+import asyncio
+import os
+import tempfile
 import unittest
 import pyaudacity
 import numpy as np
@@ -5,6 +8,8 @@ from scipy.io import wavfile
 from scipy.signal import spectrogram
 # import yep
 
+TEST_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir)
+
 
 # Calculate spectrogram for a wav audio file
 def create_spectrogram(wav_file):
@@ -22,21 +27,272 @@ def create_spectrogram(wav_file):
     return pxx
 
 
+# Mean power of each frequency over the spectrogram, in dB
+def mean_spectrum(wav_file):
+    return 10 * np.log10(create_spectrogram(wav_file).mean(axis=1) + 1e-30)
+
+
 class TestSpectrogram(unittest.TestCase):
     def test_noisered(self):
-        input = '/var/tmp/keyword_recognizer/input.wav'
-        prof = '/var/tmp/keyword_recognizer/bg_input.wav'
-        output = '/var/tmp/keyword_recognizer/noisered.wav'
-
-        # yep.start('outcome.prof')
-        # result = pyaudacity.noisered('../test.wav', 0.000, 0.300, '../test.wav', 12.0, 6.0, 3.0, 'test_out.wav')
-        result = pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output)
-        self.assertEqual(result, True)
-        # expected = create_spectrogram('../test_answer.wav')
-        # actual = create_spectrogram('test_out.wav')
-        # result does not match
-        # np.testing.assert_almost_equal(expected, actual, decimal=5)
-        # yep.stop()
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            output = os.path.join(directory, 'noisered.wav')
+
+            # yep.start('outcome.prof')
+            result = pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output)
+            self.assertEqual(result, True)
+            # yep.stop()
+
+    def test_noisered_auto(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            output = os.path.join(directory, 'noisered.wav')
+            result = pyaudacity.noisered_auto(input, 0.1, 12.0, 6.0, 3.0, output)
+            self.assertEqual(result, True)
+            self.assertEqual(wavfile.read(output)[1].shape, wavfile.read(input)[1].shape)
+
+    def test_noisered_async(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            expected = os.path.join(directory, 'expected.wav')
+            self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, expected))
+            outputs = [os.path.join(directory, f'noisered{ii}.wav') for ii in range(8)]
+
+            async def reduce_all():
+                return await asyncio.gather(*(pyaudacity.noisered_async(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0,
+                                                                        output) for output in outputs))
+
+            self.assertEqual(asyncio.run(reduce_all()), [True] * len(outputs))
+            for output in outputs:
+                np.testing.assert_array_equal(wavfile.read(output)[1], wavfile.read(expected)[1])
+
+    def test_noisered_async_cancel(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            async def cancel():
+                task = asyncio.ensure_future(pyaudacity.noisered_async(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0,
+                                                                       os.path.join(directory, 'noisered.wav')))
+                await asyncio.sleep(0)
+                task.cancel()
+                with self.assertRaises(asyncio.CancelledError):
+                    await task
+                # the pool goes on with other jobs
+                return await pyaudacity.noisered_async(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0,
+                                                       os.path.join(directory, 'after.wav'))
+
+            self.assertEqual(asyncio.run(cancel()), True)
+
+    def test_noisered_settings(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            default = os.path.join(directory, 'none.wav')
+            self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, default))
+            for preset in pyaudacity.PRESETS:
+                output = os.path.join(directory, f'{preset}.wav')
+                self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output,
+                                                    settings=preset))
+                self.assertEqual(wavfile.read(output)[1].shape, wavfile.read(default)[1].shape)
+            np.testing.assert_array_equal(wavfile.read(os.path.join(directory, 'default.wav'))[1],
+                                          wavfile.read(default)[1])
+
+            output = os.path.join(directory, 'custom.wav')
+            self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output,
+                                                settings={'window_size': 1024, 'steps_per_window': 8,
+                                                          'method': 'median', 'release_time': 0.2}))
+
+            # a profile is applied with the window size it was taken with
+            profile = os.path.join(directory, 'quality.prof')
+            self.assertTrue(pyaudacity.save_profile(prof, 0.000, 0.500, profile, settings='quality'))
+            self.assertTrue(pyaudacity.noisered_with_profile(profile, input, 12.0, 6.0, 3.0, output,
+                                                             settings='quality'))
+            self.assertFalse(pyaudacity.noisered_with_profile(profile, input, 12.0, 6.0, 3.0, output))
+
+            for settings in ('slow', {'window_size': 1000}, {'steps_per_window': 128}, {'method': 'mean'},
+                             {'window_types': 7}, {'attack_time': 2.0}, {'hop': 4},
+                             {'window_types': 2, 'steps_per_window': 2}):
+                with self.assertRaises(ValueError):
+                    pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output, settings=settings)
+
+    def test_noisered_batch(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            expected = os.path.join(directory, 'expected.wav')
+            self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, expected))
+            profile = os.path.join(directory, 'noise.prof')
+            self.assertTrue(pyaudacity.save_profile(prof, 0.000, 0.500, profile))
+
+            files = [(input, os.path.join(directory, f'batch{ii}.wav')) for ii in range(4)]
+            files.append((os.path.join(directory, 'missing.wav'), os.path.join(directory, 'missing_out.wav')))
+            # the default slices, none, and slices much shorter than the input
+            for slice_frames in (None, 0, 4096):
+                results = pyaudacity.noisered_batch(profile, files, 12.0, 6.0, 3.0, threads=2,
+                                                    slice_frames=slice_frames)
+                self.assertEqual([ok for ok, seconds in results], [True] * 4 + [False])
+                for src, dst in files[:-1]:
+                    np.testing.assert_array_equal(wavfile.read(dst)[1], wavfile.read(expected)[1])
+
+            self.assertEqual(pyaudacity.noisered_batch(os.path.join(directory, 'missing.prof'), files[:2],
+                                                       12.0, 6.0, 3.0),
+                             [(False, 0.0)] * 2)
+            with self.assertRaises(ValueError):
+                pyaudacity.noisered_batch(profile, files, 12.0, 6.0, 3.0, slice_frames=-1)
+            with self.assertRaises(TypeError):
+                pyaudacity.noisered_batch(profile, [input], 12.0, 6.0, 3.0)
+
+    def test_noisered_bytes(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            expected = os.path.join(directory, 'expected.wav')
+            self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, expected))
+            profile = os.path.join(directory, 'noise.prof')
+            self.assertTrue(pyaudacity.save_profile(prof, 0.000, 0.500, profile))
+            with open(prof, 'rb') as file:
+                profile_audio = file.read()
+            with open(input, 'rb') as file:
+                src = file.read()
+            with open(profile, 'rb') as file:
+                saved = file.read()
+            with open(expected, 'rb') as file:
+                dst = file.read()
+
+            self.assertEqual(pyaudacity.noisered_bytes(profile_audio, 0.000, 0.500, src, 12.0, 6.0, 3.0), dst)
+            self.assertEqual(pyaudacity.noisered_bytes_with_profile(saved, memoryview(src), 12.0, 6.0, 3.0), dst)
+
+            self.assertIsNone(pyaudacity.noisered_bytes(profile_audio, 0.000, 0.500, b'junk', 12.0, 6.0, 3.0))
+            self.assertIsNone(pyaudacity.noisered_bytes(b'junk', 0.000, 0.500, src, 12.0, 6.0, 3.0))
+            self.assertIsNone(pyaudacity.noisered_bytes_with_profile(saved, b'junk', 12.0, 6.0, 3.0))
+            self.assertIsNone(pyaudacity.noisered_bytes_with_profile(b'junk', src, 12.0, 6.0, 3.0))
+
+    def test_noisered_array(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            expected = os.path.join(directory, 'expected.wav')
+            self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, expected))
+            profile = os.path.join(directory, 'noise.prof')
+            self.assertTrue(pyaudacity.save_profile(prof, 0.000, 0.500, profile))
+            with open(profile, 'rb') as file:
+                saved = file.read()
+
+            rate, src = wavfile.read(input)
+            noise = wavfile.read(prof)[1][:rate // 2]
+            out = pyaudacity.noisered_array(noise, src, rate, 12.0, 6.0, 3.0)
+            self.assertEqual(out.dtype, np.int16)
+            np.testing.assert_array_equal(out, wavfile.read(expected)[1])
+            given = np.empty_like(src)
+            self.assertIs(pyaudacity.noisered_array_with_profile(saved, src, rate, 12.0, 6.0, 3.0, out=given),
+                          given)
+            np.testing.assert_array_equal(given, out)
+
+            # float32, and frames by channels, each channel reduced as the mono samples
+            out = pyaudacity.noisered_array(noise, src.astype(np.float32) / 32768, rate, 12.0, 6.0, 3.0)
+            self.assertEqual(out.dtype, np.float32)
+            stereo = pyaudacity.noisered_array(noise, np.stack([src, src], axis=1), rate, 12.0, 6.0, 3.0)
+            self.assertEqual(stereo.shape, (len(src), 2))
+            np.testing.assert_array_equal(stereo[:, 0], given)
+            np.testing.assert_array_equal(stereo[:, 1], given)
+
+            with self.assertRaises(TypeError):
+                pyaudacity.noisered_array(noise, src.astype(np.float64), rate, 12.0, 6.0, 3.0)
+            with self.assertRaises(TypeError):
+                pyaudacity.noisered_array(noise, src, rate, 12.0, 6.0, 3.0, out=np.empty(len(src), np.int32))
+            with self.assertRaises(ValueError):
+                pyaudacity.noisered_array(noise, src.reshape(-1, 2, 2), rate, 12.0, 6.0, 3.0)
+            with self.assertRaises(ValueError):
+                pyaudacity.noisered_array(noise, src, rate, 12.0, 6.0, 3.0, out=np.empty(len(src) - 1, np.int16))
+            with self.assertRaises(ValueError):
+                pyaudacity.noisered_array(noise, src, rate, 12.0, 6.0, 3.0,
+                                          out=np.empty((len(src), 2), np.int16))
+            # NumPy raises ValueError or BufferError, by version
+            with self.assertRaises((BufferError, ValueError)):
+                pyaudacity.noisered_array(noise, src[::2], rate, 12.0, 6.0, 3.0)
+            with self.assertRaises((BufferError, ValueError)):
+                pyaudacity.noisered_array_with_profile(saved, np.stack([src, src], axis=1)[:, 0], rate,
+                                                       12.0, 6.0, 3.0)
+
+    def test_noise_reducer(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            expected = os.path.join(directory, 'expected.wav')
+            self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, expected))
+
+            reducer = pyaudacity.NoiseReducer(prof, 0.000, 0.500, 12.0, 6.0, 3.0)
+            self.assertEqual(reducer.rate, 16000)
+            # the streams of one call are reused by the next, to the same result
+            for ii in range(2):
+                output = os.path.join(directory, f'process{ii}.wav')
+                self.assertTrue(reducer.process(input, output))
+                np.testing.assert_array_equal(wavfile.read(output)[1], wavfile.read(expected)[1])
+
+            src = wavfile.read(input)[1]
+            out = reducer.process_array(src)
+            self.assertEqual(out.dtype, src.dtype)
+            np.testing.assert_array_equal(out, wavfile.read(expected)[1])
+            given = np.empty_like(src)
+            self.assertIs(reducer.process_array(src, given), given)
+            np.testing.assert_array_equal(given, out)
+
+            # the state may be in use by another thread
+            with self.assertRaises(RuntimeError):
+                reducer.__init__(prof, 0.000, 0.500, 12.0, 6.0, 3.0)
+            with self.assertRaises(RuntimeError):
+                pyaudacity.NoiseReducer.__new__(pyaudacity.NoiseReducer).process(input, output)
+
+            with self.assertRaises(TypeError):
+                pyaudacity.NoiseReducer(prof, 0.000, 0.500)
+            with self.assertRaises(ValueError):
+                pyaudacity.NoiseReducer(os.path.join(directory, 'missing.wav'), 0.000, 0.500, 12.0, 6.0, 3.0)
+            with self.assertRaises(ValueError):
+                pyaudacity.NoiseReducer(prof, 0.000, 0.500, 12.0, 6.0, 3.0, settings='slow')
+
+    def test_profile_cache(self):
+        input = os.path.join(TEST_DIR, 'input.wav')
+        prof = os.path.join(TEST_DIR, 'bg_input.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            profiles = os.path.join(directory, 'profiles')
+            os.mkdir(profiles)
+            pyaudacity.set_profile_cache(directory=profiles)
+            try:
+                pyaudacity.clear_profile_cache()
+                outputs = [os.path.join(directory, f'noisered{ii}.wav') for ii in range(3)]
+                before = pyaudacity.profile_cache_stats()
+                for output in outputs:
+                    self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, output))
+                after = pyaudacity.profile_cache_stats()
+                self.assertEqual(after['misses'] - before['misses'], 1)
+                self.assertEqual(after['hits'] - before['hits'], 2)
+                for output in outputs[1:]:
+                    np.testing.assert_array_equal(wavfile.read(output)[1], wavfile.read(outputs[0])[1])
+
+                # found again in the directory once forgotten in memory
+                pyaudacity.clear_profile_cache()
+                self.assertTrue(pyaudacity.noisered(prof, 0.000, 0.500, input, 12.0, 6.0, 3.0, outputs[0]))
+                self.assertEqual(pyaudacity.profile_cache_stats()['disk_hits'] - after['disk_hits'], 1)
+                self.assertEqual(len(os.listdir(profiles)), 1)
+            finally:
+                pyaudacity.set_profile_cache()
+
+    def test_noisered_matches_answer(self):
+        # test_answer.wav is Audacity's reduction of test.wav, with its own
+        # first 0.3 seconds as the profile.  The samples differ by the
+        # dither of the 16 bit exports, so compare the loud part of the
+        # spectra, where the dither is negligible.
+        source = os.path.join(TEST_DIR, 'test.wav')
+        with tempfile.TemporaryDirectory() as directory:
+            output = os.path.join(directory, 'test_out.wav')
+            result = pyaudacity.noisered(source, 0.000, 0.300, source, 12.0, 6.0, 3.0, output)
+            self.assertEqual(result, True)
+            expected = mean_spectrum(os.path.join(TEST_DIR, 'test_answer.wav'))
+            actual = mean_spectrum(output)
+        loud = expected >= expected.max() - 30.0
+        np.testing.assert_allclose(actual[loud], expected[loud], atol=0.5)
 
 
 if __name__ == '__main__':
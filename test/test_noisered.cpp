@@ -4,18 +4,44 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <csignal>
 #include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <random>
+#include <thread>
+#include <tuple>
 
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <openssl/md5.h>
 
+#include "Dither.h"
 #include "ExportPCM.h"
+#include "Arena.h"
 #include "Audacity.h"
 #include "WaveTrack.h"
 #include "NoiseReduction.h"
+#include "NoiseReductionKernels.h"
+#include "RealFFTf.h"
+#include "FFTBackend.h"
+#include "FileException.h"
 #include "ImportPCM.h"
+#include "Instrumentation.h"
+#include "ProfileCache.h"
+#include "ReduceNoisePCM.h"
+#include "SampleKernels.h"
+#include "SimpleBlockFile.h"
+#include "Utils.h"
 
 namespace {
 
@@ -60,6 +86,942 @@ TEST_CASE("import and export") {
         remove("test_out.wav");
         delete factory;
     }
+
+    SECTION("in-memory storage") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        auto handler = PCMImportFileHandle::Open("test.wav");
+        REQUIRE(handler != nullptr);
+        TrackHolders holders{};
+        auto import_result = handler->Import(factory, holders);
+        REQUIRE(import_result == ProgressResult::Success);
+
+        auto exporter = ExportPCM();
+        auto audioArray = WaveTrackConstArray();
+        audioArray.emplace_back(std::move(holders.at(0)));
+        auto export_result = exporter.Export(audioArray, std::string("test_out.wav"));
+        REQUIRE(export_result == ProgressResult::Success);
+
+        CHECK(calc_file_hash("test.wav") == calc_file_hash("test_out.wav"));
+        remove("test_out.wav");
+        delete factory;
+    }
+
+    SECTION("cached block files stay within the budget and read as written.") {
+        // import, reduce and export with block files under the temp dir
+        auto run = [](std::vector<char> &dst, size_t &held) {
+            const auto dir_manager = std::make_shared<DirManager>();
+            auto factory = std::make_unique<TrackFactory>(dir_manager);
+            TrackHolders bg_holders{}, holders{};
+            REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) ==
+                    ProgressResult::Success);
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) == ProgressResult::Success);
+            EffectNoiseReduction effect;
+            REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+            REQUIRE(effect.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory.get()));
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(holders.at(0)));
+            REQUIRE(ExportPCM().ExportToMemory(audioArray, dst) == ProgressResult::Success);
+            held = SimpleBlockFile::GetCacheStatistics().bytes;
+        };
+
+        REQUIRE_FALSE(SimpleBlockFile::GetCache());
+        std::vector<char> expected;
+        size_t held;
+        run(expected, held);
+        CHECK(held == 0);
+
+        // everything fits
+        SimpleBlockFile::SetCacheBudget(64 << 20);
+        SimpleBlockFile::ResetCacheStatistics();
+        std::vector<char> actual;
+        run(actual, held);
+        CHECK(actual == expected);
+        auto statistics = SimpleBlockFile::GetCacheStatistics();
+        CHECK(held > 0);
+        CHECK(statistics.hits > 0);
+        CHECK(statistics.misses == 0);
+        CHECK(statistics.spills == 0);
+        CHECK(statistics.bytes == 0);
+
+        // spilled to disk and read back
+        const size_t budget = 256 << 10;
+        SimpleBlockFile::SetCacheBudget(budget);
+        SimpleBlockFile::ResetCacheStatistics();
+        actual.clear();
+        run(actual, held);
+        CHECK(actual == expected);
+        statistics = SimpleBlockFile::GetCacheStatistics();
+        CHECK(held <= budget);
+        CHECK(statistics.evictions > 0);
+        CHECK(statistics.spills > 0);
+        CHECK(statistics.misses > 0);
+
+        // a deferred block is written when asked, and stays cached
+        {
+            DirManager dirManager;
+            SimpleBlockFile::SetCacheBudget(64 << 20);
+            std::vector<short> samples(1000, 7);
+            const auto block = dirManager.NewSimpleBlockFile((samplePtr) samples.data(), samples.size(),
+                                                             int16Sample);
+            struct stat info;
+            const auto path = block->GetFileName().name.GetFullPath();
+            CHECK(stat(path.c_str(), &info) != 0);
+            CHECK(block->WriteCacheToDisk());
+            CHECK(stat(path.c_str(), &info) == 0);
+            CHECK(SimpleBlockFile::GetCacheStatistics().bytes == samples.size() * sizeof(short));
+        }
+
+        // blocks spilled by threads at once, while all of them read, read as written
+        SimpleBlockFile::SetCacheBudget(64 << 10);
+        SimpleBlockFile::ResetCacheStatistics();
+        std::vector<std::thread> threads;
+        std::atomic<int> mismatches{0};
+        for (int tt = 0; tt < 8; ++tt)
+            threads.emplace_back([tt, &mismatches] {
+                DirManager dirManager;
+                std::vector<BlockFilePtr> blocks;
+                std::vector<float> samples(4096), read(4096);
+                for (int ii = 0; ii < 40; ++ii) {
+                    std::fill(samples.begin(), samples.end(), tt * 100 + ii);
+                    blocks.push_back(dirManager.NewSimpleBlockFile((samplePtr) samples.data(), samples.size(),
+                                                                   floatSample));
+                    for (int jj = 0; jj <= ii; jj += 7) {
+                        blocks[jj]->ReadData((samplePtr) read.data(), floatSample, 0, read.size());
+                        if (!std::all_of(read.begin(), read.end(),
+                                         [&](float value) { return value == tt * 100 + jj; }))
+                            ++mismatches;
+                    }
+                }
+                // some dropped while others may be writing them
+                blocks.resize(blocks.size() / 2);
+            });
+        for (auto &thread : threads)
+            thread.join();
+        CHECK(mismatches == 0);
+        CHECK(SimpleBlockFile::GetCacheStatistics().spills > 0);
+        CHECK(SimpleBlockFile::GetCacheStatistics().bytes == 0);
+
+        SimpleBlockFile::SetCacheBudget(0);
+        CHECK_FALSE(SimpleBlockFile::GetCache());
+        CHECK(SimpleBlockFile::GetCacheStatistics().bytes == 0);
+    }
+
+    SECTION("block files without summaries hold just the samples, and read as written.") {
+        auto run = [](bool summaries, std::vector<char> &dst) {
+            const auto dir_manager = std::make_shared<DirManager>();
+            dir_manager->SetBlockSummaries(summaries);
+            auto factory = std::make_unique<TrackFactory>(dir_manager);
+            TrackHolders bg_holders{}, holders{};
+            REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) ==
+                    ProgressResult::Success);
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) == ProgressResult::Success);
+            EffectNoiseReduction effect;
+            REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+            REQUIRE(effect.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory.get()));
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(holders.at(0)));
+            REQUIRE(ExportPCM().ExportToMemory(audioArray, dst) == ProgressResult::Success);
+        };
+        std::vector<char> expected, actual;
+        run(true, expected);
+        run(false, actual);
+        CHECK(actual == expected);
+
+        const auto fileSize = [](bool summaries) {
+            DirManager dirManager;
+            dirManager.SetBlockSummaries(summaries);
+            std::vector<short> samples(1000, 1);
+            const auto block = dirManager.NewSimpleBlockFile((samplePtr) samples.data(), samples.size(),
+                                                             int16Sample, false);
+            std::ifstream file{block->GetFileName().name.GetFullPath(), std::ios::binary | std::ios::ate};
+            std::vector<short> read(samples.size());
+            block->ReadData((samplePtr) read.data(), int16Sample, 0, read.size());
+            CHECK(read == samples);
+            return (size_t) file.tellg();
+        };
+        CHECK(fileSize(false) == sizeof(auHeader) + 1000 * sizeof(short));
+        CHECK(fileSize(true) > fileSize(false));
+    }
+
+    SECTION("block files count in the gauges while they live, and none are made beyond the budget.") {
+        for (const bool inMemory : {true, false}) {
+            DirManager dirManager{inMemory};
+            dirManager.SetBlockSummaries(false);
+            const auto blockBytes = 1000 * sizeof(short) + (inMemory ? 0 : sizeof(auHeader));
+            std::vector<short> samples(1000, 1);
+            const auto &space = dirManager.GetBlockSpace();
+            const auto processLive = Instrumentation::GetReport().gauges[Instrumentation::BlockFiles].live;
+            {
+                const auto first = dirManager.NewSimpleBlockFile((samplePtr) samples.data(), samples.size(),
+                                                                 int16Sample, false);
+                auto second = dirManager.NewSimpleBlockFile((samplePtr) samples.data(), samples.size(),
+                                                            int16Sample, false);
+                CHECK(first->GetSpaceUsage() == (inMemory ? 0 : blockBytes));
+                CHECK(space.GetLive() == 2 * blockBytes);
+#ifndef NOISERED_NO_INSTRUMENTATION
+                CHECK(Instrumentation::GetReport().gauges[Instrumentation::BlockFiles].live ==
+                      processLive + 2 * blockBytes);
+#endif
+                second.reset();
+                CHECK(space.GetLive() == blockBytes);
+                CHECK(space.GetPeak() == 2 * blockBytes);
+
+                dirManager.SetSpaceBudget(2 * blockBytes);
+                CHECK(dirManager.HasSpaceFor(blockBytes));
+                CHECK_FALSE(dirManager.HasSpaceFor(blockBytes + 1));
+                second = dirManager.NewSimpleBlockFile((samplePtr) samples.data(), samples.size(),
+                                                       int16Sample, false);
+                CHECK_THROWS_AS(dirManager.NewSimpleBlockFile((samplePtr) samples.data(), samples.size(),
+                                                              int16Sample, false),
+                                FileException);
+                CHECK(space.GetLive() == 2 * blockBytes);
+            }
+            CHECK(space.GetLive() == 0);
+            CHECK(Instrumentation::GetReport().gauges[Instrumentation::BlockFiles].live == processLive);
+        }
+
+        // sample buffers and arenas give back what they take
+        const auto report = Instrumentation::GetReport();
+        {
+            SampleBuffer buffer{1000, floatSample};
+            Arena arena;
+            arena.Allocate(100);
+#ifndef NOISERED_NO_INSTRUMENTATION
+            const auto during = Instrumentation::GetReport();
+            CHECK(during.gauges[Instrumentation::SampleBuffers].live ==
+                  report.gauges[Instrumentation::SampleBuffers].live + 1000 * sizeof(float));
+            CHECK(during.gauges[Instrumentation::Arenas].live ==
+                  report.gauges[Instrumentation::Arenas].live + arena.GetCapacity());
+#endif
+        }
+        const auto after = Instrumentation::GetReport();
+        CHECK(after.gauges[Instrumentation::SampleBuffers].live == report.gauges[Instrumentation::SampleBuffers].live);
+        CHECK(after.gauges[Instrumentation::Arenas].live == report.gauges[Instrumentation::Arenas].live);
+
+#ifndef NOISERED_NO_INSTRUMENTATION
+        // a watch keeps the peak of its caller, whoever resets the peaks
+        const int watch = Instrumentation::WatchPeaks();
+        REQUIRE(watch >= 0);
+        {
+            SampleBuffer buffer{100000, floatSample};
+        }
+        Instrumentation::ResetPeaks();
+        const int other = Instrumentation::WatchPeaks();
+        REQUIRE(other >= 0);
+        CHECK(other != watch);
+        unsigned long long peaks[Instrumentation::nGauges], otherPeaks[Instrumentation::nGauges];
+        Instrumentation::UnwatchPeaks(other, otherPeaks);
+        Instrumentation::UnwatchPeaks(watch, peaks);
+        const auto live = Instrumentation::GetReport().gauges[Instrumentation::SampleBuffers].live;
+        CHECK(peaks[Instrumentation::SampleBuffers] >= live + 100000 * sizeof(float));
+        CHECK(otherPeaks[Instrumentation::SampleBuffers] < live + 100000 * sizeof(float));
+
+        // each watch ends, and beyond the most at once they fail
+        std::vector<int> watches;
+        for (unsigned ii = 0; ii < SpaceGauge::nWatches; ++ii)
+            watches.push_back(Instrumentation::WatchPeaks());
+        CHECK(std::find(watches.begin(), watches.end(), -1) == watches.end());
+        CHECK(Instrumentation::WatchPeaks() == -1);
+        for (const auto ii : watches)
+            Instrumentation::UnwatchPeaks(ii, peaks);
+        CHECK(Instrumentation::WatchPeaks() == watches[0]);
+        Instrumentation::UnwatchPeaks(watches[0], peaks);
+#endif
+    }
+
+    SECTION("block files are numbered and their directories reused.") {
+        // the generation of the temp dir in the name of the first block file
+        auto run = [](std::vector<char> &dst, std::string &dataDir, int &generation) {
+            const auto dir_manager = std::make_shared<DirManager>();
+            auto factory = std::make_unique<TrackFactory>(dir_manager);
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) == ProgressResult::Success);
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(holders.at(0)));
+            REQUIRE(ExportPCM().ExportToMemory(audioArray, dst) == ProgressResult::Success);
+            dataDir = dir_manager->GetDataFilesDir();
+            generation = -1;
+            for (int gg = 0; gg < 16; ++gg)
+                if (dir_manager->ContainsBlockFile(string_format("e0000%x00", gg)))
+                    generation = gg;
+        };
+
+        std::vector<char> expected, actual;
+        std::string firstDir, secondDir;
+        int firstGeneration, secondGeneration;
+        run(expected, firstDir, firstGeneration);
+        run(actual, secondDir, secondGeneration);
+        CHECK(actual == expected);
+        CHECK(secondDir == firstDir);
+        REQUIRE(firstGeneration >= 0);
+        // named apart from any file of the first use
+        CHECK(secondGeneration == (firstGeneration + 1) % 16);
+    }
+
+    SECTION("temp dirs are made with the first block file, and only this process's removed.") {
+        char base[] = "/tmp/noisered_tempXXXXXX";
+        REQUIRE(mkdtemp(base));
+        const std::string temp = std::string(base) + "/temp";
+        const auto exists = [](const std::string &path) {
+            struct stat info;
+            return stat(path.c_str(), &info) == 0;
+        };
+        DirManager::SetTempDir(temp);
+        std::vector<float> samples(1000, 0.5f);
+
+        {
+            // Nothing is made in memory, nor before a block file
+            const auto inMemory = std::make_shared<DirManager>(true);
+            inMemory->NewSimpleBlockFile((samplePtr) samples.data(), samples.size(), floatSample, false);
+            const auto unused = std::make_shared<DirManager>();
+            CHECK(unused->GetDataFilesDir().empty());
+            CHECK_FALSE(exists(temp));
+
+            const auto first = std::make_shared<DirManager>();
+            const auto second = std::make_shared<DirManager>();
+            auto block = first->NewSimpleBlockFile((samplePtr) samples.data(), samples.size(), floatSample, false);
+            auto another = second->NewSimpleBlockFile((samplePtr) samples.data(), samples.size(), floatSample, false);
+            const auto prefix = temp + "/project" + std::to_string(getpid()) + "-";
+            CHECK(first->GetDataFilesDir().compare(0, prefix.size(), prefix) == 0);
+            CHECK(second->GetDataFilesDir().compare(0, prefix.size(), prefix) == 0);
+            CHECK(first->GetDataFilesDir() != second->GetDataFilesDir());
+            CHECK(exists(block->GetFileName().name.GetFullPath()));
+
+            // A link in a temp dir is removed, not followed
+            mkdir((std::string(base) + "/outside").c_str(), 0755);
+            std::ofstream{std::string(base) + "/outside/kept"} << "kept";
+            REQUIRE(symlink((std::string(base) + "/outside").c_str(),
+                            (first->GetDataFilesDir() + "/link").c_str()) == 0);
+        }
+        // Another process's temp dir, which stays
+        mkdir((temp + "/project1").c_str(), 0755);
+        std::ofstream{temp + "/project1/e0000000.au"} << "theirs";
+
+        // Pooled, then removed
+        DirManager::CleanTempDir();
+        CHECK(exists(temp + "/project1/e0000000.au"));
+        CHECK(exists(std::string(base) + "/outside/kept"));
+        DIR *listing = opendir(temp.c_str());
+        REQUIRE(listing);
+        std::vector<std::string> left;
+        while (const auto entry = readdir(listing))
+            if (entry->d_name[0] != '.')
+                left.push_back(entry->d_name);
+        closedir(listing);
+        CHECK(left == std::vector<std::string>{"project1"});
+
+        // The temp directory too, once nothing else is in it
+        DirManager::CleanDir(temp + "/project1");
+        DirManager::CleanTempDir();
+        CHECK_FALSE(exists(temp));
+        DirManager::CleanDir(base);
+        DirManager::SetTempDir("/dev/shm/audacity-noisered");
+    }
+
+    SECTION("bulk appends make the blocks of appends a few samples at a time.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        auto probe = factory.NewWaveTrack(floatSample, 44100);
+        const size_t maxBlockSize = probe->GetMaxBlockSize();
+        std::vector<float> samples(maxBlockSize * 3 + maxBlockSize / 2 + 17);
+        for (size_t ii = 0; ii < samples.size(); ++ii)
+            samples[ii] = std::sin(0.001f * ii);
+
+        // the track, and its blocks as (start, length)
+        auto append = [&](const std::vector<size_t> &lengths) {
+            auto track = factory.NewWaveTrack(floatSample, 44100);
+            size_t done = 0;
+            for (auto length : lengths) {
+                track->Append((samplePtr) (samples.data() + done), floatSample, length);
+                done += length;
+            }
+            track->Flush();
+            std::vector<std::pair<long long, size_t>> blocks;
+            for (const auto &block : track->GetClipByIndex(0)->GetSequence()->GetBlockArray())
+                blocks.emplace_back(block.start.as_long_long(), block.f->GetLength());
+            std::vector<float> actual(samples.size());
+            REQUIRE(track->Get((samplePtr) actual.data(), floatSample, 0, actual.size()));
+            CHECK(actual == samples);
+            return blocks;
+        };
+
+        std::vector<size_t> small(samples.size() / 1000, 1000);
+        small.push_back(samples.size() % 1000);
+        const auto expected = append(small);
+        CHECK(expected.size() == 4);
+        CHECK(append({samples.size()}) == expected);
+        // the first block filled, then the rest at once
+        CHECK(append({1234, samples.size() - 1234}) == expected);
+        CHECK(append({maxBlockSize, 5, samples.size() - maxBlockSize - 5}) == expected);
+    }
+
+    SECTION("replacing samples in place leaves what ClearAndPaste does.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        const size_t blockSize = factory.NewWaveTrack(floatSample, 44100)->GetMaxBlockSize();
+        const size_t total = 3 * blockSize + blockSize / 2;
+        std::vector<float> samples(total);
+        for (size_t ii = 0; ii < total; ++ii)
+            samples[ii] = std::sin(0.001f * ii);
+        auto makeTrack = [&](const float *data, size_t len) {
+            auto track = factory.NewWaveTrack(floatSample, 44100);
+            track->Append((samplePtr) data, floatSample, len);
+            track->Flush();
+            return track;
+        };
+
+        // all of the track, then parts starting and ending within blocks
+        const std::vector<std::pair<size_t, size_t>> ranges{
+                {0, total}, {1000, total - 1000}, {0, blockSize + 7}, {blockSize / 3, 2 * blockSize + 11},
+                {blockSize, blockSize}};
+        for (const auto &range : ranges) {
+            const auto start = range.first, len = range.second;
+            // an output longer than the range, as the effect makes
+            std::vector<float> replacement(len + 321);
+            for (size_t ii = 0; ii < replacement.size(); ++ii)
+                replacement[ii] = -samples[(start + ii) % total];
+
+            auto expected = makeTrack(samples.data(), total);
+            auto output = makeTrack(replacement.data(), replacement.size());
+            const double t0 = output->LongSamplesToTime(start);
+            const double tLen = output->LongSamplesToTime(len);
+            output->HandleClear(tLen, output->GetEndTime(), false, false);
+            expected->ClearAndPaste(t0, t0 + tLen, output.get(), true, false);
+
+            auto actual = makeTrack(samples.data(), total);
+            output = makeTrack(replacement.data(), replacement.size());
+            REQUIRE(actual->ReplaceSamples(start, len, *output));
+            CHECK(output->GetClipByIndex(0)->GetNumSamples() == 0);
+
+            REQUIRE(actual->GetClipByIndex(0)->GetNumSamples() == total);
+            REQUIRE(expected->TimeToLongSamples(expected->GetEndTime()).as_size_t() == total);
+            std::vector<float> expectedSamples(total), actualSamples(total);
+            expected->Get((samplePtr) expectedSamples.data(), floatSample, 0, total);
+            actual->Get((samplePtr) actualSamples.data(), floatSample, 0, total);
+            CHECK(actualSamples == expectedSamples);
+        }
+    }
+
+    SECTION("mapped WAV import reads what libsndfile does.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders left{}, right{};
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, left) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("test.wav")->Import(factory, right) == ProgressResult::Success);
+        left[0]->SetChannel(WaveTrack::LeftChannel);
+        right[0]->SetChannel(WaveTrack::RightChannel);
+        auto stereoArray = WaveTrackConstArray();
+        stereoArray.emplace_back(std::move(left.at(0)));
+        stereoArray.emplace_back(std::move(right.at(0)));
+
+        // 16 bit, 24 bit and float, mono and stereo
+        std::vector<std::string> names{"input.wav"};
+        for (int subformat = 0; subformat < 3; ++subformat) {
+            names.push_back("test_format" + std::to_string(subformat) + ".wav");
+            REQUIRE(ExportPCM().Export(stereoArray, names.back(), nullptr, subformat) == ProgressResult::Success);
+        }
+
+        for (const auto &name : names) {
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open(name)->Import(factory, holders) == ProgressResult::Success);
+
+            SF_INFO info;
+            memset(&info, 0, sizeof(info));
+            SNDFILE *sf = sf_open(name.c_str(), SFM_READ, &info);
+            REQUIRE(sf != nullptr);
+            REQUIRE(holders.size() == (size_t) info.channels);
+            std::vector<float> interleaved(info.frames * info.channels);
+            REQUIRE(sf_readf_float(sf, interleaved.data(), info.frames) == info.frames);
+            sf_close(sf);
+
+            for (int c = 0; c < info.channels; ++c) {
+                REQUIRE(holders[c]->TimeToLongSamples(holders[c]->GetEndTime()) == info.frames);
+                std::vector<float> expected(info.frames), actual(info.frames);
+                for (sf_count_t ii = 0; ii < info.frames; ++ii)
+                    expected[ii] = interleaved[ii * info.channels + c];
+                holders[c]->Get((samplePtr) actual.data(), floatSample, 0, info.frames);
+                CHECK(actual == expected);
+            }
+        }
+
+        for (size_t ii = 1; ii < names.size(); ++ii)
+            remove(names[ii].c_str());
+        delete factory;
+    }
+    SECTION("tracks exported without mixing are written as the Mixer does.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        // A point of value 1 leaves the samples as they are but makes the
+        // export go through the Mixer
+        auto load = [&](const std::vector<std::string> &names, bool mixed) {
+            auto tracks = WaveTrackConstArray();
+            for (const auto &name : names) {
+                TrackHolders holders{};
+                REQUIRE(PCMImportFileHandle::Open(name)->Import(factory, holders) == ProgressResult::Success);
+                if (mixed)
+                    for (const auto &clip : holders[0]->GetClips())
+                        clip->GetEnvelope()->InsertOrReplaceRelative(0.0, 1.0);
+                if (names.size() > 1)
+                    holders[0]->SetChannel(tracks.empty() ? WaveTrack::LeftChannel : WaveTrack::RightChannel);
+                tracks.emplace_back(std::move(holders[0]));
+            }
+            return tracks;
+        };
+
+        for (const auto &names : {std::vector<std::string>{"input.wav"},
+                                  std::vector<std::string>{"input.wav", "test.wav"}}) {
+            auto direct = load(names, false);
+            auto mixed = load(names, true);
+            for (int subformat = 0; subformat < 3; ++subformat) {
+                REQUIRE(ExportPCM().Export(direct, "test_direct.wav", nullptr, subformat) == ProgressResult::Success);
+                REQUIRE(ExportPCM().Export(mixed, "test_mixed.wav", nullptr, subformat) == ProgressResult::Success);
+                CHECK(calc_file_hash("test_direct.wav") == calc_file_hash("test_mixed.wav"));
+            }
+        }
+        remove("test_direct.wav");
+        remove("test_mixed.wav");
+        delete factory;
+    }
+    SECTION("exports are the same whatever the write queue depth.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders holders{};
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, holders) == ProgressResult::Success);
+        auto tracks = WaveTrackConstArray();
+        tracks.emplace_back(std::move(holders.at(0)));
+
+        for (int subformat = 0; subformat < 3; ++subformat) {
+            ExportPCM exporter;
+            exporter.SetWriteQueueDepth(0);
+            REQUIRE(exporter.Export(tracks, "test_sync.wav", nullptr, subformat) == ProgressResult::Success);
+            const auto expected = calc_file_hash("test_sync.wav");
+            for (size_t depth : {1, 2, 8}) {
+                exporter.SetWriteQueueDepth(depth);
+                REQUIRE(exporter.Export(tracks, "test_async.wav", nullptr, subformat) == ProgressResult::Success);
+                CHECK(calc_file_hash("test_async.wav") == expected);
+            }
+        }
+        remove("test_sync.wav");
+        remove("test_async.wav");
+        delete factory;
+    }
+    SECTION("sound files in memory import and export as files do.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        for (const auto &name : {"input.wav", "test.wav"}) {
+            std::ifstream file(name, std::ios::binary);
+            const std::vector<char> bytes{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+            TrackHolders fromFile{}, fromMemory{};
+            REQUIRE(PCMImportFileHandle::Open(name)->Import(factory, fromFile) == ProgressResult::Success);
+            auto handler = PCMImportFileHandle::OpenMemory(bytes.data(), bytes.size());
+            REQUIRE(handler != nullptr);
+            REQUIRE(handler->Import(factory, fromMemory) == ProgressResult::Success);
+            REQUIRE(fromMemory.size() == fromFile.size());
+            const auto len = fromFile[0]->TimeToLongSamples(fromFile[0]->GetEndTime()).as_size_t();
+            REQUIRE(fromMemory[0]->TimeToLongSamples(fromMemory[0]->GetEndTime()) == len);
+            std::vector<float> expected(len), actual(len);
+            fromFile[0]->Get((samplePtr) expected.data(), floatSample, 0, len);
+            fromMemory[0]->Get((samplePtr) actual.data(), floatSample, 0, len);
+            CHECK(actual == expected);
+
+            auto tracks = WaveTrackConstArray();
+            tracks.emplace_back(std::move(fromMemory[0]));
+            for (int subformat = 0; subformat < 3; ++subformat) {
+                std::vector<char> exported;
+                REQUIRE(ExportPCM().ExportToMemory(tracks, exported, nullptr, subformat) == ProgressResult::Success);
+                REQUIRE(ExportPCM().Export(tracks, "test_out.wav", nullptr, subformat) == ProgressResult::Success);
+                std::ifstream out("test_out.wav", std::ios::binary);
+                CHECK(exported == std::vector<char>(std::istreambuf_iterator<char>(out), std::istreambuf_iterator<char>()));
+            }
+        }
+
+        const char garbage[] = "not a sound file";
+        CHECK(PCMImportFileHandle::OpenMemory(garbage, sizeof(garbage)) == nullptr);
+        remove("test_out.wav");
+        delete factory;
+    }
+    SECTION("deinterleaving matches the scalar result at every SIMD level.") {
+        const auto initialLevel = GetSampleKernelSimdLevel();
+        for (unsigned nChannels = 1; nChannels <= 9; ++nChannels) {
+            for (size_t len : {0, 1, 7, 8, 9, 333}) {
+                std::vector<float> floats(len * nChannels);
+                std::vector<short> shorts(len * nChannels);
+                for (size_t ii = 0; ii < floats.size(); ++ii) {
+                    floats[ii] = (float) rand() / RAND_MAX - 0.5f;
+                    shorts[ii] = (short) (rand() % 65536 - 32768);
+                }
+
+                for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+                    if (!SetSampleKernelSimdLevel(level))
+                        continue;
+                    std::vector<std::vector<float>> fromFloats(nChannels, std::vector<float>(len)),
+                            fromShorts(nChannels, std::vector<float>(len));
+                    std::vector<float *> floatsDst, shortsDst;
+                    for (unsigned c = 0; c < nChannels; ++c) {
+                        floatsDst.push_back(fromFloats[c].data());
+                        shortsDst.push_back(fromShorts[c].data());
+                    }
+                    Deinterleave(floats.data(), nChannels, floatsDst.data(), len);
+                    Deinterleave(shorts.data(), nChannels, shortsDst.data(), len);
+
+                    for (unsigned c = 0; c < nChannels; ++c)
+                        for (size_t ii = 0; ii < len; ++ii) {
+                            CHECK(fromFloats[c][ii] == floats[ii * nChannels + c]);
+                            CHECK(fromShorts[c][ii] == (float) shorts[ii * nChannels + c] * (1.0f / 0x8000));
+                        }
+                }
+            }
+        }
+        SetSampleKernelSimdLevel(initialLevel);
+    }
+
+    SECTION("format conversions match the strided conversion at every SIMD level.") {
+        const auto initialLevel = GetSampleKernelSimdLevel();
+        const size_t len = 333;
+        std::vector<float> floats(len);
+        std::vector<short> shorts(len);
+        std::vector<int> int24s(len);
+        for (size_t ii = 0; ii < len; ++ii) {
+            floats[ii] = 3.0f * rand() / RAND_MAX - 1.5f;
+            shorts[ii] = (short) (rand() % 65536 - 32768);
+            int24s[ii] = rand() % (1 << 24) - (1 << 23);
+        }
+        // clipping and ties (not NaN, which lrintf converts as it may)
+        const float edges[] = {1.0f, -1.0f, 0.5f / 32768, 1.5f / 32768, -2.5f / 32768, 0.5f / 8388608,
+                               INFINITY, -INFINITY, 1.0f - 1.0f / 65536};
+        std::copy(std::begin(edges), std::end(edges), floats.begin() + 50);
+        const int int24Edges[] = {(1 << 23) - 1, -(1 << 23), 128, -128, 384, -384, 0x7fffffff, -0x7fffffff - 1};
+        std::copy(std::begin(int24Edges), std::end(int24Edges), int24s.begin() + 50);
+        const std::pair<sampleFormat, samplePtr> sources[] = {
+                {floatSample, (samplePtr) floats.data()},
+                {int16Sample, (samplePtr) shorts.data()},
+                {int24Sample, (samplePtr) int24s.data()}};
+
+        for (const auto &source : sources)
+            for (auto format : {floatSample, int16Sample, int24Sample}) {
+                // lengths that end in every tail
+                for (size_t count : {len, len - 1, len - 5, size_t(7)}) {
+                    // the strided loop of Dither, one sample in two
+                    std::vector<char> strided(2 * count * SAMPLE_SIZE(format)), expected;
+                    CopySamples(source.second, source.first, strided.data(), format, count, true, 1, 2);
+                    for (size_t ii = 0; ii < count; ++ii) {
+                        auto sample = strided.data() + 2 * ii * SAMPLE_SIZE(format);
+                        expected.insert(expected.end(), sample, sample + SAMPLE_SIZE(format));
+                    }
+
+                    for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+                        if (!SetSampleKernelSimdLevel(level))
+                            continue;
+                        std::vector<char> actual(count * SAMPLE_SIZE(format));
+                        CopySamples(source.second, source.first, actual.data(), format, count);
+                        CHECK(actual == expected);
+                    }
+                }
+            }
+        SetSampleKernelSimdLevel(initialLevel);
+    }
+
+    SECTION("arena allocations are aligned, and frames give theirs back.") {
+        Arena arena{4096};
+        for (size_t bytes : {1, 3, 64, 100, 4096, 10000, 7}) {
+            const auto address = reinterpret_cast<uintptr_t>(arena.Allocate(bytes));
+            CHECK(address % Arena::Alignment == 0);
+        }
+        const auto capacity = arena.GetCapacity();
+        CHECK(capacity >= 4096 + 10000);
+        const auto zeros = arena.AllocateZeroed<float>(300);
+        CHECK(std::all_of(zeros, zeros + 300, [](float x) { return x == 0.0f; }));
+
+        CHECK(Arena::Current() == nullptr);
+        {
+            ArenaFrame frame;
+            CHECK(frame.GetArena() == nullptr);
+            SampleBuffer buffer(100, floatSample, frame.GetArena());
+            CHECK(buffer.ptr() != nullptr);
+        }
+
+        ArenaScope scope{arena};
+        CHECK(Arena::Current() == &arena);
+        const auto mark = arena.GetMark();
+        const auto capacityBefore = arena.GetCapacity();
+        // Scratch of frame after frame, as of Sequence calls in a run, reuses
+        // the same memory; nested frames keep what their callers hold
+        samplePtr first = nullptr;
+        for (int ii = 0; ii < 100; ++ii) {
+            ArenaFrame frame;
+            REQUIRE(frame.GetArena() == &arena);
+            SampleBuffer outer(1000, floatSample, frame.GetArena());
+            outer.Allocate(3000, floatSample, frame.GetArena());
+            if (!first)
+                first = outer.ptr();
+            CHECK(outer.ptr() == first);
+            memset(outer.ptr(), 0x55, 3000 * sizeof(float));
+            {
+                ArenaFrame inner;
+                SampleBuffer scratch(5000, int16Sample, inner.GetArena());
+                CHECK(scratch.ptr() != outer.ptr());
+                memset(scratch.ptr(), 0, 5000 * sizeof(short));
+            }
+            CHECK(std::all_of(outer.ptr(), outer.ptr() + 3000 * sizeof(float),
+                              [](char c) { return c == 0x55; }));
+        }
+        CHECK(arena.GetMark().chunk == mark.chunk);
+        CHECK(arena.GetMark().used == mark.used);
+        CHECK(arena.GetCapacity() <= capacityBefore + 2 * (3000 * sizeof(float) + 5000 * sizeof(short)) + 8192);
+
+        arena.Release();
+        CHECK(arena.GetCapacity() == 0);
+    }
+
+    SECTION("mixing matches the scalar loops at every SIMD level.") {
+        const auto initialLevel = GetSampleKernelSimdLevel();
+        const size_t len = 203;
+        std::vector<float> src(len), mix(3 * len);
+        std::vector<double> gains(len);
+        for (size_t ii = 0; ii < len; ++ii) {
+            src[ii] = 2.0f * rand() / RAND_MAX - 1.0f;
+            gains[ii] = 2.0 * rand() / RAND_MAX;
+        }
+        for (auto &sample : mix)
+            sample = 2.0f * rand() / RAND_MAX - 1.0f;
+        // other channels keep the sign of zero
+        mix[1] = -0.0f;
+        const float gain = 0.7f;
+
+        for (size_t count : {len, len - 1, len - 5, size_t(3)}) {
+            std::vector<float> expectedGained(src.begin(), src.begin() + count);
+            for (size_t ii = 0; ii < count; ++ii)
+                expectedGained[ii] *= gains[ii];
+            for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+                if (!SetSampleKernelSimdLevel(level))
+                    continue;
+                std::vector<float> gained(src.begin(), src.begin() + count);
+                ApplyGains(gained.data(), gains.data(), count);
+                CHECK(gained == expectedGained);
+
+                for (unsigned stride : {1u, 2u, 3u}) {
+                    auto expected = mix, actual = mix;
+                    for (size_t ii = 0; ii < count; ++ii)
+                        expected[ii * stride] += src[ii] * gain;
+                    MixSamples(src.data(), gain, actual.data(), stride, count);
+                    CHECK(actual == expected);
+                    if (stride > 1)
+                        CHECK(std::signbit(actual[1]));
+                }
+            }
+        }
+        SetSampleKernelSimdLevel(initialLevel);
+    }
+
+    SECTION("dither is deterministic, and the same strided and at every SIMD level.") {
+        const auto initialLevel = GetSampleKernelSimdLevel();
+        const unsigned len = 20000;
+        std::vector<float> floats(len);
+        std::vector<int> int24s(len);
+        for (unsigned ii = 0; ii < len; ++ii) {
+            floats[ii] = 0.6f * std::sin(ii * 0.0123f) + 0.3f * std::sin(ii * 0.789f);
+            int24s[ii] = std::lrint(floats[ii] * (1 << 23));
+        }
+        floats[100] = 1.5f;
+        floats[101] = -1.5f;
+        const std::tuple<sampleFormat, samplePtr, sampleFormat> conversions[] = {
+                std::make_tuple(floatSample, (samplePtr) floats.data(), int16Sample),
+                std::make_tuple(floatSample, (samplePtr) floats.data(), int24Sample),
+                std::make_tuple(int24Sample, (samplePtr) int24s.data(), int16Sample)};
+
+        for (auto type : {DitherType::rectangle, DitherType::triangle, DitherType::shaped})
+            for (const auto &conversion : conversions) {
+                const auto from = std::get<0>(conversion);
+                const auto source = std::get<1>(conversion);
+                const auto to = std::get<2>(conversion);
+                const size_t size = SAMPLE_SIZE(to);
+                std::vector<char> expected(len * size);
+                Dither{}.Apply(type, source, from, expected.data(), to, len);
+
+                // one sample in two
+                std::vector<char> strided(2 * len * size), actual;
+                Dither{}.Apply(type, source, from, strided.data(), to, len, 1, 2);
+                for (unsigned ii = 0; ii < len; ++ii)
+                    actual.insert(actual.end(), &strided[2 * ii * size], &strided[(2 * ii + 1) * size]);
+                CHECK(actual == expected);
+
+                for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+                    if (!SetSampleKernelSimdLevel(level))
+                        continue;
+                    Dither{}.Apply(type, source, from, actual.data(), to, len);
+                    CHECK(actual == expected);
+                }
+                SetSampleKernelSimdLevel(initialLevel);
+
+                Dither reseeded;
+                reseeded.SetSeed(1);
+                reseeded.Apply(type, source, from, actual.data(), to, len);
+                CHECK(actual != expected);
+
+                if (from == floatSample && to == int16Sample && type != DitherType::shaped) {
+                    // white noise of rectangular or triangular density, and
+                    // rounding, with no dc
+                    double sum = 0, sumSquares = 0;
+                    for (unsigned ii = 200; ii < len; ++ii) {
+                        const double error = ((short *) expected.data())[ii] - floats[ii] * 32768.0;
+                        sum += error;
+                        sumSquares += error * error;
+                    }
+                    const double mean = sum / (len - 200);
+                    const double variance = sumSquares / (len - 200) - mean * mean;
+                    CHECK(std::abs(mean) < 0.02);
+                    CHECK(variance == Approx(type == DitherType::rectangle ? 1.0 / 6 : 1.0 / 4).epsilon(0.1));
+                }
+            }
+    }
+}
+
+TEST_CASE("real FFT") {
+    SECTION("SIMD butterflies match the scalar result.") {
+        const auto initialLevel = GetFFTSimdLevel();
+        for (size_t fftlen = 8; fftlen <= 8192; fftlen *= 2) {
+            std::vector<float> input(fftlen);
+            for (auto &sample : input)
+                sample = (float) rand() / RAND_MAX - 0.5f;
+            auto hFFT = GetFFT(fftlen);
+
+            std::vector<float> forward, inverse;
+            for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+                if (!SetFFTSimdLevel(level))
+                    continue;
+                auto spectrum = input;
+                RealFFTf(spectrum.data(), hFFT.get());
+                auto wave = spectrum;
+                InverseRealFFTf(wave.data(), hFFT.get());
+                if (level == SimdLevel::Scalar) {
+                    forward = spectrum;
+                    inverse = wave;
+                } else {
+                    CHECK(forward == spectrum);
+                    CHECK(inverse == wave);
+                }
+            }
+        }
+        SetFFTSimdLevel(initialLevel);
+    }
+
+    SECTION("the fused spectrum matches windowing, transform and reordering.") {
+        const auto initialLevel = GetFFTSimdLevel();
+        for (size_t fftlen = 8; fftlen <= 4096; fftlen *= 2) {
+            auto hFFT = GetFFT(fftlen);
+            const size_t half = fftlen / 2;
+            std::vector<float> input(fftlen), window(fftlen);
+            for (size_t ii = 0; ii < fftlen; ++ii) {
+                input[ii] = (float) rand() / RAND_MAX - 0.5f;
+                window[ii] = 0.5f - 0.5f * cos(2 * M_PI * ii / fftlen);
+            }
+
+            for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+                if (!SetFFTSimdLevel(level))
+                    continue;
+                for (const float *pWindow : {(const float *) nullptr, (const float *) window.data()}) {
+                    std::vector<float> buffer(fftlen);
+                    for (size_t ii = 0; ii < fftlen; ++ii)
+                        buffer[ii] = pWindow ? input[ii] * pWindow[ii] : input[ii];
+                    RealFFTf(buffer.data(), hFFT.get());
+
+                    std::vector<float> scratch(fftlen), packed(fftlen), power(half + 1);
+                    RealFFTfSpectrum(input.data(), pWindow, scratch.data(),
+                                     packed.data(), power.data(), hFFT.get());
+                    CHECK(packed[0] == buffer[0]);
+                    CHECK(packed[1] == buffer[1]);
+                    CHECK(power[0] == buffer[0] * buffer[0]);
+                    CHECK(power[half] == buffer[1] * buffer[1]);
+                    for (size_t kk = 1; kk < half; ++kk) {
+                        const float re = buffer[hFFT->BitReversed[kk]];
+                        const float im = buffer[hFFT->BitReversed[kk] + 1];
+                        CHECK(packed[2 * kk] == re);
+                        CHECK(packed[2 * kk + 1] == im);
+                        CHECK(power[kk] == re * re + im * im);
+                    }
+                }
+            }
+        }
+        SetFFTSimdLevel(initialLevel);
+    }
+
+    SECTION("batched frames transform as single frames do.") {
+        const auto initialLevel = GetFFTSimdLevel();
+        const size_t fftlen = 1024, nFrames = 29;
+        auto hFFT = GetFFT(fftlen);
+        std::vector<float> frames(fftlen * nFrames);
+        for (auto &sample : frames)
+            sample = (float) rand() / RAND_MAX - 0.5f;
+
+        for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512, SimdLevel::NEON}) {
+            if (!SetFFTSimdLevel(level))
+                continue;
+            auto batch = frames;
+            RealFFTfFrames(batch.data(), nFrames, hFFT.get());
+            for (size_t ff = 0; ff < nFrames; ++ff) {
+                std::vector<float> single(fftlen), fromBatch(fftlen);
+                for (size_t ii = 0; ii < fftlen; ++ii) {
+                    single[ii] = frames[ii * nFrames + ff];
+                    fromBatch[ii] = batch[ii * nFrames + ff];
+                }
+                RealFFTf(single.data(), hFFT.get());
+                CHECK(single == fromBatch);
+            }
+        }
+        SetFFTSimdLevel(initialLevel);
+    }
+
+    SECTION("the configured backend agrees with the built-in FFT.") {
+        const size_t fftlen = 2048;
+        auto builtin = CreateBuiltinFFTBackend(fftlen);
+        auto fft = CreateFFTBackend(fftlen);
+        REQUIRE(builtin->Size() == fftlen);
+        REQUIRE(fft->Size() == fftlen);
+
+        std::vector<float> input(fftlen);
+        for (auto &sample : input)
+            sample = (float) rand() / RAND_MAX - 0.5f;
+        auto expected = input, actual = input;
+        builtin->Forward(expected.data());
+        fft->Forward(actual.data());
+        for (size_t ii = 0; ii < 2; ++ii)
+            CHECK(actual[ii] == Approx(expected[ii]).epsilon(1e-4).margin(1e-3));
+        for (size_t kk = 1; kk < fftlen / 2; ++kk)
+            for (size_t ii = 0; ii < 2; ++ii)
+                CHECK(actual[fft->SpectrumOrder()[kk] + ii] ==
+                      Approx(expected[builtin->SpectrumOrder()[kk] + ii]).epsilon(1e-4).margin(1e-3));
+
+        // The inverse takes natural order, and undoes the forward transform
+        std::vector<float> spectrum(fftlen), wave(fftlen);
+        spectrum[0] = actual[0];
+        spectrum[1] = actual[1];
+        for (size_t kk = 1; kk < fftlen / 2; ++kk) {
+            spectrum[2 * kk] = actual[fft->SpectrumOrder()[kk]];
+            spectrum[2 * kk + 1] = actual[fft->SpectrumOrder()[kk] + 1];
+        }
+        fft->Inverse(spectrum.data());
+        for (size_t kk = 0; kk < fftlen / 2; ++kk) {
+            wave[2 * kk] = spectrum[fft->TimeOrder()[kk]];
+            wave[2 * kk + 1] = spectrum[fft->TimeOrder()[kk] + 1];
+        }
+        for (size_t ii = 0; ii < fftlen; ++ii)
+            CHECK(wave[ii] == Approx(input[ii]).margin(1e-5));
+    }
+
+    SECTION("tables of one size are shared by all threads.") {
+        std::vector<HFFT> handles(4);
+        std::vector<std::thread> threads;
+        for (auto &handle : handles)
+            threads.emplace_back([&handle] { handle = GetFFT(4096); });
+        for (auto &thread : threads)
+            thread.join();
+        for (const auto &handle : handles)
+            CHECK(handle == handles[0]);
+        CHECK(GetFFT(4096) == handles[0]);
+        CHECK(GetFFT(2048) != handles[0]);
+    }
 }
 
 TEST_CASE("noise reduction") {
@@ -101,6 +1063,1539 @@ TEST_CASE("noise reduction") {
         delete effect;
     }
 
+    SECTION("saved profile can be loaded into another effect.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        auto handler = PCMImportFileHandle::Open("bg_input.wav");
+        TrackHolders holders{};
+        auto import_result = handler->Import(factory, holders);
+        REQUIRE(import_result == ProgressResult::Success);
+
+        auto effect = new EffectNoiseReduction();
+        std::vector<char> blob;
+        CHECK_FALSE(effect->SaveProfile(blob));
+        auto profile_result = effect->GetProfile(holders[0].get(), 0.0, 0.5,
+                                                 12.0, 6.0, 3.0, factory);
+        REQUIRE(profile_result);
+        REQUIRE(effect->SaveProfile(blob));
+
+        auto loaded = new EffectNoiseReduction();
+        CHECK_FALSE(loaded->LoadProfile(blob.data(), blob.size() - 1));
+        REQUIRE(loaded->LoadProfile(blob.data(), blob.size()));
+        std::vector<char> reloaded;
+        REQUIRE(loaded->SaveProfile(reloaded));
+        CHECK(reloaded == blob);
+
+        auto src_handler = PCMImportFileHandle::Open("input.wav");
+        TrackHolders src_holders{};
+        REQUIRE(src_handler->Import(factory, src_holders) == ProgressResult::Success);
+        CHECK(loaded->ReduceNoise(src_holders[0].get(), 12.0, 6.0, 3.0, factory));
+
+        delete factory;
+        delete effect;
+        delete loaded;
+    }
+
+    SECTION("cached profiles skip the import and are those taken.") {
+        ProfileCache cache;
+        const auto take = [](const std::string &path, double t0, double t1,
+                             const EffectNoiseReduction::AdvancedSettings &settings) {
+            EffectNoiseReduction effect;
+            REQUIRE(effect.SetAdvancedSettings(settings));
+            const auto dir_manager = std::make_shared<DirManager>(true);
+            TrackFactory factory{dir_manager};
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open(path)->Import(&factory, holders) == ProgressResult::Success);
+            REQUIRE(effect.GetProfile(holders[0].get(), t0, t1, 12.0, 6.0, 3.0, &factory));
+            std::vector<char> blob;
+            REQUIRE(effect.SaveProfile(blob));
+            return blob;
+        };
+        const auto cached = [&](const std::string &path, double t0, double t1,
+                                const EffectNoiseReduction::AdvancedSettings &settings) {
+            EffectNoiseReduction effect;
+            REQUIRE(effect.SetAdvancedSettings(settings));
+            REQUIRE(cache.GetProfile(effect, path, t0, t1));
+            std::vector<char> blob;
+            REQUIRE(effect.SaveProfile(blob));
+            return blob;
+        };
+        const auto counts = [&] {
+            const auto counts = cache.GetCounts();
+            return std::make_tuple(counts.hits, counts.diskHits, counts.misses, counts.entries);
+        };
+
+        EffectNoiseReduction::AdvancedSettings defaults, quality;
+        REQUIRE(EffectNoiseReduction::GetPreset("quality", quality));
+        const auto expected = take("bg_input.wav", 0.0, 0.5, defaults);
+        CHECK(cached("bg_input.wav", 0.0, 0.5, defaults) == expected);
+        CHECK(counts() == std::make_tuple(0ull, 0ull, 1ull, size_t{1}));
+        CHECK(cached("bg_input.wav", 0.0, 0.5, defaults) == expected);
+        CHECK(counts() == std::make_tuple(1ull, 0ull, 1ull, size_t{1}));
+
+        // Another range, other window settings and another file each miss
+        CHECK(cached("bg_input.wav", 0.0, 0.25, defaults) == take("bg_input.wav", 0.0, 0.25, defaults));
+        CHECK(cached("bg_input.wav", 0.0, 0.5, quality) == take("bg_input.wav", 0.0, 0.5, quality));
+        CHECK(cached("test.wav", 0.0, 0.3, defaults) == take("test.wav", 0.0, 0.3, defaults));
+        CHECK(counts() == std::make_tuple(1ull, 0ull, 4ull, size_t{4}));
+
+        // The bytes of a file are the file
+        std::ifstream file("bg_input.wav", std::ios::binary);
+        const std::vector<char> bytes{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        EffectNoiseReduction fromBytes;
+        REQUIRE(cache.GetProfile(fromBytes, bytes.data(), bytes.size(), 0.0, 0.5));
+        std::vector<char> blob;
+        REQUIRE(fromBytes.SaveProfile(blob));
+        CHECK(blob == expected);
+        CHECK(counts() == std::make_tuple(2ull, 0ull, 4ull, size_t{4}));
+
+        // The least recently used go first
+        cache.SetCapacity(2);
+        CHECK(counts() == std::make_tuple(2ull, 0ull, 4ull, size_t{2}));
+        CHECK(cached("bg_input.wav", 0.0, 0.25, defaults) == take("bg_input.wav", 0.0, 0.25, defaults));
+        CHECK(cached("bg_input.wav", 0.0, 0.5, defaults) == expected);
+        CHECK(counts() == std::make_tuple(3ull, 0ull, 5ull, size_t{2}));
+        CHECK(cached("test.wav", 0.0, 0.3, defaults) == take("test.wav", 0.0, 0.3, defaults));
+        CHECK(counts() == std::make_tuple(3ull, 0ull, 6ull, size_t{2}));
+
+        // Profiles in the directory outlive those in memory
+        char directory[] = "/tmp/noisered_profilesXXXXXX";
+        REQUIRE(mkdtemp(directory));
+        cache.SetDirectory(directory);
+        cache.Clear();
+        CHECK(cached("bg_input.wav", 0.0, 0.5, defaults) == expected);
+        cache.Clear();
+        CHECK(counts() == std::make_tuple(3ull, 0ull, 7ull, size_t{0}));
+        ProfileCache another;
+        another.SetDirectory(directory);
+        EffectNoiseReduction fromDisk;
+        REQUIRE(another.GetProfile(fromDisk, "bg_input.wav", 0.0, 0.5));
+        REQUIRE(fromDisk.SaveProfile(blob));
+        CHECK(blob == expected);
+        CHECK(another.GetCounts().diskHits == 1);
+        CHECK(another.GetCounts().misses == 0);
+
+        // Failures are not cached
+        EffectNoiseReduction failed;
+        CHECK_FALSE(cache.GetProfile(failed, "no_such_file.wav", 0.0, 0.5));
+        CHECK_FALSE(cache.GetProfile(failed, bytes.data(), 16, 0.0, 0.5));
+        CHECK(counts() == std::make_tuple(3ull, 0ull, 7ull, size_t{0}));
+
+        DIR *listing = opendir(directory);
+        REQUIRE(listing);
+        size_t files = 0;
+        while (const auto entry = readdir(listing))
+            if (entry->d_name[0] != '.') {
+                remove((std::string(directory) + "/" + entry->d_name).c_str());
+                ++files;
+            }
+        closedir(listing);
+        rmdir(directory);
+        CHECK(files == 1);
+    }
+
+    SECTION("regions of several files profile as the mean of their windows.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        std::mt19937 generator{13};
+        std::normal_distribution<float> normal;
+        const auto noiseTrack = [&](float deviation, double rate) {
+            std::vector<float> samples(32000);
+            for (auto &sample : samples)
+                sample = deviation * normal(generator);
+            auto track = factory.NewWaveTrack(floatSample, rate);
+            track->Append((samplePtr) samples.data(), floatSample, samples.size());
+            track->Flush();
+            return track;
+        };
+        const auto quiet = noiseTrack(0.01f, 16000), loud = noiseTrack(0.04f, 16000);
+        // The means follow the header and the sums in a saved profile
+        const auto means = [](EffectNoiseReduction &effect) {
+            std::vector<char> blob;
+            REQUIRE(effect.SaveProfile(blob));
+            const size_t spectrumSize = 1025;
+            std::vector<float> result(spectrumSize);
+            memcpy(result.data(), blob.data() + blob.size() - spectrumSize * sizeof(float),
+                   spectrumSize * sizeof(float));
+            return result;
+        };
+
+        EffectNoiseReduction single, one, quietOnly, loudOnly, both;
+        REQUIRE(single.GetProfile(quiet.get(), 0.25, 1.25, 12.0, 6.0, 3.0, &factory));
+        REQUIRE(one.GetProfile({{quiet.get(), 0.25, 1.25}}, 12.0, 6.0, 3.0, &factory));
+        std::vector<char> singleBlob, oneBlob;
+        REQUIRE(single.SaveProfile(singleBlob));
+        REQUIRE(one.SaveProfile(oneBlob));
+        CHECK(oneBlob == singleBlob);
+
+        // Regions of the same length weigh the same
+        REQUIRE(quietOnly.GetProfile(quiet.get(), 0.0, 1.0, 12.0, 6.0, 3.0, &factory));
+        REQUIRE(loudOnly.GetProfile(loud.get(), 1.0, 2.0, 12.0, 6.0, 3.0, &factory));
+        REQUIRE(both.GetProfile({{quiet.get(), 0.0, 1.0}, {loud.get(), 1.0, 2.0}}, 12.0, 6.0, 3.0, &factory));
+        const auto quietMeans = means(quietOnly), loudMeans = means(loudOnly), bothMeans = means(both);
+        for (size_t ii = 0; ii < bothMeans.size(); ++ii)
+            CHECK(bothMeans[ii] == Approx((quietMeans[ii] + loudMeans[ii]) / 2).epsilon(1e-5));
+
+        // Many regions share a few threads, to the same profile however many
+        std::vector<EffectNoiseReduction::ProfileRegion> many;
+        for (int ii = 0; ii < 48; ++ii)
+            many.push_back({ii % 2 ? loud.get() : quiet.get(), 0.02 * ii, 0.02 * ii + 0.5});
+        std::vector<char> manyBlob;
+        for (const unsigned threads : {1u, 3u, 0u}) {
+            EffectNoiseReduction effect;
+            effect.SetThreadCount(threads);
+            REQUIRE(effect.GetProfile(many, 12.0, 6.0, 3.0, &factory));
+            std::vector<char> blob;
+            REQUIRE(effect.SaveProfile(blob));
+            if (manyBlob.empty())
+                manyBlob = blob;
+            CHECK(blob == manyBlob);
+        }
+
+        // A region too short, or of another rate, fails the whole profile
+        EffectNoiseReduction failed;
+        CHECK_FALSE(failed.GetProfile({{quiet.get(), 0.0, 1.0}, {loud.get(), 1.0, 1.01}},
+                                      12.0, 6.0, 3.0, &factory));
+        failed.SetThreadCount(4);
+        many[30].t1 = many[30].t0 + 0.01;
+        CHECK_FALSE(failed.GetProfile(many, 12.0, 6.0, 3.0, &factory));
+        const auto otherRate = noiseTrack(0.01f, 8000);
+        CHECK_FALSE(failed.GetProfile({{quiet.get(), 0.0, 1.0}, {otherRate.get(), 0.0, 1.0}},
+                                      12.0, 6.0, 3.0, &factory));
+        CHECK_FALSE(failed.ReduceNoise(quiet.get(), 12.0, 6.0, 3.0, &factory));
+    }
+
+    SECTION("the quietest windows of a track profile its noise.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        // Noise throughout, and a tone over all but the first quarter
+        const double rate = 16000;
+        const size_t len = 6 * 16000;
+        std::mt19937 generator{17};
+        std::normal_distribution<float> normal;
+        std::vector<float> samples(len);
+        for (size_t ii = 0; ii < len; ++ii) {
+            samples[ii] = 0.01f * normal(generator);
+            if (ii >= len / 4)
+                samples[ii] += 0.1f * sin(2.0 * M_PI * 1000 * ii / rate);
+        }
+        auto track = factory.NewWaveTrack(floatSample, rate);
+        track->Append((samplePtr) samples.data(), floatSample, len);
+        track->Flush();
+        const auto means = [](EffectNoiseReduction &effect) {
+            std::vector<char> blob;
+            REQUIRE(effect.SaveProfile(blob));
+            const size_t spectrumSize = 1025;
+            std::vector<float> result(spectrumSize);
+            memcpy(result.data(), blob.data() + blob.size() - spectrumSize * sizeof(float),
+                   spectrumSize * sizeof(float));
+            return result;
+        };
+
+        EffectNoiseReduction noise, quietest, all, whole;
+        REQUIRE(noise.GetProfile(track.get(), 0.0, 1.4, 12.0, 6.0, 3.0, &factory));
+        REQUIRE(quietest.GetAutoProfile({track.get()}, 0.1, 12.0, 6.0, 3.0, &factory));
+        const auto noiseMeans = means(noise), quietestMeans = means(quietest);
+        // The quietest windows are of the noise alone, if a little below its mean
+        double ratio = 0;
+        for (size_t ii = 1; ii < noiseMeans.size() - 1; ++ii)
+            ratio += quietestMeans[ii] / noiseMeans[ii];
+        ratio /= noiseMeans.size() - 2;
+        CHECK(ratio > 0.85);
+        CHECK(ratio < 1.05);
+        CHECK(quietestMeans[128] < 2 * noiseMeans[128]);
+
+        // All of the windows are the profile of all of the track
+        REQUIRE(all.GetAutoProfile({track.get()}, 1.0, 12.0, 6.0, 3.0, &factory));
+        REQUIRE(whole.GetProfile(track.get(), 0.0, track->GetEndTime(), 12.0, 6.0, 3.0, &factory));
+        const auto allMeans = means(all), wholeMeans = means(whole);
+        for (size_t ii = 0; ii < allMeans.size(); ++ii)
+            CHECK(allMeans[ii] == Approx(wholeMeans[ii]).epsilon(1e-4));
+
+        CHECK_FALSE(quietest.GetAutoProfile({track.get()}, 0.0, 12.0, 6.0, 3.0, &factory));
+        // Which leaves the profile of the windows given
+        CHECK(quietest.ReduceNoise(track.get(), 12.0, 6.0, 3.0, &factory));
+    }
+
+    SECTION("all channels of a stereo file are processed.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+
+        // make a stereo file out of two copies of the mono one
+        TrackHolders left{}, right{};
+        REQUIRE(PCMImportFileHandle::Open("test.wav")->Import(factory, left) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("test.wav")->Import(factory, right) == ProgressResult::Success);
+        left[0]->SetChannel(WaveTrack::LeftChannel);
+        right[0]->SetChannel(WaveTrack::RightChannel);
+        auto stereoArray = WaveTrackConstArray();
+        stereoArray.emplace_back(std::move(left.at(0)));
+        stereoArray.emplace_back(std::move(right.at(0)));
+        REQUIRE(ExportPCM().Export(stereoArray, std::string("test_stereo.wav")) == ProgressResult::Success);
+
+        TrackHolders holders{};
+        REQUIRE(PCMImportFileHandle::Open("test_stereo.wav")->Import(factory, holders) == ProgressResult::Success);
+        REQUIRE(holders.size() == 2);
+
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfile(holders[0].get(), 0.0, 0.3, 12.0, 6.0, 3.0, factory));
+        REQUIRE(effect->ReduceNoise(std::vector<WaveTrack *>{holders[0].get(), holders[1].get()},
+                                    12.0, 6.0, 3.0, factory));
+
+        auto audioArray = WaveTrackConstArray();
+        audioArray.emplace_back(std::move(holders.at(0)));
+        audioArray.emplace_back(std::move(holders.at(1)));
+        REQUIRE(ExportPCM().Export(audioArray, std::string("test_out.wav")) == ProgressResult::Success);
+
+        TrackHolders reduced{};
+        REQUIRE(PCMImportFileHandle::Open("test_out.wav")->Import(factory, reduced) == ProgressResult::Success);
+        REQUIRE(reduced.size() == 2);
+
+        // each channel as the mono file is reduced and exported alone
+        TrackHolders mono{};
+        REQUIRE(PCMImportFileHandle::Open("test.wav")->Import(factory, mono) == ProgressResult::Success);
+        EffectNoiseReduction monoEffect;
+        REQUIRE(monoEffect.GetProfile(mono[0].get(), 0.0, 0.3, 12.0, 6.0, 3.0, factory));
+        REQUIRE(monoEffect.ReduceNoise(mono[0].get(), 12.0, 6.0, 3.0, factory));
+        auto monoArray = WaveTrackConstArray();
+        monoArray.emplace_back(std::move(mono.at(0)));
+        REQUIRE(ExportPCM().Export(monoArray, std::string("test_mono.wav")) == ProgressResult::Success);
+        TrackHolders expected{};
+        REQUIRE(PCMImportFileHandle::Open("test_mono.wav")->Import(factory, expected) == ProgressResult::Success);
+        REQUIRE(expected.size() == 1);
+
+        const auto len = expected[0]->TimeToLongSamples(expected[0]->GetEndTime()).as_size_t();
+        std::vector<float> expectedSamples(len), original(len);
+        expected[0]->Get((samplePtr) expectedSamples.data(), floatSample, 0, len);
+        TrackHolders source{};
+        REQUIRE(PCMImportFileHandle::Open("test.wav")->Import(factory, source) == ProgressResult::Success);
+        source[0]->Get((samplePtr) original.data(), floatSample, 0, len);
+        CHECK(expectedSamples != original);
+        for (const auto &channel : reduced) {
+            REQUIRE(channel->TimeToLongSamples(channel->GetEndTime()).as_size_t() == len);
+            std::vector<float> samples(len);
+            channel->Get((samplePtr) samples.data(), floatSample, 0, len);
+            CHECK(samples == expectedSamples);
+        }
+
+        remove("test_stereo.wav");
+        remove("test_out.wav");
+        remove("test_mono.wav");
+        delete factory;
+        delete effect;
+    }
+
+    SECTION("parallel noise reduction of one track matches the serial result.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders bg_holders{}, serial{}, parallel{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, serial) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, parallel) == ProgressResult::Success);
+
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+        REQUIRE(effect->ReduceNoise(serial[0].get(), 12.0, 6.0, 3.0, factory));
+        effect->SetThreadCount(4);
+        REQUIRE(effect->ReduceNoise(parallel[0].get(), 12.0, 6.0, 3.0, factory));
+
+        const auto len = serial[0]->TimeToLongSamples(serial[0]->GetEndTime()).as_size_t();
+        REQUIRE(parallel[0]->TimeToLongSamples(parallel[0]->GetEndTime()).as_size_t() == len);
+        std::vector<float> expected(len), actual(len);
+        serial[0]->Get((samplePtr) expected.data(), floatSample, 0, len);
+        parallel[0]->Get((samplePtr) actual.data(), floatSample, 0, len);
+        CHECK(expected == actual);
+
+        delete factory;
+        delete effect;
+    }
+
+    SECTION("lazy noise reduction computes the blocks read, as an eager pass would.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = std::make_unique<TrackFactory>(dir_manager);
+        TrackHolders bg_holders{}, holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) == ProgressResult::Success);
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+
+        // input.wav over and over, for a track of several blocks
+        const auto inputLen = holders[0]->TimeToLongSamples(holders[0]->GetEndTime()).as_size_t();
+        std::vector<float> input(inputLen);
+        holders[0]->Get((samplePtr) input.data(), floatSample, 0, inputLen);
+        const auto makeTrack = [&] {
+            auto track = factory->NewWaveTrack(floatSample, holders[0]->GetRate());
+            for (int ii = 0; ii < 30; ++ii)
+                track->Append((samplePtr) input.data(), floatSample, inputLen);
+            track->Flush();
+            return track;
+        };
+        const size_t len = inputLen * 30;
+        const auto get = [](WaveTrack &track, size_t start, size_t count) {
+            std::vector<float> samples(count);
+            track.Get((samplePtr) samples.data(), floatSample, start, count);
+            return samples;
+        };
+        const auto available = [](WaveTrack &track) {
+            std::vector<bool> result;
+            for (const auto &block : track.GetClipByIndex(0)->GetSequence()->GetBlockArray())
+                result.push_back(block.f->IsDataAvailable());
+            return result;
+        };
+
+        auto eager = makeTrack();
+        REQUIRE(effect.ReduceNoise(eager.get(), 12.0, 6.0, 3.0, factory.get()));
+        const auto expected = get(*eager, 0, len);
+
+        // On demand only:  a read of the first second reduces the first block
+        effect.SetLazy(true, false);
+        auto lazy = makeTrack();
+        REQUIRE(effect.ReduceNoise(lazy.get(), 12.0, 6.0, 3.0, factory.get()));
+        REQUIRE(lazy->TimeToLongSamples(lazy->GetEndTime()).as_size_t() == len);
+        auto blocks = available(*lazy);
+        REQUIRE(blocks.size() >= 4);
+        CHECK(std::none_of(blocks.begin(), blocks.end(), [](bool ready) { return ready; }));
+        CHECK(get(*lazy, 0, 16000) == std::vector<float>(expected.begin(), expected.begin() + 16000));
+        blocks = available(*lazy);
+        CHECK(blocks[0]);
+        CHECK(std::count(blocks.begin(), blocks.end(), true) == 1);
+        // and one across the boundary of others, those two
+        const auto boundary = lazy->GetClipByIndex(0)->GetSequence()->GetBlockArray()[2].start.as_size_t();
+        CHECK(get(*lazy, boundary - 100, 200) ==
+              std::vector<float>(expected.begin() + boundary - 100, expected.begin() + boundary + 100));
+        blocks = available(*lazy);
+        CHECK(std::count(blocks.begin(), blocks.end(), true) == 3);
+        CHECK_FALSE(blocks.back());
+        CHECK(get(*lazy, 0, len) == expected);
+        blocks = available(*lazy);
+        CHECK(std::all_of(blocks.begin(), blocks.end(), [](bool ready) { return ready; }));
+
+        // In the background, read from the end first and from several threads
+        effect.SetLazy(true);
+        auto background = makeTrack();
+        REQUIRE(effect.ReduceNoise(background.get(), 12.0, 6.0, 3.0, factory.get()));
+        CHECK(get(*background, len - 1000, 1000) == std::vector<float>(expected.end() - 1000, expected.end()));
+        std::vector<std::vector<float>> actual(4);
+        std::vector<std::thread> threads;
+        for (auto &samples : actual)
+            threads.emplace_back([&] { samples = get(*background, 0, len); });
+        for (auto &thread : threads)
+            thread.join();
+        for (const auto &samples : actual)
+            CHECK(samples == expected);
+
+        // A track that goes before its blocks are reduced stops their thread
+        auto dropped = makeTrack();
+        REQUIRE(effect.ReduceNoise(dropped.get(), 12.0, 6.0, 3.0, factory.get()));
+        dropped.reset();
+    }
+
+    SECTION("tracks stored in 16 bits are reduced and exported as float tracks are.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = std::make_unique<TrackFactory>(dir_manager);
+        TrackHolders bg_holders{}, wide{}, compact{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) ==
+                ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), wide) == ProgressResult::Success);
+        auto handle = PCMImportFileHandle::Open("input.wav");
+        handle->SetSampleFormat(int16Sample);
+        REQUIRE(handle->Import(factory.get(), compact) == ProgressResult::Success);
+        REQUIRE(wide[0]->GetSampleFormat() == floatSample);
+        REQUIRE(compact[0]->GetSampleFormat() == int16Sample);
+
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+        REQUIRE(effect.ReduceNoise(wide[0].get(), 12.0, 6.0, 3.0, factory.get()));
+        // segments are reduced into 16 bit tracks too
+        effect.SetThreadCount(4);
+        REQUIRE(effect.ReduceNoise(compact[0].get(), 12.0, 6.0, 3.0, factory.get()));
+        CHECK(compact[0]->GetSampleFormat() == int16Sample);
+        CHECK(compact[0]->GetNumClips() == 1);
+
+        std::vector<char> expected, actual;
+        auto wideArray = WaveTrackConstArray(), compactArray = WaveTrackConstArray();
+        wideArray.emplace_back(std::move(wide.at(0)));
+        compactArray.emplace_back(std::move(compact.at(0)));
+        REQUIRE(ExportPCM().ExportToMemory(wideArray, expected) == ProgressResult::Success);
+        REQUIRE(ExportPCM().ExportToMemory(compactArray, actual) == ProgressResult::Success);
+        CHECK(expected == actual);
+    }
+
+    SECTION("reading blocks ahead gives the result of reading them in turn.") {
+        // block files on disk, read by the read-ahead threads
+        const auto dir_manager = std::make_shared<DirManager>();
+        auto factory = std::make_unique<TrackFactory>(dir_manager);
+        TrackHolders bg_holders{}, serial{}, readAhead{}, parallel{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) ==
+                ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), serial) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), readAhead) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), parallel) == ProgressResult::Success);
+
+        EffectNoiseReduction effect;
+        effect.SetReadAhead(2);
+        REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+        std::vector<char> withReadAhead;
+        REQUIRE(effect.SaveProfile(withReadAhead));
+        REQUIRE(effect.ReduceNoise(readAhead[0].get(), 12.0, 6.0, 3.0, factory.get()));
+        effect.SetThreadCount(3);
+        REQUIRE(effect.ReduceNoise(parallel[0].get(), 12.0, 6.0, 3.0, factory.get()));
+
+        EffectNoiseReduction reference;
+        REQUIRE(reference.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+        std::vector<char> withoutReadAhead;
+        REQUIRE(reference.SaveProfile(withoutReadAhead));
+        CHECK(withReadAhead == withoutReadAhead);
+        REQUIRE(reference.ReduceNoise(serial[0].get(), 12.0, 6.0, 3.0, factory.get()));
+
+        const auto len = serial[0]->TimeToLongSamples(serial[0]->GetEndTime()).as_size_t();
+        std::vector<float> expected(len), actual(len);
+        serial[0]->Get((samplePtr) expected.data(), floatSample, 0, len);
+        for (const auto &holders : {&readAhead, &parallel}) {
+            REQUIRE((*holders)[0]->TimeToLongSamples((*holders)[0]->GetEndTime()).as_size_t() == len);
+            (*holders)[0]->Get((samplePtr) actual.data(), floatSample, 0, len);
+            CHECK(expected == actual);
+        }
+    }
+
+    SECTION("streaming noise reduction matches reduction of a track.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders bg_holders{}, holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, holders) == ProgressResult::Success);
+        const auto len = holders[0]->TimeToLongSamples(holders[0]->GetEndTime()).as_size_t();
+        std::vector<float> input(len);
+        holders[0]->Get((samplePtr) input.data(), floatSample, 0, len);
+
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->CreateStream(12.0, 6.0, 3.0) == nullptr);
+        REQUIRE(effect->GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+        auto stream = effect->CreateStream(12.0, 6.0, 3.0);
+        REQUIRE(stream != nullptr);
+        CHECK(stream->GetRate() == holders[0]->GetRate());
+        REQUIRE(effect->ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory));
+        std::vector<float> expected(len);
+        holders[0]->Get((samplePtr) expected.data(), floatSample, 0, len);
+
+        // Twice, to check that Flush starts the stream over
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<float> actual;
+            size_t pushed = 0;
+            for (size_t chunk = 1; pushed < len; chunk = chunk * 3 + 1) {
+                const auto nn = std::min(chunk % 4000 + 1, len - pushed);
+                stream->Push(&input[pushed], nn);
+                pushed += nn;
+                // Output lags by the latency
+                CHECK(actual.size() + stream->Available() + std::min(pushed, stream->GetLatency()) <= pushed);
+                std::vector<float> buffer(stream->Available());
+                CHECK(stream->Pull(buffer.data(), buffer.size()) == buffer.size());
+                actual.insert(actual.end(), buffer.begin(), buffer.end());
+            }
+            stream->Flush();
+            std::vector<float> buffer(stream->Available());
+            stream->Pull(buffer.data(), buffer.size());
+            actual.insert(actual.end(), buffer.begin(), buffer.end());
+            CHECK(actual == expected);
+        }
+
+        delete factory;
+        delete effect;
+    }
+
+    SECTION("samples in memory are profiled and reduced as tracks are.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders bg_holders{}, holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, holders) == ProgressResult::Success);
+        const double rate = holders[0]->GetRate();
+        const auto len = holders[0]->TimeToLongSamples(holders[0]->GetEndTime()).as_size_t();
+        std::vector<float> input(len);
+        holders[0]->Get((samplePtr) input.data(), floatSample, 0, len);
+        const auto noiseLen = bg_holders[0]->TimeToLongSamples(0.5).as_size_t();
+        std::vector<float> noise(noiseLen);
+        bg_holders[0]->Get((samplePtr) noise.data(), floatSample, 0, noiseLen);
+
+        EffectNoiseReduction fromTrack, fromSamples;
+        REQUIRE(fromTrack.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+        REQUIRE(fromSamples.GetProfile(noise.data(), noiseLen, rate));
+        std::vector<char> expectedProfile, actualProfile;
+        REQUIRE(fromTrack.SaveProfile(expectedProfile));
+        REQUIRE(fromSamples.SaveProfile(actualProfile));
+        CHECK(actualProfile == expectedProfile);
+        CHECK_FALSE(EffectNoiseReduction().GetProfile(noise.data(), 10, rate));
+
+        REQUIRE(fromTrack.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory));
+        std::vector<float> expected(len);
+        holders[0]->Get((samplePtr) expected.data(), floatSample, 0, len);
+        std::vector<float> actual(len);
+        REQUIRE(ReduceNoiseSamples(fromSamples, input.data(), floatSample, actual.data(), floatSample,
+                                   len, 1, rate, 12.0, 6.0, 3.0));
+        CHECK(actual == expected);
+        CHECK_FALSE(ReduceNoiseSamples(fromSamples, input.data(), floatSample, actual.data(), floatSample,
+                                       len, 1, rate / 2, 12.0, 6.0, 3.0));
+
+        // Interleaved channels are each reduced as alone; 16 bit samples are
+        // scaled as read from a file, and converted back as exported
+        std::vector<float> reversed(input.rbegin(), input.rend()), reducedReversed(len);
+        REQUIRE(ReduceNoiseSamples(fromSamples, reversed.data(), floatSample, reducedReversed.data(), floatSample,
+                                   len, 1, rate, 12.0, 6.0, 3.0));
+        std::vector<float> stereo(2 * len), reducedStereo(2 * len);
+        std::vector<short> stereoShorts(2 * len), reducedShorts(2 * len);
+        for (size_t ii = 0; ii < len; ++ii) {
+            stereo[2 * ii] = input[ii];
+            stereo[2 * ii + 1] = reversed[ii];
+            stereoShorts[2 * ii] = (short) std::lrint(std::max(-1.0f, std::min(input[ii], 32767.0f / 32768)) * 32768);
+        }
+        REQUIRE(ReduceNoiseSamples(fromSamples, stereo.data(), floatSample, reducedStereo.data(), floatSample,
+                                   len, 2, rate, 12.0, 6.0, 3.0));
+        for (size_t ii = 0; ii < len; ++ii) {
+            CHECK(reducedStereo[2 * ii] == expected[ii]);
+            CHECK(reducedStereo[2 * ii + 1] == reducedReversed[ii]);
+        }
+
+        std::vector<float> fromShorts(len), reducedFromShorts(len);
+        for (size_t ii = 0; ii < len; ++ii)
+            fromShorts[ii] = stereoShorts[2 * ii] * (1.0f / 0x8000);
+        REQUIRE(ReduceNoiseSamples(fromSamples, fromShorts.data(), floatSample, reducedFromShorts.data(),
+                                   floatSample, len, 1, rate, 12.0, 6.0, 3.0));
+        std::vector<short> expectedShorts(len);
+        CopySamples((samplePtr) reducedFromShorts.data(), floatSample, (samplePtr) expectedShorts.data(),
+                    int16Sample, len);
+        REQUIRE(ReduceNoiseSamples(fromSamples, stereoShorts.data(), int16Sample, reducedShorts.data(), int16Sample,
+                                   len, 2, rate, 12.0, 6.0, 3.0));
+        for (size_t ii = 0; ii < len; ++ii)
+            CHECK(reducedShorts[2 * ii] == expectedShorts[ii]);
+
+        delete factory;
+    }
+
+    SECTION("streaming a file writes what import, reduction and export do.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders bg_holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+
+        // a stereo file of two copies of the input too
+        TrackHolders left{}, right{};
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, left) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, right) == ProgressResult::Success);
+        left[0]->SetChannel(WaveTrack::LeftChannel);
+        right[0]->SetChannel(WaveTrack::RightChannel);
+        auto stereoArray = WaveTrackConstArray();
+        stereoArray.emplace_back(std::move(left.at(0)));
+        stereoArray.emplace_back(std::move(right.at(0)));
+        REQUIRE(ExportPCM().Export(stereoArray, std::string("test_stereo.wav")) == ProgressResult::Success);
+
+        for (const char *src : {"input.wav", "test_stereo.wav"}) {
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open(src)->Import(factory, holders) == ProgressResult::Success);
+            std::vector<WaveTrack *> tracks;
+            auto audioArray = WaveTrackConstArray();
+            for (auto &holder : holders) {
+                tracks.push_back(holder.get());
+                audioArray.emplace_back(std::move(holder));
+            }
+            REQUIRE(effect->ReduceNoise(tracks, 12.0, 6.0, 3.0, factory));
+            REQUIRE(ExportPCM().Export(audioArray, std::string("test_out.wav")) == ProgressResult::Success);
+
+            REQUIRE(ReduceNoisePCM(*effect, src, "test_stream.wav", 12.0, 6.0, 3.0) == ProgressResult::Success);
+            CHECK(calc_file_hash("test_stream.wav") == calc_file_hash("test_out.wav"));
+        }
+        CHECK(ReduceNoisePCM(*effect, "missing.wav", "test_stream.wav", 12.0, 6.0, 3.0) == ProgressResult::Failed);
+
+        remove("test_stereo.wav");
+        remove("test_out.wav");
+        remove("test_stream.wav");
+        delete factory;
+        delete effect;
+    }
+
+    SECTION("streams kept from one call to the next give the results of NEW ones.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders bg_holders{}, holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, holders) == ProgressResult::Success);
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+
+        // a stereo file too, with more channels than the streams so far
+        const double rate = holders[0]->GetRate();
+        const auto len = holders[0]->TimeToLongSamples(holders[0]->GetEndTime()).as_size_t();
+        std::vector<float> mono(len), stereo(2 * len);
+        holders[0]->Get((samplePtr) mono.data(), floatSample, 0, len);
+        for (size_t ii = 0; ii < len; ++ii)
+            stereo[2 * ii] = stereo[2 * ii + 1] = mono[ii];
+        std::vector<float> expectedMono(len), expectedStereo(2 * len);
+        REQUIRE(ReduceNoiseSamples(*effect, mono.data(), floatSample, expectedMono.data(), floatSample,
+                                   len, 1, rate, 12.0, 6.0, 3.0));
+        REQUIRE(ReduceNoiseSamples(*effect, stereo.data(), floatSample, expectedStereo.data(), floatSample,
+                                   len, 2, rate, 12.0, 6.0, 3.0));
+        REQUIRE(ReduceNoisePCM(*effect, "input.wav", "test_out.wav", 12.0, 6.0, 3.0) == ProgressResult::Success);
+        const auto expectedFile = calc_file_hash("test_out.wav");
+
+        NoiseReductionStreams streams;
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<float> actualMono(len), actualStereo(2 * len);
+            REQUIRE(ReduceNoiseSamples(*effect, streams, mono.data(), floatSample, actualMono.data(), floatSample,
+                                       len, 1, rate, 12.0, 6.0, 3.0));
+            CHECK(actualMono == expectedMono);
+            REQUIRE(ReduceNoiseSamples(*effect, streams, stereo.data(), floatSample, actualStereo.data(),
+                                       floatSample, len, 2, rate, 12.0, 6.0, 3.0));
+            CHECK(streams.size() == 2);
+            CHECK(actualStereo == expectedStereo);
+
+            REQUIRE(ReduceNoisePCM(*effect, streams, "input.wav", "test_stream.wav", 12.0, 6.0, 3.0) ==
+                    ProgressResult::Success);
+            CHECK(calc_file_hash("test_stream.wav") == expectedFile);
+        }
+        CHECK(ReduceNoisePCM(*effect, streams, "missing.wav", "test_stream.wav", 12.0, 6.0, 3.0) ==
+              ProgressResult::Failed);
+        CHECK(streams.empty());
+
+        remove("test_out.wav");
+        remove("test_stream.wav");
+        delete factory;
+        delete effect;
+    }
+
+    SECTION("stage timers and counters add up the work done while enabled.") {
+        const auto run = [] {
+            const auto dir_manager = std::make_shared<DirManager>(true);
+            auto factory = std::make_unique<TrackFactory>(dir_manager);
+            TrackHolders bg_holders{}, holders{};
+            REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) ==
+                    ProgressResult::Success);
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) == ProgressResult::Success);
+            EffectNoiseReduction effect;
+            effect.SetThreadCount(2);
+            REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+            REQUIRE(effect.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory.get()));
+            const auto len = holders[0]->TimeToLongSamples(holders[0]->GetEndTime()).as_size_t();
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(holders.at(0)));
+            std::vector<char> data;
+            REQUIRE(ExportPCM().ExportToMemory(audioArray, data) == ProgressResult::Success);
+            return len;
+        };
+
+        REQUIRE_FALSE(Instrumentation::IsEnabled());
+        auto before = Instrumentation::GetReport();
+        run();
+        auto report = Instrumentation::GetReport() - before;
+        for (const auto &timing : report.stages)
+            CHECK(timing.calls == 0);
+        for (const auto count : report.counters)
+            CHECK(count == 0);
+
+        Instrumentation::Enable();
+        before = Instrumentation::GetReport();
+        const auto len = run();
+        report = Instrumentation::GetReport() - before;
+        Instrumentation::Disable();
+
+        const auto calls = [&](Instrumentation::Stage stage) { return report.stages[stage].calls; };
+        CHECK(calls(Instrumentation::Import) == 2);
+        CHECK(calls(Instrumentation::Export) == 1);
+        CHECK(calls(Instrumentation::Replace) == 1);
+        CHECK(calls(Instrumentation::Profile) > 0);
+        CHECK(calls(Instrumentation::Append) > 0);
+        CHECK(calls(Instrumentation::BlockRead) > 0);
+        CHECK(calls(Instrumentation::BlockWrite) > 0);
+        // the windows of the profile are transformed in batches, as part of
+        // profiling; those reduced one at a time, and classified
+        const auto windows = report.counters[Instrumentation::Windows];
+        CHECK(calls(Instrumentation::FFT) > 0);
+        CHECK(calls(Instrumentation::FFT) < windows);
+        CHECK(calls(Instrumentation::Classify) > 0);
+        CHECK(calls(Instrumentation::Classify) < windows);
+        CHECK(calls(Instrumentation::InverseFFT) == calls(Instrumentation::OverlapAdd));
+        CHECK(report.counters[Instrumentation::SamplesExported] == len);
+        CHECK(report.counters[Instrumentation::BlocksWritten] == calls(Instrumentation::BlockWrite));
+        CHECK(report.counters[Instrumentation::BytesRead] > 0);
+        CHECK(report.stages[Instrumentation::Import].nanoseconds > 0);
+    }
+
+    SECTION("a trace holds the spans of the coarser stages on each thread.") {
+        REQUIRE_FALSE(Instrumentation::IsTracing());
+        std::ostringstream unused;
+        CHECK_FALSE(Instrumentation::StopTrace(unused));
+
+        REQUIRE(Instrumentation::StartTrace());
+        CHECK_FALSE(Instrumentation::StartTrace());
+        CHECK(Instrumentation::IsEnabled());
+        {
+            const auto dir_manager = std::make_shared<DirManager>(true);
+            auto factory = std::make_unique<TrackFactory>(dir_manager);
+            TrackHolders bg_holders{}, holders{};
+            REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) ==
+                    ProgressResult::Success);
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) == ProgressResult::Success);
+            EffectNoiseReduction effect;
+            effect.SetThreadCount(2);
+            REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+            REQUIRE(effect.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory.get()));
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(holders.at(0)));
+            std::vector<char> data;
+            ExportPCM exporter;
+            exporter.SetWriteQueueDepth(2);
+            REQUIRE(exporter.ExportToMemory(audioArray, data) == ProgressResult::Success);
+        }
+        std::ostringstream out;
+        REQUIRE(Instrumentation::StopTrace(out));
+        CHECK_FALSE(Instrumentation::IsTracing());
+        CHECK_FALSE(Instrumentation::IsEnabled());
+
+        const auto trace = out.str();
+        const auto count = [&](const std::string &text) {
+            size_t n = 0;
+            for (auto pos = trace.find(text); pos != std::string::npos; pos = trace.find(text, pos + 1))
+                ++n;
+            return n;
+        };
+        CHECK(trace.compare(0, 16, "{\"traceEvents\": ") == 0);
+#ifndef NOISERED_NO_INSTRUMENTATION
+        for (const auto stage : {Instrumentation::Import, Instrumentation::Steps, Instrumentation::FFTBatch,
+                                 Instrumentation::BlockRead, Instrumentation::BlockWrite,
+                                 Instrumentation::Replace, Instrumentation::Export,
+                                 Instrumentation::ExportWrite})
+            CHECK(count("\"name\": \"" + std::string(Instrumentation::GetName(stage)) + "\"") > 0);
+        for (const auto stage : {Instrumentation::FFT, Instrumentation::Classify, Instrumentation::Append})
+            CHECK(count("\"name\": \"" + std::string(Instrumentation::GetName(stage)) + "\"") == 0);
+        // this thread, the two of the segments, and the writer's
+        CHECK(count("\"thread_name\"") >= 4);
+#endif
+    }
+
+    SECTION("a batch of files is written as one file at a time is.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders bg_holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        auto effect = new EffectNoiseReduction();
+        CHECK(ReduceNoisePCMBatch(*effect, {{"input.wav", "test_batch0.wav"}}, 12.0, 6.0, 3.0)[0].result ==
+              ProgressResult::Failed);
+        REQUIRE(effect->GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+
+        REQUIRE(ReduceNoisePCM(*effect, "input.wav", "test_out.wav", 12.0, 6.0, 3.0) == ProgressResult::Success);
+        const auto expected = calc_file_hash("test_out.wav");
+        std::vector<std::pair<std::string, std::string>> files;
+        for (int ii = 0; ii < 6; ++ii)
+            files.emplace_back(ii == 3 ? "missing.wav" : "input.wav", "test_batch" + std::to_string(ii) + ".wav");
+        const auto results = ReduceNoisePCMBatch(*effect, files, 12.0, 6.0, 3.0, 4);
+        REQUIRE(results.size() == files.size());
+        for (size_t ii = 0; ii < files.size(); ++ii) {
+            if (ii == 3)
+                CHECK(results[ii].result == ProgressResult::Failed);
+            else {
+                CHECK(results[ii].result == ProgressResult::Success);
+                CHECK(results[ii].seconds > 0);
+                CHECK(calc_file_hash(files[ii].second) == expected);
+            }
+            remove(files[ii].second.c_str());
+        }
+
+        remove("test_out.wav");
+        delete factory;
+        delete effect;
+    }
+
+    SECTION("a batch of long files split into slices among short ones is written as one file at a time is.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = std::make_unique<TrackFactory>(dir_manager);
+        TrackHolders bg_holders{}, holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) == ProgressResult::Success);
+        REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) == ProgressResult::Success);
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()));
+
+        // A stereo file of input.wav over and over, forwards on the left
+        // and backwards on the right
+        const auto inputLen = holders[0]->TimeToLongSamples(holders[0]->GetEndTime()).as_size_t();
+        std::vector<float> input(inputLen);
+        holders[0]->Get((samplePtr) input.data(), floatSample, 0, inputLen);
+        std::vector<float> reversed(input.rbegin(), input.rend());
+        auto left = factory->NewWaveTrack(floatSample, holders[0]->GetRate());
+        auto right = factory->NewWaveTrack(floatSample, holders[0]->GetRate());
+        for (int ii = 0; ii < 8; ++ii) {
+            left->Append((samplePtr) input.data(), floatSample, inputLen);
+            right->Append((samplePtr) reversed.data(), floatSample, inputLen);
+        }
+        left->Flush();
+        right->Flush();
+        left->SetChannel(WaveTrack::LeftChannel);
+        right->SetChannel(WaveTrack::RightChannel);
+        auto stereoArray = WaveTrackConstArray();
+        stereoArray.emplace_back(std::move(left));
+        stereoArray.emplace_back(std::move(right));
+        REQUIRE(ExportPCM().Export(stereoArray, "test_long.wav", nullptr, 2) == ProgressResult::Success);
+
+        for (int subformat : {0, 2}) {
+            std::map<std::string, std::string> expected;
+            for (const auto name : {"input.wav", "test_long.wav"}) {
+                REQUIRE(ReduceNoisePCM(effect, name, "test_out.wav", 12.0, 6.0, 3.0, subformat) ==
+                        ProgressResult::Success);
+                expected[name] = calc_file_hash("test_out.wav");
+            }
+
+            std::vector<std::pair<std::string, std::string>> files;
+            for (int ii = 0; ii < 8; ++ii)
+                files.emplace_back(ii == 0 || ii == 5 ? "test_long.wav" : ii == 6 ? "missing.wav" : "input.wav",
+                                   "test_batch" + std::to_string(ii) + ".wav");
+            // Slices of a few overlaps, the last one short; and none
+            for (const size_t sliceFrames : {size_t{32768}, size_t{100000}, size_t{0}})
+                for (const unsigned threads : {1u, 3u, 8u}) {
+                    const auto results = ReduceNoisePCMBatch(effect, files, 12.0, 6.0, 3.0, threads, subformat,
+                                                             sliceFrames);
+                    REQUIRE(results.size() == files.size());
+                    for (size_t ii = 0; ii < files.size(); ++ii) {
+                        if (files[ii].first == "missing.wav")
+                            CHECK(results[ii].result == ProgressResult::Failed);
+                        else {
+                            CHECK(results[ii].result == ProgressResult::Success);
+                            CHECK(results[ii].seconds > 0);
+                            CHECK(calc_file_hash(files[ii].second) == expected[files[ii].first]);
+                        }
+                        remove(files[ii].second.c_str());
+                    }
+                }
+        }
+
+        // A long file whose writes fail part way fails alone, while other
+        // threads are still reducing its later slices
+        {
+            struct rlimit before;
+            REQUIRE(getrlimit(RLIMIT_FSIZE, &before) == 0);
+            struct rlimit limit = before;
+            limit.rlim_cur = 300000;
+            const auto handler = signal(SIGXFSZ, SIG_IGN);
+            REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+            std::vector<std::pair<std::string, std::string>> files{{"test_long.wav", "test_batch0.wav"}};
+            for (int ii = 1; ii < 6; ++ii)
+                files.emplace_back("input.wav", "test_batch" + std::to_string(ii) + ".wav");
+            const auto results = ReduceNoisePCMBatch(effect, files, 12.0, 6.0, 3.0, 4, 0, 32768);
+            REQUIRE(setrlimit(RLIMIT_FSIZE, &before) == 0);
+            signal(SIGXFSZ, handler);
+            CHECK(results[0].result == ProgressResult::Cancelled);
+            for (size_t ii = 0; ii < files.size(); ++ii) {
+                if (ii > 0)
+                    CHECK(results[ii].result == ProgressResult::Success);
+                remove(files[ii].second.c_str());
+            }
+        }
+
+        // A long file that cannot be written fails alone
+        const auto results = ReduceNoisePCMBatch(effect, {{"test_long.wav", "no_such_dir/test_batch.wav"},
+                                                          {"input.wav", "test_batch1.wav"}},
+                                                 12.0, 6.0, 3.0, 2, 0, 32768);
+        CHECK(results[0].result == ProgressResult::Cancelled);
+        CHECK(results[1].result == ProgressResult::Success);
+        remove("test_batch1.wav");
+
+        remove("test_long.wav");
+        remove("test_out.wav");
+    }
+
+    SECTION("concurrent runs give the serial result.") {
+        // each with its own DirManager, as pyaudacity calls are
+        auto run = [](bool inMemory, std::vector<char> &dst) {
+            const auto dir_manager = std::make_shared<DirManager>(inMemory);
+            auto factory = std::make_unique<TrackFactory>(dir_manager);
+            TrackHolders bg_holders{}, holders{};
+            if (PCMImportFileHandle::Open("bg_input.wav")->Import(factory.get(), bg_holders) != ProgressResult::Success ||
+                PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) != ProgressResult::Success)
+                return false;
+            EffectNoiseReduction effect;
+            if (!effect.GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory.get()) ||
+                !effect.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory.get()))
+                return false;
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(holders.at(0)));
+            return ExportPCM().ExportToMemory(audioArray, dst) == ProgressResult::Success;
+        };
+
+        std::vector<char> expected;
+        REQUIRE(run(true, expected));
+
+        // half of them with block files under the temp dir
+        const size_t nThreads = 8;
+        std::vector<std::vector<char>> actual(nThreads);
+        std::vector<int> results(nThreads);
+        std::vector<std::thread> threads;
+        for (size_t ii = 0; ii < nThreads; ++ii)
+            threads.emplace_back([&, ii] { results[ii] = run(ii % 2 == 0, actual[ii]); });
+        for (auto &thread : threads)
+            thread.join();
+        for (size_t ii = 0; ii < nThreads; ++ii) {
+            CHECK(results[ii]);
+            CHECK(actual[ii] == expected);
+        }
+    }
+
+    SECTION("dozens of pipelines share the caches while SIMD levels switch.") {
+        // half of the profiles from files and half from memory, through one
+        // cache, and half of the tracks with block files under the temp dir
+        std::vector<char> profileSource;
+        {
+            std::ifstream file("bg_input.wav", std::ios::in | std::ios::binary);
+            profileSource.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        ProfileCache cache;
+        auto run = [&](size_t ii, std::vector<char> &dst) {
+            const auto dir_manager = std::make_shared<DirManager>(ii % 2 == 0);
+            auto factory = std::make_unique<TrackFactory>(dir_manager);
+            EffectNoiseReduction effect;
+            TrackHolders holders{};
+            if (!(ii % 4 < 2 ? cache.GetProfile(effect, "bg_input.wav", 0.0, 0.5)
+                             : cache.GetProfile(effect, profileSource.data(), profileSource.size(), 0.0, 0.5)) ||
+                PCMImportFileHandle::Open("input.wav")->Import(factory.get(), holders) != ProgressResult::Success ||
+                !effect.ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory.get()))
+                return false;
+            auto audioArray = WaveTrackConstArray();
+            audioArray.emplace_back(std::move(holders.at(0)));
+            return ExportPCM().ExportToMemory(audioArray, dst) == ProgressResult::Success;
+        };
+
+        std::vector<char> expected;
+        REQUIRE(run(0, expected));
+
+        // the block cache evicting for all of them, and every kernel level
+        // forced in turn meanwhile, each giving the same samples
+        const auto initialBudget = SimpleBlockFile::GetCacheBudget();
+        const auto initialLevels = std::make_tuple(GetFFTSimdLevel(), GetKernelSimdLevel(),
+                                                   GetSampleKernelSimdLevel());
+        SimpleBlockFile::SetCacheBudget(4 << 20);
+        std::atomic<bool> done{false};
+        std::thread switcher([&] {
+            const SimdLevel levels[] = {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2,
+                                        SimdLevel::AVX512, SimdLevel::NEON};
+            for (size_t ii = 0; !done; ++ii) {
+                const auto level = levels[ii % (sizeof(levels) / sizeof(levels[0]))];
+                SetFFTSimdLevel(level);
+                SetKernelSimdLevel(level);
+                SetSampleKernelSimdLevel(level);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+
+        const size_t nThreads = 32;
+        std::vector<std::vector<char>> actual(nThreads);
+        std::vector<int> results(nThreads);
+        std::vector<std::thread> threads;
+        for (size_t ii = 0; ii < nThreads; ++ii)
+            threads.emplace_back([&, ii] { results[ii] = run(ii, actual[ii]); });
+        for (auto &thread : threads)
+            thread.join();
+        done = true;
+        switcher.join();
+        SetFFTSimdLevel(std::get<0>(initialLevels));
+        SetKernelSimdLevel(std::get<1>(initialLevels));
+        SetSampleKernelSimdLevel(std::get<2>(initialLevels));
+        SimpleBlockFile::SetCacheBudget(initialBudget);
+
+        for (size_t ii = 0; ii < nThreads; ++ii) {
+            CHECK(results[ii]);
+            CHECK(actual[ii] == expected);
+        }
+        const auto counts = cache.GetCounts();
+        CHECK(counts.hits + counts.misses == nThreads + 1);
+    }
+
+    SECTION("SIMD kernels match the scalar result.") {
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        auto factory = new TrackFactory(dir_manager);
+        TrackHolders bg_holders{};
+        REQUIRE(PCMImportFileHandle::Open("bg_input.wav")->Import(factory, bg_holders) == ProgressResult::Success);
+        auto effect = new EffectNoiseReduction();
+        REQUIRE(effect->GetProfile(bg_holders[0].get(), 0.0, 0.5, 12.0, 6.0, 3.0, factory));
+
+        const auto initialLevel = GetKernelSimdLevel();
+        std::vector<float> expected;
+        for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON}) {
+            if (!SetKernelSimdLevel(level))
+                continue;
+            TrackHolders holders{};
+            REQUIRE(PCMImportFileHandle::Open("input.wav")->Import(factory, holders) == ProgressResult::Success);
+            REQUIRE(effect->ReduceNoise(holders[0].get(), 12.0, 6.0, 3.0, factory));
+
+            const auto len = holders[0]->TimeToLongSamples(holders[0]->GetEndTime()).as_size_t();
+            std::vector<float> actual(len);
+            holders[0]->Get((samplePtr) actual.data(), floatSample, 0, len);
+            if (level == SimdLevel::Scalar)
+                expected = actual;
+            else
+                CHECK(expected == actual);
+        }
+        SetKernelSimdLevel(initialLevel);
+
+        delete factory;
+        delete effect;
+    }
+
+    SECTION("band classification ranks powers at every SIMD level.") {
+        const size_t nBands = 1025;
+        const auto initialLevel = GetKernelSimdLevel();
+        // Unrolled (3, 2), (5, 2), (5, 3) and (9, 2), and generic others
+        const unsigned shapes[][2] = {{3, 2}, {5, 2}, {5, 3}, {9, 2}, {5, 1}, {7, 4}, {17, 2}};
+        for (const auto &shape : shapes) {
+            const unsigned nWindows = shape[0], rank = shape[1];
+            std::vector<std::vector<float>> rows(nWindows, std::vector<float>(nBands));
+            std::vector<const float *> spectrums;
+            for (auto &row : rows) {
+                for (auto &power : row)
+                    power = (float) rand() / RAND_MAX;
+                spectrums.push_back(row.data());
+            }
+            std::vector<float> thresholds(nBands), expected(nBands);
+            for (size_t ii = 0; ii < nBands; ++ii) {
+                thresholds[ii] = (float) rand() / RAND_MAX;
+                std::vector<float> column;
+                for (const auto &row : rows)
+                    column.push_back(row[ii]);
+                std::sort(column.begin(), column.end(), std::greater<float>());
+                expected[ii] = column[rank - 1] <= thresholds[ii] ? 1.0f : 0.0f;
+            }
+
+            for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON}) {
+                if (!SetKernelSimdLevel(level))
+                    continue;
+                std::vector<float> isNoise(nBands, -1.0f);
+                ClassifyBands(isNoise.data(), spectrums.data(), nWindows, rank,
+                              thresholds.data(), 1, nBands);
+                CHECK(isNoise[0] == -1.0f);
+                CHECK(std::equal(isNoise.begin() + 1, isNoise.end(), expected.begin() + 1));
+            }
+        }
+        SetKernelSimdLevel(initialLevel);
+    }
+
+    SECTION("sorted bands slide a median over any count of windows.") {
+        const size_t nBands = 257;
+        for (const unsigned nWindows : {9u, 17u, 33u}) {
+            // As the Worker keeps them:  zeros of all but the newest window
+            std::vector<float> sorted(nBands * nWindows, 0.0f);
+            std::vector<std::vector<float>> history(nWindows, std::vector<float>(nBands, 0.0f));
+            bool matched = true;
+            for (int step = 0; step < 200; ++step) {
+                std::vector<float> newest(nBands);
+                for (auto &power : newest)
+                    // Ties too
+                    power = (float) (rand() % 64) / 64;
+                history.insert(history.begin(), newest);
+                history.pop_back();
+                InsertSortedBands(sorted.data(), nWindows, nWindows - 1, newest.data(), 1, nBands);
+                for (size_t ii = 1; ii < nBands; ++ii) {
+                    std::vector<float> column;
+                    for (const auto &row : history)
+                        column.push_back(row[ii]);
+                    std::sort(column.begin(), column.end());
+                    matched = matched && std::equal(column.begin(), column.end(), &sorted[ii * nWindows]);
+                }
+                RemoveSortedBands(sorted.data(), nWindows, nWindows, history.back().data(), 1, nBands);
+            }
+            CHECK(matched);
+            // Band 0 was outside the range
+            CHECK(std::all_of(sorted.begin(), sorted.begin() + nWindows, [](float power) { return power == 0.0f; }));
+        }
+    }
+
+    SECTION("a profile of another rate is mapped onto the bins of the track.") {
+        // Noise of the same density at both rates:  three times the power
+        // at three times the bandwidth
+        std::mt19937 generator{5};
+        std::normal_distribution<float> normal;
+        const auto noise = [&](size_t len, float deviation) {
+            std::vector<float> samples(len);
+            for (auto &sample : samples)
+                sample = deviation * normal(generator);
+            return samples;
+        };
+        const auto low = noise(16000, 0.02f / std::sqrt(3.0f));
+        const auto high = noise(48000, 0.02f);
+        const size_t len = 96000;
+        const auto input = noise(len, 0.02f);
+
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        // The level of the noise after reduction with a profile
+        const auto residual = [&](EffectNoiseReduction &effect, bool &result) {
+            auto track = factory.NewWaveTrack(floatSample, 48000);
+            track->Append((samplePtr) input.data(), floatSample, len);
+            track->Flush();
+            result = effect.ReduceNoise(track.get(), 12.0, 6.0, 3.0, &factory);
+            std::vector<float> output(len);
+            track->Get((samplePtr) output.data(), floatSample, 0, len);
+            double sum = 0;
+            // away from the ends
+            for (size_t ii = 8000; ii < len - 8000; ++ii)
+                sum += output[ii] * output[ii];
+            return std::sqrt(sum / (len - 16000));
+        };
+
+        EffectNoiseReduction sameRate, otherRate;
+        REQUIRE(sameRate.GetProfile(high.data(), high.size(), 48000));
+        REQUIRE(otherRate.GetProfile(low.data(), low.size(), 16000));
+        bool result;
+        residual(otherRate, result);
+        CHECK_FALSE(result);
+
+        otherRate.SetResampleProfile(true);
+        const double expected = residual(sameRate, result);
+        REQUIRE(result);
+        const double actual = residual(otherRate, result);
+        REQUIRE(result);
+        CHECK(expected < 0.02 / 2);
+        CHECK(actual == Approx(expected).epsilon(0.03));
+
+        // The profile itself is left at its rate
+        std::vector<char> blob;
+        REQUIRE(otherRate.SaveProfile(blob));
+        EffectNoiseReduction loaded;
+        REQUIRE(loaded.LoadProfile(blob.data(), blob.size()));
+        residual(loaded, result);
+        CHECK_FALSE(result);
+    }
+
+    SECTION("an adaptive profile follows noise that falls during reduction.") {
+        // Profiled in loud noise, which then stops, leaving quiet noise and,
+        // after a while, a tone louder than that but quieter than the loud
+        // noise in its bins; without frequency smoothing, which would lower
+        // the gains of so narrow a tone
+        const double rate = 16000;
+        const size_t len = 8 * 16000, toneStart = len / 2;
+        const double frequency = 1000, amplitude = 0.008;
+        std::mt19937 generator{9};
+        std::normal_distribution<float> normal;
+        std::vector<float> loud(16000), input(len);
+        for (auto &sample : loud)
+            sample = 0.06f * normal(generator);
+        for (size_t ii = 0; ii < len; ++ii) {
+            input[ii] = 0.01f * normal(generator);
+            if (ii >= toneStart)
+                input[ii] += amplitude * sin(2.0 * M_PI * frequency * ii / rate);
+        }
+
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        const auto reduce = [&](EffectNoiseReduction &effect) {
+            auto track = factory.NewWaveTrack(floatSample, rate);
+            track->Append((samplePtr) input.data(), floatSample, len);
+            track->Flush();
+            REQUIRE(effect.ReduceNoise(track.get(), 12.0, 6.0, 0.0, &factory));
+            std::vector<float> output(len);
+            track->Get((samplePtr) output.data(), floatSample, 0, len);
+            return output;
+        };
+        // Amplitude of the tone in the output, away from the ends
+        const auto toneAmplitude = [&](const std::vector<float> &output) {
+            double re = 0, im = 0;
+            const size_t first = toneStart + 8000, last = len - 8000;
+            for (size_t ii = first; ii < last; ++ii) {
+                re += output[ii] * cos(2.0 * M_PI * frequency * ii / rate);
+                im += output[ii] * sin(2.0 * M_PI * frequency * ii / rate);
+            }
+            return 2.0 * std::sqrt(re * re + im * im) / (last - first);
+        };
+
+        EffectNoiseReduction fixed, adaptive;
+        REQUIRE(fixed.GetProfile(loud.data(), loud.size(), rate));
+        REQUIRE(adaptive.GetProfile(loud.data(), loud.size(), rate));
+        adaptive.SetAdaptiveProfile(0.5);
+
+        // The fixed profile takes the tone for noise, the adapted one not
+        CHECK(toneAmplitude(reduce(fixed)) < amplitude / 2);
+        const auto adapted = reduce(adaptive);
+        CHECK(toneAmplitude(adapted) > amplitude * 0.75);
+
+        // Which is the same on any number of threads, and leaves the
+        // profile as it was
+        adaptive.SetThreadCount(4);
+        CHECK(reduce(adaptive) == adapted);
+        std::vector<char> fixedBlob, adaptiveBlob;
+        REQUIRE(fixed.SaveProfile(fixedBlob));
+        REQUIRE(adaptive.SaveProfile(adaptiveBlob));
+        CHECK(fixedBlob == adaptiveBlob);
+
+        // Streams adapt as tracks do
+        auto stream = adaptive.CreateStream(12.0, 6.0, 0.0);
+        REQUIRE(stream);
+        std::vector<float> streamed(len);
+        stream->Push(input.data(), len);
+        stream->Flush();
+        REQUIRE(stream->Pull(streamed.data(), len) == len);
+        CHECK(streamed == adapted);
+    }
+
+    SECTION("a frequency range limits the bands reduced.") {
+        // Quiet tones, which pass for noise, in and out of the speech band
+        const double rate = 48000;
+        const size_t len = 3 * 48000;
+        const double inBand = 1000, outOfBand = 8000, amplitude = 0.002;
+        std::mt19937 generator{21};
+        std::normal_distribution<float> normal;
+        std::vector<float> noise(48000), input(len);
+        for (auto &sample : noise)
+            sample = 0.02f * normal(generator);
+        for (size_t ii = 0; ii < len; ++ii)
+            input[ii] = 0.02f * normal(generator) + amplitude * (sin(2.0 * M_PI * inBand * ii / rate) +
+                                                                 sin(2.0 * M_PI * outOfBand * ii / rate));
+
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        const auto reduce = [&](EffectNoiseReduction &effect) {
+            auto track = factory.NewWaveTrack(floatSample, rate);
+            track->Append((samplePtr) input.data(), floatSample, len);
+            track->Flush();
+            REQUIRE(effect.ReduceNoise(track.get(), 12.0, 6.0, 3.0, &factory));
+            std::vector<float> output(len);
+            track->Get((samplePtr) output.data(), floatSample, 0, len);
+            return output;
+        };
+        const auto toneAmplitude = [&](const std::vector<float> &output, double frequency) {
+            double re = 0, im = 0;
+            const size_t first = 12000, last = len - 12000;
+            for (size_t ii = first; ii < last; ++ii) {
+                re += output[ii] * cos(2.0 * M_PI * frequency * ii / rate);
+                im += output[ii] * sin(2.0 * M_PI * frequency * ii / rate);
+            }
+            return 2.0 * std::sqrt(re * re + im * im) / (last - first);
+        };
+
+        EffectNoiseReduction all, speech;
+        REQUIRE(all.GetProfile(noise.data(), noise.size(), rate));
+        REQUIRE(speech.GetProfile(noise.data(), noise.size(), rate));
+        CHECK_FALSE(speech.SetFrequencyRange(3400, 300));
+        REQUIRE(speech.SetFrequencyRange(300, 3400));
+
+        const auto full = reduce(all), limited = reduce(speech);
+        CHECK(toneAmplitude(full, inBand) < amplitude / 2);
+        CHECK(toneAmplitude(full, outOfBand) < amplitude / 2);
+        CHECK(toneAmplitude(limited, inBand) < amplitude / 2);
+        CHECK(toneAmplitude(limited, outOfBand) == Approx(toneAmplitude(input, outOfBand)).epsilon(0.02));
+
+        // A range of all the bands is no range
+        REQUIRE(speech.SetFrequencyRange(0, rate / 2));
+        CHECK(reduce(speech) == full);
+        REQUIRE(speech.SetFrequencyRange(-1, -1));
+        CHECK(reduce(speech) == full);
+    }
+
+    SECTION("low latency bounds the delay of a stream.") {
+        // Noise, then a tone in it; without frequency smoothing, which would
+        // lower the gains of the tone's few bins
+        const double rate = 48000, frequency = 1000, amplitude = 0.1;
+        const size_t len = 2 * 48000, toneStart = len / 2;
+        std::mt19937 generator{33};
+        std::normal_distribution<float> normal;
+        std::vector<float> noise(24000), input(len);
+        for (auto &sample : noise)
+            sample = 0.02f * normal(generator);
+        for (size_t ii = 0; ii < len; ++ii) {
+            input[ii] = 0.02f * normal(generator);
+            if (ii >= toneStart)
+                input[ii] += amplitude * sin(2.0 * M_PI * frequency * ii / rate);
+        }
+        const auto level = [&](const std::vector<float> &samples, size_t first, size_t last) {
+            double sum = 0;
+            for (size_t ii = first; ii < last; ++ii)
+                sum += samples[ii] * samples[ii];
+            return std::sqrt(sum / (last - first));
+        };
+
+        EffectNoiseReduction quality, live;
+        live.SetLowLatency(25);
+        REQUIRE(quality.GetProfile(noise.data(), noise.size(), rate));
+        REQUIRE(live.GetProfile(noise.data(), noise.size(), rate));
+        // A profile of the quality window does not fit
+        std::vector<char> blob;
+        REQUIRE(quality.SaveProfile(blob));
+        EffectNoiseReduction mismatched;
+        mismatched.SetLowLatency(25);
+        REQUIRE(mismatched.LoadProfile(blob.data(), blob.size()));
+        CHECK(mismatched.CreateStream(12.0, 6.0, 0.0) == nullptr);
+
+        auto qualityStream = quality.CreateStream(12.0, 6.0, 0.0);
+        auto stream = live.CreateStream(12.0, 6.0, 0.0);
+        REQUIRE(qualityStream);
+        REQUIRE(stream);
+        CHECK(stream->GetLatency() <= 0.025 * rate);
+        CHECK(stream->GetLatency() < qualityStream->GetLatency());
+
+        // Output lags by no more, still reduces the noise and keeps the tone
+        std::vector<float> output;
+        for (size_t pushed = 0; pushed < len; pushed += 128) {
+            stream->Push(&input[pushed], 128);
+            CHECK(pushed + 128 - (output.size() + stream->Available()) <= stream->GetLatency());
+            std::vector<float> buffer(stream->Available());
+            stream->Pull(buffer.data(), buffer.size());
+            output.insert(output.end(), buffer.begin(), buffer.end());
+        }
+        stream->Flush();
+        std::vector<float> buffer(stream->Available());
+        stream->Pull(buffer.data(), buffer.size());
+        output.insert(output.end(), buffer.begin(), buffer.end());
+        REQUIRE(output.size() == len);
+        CHECK(level(output, 4800, toneStart - 4800) < level(input, 4800, toneStart - 4800) / 3);
+        CHECK(level(output, toneStart + 4800, len - 4800) ==
+              Approx(level(input, toneStart + 4800, len - 4800)).epsilon(0.05));
+
+        // As a track is reduced in the same mode
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        auto track = factory.NewWaveTrack(floatSample, rate);
+        track->Append((samplePtr) input.data(), floatSample, len);
+        track->Flush();
+        REQUIRE(live.ReduceNoise(track.get(), 12.0, 6.0, 0.0, &factory));
+        std::vector<float> expected(len);
+        track->Get((samplePtr) expected.data(), floatSample, 0, len);
+        CHECK(output == expected);
+    }
+
+    SECTION("cancelled reduction fails and leaves the track as it was.") {
+        const double rate = 16000;
+        const size_t len = 3 * 16000;
+        std::mt19937 generator{46};
+        std::normal_distribution<float> normal;
+        std::vector<float> noise(8000), input(len);
+        for (auto &sample : noise)
+            sample = 0.02f * normal(generator);
+        for (size_t ii = 0; ii < len; ++ii)
+            input[ii] = 0.02f * normal(generator) + 0.1f * (float) sin(ii * 0.3);
+
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        auto track = factory.NewWaveTrack(floatSample, rate);
+        track->Append((samplePtr) input.data(), floatSample, len);
+        track->Flush();
+
+        EffectNoiseReduction effect;
+        REQUIRE(effect.GetProfile(noise.data(), noise.size(), rate));
+        std::atomic<bool> cancel{true};
+        effect.SetCancel(&cancel);
+        CHECK(effect.IsCancelled());
+        std::vector<float> output(len);
+        for (const unsigned threads : {1u, 3u}) {
+            effect.SetThreadCount(threads);
+            CHECK_FALSE(effect.ReduceNoise(track.get(), 12.0, 6.0, 3.0, &factory));
+            track->Get((samplePtr) output.data(), floatSample, 0, len);
+            CHECK(output == input);
+        }
+        CHECK_FALSE(effect.GetProfile(track.get(), 0.0, 0.5, 12.0, 6.0, 3.0, &factory));
+
+        cancel = false;
+        CHECK_FALSE(effect.IsCancelled());
+        REQUIRE(effect.GetProfile(noise.data(), noise.size(), rate));
+        CHECK(effect.ReduceNoise(track.get(), 12.0, 6.0, 3.0, &factory));
+        track->Get((samplePtr) output.data(), floatSample, 0, len);
+        CHECK(output != input);
+        effect.SetCancel(nullptr);
+    }
+
+    SECTION("advanced settings and presets trade quality for speed.") {
+        const double rate = 16000;
+        const size_t len = 3 * 16000;
+        std::mt19937 generator{47};
+        std::normal_distribution<float> normal;
+        std::vector<float> noise(8000), input(len);
+        for (auto &sample : noise)
+            sample = 0.02f * normal(generator);
+        // Noise alone for the first second, then with a tone
+        for (size_t ii = 0; ii < len; ++ii)
+            input[ii] = 0.02f * normal(generator) + (ii >= 16000 ? 0.1f * (float) sin(ii * 0.3) : 0.0f);
+        const auto power = [](const std::vector<float> &samples, size_t start, size_t end) {
+            double sum = 0;
+            for (size_t ii = start; ii < end; ++ii)
+                sum += samples[ii] * samples[ii];
+            return sum / (end - start);
+        };
+
+        const auto dir_manager = std::make_shared<DirManager>(true);
+        TrackFactory factory(dir_manager);
+        const auto reduce = [&](EffectNoiseReduction &effect) {
+            auto track = factory.NewWaveTrack(floatSample, rate);
+            track->Append((samplePtr) input.data(), floatSample, len);
+            track->Flush();
+            REQUIRE(effect.GetProfile(noise.data(), noise.size(), rate));
+            REQUIRE(effect.ReduceNoise(track.get(), 12.0, 6.0, 3.0, &factory));
+            std::vector<float> output(len);
+            track->Get((samplePtr) output.data(), floatSample, 0, len);
+            return output;
+        };
+
+        EffectNoiseReduction::AdvancedSettings preset;
+        for (const auto name : {"fast", "default", "quality"}) {
+            REQUIRE(EffectNoiseReduction::GetPreset(name, preset));
+            EffectNoiseReduction effect;
+            REQUIRE(effect.SetPreset(name));
+            const auto settings = effect.GetAdvancedSettings();
+            CHECK(settings.windowTypes == preset.windowTypes);
+            CHECK(settings.windowSizeChoice == preset.windowSizeChoice);
+            CHECK(settings.stepsPerWindowChoice == preset.stepsPerWindowChoice);
+            const auto output = reduce(effect);
+            // The noise falls by most of the 12 dB, and the tone far less
+            CHECK(power(output, 4000, 12000) < 0.15 * power(input, 4000, 12000));
+            CHECK(power(output, 24000, 40000) > 0.2 * power(input, 24000, 40000));
+        }
+        CHECK_FALSE(EffectNoiseReduction::GetPreset("slow", preset));
+
+        // The defaults are those of the preferences, as before
+        EffectNoiseReduction defaulted, named;
+        REQUIRE(named.SetPreset("default"));
+        CHECK(reduce(defaulted) == reduce(named));
+
+        // Every window type at its fewest steps, by either method
+        for (int windowTypes = 0; windowTypes < 7; ++windowTypes)
+            for (int method = 0; method < 2; ++method) {
+                EffectNoiseReduction::AdvancedSettings settings;
+                settings.windowTypes = windowTypes;
+                settings.stepsPerWindowChoice = windowTypes == 0 || windowTypes == 1 || windowTypes == 4 ||
+                                                windowTypes == 6 ? 0 : 1;
+                settings.method = method;
+                settings.windowSizeChoice = 7;
+                EffectNoiseReduction effect;
+                REQUIRE(effect.SetAdvancedSettings(settings));
+                const auto output = reduce(effect);
+                CHECK(std::all_of(output.begin(), output.end(), [](float sample) { return std::isfinite(sample); }));
+                CHECK(power(output, 4000, 12000) < 0.5 * power(input, 4000, 12000));
+            }
+
+        // Invalid settings change nothing
+        EffectNoiseReduction effect;
+        REQUIRE(effect.SetPreset("fast"));
+        for (const auto &change : std::vector<std::function<void(EffectNoiseReduction::AdvancedSettings &)>>{
+                [](EffectNoiseReduction::AdvancedSettings &settings) { settings.windowTypes = 2; },
+                [](EffectNoiseReduction::AdvancedSettings &settings) { settings.windowTypes = 7; },
+                [](EffectNoiseReduction::AdvancedSettings &settings) { settings.windowSizeChoice = 12; },
+                [](EffectNoiseReduction::AdvancedSettings &settings) { settings.stepsPerWindowChoice = 6; },
+                [](EffectNoiseReduction::AdvancedSettings &settings) { settings.method = 2; },
+                [](EffectNoiseReduction::AdvancedSettings &settings) { settings.attackTime = 1.5; },
+                [](EffectNoiseReduction::AdvancedSettings &settings) { settings.releaseTime = -0.1; },
+                [](EffectNoiseReduction::AdvancedSettings &settings) {
+                    // 64 steps of a window of 32
+                    settings.windowSizeChoice = 2;
+                    settings.stepsPerWindowChoice = 5;
+                },
+        }) {
+            auto settings = effect.GetAdvancedSettings();
+            change(settings);
+            CHECK_FALSE(effect.SetAdvancedSettings(settings));
+            CHECK(effect.GetAdvancedSettings().windowTypes == 1);
+            CHECK(effect.GetAdvancedSettings().stepsPerWindowChoice == 0);
+        }
+
+        // A profile must be of the window size it is applied with
+        REQUIRE(effect.GetProfile(noise.data(), noise.size(), rate));
+        REQUIRE(effect.SetPreset("quality"));
+        auto track = factory.NewWaveTrack(floatSample, rate);
+        track->Append((samplePtr) input.data(), floatSample, len);
+        track->Flush();
+        CHECK_FALSE(effect.ReduceNoise(track.get(), 12.0, 6.0, 3.0, &factory));
+    }
+
     SECTION("profile source is different from source..") {
         // import
         const auto dir_manager = std::make_shared<DirManager>();